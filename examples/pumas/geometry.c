@@ -108,7 +108,7 @@ static enum pumas_step medium2(struct pumas_context * context,
     double * step_ptr)
 {
         if ((medium_ptr == NULL) && (step_ptr == NULL))
-                return PUMAS_STEP_RAW;
+                return PUMAS_STEP_EXACT;
 
         /* Check the muon position and direction */
         const double z = state->position[2];
@@ -150,16 +150,12 @@ static enum pumas_step medium2(struct pumas_context * context,
                 step = -1.;
         }
 
-        if (step_ptr != NULL) {
-#define STEP_EPSILON 1E-07
-                /* Offset slightly the step length in order to end in the new
-                 * medium
-                 */
-                if (step > 0) step += STEP_EPSILON;
-                *step_ptr = step;
-        }
+        /* The proposed step is the exact distance to the next boundary. Thus,
+         * PUMAS can cross it without any search
+         */
+        if (step_ptr != NULL) *step_ptr = step;
 
-        return PUMAS_STEP_RAW;
+        return PUMAS_STEP_EXACT;
 }
 
 /* The executable main entry point */
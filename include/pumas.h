@@ -36,8 +36,8 @@ extern "C" {
 
 /* PUMAS library version. */
 #define PUMAS_VERSION_MAJOR 1
-#define PUMAS_VERSION_MINOR 2
-#define PUMAS_VERSION_PATCH 3
+#define PUMAS_VERSION_MINOR 3
+#define PUMAS_VERSION_PATCH 0
 
 /**
  * Projectiles supported by PUMAS.
@@ -308,6 +308,40 @@ struct pumas_state {
         int decayed;
 };
 
+/**
+ * Container for a batch of Monte-Carlo states.
+ *
+ * This structure describes a set of particle Monte Carlo states stored as a
+ * structure of arrays, i.e. each member points to an array with one entry per
+ * state. It is used for transporting states in batches, see
+ * `pumas_context_transport_batch`.
+ *
+ * The *energy*, *position* and *direction* arrays are mandatory. Other members
+ * can be `NULL`, in which case default initial values are used, i.e. a
+ * *charge* of -1, a unit *weight* and zero for the others. The corresponding
+ * final values are then not returned.
+ */
+struct pumas_states {
+        /** The particles' electric charges. */
+        double * charge;
+        /** The current kinetic energies, in GeV. */
+        double * energy;
+        /** The total travelled distances, in m. */
+        double * distance;
+        /** The total travelled grammages, in kg/m^2. */
+        double * grammage;
+        /** The particles' proper times, in m/c. */
+        double * time;
+        /** The Monte-Carlo weights. */
+        double * weight;
+        /** The absolute locations, in m, as x, y and z arrays. */
+        double * position[3];
+        /** The momentums' unit directions, as x, y and z arrays. */
+        double * direction[3];
+        /** Status flags telling if the particles have decayed or not.  */
+        int * decayed;
+};
+
 /**
  * The local properties of a propagation medium.
  */
@@ -417,7 +451,9 @@ typedef void pumas_recorder_cb (struct pumas_context * context,
  * them. Although it exposes some public data that the user may alter it also
  * encloses other opaque data. Therefore, it **must** be handled with the
  * `pumas_recorder_create`, `pumas_recorder_clear` and `pumas_recorder_destroy`
- * functions.
+ * functions. Alternatively, Monte Carlo steps can be streamed as fixed size
+ * `pumas_stream_frame` objects with a recorder created by
+ * `pumas_recorder_create_stream`.
  *
  * By default a newly created recorder is configured for saving all Monte Carlo
  * steps as `pumas_frame` objects. This behaviour can be modified by setting a
@@ -425,6 +461,13 @@ typedef void pumas_recorder_cb (struct pumas_context * context,
  * structure control the sampling rate of Monte Carlo steps and allow to access
  * the sampled `pumas_frame`, as detailed herein.
  *
+ * Monte Carlo steps can be further filtered by event type, energy loss or
+ * travelled distance, using the *event_mask*, *energy_loss* and *distance*
+ * fields. These filters are applied before any copy of the Monte Carlo state,
+ * including for a user supplied *record* callback. The energy loss and the
+ * distance are computed w.r.t. the last recorded step of the track, or w.r.t.
+ * the start of the track. They do not apply to the start and stop steps.
+ *
  * **Note** : A recorder is enabled (disabled) by setting (unsetting) it to
  * (from) the *recorder* field of a `pumas_context`. Only the corresponding
  * context is recorded.
@@ -455,6 +498,196 @@ struct pumas_recorder {
          * initialisation.
          */
         void * user_data;
+        /**
+         * Mask of recorded events. If not `PUMAS_EVENT_NONE`, only steps
+         * with an event matching the mask are recorded, e.g.
+         * `PUMAS_EVENT_VERTEX_DEL | PUMAS_EVENT_MEDIUM`. Defaults to
+         * `PUMAS_EVENT_NONE`, i.e. no filtering.
+         */
+        enum pumas_event event_mask;
+        /**
+         * The minimum energy loss between recorded steps, in GeV. In
+         * backward mode, the energy gain is considered. Defaults to zero,
+         * i.e. no filtering.
+         */
+        double energy_loss;
+        /**
+         * The minimum travelled distance between recorded steps, in m.
+         * Defaults to zero, i.e. no filtering.
+         */
+        double distance;
+};
+
+/** A streamed Monte-Carlo frame.
+ *
+ * This structure exposes data relative to a Monte Carlo frame recorded by a
+ * streaming recorder, see `pumas_recorder_create_stream`. Contrary to
+ * `pumas_frame` objects, it does not reference any memory. Thus, it has a
+ * fixed size and it can be written to disk as is.
+ */
+struct pumas_stream_frame {
+        /** The recorded Monte Carlo state. */
+        struct pumas_state state;
+        /** The index of the recorded track, starting from 0. */
+        long track;
+        /** The material index of the medium, or -1 if there is no medium. */
+        int material;
+        /** The corresponding Monte Carlo event. */
+        enum pumas_event event;
+};
+
+/** A user supplied consumer of streamed frames.
+ * @param recorder The streaming recorder.
+ * @param n        The number of frames.
+ * @param frames   The streamed frames.
+ *
+ * This callback allows to drain the frames of a streaming recorder, e.g. in
+ * order to process them on the fly. The *frames* are only valid during the
+ * call.
+ *
+ * **Warning** : if the library is compiled with `THREADS_MODE` enabled, the
+ * callback is called from a dedicated consumer thread, concurrently to the
+ * transport.
+ */
+typedef void pumas_stream_cb (struct pumas_recorder * recorder, int n,
+    const struct pumas_stream_frame * frames);
+
+/** Tag of a block of columns. */
+#define PUMAS_COLUMN_TAG 0x4C4F4350
+
+/** Columns of the columnar trajectory format.
+ *
+ * The track and length columns have one entry per track, as `long` and `int`.
+ * The event and material columns have one `int` entry per frame. Other
+ * columns have one floating point entry per frame, as `double` or as `float`
+ * depending on the encoding of the block.
+ */
+enum pumas_column {
+        /** The indices of the recorded tracks. */
+        PUMAS_COLUMN_TRACK = 0,
+        /** The number of frames of each track. */
+        PUMAS_COLUMN_LENGTH,
+        /** The kinetic energy, in GeV. */
+        PUMAS_COLUMN_ENERGY,
+        /** The x coordinate of the position, in m. */
+        PUMAS_COLUMN_POSITION_X,
+        /** The y coordinate of the position, in m. */
+        PUMAS_COLUMN_POSITION_Y,
+        /** The z coordinate of the position, in m. */
+        PUMAS_COLUMN_POSITION_Z,
+        /** The x component of the direction. */
+        PUMAS_COLUMN_DIRECTION_X,
+        /** The y component of the direction. */
+        PUMAS_COLUMN_DIRECTION_Y,
+        /** The z component of the direction. */
+        PUMAS_COLUMN_DIRECTION_Z,
+        /** The travelled grammage, in kg/m^2. */
+        PUMAS_COLUMN_GRAMMAGE,
+        /** The Monte Carlo event. */
+        PUMAS_COLUMN_EVENT,
+        /** The material index, or -1 if there is no medium. */
+        PUMAS_COLUMN_MATERIAL,
+        /** The number of columns. */
+        PUMAS_COLUMN_N
+};
+
+/** Encoding flags for the columnar trajectory format. */
+enum pumas_column_encoding {
+        /** Floating point values are written as `double`. */
+        PUMAS_COLUMN_ENCODING_DOUBLE = 0,
+        /** Floating point values are written as `float`. */
+        PUMAS_COLUMN_ENCODING_FLOAT = 1,
+        /** The kinetic energy, the position and the grammage are written as
+         * differences to the previous frame of the same track.
+         */
+        PUMAS_COLUMN_ENCODING_DELTA = 2
+};
+
+/** Header of a block of columns.
+ *
+ * A columnar recorder writes recorded frames by blocks, see
+ * `pumas_recorder_create_columnar`. Each block starts with this header. It is
+ * followed by the columns data, in the order of the `pumas_column`
+ * enumeration. The byte size of each column is given by the header. Thus, a
+ * reader can skip unneeded columns. Data are written in the native binary
+ * layout.
+ *
+ * Within a block, the frames are grouped by track. With delta encoding, the
+ * first frame of each track in the block is written as a difference to zero.
+ * Thus, blocks can be decoded independently, by cumulative sums.
+ */
+struct pumas_column_block {
+        /** The block tag, i.e. `PUMAS_COLUMN_TAG`. */
+        int tag;
+        /** The encoding flags of the block. */
+        int encoding;
+        /** The number of frames in the block. */
+        int n_frames;
+        /** The number of tracks in the block. */
+        int n_tracks;
+        /** The byte size of each column. */
+        int size[PUMAS_COLUMN_N];
+};
+
+/** Models of density laws for built-in geometries. */
+enum pumas_density_model {
+        /** The density is uniform. */
+        PUMAS_DENSITY_UNIFORM = 0,
+        /** The density varies exponentially. */
+        PUMAS_DENSITY_EXPONENTIAL,
+        /** The density varies as a polynomial, up to cubic. */
+        PUMAS_DENSITY_POLYNOMIAL
+};
+
+/**
+ * A density law for the media of built-in geometries.
+ *
+ * The density varies along a coordinate *h*, e.g. the altitude or the
+ * radius, depending on the geometry. Let x = *h* - *origin*. Then, the density
+ * is
+ *
+ *     rho = coefficients[0]                              (uniform),
+ *
+ *     rho = coefficients[0] * exp(x / length)            (exponential),
+ *
+ *     rho = coefficients[0] + coefficients[1] * x + ...  (polynomial).
+ *
+ * The density must be strictly positive over the medium. A uniform law with a
+ * null or negative density stands for the default density of the material.
+ *
+ * The column density along a transport step is integrated analytically, in
+ * closed form along an axis or with a Gaussian quadrature along a radius.
+ * Thus, density laws do not limit the step length.
+ */
+struct pumas_density_law {
+        /** The density model. */
+        enum pumas_density_model model;
+        /** The origin of the coordinate, in m. */
+        double origin;
+        /** The scale length of the exponential model, in m. */
+        double length;
+        /** The density coefficients, in kg/m^3/m^i. */
+        double coefficients[4];
+};
+
+/** Shapes of the layers of a stratified geometry. */
+enum pumas_layer_shape {
+        /** The layers are horizontal slabs, along the z-axis. */
+        PUMAS_LAYER_PLANAR = 0,
+        /** The layers are concentric spherical shells, centred on the
+         * origin.
+         */
+        PUMAS_LAYER_SPHERICAL
+};
+
+/** A layer of a stratified geometry. */
+struct pumas_layer {
+        /** The material index of the layer. */
+        int material;
+        /** The top of the layer, i.e. an altitude or a radius in m. */
+        double top;
+        /** The density law of the layer. */
+        struct pumas_density_law density;
 };
 
 /** Return codes for the medium callback. */
@@ -471,7 +704,17 @@ enum pumas_step {
          * tracer used, it can save PUMAS from performing some redundant
          * geometry checks.
          */
-        PUMAS_STEP_RAW
+        PUMAS_STEP_RAW,
+        /** The proposed step is the exact distance to the next boundary.
+         *
+         * The distance is measured along the propagation direction. A step
+         * ending on a boundary is offset by PUMAS in order to cross it, and
+         * the boundary is not searched for. Shorter steps, not reaching any
+         * boundary, are also allowed. Note that if the local magnetic field
+         * is not null, the trajectory is curved. Then, the boundary is
+         * searched for, as for `PUMAS_STEP_CHECK`.
+         */
+        PUMAS_STEP_EXACT
 };
 
 /**
@@ -496,7 +739,10 @@ enum pumas_step {
  * numerically. Therefore it is recommended to return `PUMAS_STEP_CHECK` if you
  * are unsure of what to do since it is more robust. The raw mode is usefull if
  * your geometry engine already performs those checks in order to avoid double
- * work.
+ * work. If your geometry can compute the exact distance to the next boundary,
+ * e.g. for layered media, then `PUMAS_STEP_EXACT` should be returned. In this
+ * case, crossing a boundary requires a single location call, instead of a
+ * search by dichotomy.
  *
  * **Warning** : it is an error to return zero or less for any state if the
  * extension is finite.
@@ -550,6 +796,57 @@ typedef void pumas_handler_cb (enum pumas_return rc, pumas_function_t * caller,
  */
 typedef double pumas_random_cb (struct pumas_context * context);
 
+/**
+ * Callback for generating the initial state of a Monte Carlo event.
+ *
+ * @param context The worker's simulation context.
+ * @param event   The index of the Monte Carlo event.
+ * @param state   The initial state to fill.
+ *
+ * This callback is used by `pumas_context_run_parallel`. The *state* is
+ * initialised with default values, i.e. a charge of -1, a weight of 1 and
+ * all other fields set to zero. The callback must at least set the kinetic
+ * energy, the position and the direction of the state.
+ *
+ * **Warning** : the callback might be called concurrently from distinct
+ * threads, with distinct *context*. Random numbers should be drawn from the
+ * *context* random stream.
+ */
+typedef void pumas_generator_cb (struct pumas_context * context, long event,
+    struct pumas_state * state);
+
+/**
+ * Callback for scoring the final state of a Monte Carlo event.
+ *
+ * @param context The worker's simulation context.
+ * @param event   The index of the Monte Carlo event.
+ * @param state   The final state.
+ * @param end     The transport end condition.
+ * @param media   The initial and final media.
+ *
+ * This callback is used by `pumas_context_run_parallel`. Results should be
+ * accumulated in the *context* `user_data`, and then merged with a
+ * `pumas_reducer_cb`.
+ *
+ * **Warning** : the callback might be called concurrently from distinct
+ * threads, with distinct *context*.
+ */
+typedef void pumas_scorer_cb (struct pumas_context * context, long event,
+    struct pumas_state * state, enum pumas_event end,
+    struct pumas_medium * media[2]);
+
+/**
+ * Callback for merging the results of a parallel run.
+ *
+ * @param context The simulation context provided to the run.
+ * @param worker  The simulation context of a worker.
+ *
+ * This callback is used by `pumas_context_run_parallel`. It is called
+ * sequentially, from the calling thread, once per worker.
+ */
+typedef void pumas_reducer_cb (
+    struct pumas_context * context, struct pumas_context * worker);
+
 /** Mode flags for the Monte Carlo transport. */
 struct pumas_context_mode {
         /**
@@ -620,8 +917,10 @@ struct pumas_context_limit {
  * `pumas_context_random_seed_set` function.  Note that two contexts seeded
  * with the same value are 100% correlated. If no seed is provided then one is
  * picked randomly from the OS, e.g.  from `/dev/urandom` on UNIX.
- * Alternatively, a custom random engine can be used instead of the native one
- * by overriding the *random* callback.
+ * A counter based random engine is also embedded. It can be selected with the
+ * `pumas_context_random_stream_set` function. Alternatively, a custom random
+ * engine can be used instead of the native ones by overriding the *random*
+ * callback.
  *
  * The geometry of the simulation is specified by setting the *medium* field
  * with a `pumas_medium_cb` callback.  By default the *medium* field is `NULL`.
@@ -697,6 +996,23 @@ struct pumas_context {
  */
 struct pumas_physics;
 
+/**
+ * Opaque handle for a built-in geometry.
+ *
+ * A built-in geometry provides the media and the ray tracing of common
+ * simulation geometries, instead of user supplied `pumas_medium_cb` and
+ * `pumas_locals_cb` callbacks. Built-in geometries are created with the
+ * `pumas_geometry_create_*` functions and destroyed with
+ * `pumas_geometry_destroy`. They are enabled with the
+ * `pumas_context_geometry_set` function.
+ *
+ * Built-in geometries propose exact steps to the next boundary, i.e.
+ * `PUMAS_STEP_EXACT`. A built-in geometry is not modified by the transport.
+ * Thus, it can be shared between simulation contexts, e.g. when running
+ * concurrently.
+ */
+struct pumas_geometry;
+
 /**
  * Prototype for a Differential Cross-Section (DCS).
  *
@@ -812,6 +1128,17 @@ struct pumas_physics_settings {
          * pointer provided by `pumas_physics_create` points to `NULL`.
          */
         int dry;
+        /** The number of threads used for tabulating the physics.
+         *
+         * Atomic elements and base materials are tabulated in parallel when
+         * PUMAS is built with threads support. Providing a value of one or
+         * less results in a sequential tabulation. The tabulated physics does
+         * not depend on the number of threads.
+         *
+         * __Warning__: user supplied DCS and memory callbacks must then be
+         * thread safe.
+         */
+        int n_threads;
 };
 
 /**
@@ -980,6 +1307,47 @@ PUMAS_API enum pumas_return pumas_physics_dump(
 PUMAS_API enum pumas_return pumas_physics_load(
     struct pumas_physics ** physics, FILE * stream);
 
+/**
+ * Map the physics tables from a file.
+ *
+ * @param physics   The physics tables.
+ * @param path      The path to the binary dump.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Map the physics tables from a binary dump previously generated with
+ * `pumas_physics_dump`. Contrary to `pumas_physics_load` the tables are not
+ * copied. Instead, the dump file is mapped to memory as a private mapping.
+ * The bulk of the tables is loaded on demand, and it is shared between
+ * processes mapping the same dump. The mapping is released by
+ * `pumas_physics_destroy`.
+ *
+ * __Note__: the dump stores absolute addresses, which are relinked after
+ * mapping. The relinked pages, i.e. the physics header, the tables of
+ * addresses, and the elements and materials descriptions, are copied on
+ * write. Thus, they are private to each process. Their size does not depend
+ * on the energy grid, contrary to the shared tables.
+ *
+ * __Note__: on systems without `mmap` support, the tables are loaded with
+ * `pumas_physics_load` instead.
+ *
+ * __Warning__: the dump file must not be modified while it is mapped.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_FORMAT_ERROR            The binary dump is not compatible
+ * with the current version.
+ *
+ *     PUMAS_RETURN_PHYSICS_ERROR           The physics is not initialised.
+ *
+ *     PUMAS_RETURN_PATH_ERROR              The path is invalid (null), or the
+ * file could not be opened.
+ *
+ *     PUMAS_RETURN_IO_ERROR                Could not read or map the file.
+ */
+PUMAS_API enum pumas_return pumas_physics_map(
+    struct pumas_physics ** physics, const char * path);
+
 /**
  * Get the cutoff value used by the physics.
  *
@@ -1047,6 +1415,113 @@ PUMAS_API enum pumas_return pumas_context_transport(
     struct pumas_context * context, struct pumas_state * state,
     enum pumas_event * event, struct pumas_medium * media[2]);
 
+/**
+ * Perform a Monte-Carlo transport of a batch of states.
+ *
+ * @param context The simulation context.
+ * @param n       The number of states.
+ * @param states  The initial states or the final states at return.
+ * @param events  The end events or `NULL`.
+ * @param media   The initial and final media, or `NULL`.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Transport *n* Monte Carlo *states* according to a simulation *context*. This
+ * is equivalent to calling `pumas_context_transport` for each state, except
+ * that the context configuration is checked only once for the whole batch.
+ *
+ * At return the *states* arrays are updated. If *events* is not `NULL` it must
+ * have a size of *n* and it is filled with the transport end conditions. If
+ * *media* is not `NULL` it must have a size of *2 n*. Then, it is filled with
+ * the initial (index 2 i) and final (index 2 i + 1) media seen by the i-th
+ * particle. As for `pumas_context_transport`, the media of an already decayed
+ * state are left unchanged.
+ *
+ * The transport stops at the first error. States located after the faulty one
+ * are left unchanged.
+ *
+ * **Warning**: the callbacks of the simulation context are called with a
+ * temporary `pumas_state` structure, gathered from the *states* arrays. Thus,
+ * user wrapped (sub-classed) states are not supported in batch mode.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_ACCURACY_ERROR          The requested accuracy is not valid.
+ *
+ *     PUMAS_RETURN_DENSITY_ERROR           A null or negative density was
+ * encountered.
+ *
+ *     PUMAS_RETURN_DIRECTION_ERROR         A non unit direction was provided.
+ *
+ *     PUMAS_RETURN_PHYSICS_ERROR           The physics is not initalised.
+ *
+ *     PUMAS_RETURN_MEDIUM_ERROR            The medium callback was not defined.
+ *
+ *     PUMAS_RETURN_MISSING_LIMIT           An external limit is needed.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The context or a mandatory states
+ * array is NULL, or the number of states is negative.
+ */
+PUMAS_API enum pumas_return pumas_context_transport_batch(
+    struct pumas_context * context, int n, struct pumas_states * states,
+    enum pumas_event * events, struct pumas_medium ** media);
+
+/**
+ * Run Monte Carlo events in parallel.
+ *
+ * @param context   The simulation context.
+ * @param n_threads The number of threads.
+ * @param n_events  The number of Monte Carlo events.
+ * @param generator The generator of initial states.
+ * @param scorer    The scorer of final states, or `NULL`.
+ * @param reducer   The reducer of results, or `NULL`.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Generate, transport and score *n_events* Monte Carlo events using
+ * *n_threads* workers. Each worker uses its own copy of the simulation
+ * *context*, including its `user_data` memory. Events are distributed among
+ * workers in chunks. Idle workers steal events from busy ones. Once all events
+ * have been processed, the *reducer* is called for each worker, in order.
+ *
+ * If the default random engine is used, the i-th worker is seeded with the
+ * seed of the *context* plus i. If the counter based engine is used, the
+ * random stream is set to the event index before generating each event, see
+ * `pumas_context_random_event_set`. Then, results do not depend on the number
+ * of threads. Otherwise, the *random* callback of the *context* is used by all
+ * workers. It must then be thread safe. Recording is not supported, i.e. the
+ * *recorder* of the *context* must be `NULL`.
+ *
+ * **Note**: multithreading requires the library to be compiled with
+ * `THREADS_MODE` enabled, e.g. using the `PUMAS_USE_THREADS` CMake option.
+ * Otherwise, all events are processed sequentially by a single worker.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_ACCURACY_ERROR          The requested accuracy is not valid.
+ *
+ *     PUMAS_RETURN_DENSITY_ERROR           A null or negative density was
+ * encountered.
+ *
+ *     PUMAS_RETURN_DIRECTION_ERROR         A non unit direction was generated.
+ *
+ *     PUMAS_RETURN_MEMORY_ERROR            Could not allocate memory.
+ *
+ *     PUMAS_RETURN_PHYSICS_ERROR           The physics is not initalised.
+ *
+ *     PUMAS_RETURN_MEDIUM_ERROR            The medium callback was not defined.
+ *
+ *     PUMAS_RETURN_MISSING_LIMIT           An external limit is needed.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The context or the generator is
+ * NULL, or the number of threads is not strictly positive, or a recorder is
+ * set.
+ */
+PUMAS_API enum pumas_return pumas_context_run_parallel(
+    struct pumas_context * context, int n_threads, long n_events,
+    pumas_generator_cb * generator, pumas_scorer_cb * scorer,
+    pumas_reducer_cb * reducer);
+
 /**
  * Print a summary of the physics.
  *
@@ -1156,8 +1631,9 @@ PUMAS_API pumas_handler_cb * pumas_error_handler_get(void);
  * __Note__: only the first error occuring is recorded. Subsequent error(s) are
  * muted but not recorded.
  *
- * __Warning__: this function is **not** thread safe. Only a single error stream
- * can be handled at a time.
+ * __Note__: this function **is** thread safe. The catch status is local to the
+ * calling thread, i.e. errors occuring in other threads are not caught.
+ * However, the error handler is shared by all threads.
  */
 PUMAS_API void pumas_error_catch(int enable);
 
@@ -1172,8 +1648,8 @@ PUMAS_API void pumas_error_catch(int enable);
  *
  * __Note__: calling this function disables further error's catching.
  *
- * __Warning__: this function is **not** thread safe. Only a single error stream
- * can be handled at a time.
+ * __Note__: this function **is** thread safe. Only the error caught by the
+ * calling thread is raised.
  *
  * __Error codes__
  *
@@ -1265,6 +1741,57 @@ PUMAS_API enum pumas_return pumas_context_random_seed_set(
 PUMAS_API enum pumas_return pumas_context_random_seed_get(
     struct pumas_context * context, unsigned long * seed);
 
+/**
+ * Select the counter based random engine of a simulation context.
+ *
+ * @param context         The simulation context.
+ * @param seed            The random seed.
+ * @param stream          The index of the random stream.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Set the *random* callback of the simulation context to a counter based
+ * engine (Philox4x32-10) instead of the default Mersenne Twister. The key of
+ * the engine is given by the *seed* and by the *stream* index. Only the 32
+ * lower bits of each are used. The event index is reset to zero.
+ *
+ * The counter based engine has no initialisation cost and a small state,
+ * stored within the simulation context. Random numbers for a given event can
+ * be directly accessed with the `pumas_context_random_event_set` function.
+ *
+ * **Note**: in order to switch back to the Mersenne Twister engine, the
+ * previous value of the *random* callback must be restored.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The context is NULL.
+ */
+PUMAS_API enum pumas_return pumas_context_random_stream_set(
+    struct pumas_context * context, unsigned long seed, unsigned long stream);
+
+/**
+ * Set the event index of the counter based random engine.
+ *
+ * @param context         The simulation context.
+ * @param event           The event index.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Jump to the start of the random sequence of the given *event*, in constant
+ * time. Random numbers drawn for an event only depend on the seed, on the
+ * stream index and on the event index. Thus, results are reproducible
+ * whatever the ordering of events, e.g. when running with multiple threads.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_MISSING_RANDOM          The counter based engine is not
+ * selected.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The context is NULL.
+ */
+PUMAS_API enum pumas_return pumas_context_random_event_set(
+    struct pumas_context * context, unsigned long event);
+
 /**
  * Load the random state of a simulation context.
  *
@@ -1337,6 +1864,28 @@ PUMAS_API void pumas_context_destroy(struct pumas_context ** context);
 PUMAS_API const struct pumas_physics * pumas_context_physics_get(
     const struct pumas_context * context);
 
+/**
+ * Set a built-in geometry for a simulation context.
+ *
+ * @param context  The simulation context.
+ * @param geometry The built-in geometry, or `NULL`.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Set the *medium* callback of the simulation *context* to the one of the
+ * built-in *geometry*. If *geometry* is `NULL`, the *medium* callback is
+ * unset. Note that the *geometry* is not copied. Thus, it must not be
+ * destroyed while being used by the *context*.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_INDEX_ERROR     The geometry uses an invalid material index.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR     The *context* is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_context_geometry_set(
+    struct pumas_context * context, struct pumas_geometry * geometry);
+
 /**
  * The CSDA range.
  *
@@ -1639,6 +2188,125 @@ PUMAS_API enum pumas_return pumas_physics_property_cross_section(
     const struct pumas_physics * physics, int material, double energy,
     double * cross_section);
 
+/**
+ * The CSDA range, for an array of kinetic energies.
+ *
+ * @param physics     The physics tables.
+ * @param mode        The energy loss mode.
+ * @param material    The material index.
+ * @param n           The number of kinetic energy values.
+ * @param energy      The initial kinetic energies, in GeV.
+ * @param range       The grammage ranges in kg/m^(2).
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * This function is a vectorised version of `pumas_physics_property_range`,
+ * returning identical values. The *energy* values need not be sorted. Yet,
+ * the table lookup is faster for monotone, e.g. sorted, values since bracketing
+ * indices are reused from one value to the next one.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_INDEX_ERROR             The mode or material index is
+ * not valid.
+ *
+ *     PUMAS_RETURN_PHYSICS_ERROR           The physics is not initialised.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The number of values is negative
+ * or an array is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_physics_property_range_v(
+    const struct pumas_physics * physics, enum pumas_mode mode,
+    int material, int n, const double * energy, double * range);
+
+/**
+ * Kinetic energies for travelling over an array of CSDA ranges.
+ *
+ * @param physics     The physics tables.
+ * @param mode        The energy loss mode
+ * @param material    The material index.
+ * @param n           The number of range values.
+ * @param range       The requested grammage ranges, in kg/m^(2).
+ * @param energy      The required kinetic energies in GeV.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * This function is a vectorised version of
+ * `pumas_physics_property_kinetic_energy`. See the
+ * `pumas_physics_property_range_v` function for more details.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_INDEX_ERROR             The mode or material index is
+ * not valid.
+ *
+ *     PUMAS_RETURN_PHYSICS_ERROR           The physics is not initialised.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The number of values is negative
+ * or an array is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_physics_property_kinetic_energy_v(
+    const struct pumas_physics * physics, enum pumas_mode mode,
+    int material, int n, const double * range, double * energy);
+
+/**
+ * Stopping power per unit mass, for an array of kinetic energies.
+ *
+ * @param physics     The physics tables.
+ * @param mode        The energy loss mode
+ * @param material    The material index.
+ * @param n           The number of kinetic energy values.
+ * @param energy      The kinetic energies, in GeV.
+ * @param dedx        The computed stopping powers in GeV/(kg/m^(2)).
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * This function is a vectorised version of
+ * `pumas_physics_property_stopping_power`. See the
+ * `pumas_physics_property_range_v` function for more details.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_INDEX_ERROR             The mode or material index is
+ * not valid.
+ *
+ *     PUMAS_RETURN_PHYSICS_ERROR           The physics is not initialised.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The number of values is negative
+ * or an array is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_physics_property_stopping_power_v(
+    const struct pumas_physics * physics, enum pumas_mode mode,
+    int material, int n, const double * energy, double * dedx);
+
+/**
+ * Cross-section for hard collisions, for an array of kinetic energies.
+ *
+ * @param physics       The physics tables.
+ * @param material      The material index.
+ * @param n             The number of kinetic energy values.
+ * @param energy        The kinetic energies, in GeV.
+ * @param cross_section The computed cross-sections in m^(2)/kg.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * This function is a vectorised version of
+ * `pumas_physics_property_cross_section`. See the
+ * `pumas_physics_property_range_v` function for more details.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_INDEX_ERROR             The material index is not valid.
+ *
+ *     PUMAS_RETURN_PHYSICS_ERROR           The physics is not initialised.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR             The number of values is negative
+ * or an array is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_physics_property_cross_section_v(
+    const struct pumas_physics * physics, int material, int n,
+    const double * energy, double * cross_section);
+
 /**
  * The total number of atomic elements.
  *
@@ -1983,13 +2651,110 @@ PUMAS_API enum pumas_return pumas_physics_table_index(
 PUMAS_API enum pumas_return pumas_recorder_create(
     struct pumas_recorder ** recorder, int extra_memory);
 
+/**
+ * Create a new streaming Monte Carlo recorder.
+ *
+ * @param recorder     The Monte Carlo recorder.
+ * @param extra_memory The size of the user extra memory if any is claimed.
+ * @param capacity     The capacity of the ring buffer, in frames.
+ * @param stream       The output stream, or `NULL`.
+ * @param consumer     The consumer of frames, or `NULL`.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Create a new *recorder* object which writes Monte Carlo steps as fixed size
+ * `pumas_stream_frame` objects to a preallocated ring buffer. The *capacity* of
+ * the buffer is rounded up to a power of two. The buffer is drained to the
+ * *consumer* callback, if not `NULL`. Otherwise, frames are written in binary
+ * format to the output *stream*. Thus, the memory usage of the recorder does
+ * not depend on the number of recorded steps. The *first* field of the
+ * recorder is not used while its *length* field counts the recorded frames.
+ *
+ * If the library is compiled with `THREADS_MODE` enabled, the buffer is
+ * drained by a dedicated consumer thread. Writing frames to the buffer is lock
+ * free. The consumer thread is woken up whenever the buffer is half full, or
+ * when the recorder is flushed. If the buffer is full, the transport waits for
+ * the consumer. Otherwise, the buffer is drained by the transport when it is
+ * full.
+ *
+ * Setting a *record* callback to the recorder disables the streaming. The
+ * *extra_memory* argument has the same meaning than for
+ * `pumas_recorder_create`.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_MEMORY_ERROR    Could not allocate memory or start the
+ * consumer thread.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR     The capacity is not strictly positive, or
+ * both *stream* and *consumer* are `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_recorder_create_stream(
+    struct pumas_recorder ** recorder, int extra_memory, int capacity,
+    FILE * stream, pumas_stream_cb * consumer);
+
+/**
+ * Create a new columnar Monte Carlo recorder.
+ *
+ * @param recorder     The Monte Carlo recorder.
+ * @param extra_memory The size of the user extra memory if any is claimed.
+ * @param capacity     The capacity of the ring buffer, in frames.
+ * @param block_size   The maximum number of frames per block.
+ * @param stream       The output stream.
+ * @param encoding     The encoding flags.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Create a streaming *recorder*, as `pumas_recorder_create_stream`, but
+ * writing frames in a columnar format to the output *stream*. Frames are
+ * gathered in blocks of up to *block_size* frames, each block being written as
+ * a `pumas_column_block` header followed by the columns data. See the
+ * `pumas_column` enumeration for the list of columns.
+ *
+ * The *encoding* is a bitwise combination of `pumas_column_encoding` flags.
+ * Writing floating point values as `float` halves the size of a block. Delta
+ * encoding improves the accuracy of `float` values for small steps, as well
+ * as the compressibility of the output.
+ *
+ * A partial block is written whenever the recorder is flushed.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_MEMORY_ERROR    Could not allocate memory or start the
+ * consumer thread.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR     The capacity or the block size is not
+ * strictly positive, or *stream* is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_recorder_create_columnar(
+    struct pumas_recorder ** recorder, int extra_memory, int capacity,
+    int block_size, FILE * stream, int encoding);
+
+/**
+ * Flush a streaming Monte Carlo recorder.
+ *
+ * @param recorder The recorder handle.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Wait until all frames of a streaming recorder have been drained. The output
+ * stream, if any, is flushed as well. This function must not be called during
+ * a transport using the *recorder*. It does nothing for other recorders.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_IO_ERROR        Could not write to the output stream.
+ */
+PUMAS_API enum pumas_return pumas_recorder_flush(
+    struct pumas_recorder * recorder);
+
 /**
  * Clear all recorded frames.
  *
  * @param recorder The recorder handle.
  *
  * Erase all recorded `pumas_frame` instances from the recorder and reset the
- * frame count.
+ * frame count. A streaming recorder is flushed, and its track count is reset.
  */
 PUMAS_API void pumas_recorder_clear(struct pumas_recorder * recorder);
 
@@ -2009,6 +2774,146 @@ PUMAS_API void pumas_recorder_clear(struct pumas_recorder * recorder);
  */
 PUMAS_API void pumas_recorder_destroy(struct pumas_recorder ** recorder);
 
+/**
+ * Create a voxelised geometry.
+ *
+ * @param geometry The built-in geometry.
+ * @param origin   The lower corner of the grid, in m.
+ * @param spacing  The size of a cell along each axis, in m.
+ * @param shape    The number of cells along each axis.
+ * @param material The material index of each cell.
+ * @param density  The density of each cell, in kg/m^3, or `NULL`.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Create a regular grid of cells with uniform properties. Cell (i, j, k)
+ * spans from origin + (i, j, k) * spacing to origin + (i + 1, j + 1, k + 1) *
+ * spacing. Its properties are given by the *material* and *density* arrays
+ * at index i + shape[0] * (j + shape[1] * k). If *density* is `NULL`, the
+ * default density of the material is used for all cells. Cells with identical
+ * properties share the same `pumas_medium`. Thus, crossing between such cells
+ * is not a medium change.
+ *
+ * The grid is traversed with a 3D-DDA algorithm. The proposed steps end on the
+ * next face of a cell with different properties, or on the grid boundary.
+ * Outside of the grid there is no medium. The input arrays are copied.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_DENSITY_ERROR   A cell has a null or negative density.
+ *
+ *     PUMAS_RETURN_INDEX_ERROR     A cell has a negative material index.
+ *
+ *     PUMAS_RETURN_MEMORY_ERROR    Could not allocate memory.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR     The grid shape or spacing is not strictly
+ * positive, or the grid is too large, or *material* is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_geometry_create_voxels(
+    struct pumas_geometry ** geometry, const double origin[3],
+    const double spacing[3], const int shape[3], const int * material,
+    const double * density);
+
+/**
+ * Create a stratified geometry.
+ *
+ * @param geometry The built-in geometry.
+ * @param shape    The shape of the layers.
+ * @param bottom   The bottom of the first layer, in m.
+ * @param n_layers The number of layers.
+ * @param layers   The layers, from bottom to top.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Create a geometry of stacked layers, either planar or spherical depending on
+ * *shape*. Layer i spans from the top of layer i - 1, or from *bottom* for the
+ * first layer, to its own *top*. The coordinate of density laws is the
+ * altitude z for planar layers, or the radius for spherical ones. Outside of
+ * the layers there is no medium. The input layers are copied.
+ *
+ * The proposed steps are exact intersections of the propagation ray with the
+ * layer boundaries. The density laws are evaluated by the locals callback of
+ * the media, and their column density is integrated analytically along
+ * transport steps (see `pumas_density_law`).
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_INDEX_ERROR     The *shape* is not valid, or a layer has a
+ * negative material index or an invalid density model.
+ *
+ *     PUMAS_RETURN_MEMORY_ERROR    Could not allocate memory.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR     The layers are not sorted, or the number of
+ * layers is not strictly positive, or *layers* is `NULL`, or a density law is
+ * not valid or not strictly positive over its layer.
+ */
+PUMAS_API enum pumas_return pumas_geometry_create_layers(
+    struct pumas_geometry ** geometry, enum pumas_layer_shape shape,
+    double bottom, int n_layers, const struct pumas_layer * layers);
+
+/**
+ * Create a terrain geometry from a digital elevation model.
+ *
+ * @param geometry The built-in geometry.
+ * @param path     The path to the elevation raster.
+ * @param bottom   The bottom of the geometry, in m.
+ * @param top      The top of the geometry, in m.
+ * @param material The material indices of the ground and of the sky.
+ * @param density  The densities of the ground and of the sky, in kg/m^3, or
+ * `NULL`.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * Create a geometry of two media, the ground and the sky, separated by a
+ * topography surface. The elevation raster must be an ESRI ASCII grid, i.e. a
+ * header of `ncols`, `nrows`, `xllcorner` (or `xllcenter`), `yllcorner` (or
+ * `yllcenter`), `cellsize` and optionally `NODATA_value` entries, followed by
+ * the elevation values in m, row by row from north to south. The raster
+ * coordinates are the x and y axes, e.g. projected coordinates. The elevation
+ * values are located at the cell centres and they are bilinearly interpolated
+ * in between. The geometry spans over the hull of the cell centres, from
+ * *bottom* to *top*. Outside of it there is no medium.
+ *
+ * The ground lies below the topography surface and the sky above it. A
+ * negative sky material index stands for no medium above the ground. If
+ * *density* is `NULL`, the default density of the materials is used.
+ *
+ * The proposed steps are exact intersections of the propagation ray with the
+ * topography surface, or with the geometry bounds. The surface is traversed
+ * using a min/max quadtree of the elevation values, for empty space skipping.
+ *
+ * __Error codes__
+ *
+ *     PUMAS_RETURN_DENSITY_ERROR   A density is null or negative.
+ *
+ *     PUMAS_RETURN_FORMAT_ERROR    The raster is not a valid ESRI ASCII grid,
+ * e.g. a header entry is missing, or it has less than two rows or columns, or
+ * it has missing values.
+ *
+ *     PUMAS_RETURN_INDEX_ERROR     The ground material index is negative.
+ *
+ *     PUMAS_RETURN_MEMORY_ERROR    Could not allocate memory.
+ *
+ *     PUMAS_RETURN_PATH_ERROR      Could not open the raster.
+ *
+ *     PUMAS_RETURN_VALUE_ERROR     The topography is not strictly contained
+ * between *bottom* and *top*, or *material* is `NULL`.
+ */
+PUMAS_API enum pumas_return pumas_geometry_create_terrain(
+    struct pumas_geometry ** geometry, const char * path, double bottom,
+    double top, const int material[2], const double * density);
+
+/**
+ * Destroy a built-in geometry.
+ *
+ * @param geometry The built-in geometry.
+ *
+ * Release the memory used by a built-in geometry.
+ *
+ * __Note__: at return `geometry` is set to `NULL`.
+ */
+PUMAS_API void pumas_geometry_destroy(struct pumas_geometry ** geometry);
+
 /**
  * User supplied callback for memory allocation.
  *
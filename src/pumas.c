@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -50,6 +51,49 @@
 #include <fenv.h>
 #endif
 
+/* Export of some internal functions, for the unit tests. */
+#ifndef TEST_MODE
+#define TEST_MODE 0
+#endif
+
+/* Optional support for multithreading, using POSIX threads. */
+#ifndef THREADS_MODE
+#define THREADS_MODE 0
+#endif
+#if (THREADS_MODE)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* Optional support for memory mapped physics dumps, on POSIX systems. */
+#ifndef MMAP_MODE
+#if defined(__unix__) || defined(__APPLE__)
+#define MMAP_MODE 1
+#else
+#define MMAP_MODE 0
+#endif
+#endif
+#if (MMAP_MODE)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Storage qualifier for thread specific data, e.g. the error catch status. */
+#ifndef THREAD_LOCAL
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#error "no thread local storage. Define THREAD_LOCAL, e.g. as empty for a \
+non thread safe error catch."
+#endif
+#endif
+
 /* Some tuning factors as macros. */
 /**
  * Number of schemes to tabulate for the computation of the energy loss.
@@ -68,6 +112,11 @@
  * simulated.
  */
 #define N_DEL_PROCESSES 4
+/**
+ * Number of interleaved CEL properties per table row, i.e. the grammage, the
+ * proper time, the energy loss and the energy straggling.
+ */
+#define N_CEL_INTERLEAVED 4
 /**
  * Default cutoff between Continuous Energy Loss (CEL) and DELs.
  */
@@ -123,6 +172,13 @@
  * Minimum kinetic energy for using the DCS tabulation.
  */
 #define DCS_MODEL_MIN_KINETIC 10.
+/**
+ * Tuning parameters for the tabulation of the polar angle in photonuclear DELs
+ */
+/* Number of tabulated quantiles per node */
+#define POLAR_N_QUANTILES 23
+/* Number of nodes for the integration of the polar PDF */
+#define POLAR_N_PDF 129
 /* Some constants, as macros. */
 /**
  * Fine-structure constant
@@ -420,6 +476,19 @@ struct pumas_random_data {
         /** PRNG buffer (Mersenne Twister) */
         unsigned long buffer[MT_PERIOD];
 };
+/**
+ *  Data for the counter based PRNG (Philox4x32-10)
+ */
+struct random_counter_data {
+        /** The key, i.e. the seed and the stream index (32 bits each) */
+        unsigned long key[2];
+        /** The counter, i.e. the block and the event indices (64 bits each) */
+        unsigned long counter[4];
+        /** The last random block */
+        unsigned long buffer[4];
+        /** Index in the random block */
+        int index;
+};
 /**
  * The local data managed by a simulation context.
  */
@@ -452,19 +521,15 @@ struct simulation_context {
         double step_invlb1;
         /** Data for the default PRNG. */
         struct pumas_random_data * random_data;
-        /** Flag for the parity check of the Gaussian random generator.
-         *
-         * Gaussian variates are generated in pair using the Box-Muller
-         * transform.
-         */
-        int randn_done;
-        /** The next Gaussian variate. */
-        double randn_next;
+        /** Data for the counter based PRNG. */
+        struct random_counter_data random_counter;
         /**
          * Pointer to the worspace for the temporary storage of intermediary
          * computations.
          */
         struct coulomb_workspace * workspace;
+        /** The built-in geometry, if any. */
+        struct pumas_geometry * geometry;
         /** Size of the user extended memory. */
         int extra_memory;
         /**
@@ -491,6 +556,80 @@ struct frame_stack {
         /** Placeholder for frames */
         struct pumas_frame frames[];
 };
+/**
+ * Buffer for writing recorded frames by blocks of columns.
+ */
+struct column_writer {
+        /** The encoding flags. */
+        int encoding;
+        /** The maximum number of frames per block. */
+        int block_size;
+        /** The number of frames in the current block. */
+        int n_frames;
+        /** The number of tracks in the current block. */
+        int n_tracks;
+        /** The floating point columns, from the energy to the grammage. */
+        double * value[PUMAS_COLUMN_EVENT - PUMAS_COLUMN_ENERGY];
+        /** The track indices column. */
+        long * track;
+        /** The track lengths column. */
+        int * length;
+        /** The events column. */
+        int * event;
+        /** The materials column. */
+        int * material;
+        /** Scratch buffer for encoded values. */
+        void * scratch;
+        /** Placeholder for the columns data. */
+        double data[];
+};
+
+/**
+ * Handle for a stream of recorded frames.
+ *
+ * The frames are written to a ring buffer with a single producer, i.e. the
+ * transport, and a single consumer. The producer only modifies the head index
+ * while the consumer only modifies the tail one. The indices are padded in
+ * order to lie on distinct cache lines.
+ */
+struct frame_stream {
+        /** The total number of written frames. */
+        unsigned long head;
+        /** Padding of the head index. */
+        char pad_head[64 - sizeof(unsigned long)];
+        /** The total number of drained frames. */
+        unsigned long tail;
+        /** Padding of the tail index. */
+        char pad_tail[64 - sizeof(unsigned long)];
+        /** The ring buffer capacity, minus one. */
+        unsigned long mask;
+        /** The index of the current track. */
+        long track;
+        /** The streaming recorder. */
+        struct pumas_recorder * recorder;
+        /** The output stream. */
+        FILE * stream;
+        /** The user supplied consumer, if any. */
+        pumas_stream_cb * consumer;
+        /** The columns writer, for a columnar output. */
+        struct column_writer * columns;
+        /** Flag for output errors. */
+        int io_error;
+#if (THREADS_MODE)
+        /** The consumer thread. */
+        pthread_t thread;
+        /** Lock for waking up the consumer. */
+        pthread_mutex_t mutex;
+        /** Condition for waking up the consumer. */
+        pthread_cond_t cond;
+        /** Flag for a pending wake up, protected by the mutex. */
+        int wake;
+        /** Flag for stopping the consumer, protected by the mutex. */
+        int stop;
+#endif
+        /** Placeholder for frames. */
+        struct pumas_stream_frame frames[];
+};
 /**
  * Low level container for a frame recorder.
  */
@@ -501,9 +640,109 @@ struct frame_recorder {
         struct pumas_frame * last;
         /** Link to the 1st entry of the chained list of stacks. */
         struct frame_stack * stack;
+        /** Link to the frames stream, for a streaming recorder. */
+        struct frame_stream * stream;
+        /** The kinetic energy at the last recorded step. */
+        double last_energy;
+        /** The position at the last recorded step. */
+        double last_position[3];
         /** Placeholder for extra data. */
         double data[];
 };
+/**
+ * A medium of a built-in geometry.
+ */
+struct geometry_medium {
+        /** The public API data. */
+        struct pumas_medium api;
+        /** The density law of the medium. */
+        struct pumas_density_law law;
+        /** Flag for a density law depending on the radius. */
+        int radial;
+        /** The length scale of the density variations, for quadratures. */
+        double scale;
+};
+/**
+ * Base data of a built-in geometry.
+ */
+struct pumas_geometry {
+        /** The medium callback of the geometry. */
+        pumas_medium_cb * medium;
+        /** The number of media. */
+        int n_media;
+        /** The media of the geometry. */
+        struct geometry_medium * media;
+};
+/**
+ * Data for a voxelised geometry.
+ */
+struct voxel_geometry {
+        /** The base geometry data. */
+        struct pumas_geometry base;
+        /** The lower corner of the grid. */
+        double origin[3];
+        /** The size of a cell along each axis. */
+        double spacing[3];
+        /** The number of cells along each axis. */
+        int shape[3];
+        /** The medium index of each cell. */
+        int * cells;
+        /** Placeholder for the media and for the cells. */
+        struct geometry_medium data[];
+};
+/**
+ * Data for a stratified geometry.
+ */
+struct layer_geometry {
+        /** The base geometry data. */
+        struct pumas_geometry base;
+        /** Flag for spherical layers. */
+        int spherical;
+        /** The number of layers. */
+        int n_layers;
+        /** The boundaries of the layers, from bottom to top. */
+        double * boundaries;
+        /** Placeholder for the media and for the boundaries. */
+        struct geometry_medium data[];
+};
+/**
+ * Data for a terrain geometry.
+ */
+struct terrain_geometry {
+        /** The base geometry data. */
+        struct pumas_geometry base;
+        /** The location of the first elevation node. */
+        double origin[2];
+        /** The distance between elevation nodes. */
+        double spacing;
+        /** The number of elevation nodes along x and y. */
+        int shape[2];
+        /** The bottom of the geometry. */
+        double bottom;
+        /** The top of the geometry. */
+        double top;
+        /** The number of levels of the quadtree. */
+        int n_levels;
+        /** The offsets of the quadtree levels, in number of nodes. */
+        int offsets[32];
+        /** The elevation nodes. */
+        double * heights;
+        /** The minimum and maximum elevations of the quadtree nodes. */
+        double * bounds;
+        /** Placeholder for the media, the elevations and the quadtree. */
+        struct geometry_medium data[];
+};
+/**
+ * Helper structure for sorting the cells of a voxelised geometry.
+ */
+struct voxel_sort {
+        /** The material index of the cell. */
+        int material;
+        /** The index of the cell. */
+        int cell;
+        /** The density of the cell. */
+        double density;
+};
 /**
  * Data relative to an atomic element.
  */
@@ -548,6 +787,25 @@ struct composite_material {
         /** Placeholder for the sub components' data. */
         struct composite_component component[];
 };
+/**
+ * Temporary tables of material indices and names, for parsing MDF settings.
+ */
+struct mdf_settings_tables {
+        /** Buffer for the material index tables. */
+        int * index;
+        /** The total size of the index buffer. */
+        int index_size;
+        /** The free size left in the index buffer. */
+        int index_free;
+        /** The number of atomic elements of the current composite. */
+        int n_elements;
+        /** Buffer for the names table. */
+        char * name;
+        /** The total size of the names buffer. */
+        int name_size;
+        /** The free size left in the names buffer. */
+        int name_free;
+};
 /**
  * Temporary data for the parsing of a MDF.
  */
@@ -594,9 +852,36 @@ struct mdf_buffer {
         int size_elements_names;
         /** The total size of materials names. */
         int size_materials_names;
+        /** Work buffer for the per element CEL and DEL terms. */
+        double * cel_table;
         /** Placeholder for the read buffer. */
         char data[];
 };
+/**
+ * Line reader for text data files, e.g. dE/dX tables.
+ *
+ * The state is local to the reader, thus distinct files can be read
+ * concurrently. When possible the file content is mapped to memory and lines
+ * are returned in place. Otherwise, lines are read with stdio to a buffer.
+ */
+struct io_reader {
+        /** The name of the file being read. */
+        const char * filename;
+        /** The current line number. */
+        int line;
+        /** The file handle, for stdio reads. */
+        FILE * fid;
+        /** The line buffer, for stdio reads. */
+        char * buffer;
+        /** The size of the line buffer. */
+        int size;
+        /** The mapped file content, or `NULL`. */
+        const char * map;
+        /** The size of the mapped content. */
+        size_t map_size;
+        /** The read offset in the mapped content. */
+        size_t offset;
+};
 /*!
  * Pointers to the data fields of a node in a MDF file.
  *
@@ -637,6 +922,21 @@ struct mdf_node {
                 char * I;
         } at4;
 };
+/**
+ * Snapshot of the CEL properties at a given kinetic energy.
+ */
+struct cel_snapshot {
+        /** The total grammage (CSDA range). */
+        double grammage;
+        /** The total proper time. */
+        double time;
+        /** The average energy loss. */
+        double dedx;
+        /** The energy straggling. */
+        double straggling;
+        /** The number of interaction lengths for inelastic DELs. */
+        double ni_in;
+};
 /**
  * Temporary data for a DEL event.
  */
@@ -662,10 +962,14 @@ struct pumas_physics {
  * Version tag for the physics data format. Increment whenever the
  * structure changes.
  */
-#define PHYSICS_BINARY_DUMP_TAG 13
+#define PHYSICS_BINARY_DUMP_TAG 22
 
         /** The total byte size of the shared data. */
         int size;
+        /** Flag telling if the shared data are memory mapped from a dump. */
+        int mapped;
+        /** The number of threads used for tabulating the physics. */
+        int n_threads;
         /** The number of kinetic energy values in the dE/dX tables. */
         int n_energies;
         /** The total number of materials, basic and composites. */
@@ -718,6 +1022,12 @@ struct pumas_physics {
         /** The tabulated values of the average energy loss. */
         double * table_dE;
         double * table_dE_dK;
+        /**
+         * The interleaved values of the grammage, proper time, average
+         * energy loss and energy straggling, with their derivatives w.r.t.
+         * the kinetic energy.
+         */
+        double * table_CEL;
         /** The tabulated values of the energy straggling. */
         double * table_Omega;
         double * table_Omega_dK;
@@ -739,10 +1049,28 @@ struct pumas_physics {
         /** The tabulated cross section normalisation. */
         double * table_CSn;
         double * table_CSn_dK;
+        /**
+         * The tabulated alias tables for the randomisation of DEL targets.
+         * The acceptance probabilities are stored in `table_Af` and the
+         * alias indices in `table_Ai`.
+         */
+        double * table_Af;
+        int * table_Ai;
         /* The tabulated data for DCSs **/
         float * table_DCS;
         float * table_DCS_x;
         float * table_DCS_envelope;
+        /**
+         * The cumulative integrals of the tabulated DCSs, for the inverse
+         * sampling of DELs. The last value of a row is the integral above
+         * the tabulation range. It is negative if the row cannot be used.
+         */
+        double * table_DCS_CDF;
+        /**
+         * The tabulated quantiles of the momentum transfer in photonuclear
+         * DELs. The energy loss nodes are those of `table_DCS_x`.
+         */
+        float * table_polar;
         /** The element wise fractional threshold for DELs. */
         double * table_Xt;
         /** The total kinetic threshold for DELs. */
@@ -766,6 +1094,11 @@ struct pumas_physics {
         /** The tabulated interaction lengths for DEL Coulomb events. */
         double * table_Lb;
         double * table_Lb_dK;
+        /**
+         * The tabulated fractional contributions of atomic components to the
+         * EHS cross section.
+         */
+        double * table_EHSf;
         /** The tabulated multiple scattering 1st moment. */
         double * table_Ms1;
         double * table_Ms1_dK;
@@ -799,6 +1132,21 @@ struct pumas_physics {
         pumas_dcs_t * dcs_pair_production;
         /** The photonuclear DCS. */
         pumas_dcs_t * dcs_photonuclear;
+        /* Number of log-uniform bins for the indexing of kinetic energies. */
+#define KINETIC_INDEX_N_BINS 1024
+        /**
+         * Lookup table for the indexing of kinetic energies. The i-th entry
+         * is the index of the closest tabulated kinetic energy from below
+         * the lower edge of the i-th bin.
+         */
+        int kinetic_index[KINETIC_INDEX_N_BINS];
+        /** The log of the lower edge of the kinetic energy bins. */
+        double kinetic_index_min;
+        /**
+         * The inverse width of the kinetic energy bins, in log. A null value
+         * indicates that the lookup table is not initialised.
+         */
+        double kinetic_index_scale;
         /**
          * Placeholder for shared data storage with -double- memory alignment.
          */
@@ -825,8 +1173,6 @@ struct physics_element {
         struct physics_element * next;
         /** The element index. */
         int index;
-        /** The mass fraction of the element in the current material. */
-        double fraction;
 };
 
 /**
@@ -834,9 +1180,9 @@ struct physics_element {
  *
  * This structure gathers data related to the tabulation of the energy loss of
  * materials with the `physics_tabulate` function. **Note** that the two last
- * parameters: *path* and *elements* should not be set directly. They are filled
- * in (updated) by the `physics_tabulate` function. Note also that if no energy
- * grid is provided then a default one is set.
+ * parameters: *elements* and *default_energy* should not be set directly. They
+ * are filled in (updated) by the `physics_tabulate` function. Note also that if
+ * no energy grid is provided then a default one is set.
  *
  * **Warning**: the energy grid should not be changed between successive calls
  * to `physics_tabulate`. If a new energy grid is needed then a new
@@ -855,14 +1201,22 @@ struct physics_tabulation_data {
         int overwrite;
         /** Path to a directory where the tabulation should be written. */
         char * outdir;
-        /** Index of the material to tabulate */
-        int material;
-        /** Path to the energy loss file of the last tabulated material. */
-        char * path;
         /** List of atomic elements contained in the tabulated material(s). */
         struct physics_element * elements;
-        /** Temporary work data */
-        double * work;
+        /** Storage for the default energy grid, if used. */
+        double * default_energy;
+};
+
+/**
+ * Arguments for a parallel tabulation of materials or atomic elements.
+ */
+struct physics_tabulation_task {
+        /** The tabulation data. */
+        struct physics_tabulation_data * data;
+        /** The indices of the materials to tabulate. */
+        const int * materials;
+        /** The atomic elements to tabulate. */
+        struct physics_element ** elements;
 };
 
 /**
@@ -884,9 +1238,15 @@ static void default_error_handler(
  */
 static struct {
         pumas_handler_cb * handler;
+} s_error = { &default_error_handler };
+
+/**
+ * Thread specific data for catching errors.
+ */
+static THREAD_LOCAL struct {
         int catch;
         struct error_context catch_error;
-} s_error = { &default_error_handler, 0 };
+} s_error_catch;
 
 /* Prototypes of low level static functions. */
 /**
@@ -909,6 +1269,12 @@ static double cel_energy_loss(const struct pumas_physics * physics,
     double kinetic);
 static double cel_straggling(const struct pumas_physics * physics,
     struct pumas_context * context, int material, double kinetic);
+static void cel_snapshot(const struct pumas_physics * physics,
+    struct pumas_context * context, enum pumas_mode scheme, int material,
+    double kinetic, struct cel_snapshot * snapshot);
+static void cel_fluctuation(const struct pumas_physics * physics,
+    struct pumas_context * context, enum pumas_mode scheme, int material,
+    double kinetic, double * dedx, double * straggling);
 static double cel_magnetic_rotation(const struct pumas_physics * physics,
     struct pumas_context * context, int material, double kinetic);
 static double del_cross_section(const struct pumas_physics * physics,
@@ -962,6 +1328,10 @@ static double dcs_ionisation_randomise(const struct pumas_physics * physics,
 static double dcs_evaluate(const struct pumas_physics * physics,
     struct pumas_context * context, dcs_function_t * dcs_func,
     const struct atomic_element * element, double K, double q);
+static inline void dcs_power_law(
+    double l0, double l1, double y0, double y1, double * c, double * a);
+static inline double dcs_power_law_integral(double c, double a, double d);
+static inline double dcs_power_law_inverse(double c, double a, double r);
 
 /**
  * Implementations of polar angle distributions and accessor.
@@ -979,9 +1349,22 @@ static double polar_photonuclear(const struct pumas_physics * physics,
 static double polar_ionisation(const struct pumas_physics * physics,
     struct pumas_context * context, const struct atomic_element * element,
     double ki, double kf);
+static int polar_photonuclear_tabulated(const struct pumas_physics * physics,
+    struct pumas_context * context, const struct atomic_element * element,
+    double ki, double kf, double * t);
+static void polar_photonuclear_tabulate(const struct pumas_physics * physics,
+    const struct atomic_element * element, double ki, double kf,
+    float * quantiles);
 /**
  * Low level routines for the propagation in matter.
  */
+static enum pumas_return transport_check_context(
+    const struct pumas_physics * physics, struct pumas_context * context,
+    struct error_context * error_);
+static enum pumas_return transport_state(const struct pumas_physics * physics,
+    struct pumas_context * context, struct pumas_state * state,
+    enum pumas_event * event, struct pumas_medium * media[2],
+    struct error_context * error_);
 static enum pumas_event transport_with_csda(
     const struct pumas_physics * physics, struct pumas_context * context,
     struct pumas_state * state, struct pumas_medium * medium,
@@ -1007,7 +1390,8 @@ static double transport_set_locals(const struct pumas_context * context,
     struct medium_locals * locals);
 static void transport_limit(const struct pumas_physics * physics,
     struct pumas_context * context, const struct pumas_state * state,
-    int material, double di, double Xi, double * distance_max);
+    int material, double Xi, const struct cel_snapshot * snapshot,
+    double * grammage_max);
 static void transport_do_del(const struct pumas_physics * physics,
     struct pumas_context * context, struct pumas_state * state, int material);
 static void transport_do_ehs(const struct pumas_physics * physics,
@@ -1023,6 +1407,10 @@ static polar_function_t * del_randomise_reverse(
     const struct pumas_physics * physics, struct pumas_context * context,
     struct pumas_state * state, int material, int * process,
     const struct atomic_element ** element);
+static int del_randomise_inverse(const struct pumas_physics * physics,
+    struct pumas_context * context, int process,
+    const struct atomic_element * element, double kinetic, double * xmin,
+    double xmax, double * x);
 static void del_randomise_power_law(struct pumas_context * context,
     double alpha, double xmin, double xmax, double * p_r, double * p_w);
 static void del_randomise_target(const struct pumas_physics * physics,
@@ -1031,9 +1419,57 @@ static void del_randomise_target(const struct pumas_physics * physics,
 /**
  * Helper routine for recording a state.
  */
+static double geometry_locals(struct pumas_medium * medium,
+    struct pumas_state * state, struct pumas_locals * locals);
+static double density_law_evaluate(
+    const struct pumas_density_law * law, double h, double * derivative);
+static int density_law_check(
+    const struct pumas_density_law * law, double h0, double h1);
+static const struct geometry_medium * geometry_analytic(
+    const struct pumas_medium * medium);
+static double geometry_grammage(const struct geometry_medium * medium,
+    const double * position, const double * direction, double step);
+static double geometry_grammage_segment(const struct geometry_medium * medium,
+    const double * position, const double * direction, double s0, double s1);
+static double geometry_distance(const struct geometry_medium * medium,
+    const double * position, const double * direction, double grammage,
+    double step_max);
+static int voxels_compare(const void * a, const void * b);
+static enum pumas_step layers_medium(struct pumas_context * context,
+    struct pumas_state * state, struct pumas_medium ** medium, double * step);
+static enum pumas_step voxels_medium(struct pumas_context * context,
+    struct pumas_state * state, struct pumas_medium ** medium, double * step);
+static enum pumas_step terrain_medium(struct pumas_context * context,
+    struct pumas_state * state, struct pumas_medium ** medium, double * step);
+static double terrain_height(
+    const struct terrain_geometry * geometry, double x, double y);
+static int terrain_clip(const struct terrain_geometry * geometry, int level,
+    int i, int j, const double * position, const double * direction,
+    double * t0, double * t1);
+static double terrain_intersect(const struct terrain_geometry * geometry,
+    int level, int i, int j, const double * position,
+    const double * direction, double t0, double t1);
 static void record_state(struct pumas_context * context,
     struct pumas_medium * medium, enum pumas_event event,
     struct pumas_state * state);
+static struct frame_recorder * recorder_allocate(int extra_memory);
+static enum pumas_return stream_create(struct frame_recorder ** recorder,
+    int extra_memory, int capacity, FILE * output, pumas_stream_cb * consumer,
+    struct column_writer * columns, struct error_context * error_);
+static void stream_push(struct frame_stream * stream,
+    struct pumas_medium * medium, enum pumas_event event,
+    struct pumas_state * state);
+static void stream_drain(struct frame_stream * stream);
+static void stream_flush(struct frame_stream * stream);
+static void stream_destroy(struct frame_stream * stream);
+static struct column_writer * columns_allocate(int block_size, int encoding);
+static void columns_push(
+    struct frame_stream * stream, const struct pumas_stream_frame * frame);
+static void columns_write(struct frame_stream * stream);
+#if (THREADS_MODE)
+static void stream_wake(struct frame_stream * stream);
+static void * stream_consume(void * args);
+#endif
 /**
  * For memory padding.
  */
@@ -1080,6 +1516,9 @@ static int table_index(const struct pumas_physics * physics,
 static double table_interpolate_pchip(const struct pumas_physics * physics,
     struct pumas_context * context, const double * table_X,
     const double * table_Y, const double * table_M, double x);
+static void table_interpolate_pchip_v(const struct pumas_physics * physics,
+    const double * table_X, const double * table_Y, const double * table_M,
+    int n, const double * x, double * y);
 static void table_get_msc(const struct pumas_physics * physics,
     struct pumas_context * context, int material, double kinetic, double * mu0,
     double * invlb1);
@@ -1105,6 +1544,8 @@ static inline double * table_get_dE(
     const struct pumas_physics * physics, int scheme, int material, int row);
 static inline double * table_get_dE_dK(
     const struct pumas_physics * physics, int scheme, int material, int row);
+static inline double * table_get_CEL(
+    const struct pumas_physics * physics, int scheme, int material, int row);
 static inline double * table_get_Omega(
     const struct pumas_physics * physics, int material, int row);
 static inline double * table_get_Omega_dK(
@@ -1129,6 +1570,10 @@ static inline double * table_get_CSn(
     const struct pumas_physics * physics, int process, int element, int row);
 static inline double * table_get_CSn_dK(
     const struct pumas_physics * physics, int process, int element, int row);
+static inline double * table_get_Af(const struct pumas_physics * physics,
+    int component, int n_components, int row);
+static inline int * table_get_Ai(const struct pumas_physics * physics,
+    int component, int n_components, int row);
 static inline double * table_get_Xt(
     const struct pumas_physics * physics, int process, int element, int row);
 static inline double * table_get_Kt(
@@ -1153,6 +1598,8 @@ static inline double * table_get_Lb(
     const struct pumas_physics * physics, int material, int row);
 static inline double * table_get_Lb_dK(
     const struct pumas_physics * physics, int material, int row);
+static inline double * table_get_EHSf(
+    const struct pumas_physics * physics, int component, int row);
 static inline double * table_get_Ms1(
     const struct pumas_physics * physics, int scheme, int material, int row);
 static inline double * table_get_Ms1_dK(
@@ -1164,6 +1611,10 @@ static inline float * table_get_dcs(const struct pumas_physics * physics,
 static inline float * table_get_dcs_envelope(
     const struct pumas_physics * physics, int process, int element,
     int kinetic);
+static inline double * table_get_dcs_cdf(const struct pumas_physics * physics,
+    int process, int element, int kinetic);
+static inline float * table_get_polar(const struct pumas_physics * physics,
+    int element, int kinetic, int x);
 /**
  * Routine(s) wrapping static data
  */
@@ -1179,31 +1630,40 @@ static enum pumas_return step_transport(const struct pumas_physics * physics,
     struct error_context * error_);
 static void step_fluctuate(const struct pumas_physics * physics,
     struct pumas_context * context, struct pumas_state * state, int material,
-    double Xtot, double dX, double * kf, double * dE);
+    const struct cel_snapshot * snapshot, double dX, double * kf,
+    double * ratio);
 static double step_randn(struct pumas_context * context);
+static double step_rande(struct pumas_context * context);
 static void step_rotate_direction(struct pumas_context * context,
     struct pumas_state * state, double mu);
 /**
  * I/O utility routines.
  */
 static enum pumas_return io_parse_dedx_file(struct pumas_physics * physics,
-    FILE * fid, int material, const char * filename,
+    struct io_reader * reader, int material, double * cel_table,
     struct error_context * error_);
 static enum pumas_return io_parse_dedx_row(struct pumas_physics * physics,
-    char * buffer, int material, int * row, const char * filename, int line,
+    const char * buffer, int length, int material, int * row,
+    double * cel_table, const char * filename, int line,
     struct error_context * error_);
-static enum pumas_return io_read_line(FILE * fid, char ** buffer,
-    const char * filename, int line, struct error_context * error_);
+static enum pumas_return io_reader_open(struct io_reader * reader,
+    const char * path, struct error_context * error_);
+static void io_reader_close(struct io_reader * reader);
+static enum pumas_return io_reader_line(struct io_reader * reader,
+    const char ** line, int * length, struct error_context * error_);
+static int io_line_find(const char * line, int length, const char * pattern);
+static int io_scan_double(const char ** cursor, const char * end,
+    double * value);
 /**
  * Routines for the parsing of MDFs.
  */
 static enum pumas_return mdf_parse_settings(
     const struct pumas_physics * physics, struct mdf_buffer * mdf,
     const char * dedx_path, struct error_context * error_);
-static int mdf_settings_index(
+static int mdf_settings_index(struct mdf_settings_tables * tables,
     int operation, int value, struct error_context * error_);
-static int mdf_settings_name(
-    int size, char prefix, const char * name, struct error_context * error_);
+static int mdf_settings_name(struct mdf_settings_tables * tables, int size,
+    char prefix, const char * name, struct error_context * error_);
 static enum pumas_return mdf_parse_kinetic(struct mdf_buffer * mdf,
     const char * path, int n_energies, double * energy,
     struct error_context * error_);
@@ -1224,6 +1684,14 @@ static enum pumas_return mdf_format_path(const char * directory,
 /**
  * Routines for the pre-computation of various properties: CEL, DCS, ...
  */
+/* Callback for a tabulation task, e.g. over atomic elements. */
+typedef enum pumas_return compute_task_t(struct pumas_physics * physics,
+    int index, void * args, struct error_context * error_);
+static enum pumas_return compute_parallel(struct pumas_physics * physics,
+    int n_tasks, compute_task_t * task, void * args,
+    struct error_context * error_);
+static enum pumas_return compute_base_material(struct pumas_physics * physics,
+    int material, void * args, struct error_context * error_);
 static enum pumas_return compute_composite(struct pumas_physics * physics,
     int material, struct error_context * error_);
 static enum pumas_return compute_composite_density(
@@ -1233,9 +1701,11 @@ static void compute_composite_weights(
     struct pumas_physics * physics, int material);
 static void compute_composite_tables(
     struct pumas_physics * physics, int material);
+static void compute_del_alias(struct pumas_physics * physics, int material);
 static void compute_cel_integrals(struct pumas_physics * physics, int imed);
+static void compute_kinetic_index(struct pumas_physics * physics);
 static enum pumas_return compute_scattering(struct pumas_physics * physics,
-    int imed, struct error_context * error_);
+    int imed, double * ms1_table, struct error_context * error_);
 static void compute_kinetic_integral(
     struct pumas_physics * physics, double * table, double * work);
 static void compute_time_integrals(
@@ -1243,6 +1713,8 @@ static void compute_time_integrals(
 static void compute_cel_grammage_integral(
     struct pumas_physics * physics, int scheme, int material);
 static void compute_pchip_coeffs(struct pumas_physics * physics, int material);
+static void compute_cel_interleaved(
+    struct pumas_physics * physics, int material);
 static void compute_pchip_elements_coeffs(struct pumas_physics * physics);
 static void compute_pchip_integral_coeffs(
     struct pumas_physics * physics, int material);
@@ -1254,14 +1726,18 @@ static void compute_csda_magnetic_transport(
     struct pumas_physics * physics, int imed);
 static enum pumas_return compute_scattering_parameters(
     struct pumas_physics * physics, int medium_index, int row,
-    struct error_context * error_);
+    double * ms1_table, struct coulomb_workspace * workspace);
 static enum pumas_return compute_msc_soft(struct pumas_physics * physics,
-    int row, double ** data, struct error_context * error_);
+    double ** data, struct error_context * error_);
+static enum pumas_return compute_msc_soft_element(
+    struct pumas_physics * physics, int element, void * args,
+    struct error_context * error_);
 static double compute_msc_electronic(struct pumas_physics * physics,
     enum pumas_mode mode, int material, int row);
 static double compute_cutoff_objective(
     const struct pumas_physics * physics, double mu, void * workspace);
-static double * compute_cel_and_del(struct pumas_physics * physics, int row);
+static enum pumas_return compute_cel_and_del(struct pumas_physics * physics,
+    int row, double * cel_table, struct error_context * error_);
 static void compute_regularise_del(
     struct pumas_physics * physics, int material);
 static double compute_dcs_integral(struct pumas_physics * physics, int mode,
@@ -1269,10 +1745,19 @@ static double compute_dcs_integral(struct pumas_physics * physics, int mode,
     double xlow, double xhigh, int nint);
 static void compute_ZoA(struct pumas_physics * physics, int material);
 static void compute_MEE(struct pumas_physics * physics, int material);
-static enum pumas_return compute_dcs_table(
-    struct pumas_physics * physics, int element, struct error_context * error_);
+static double compute_dcs_node(const struct pumas_physics * physics, int i);
+static enum pumas_return compute_dcs_table(struct pumas_physics * physics,
+    int element, void * args, struct error_context * error_);
+static enum pumas_return compute_polar_table(struct pumas_physics * physics,
+    int element, void * args, struct error_context * error_);
 static enum pumas_return physics_tabulate(struct pumas_physics * physics,
-    struct physics_tabulation_data * data, struct error_context * error_);
+    struct physics_tabulation_data * data, int material,
+    struct error_context * error_);
+static enum pumas_return physics_tabulation_prepare(
+    struct pumas_physics * physics, struct physics_tabulation_data * data,
+    int n_materials, const int * materials, struct error_context * error_);
+static enum pumas_return physics_tabulate_task(struct pumas_physics * physics,
+    int index, void * args, struct error_context * error_);
 static void physics_tabulation_clear(const struct pumas_physics * physics,
     struct physics_tabulation_data * data);
 static struct physics_element * tabulation_element_create(
@@ -1315,7 +1800,18 @@ static int math_find_minimum_bisection(
     const struct pumas_physics * physics, double xa, double xb, double xc,
     const double * fb_p, double tol, int max_iter, void * params, double * x0,
     double * f0);
-static int math_gauss_quad(int n, double * p1, double * p2);
+/* State of an iterative Gaussian quadrature. */
+struct gauss_quad {
+        const double * xGQ;
+        const double * wGQ;
+        int i;
+        int j;
+        int n_itv;
+        double h;
+        double x0;
+};
+static int math_gauss_quad(
+    struct gauss_quad * quad, int n, double * p1, double * p2);
 static void math_gauss_quad_coefficients(
     int n, const double ** xGQ, const double ** wGQ);
 static void math_gauss_quad_initialise(
@@ -1432,8 +1928,9 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
 #endif
         FILE * fid_mdf = NULL;
         struct mdf_buffer * mdf = NULL;
+        double * ms1_table = NULL;
         const int pad_size = sizeof(*((*physics_ptr)->data));
-#define N_DATA_POINTERS 53
+#define N_DATA_POINTERS 59
         int size_data[N_DATA_POINTERS];
 
         /* Check the particle type. */
@@ -1470,6 +1967,9 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
                         opts.elastic_ratio = settings_->elastic_ratio;
                 }
 
+                if (settings_->n_threads > 0)
+                        opts.n_threads = settings_->n_threads;
+
                 if (settings_->bremsstrahlung != NULL) {
                         if (dcs_check_model(PUMAS_PROCESS_BREMSSTRAHLUNG,
                             settings_->bremsstrahlung, error_) ==
@@ -1531,6 +2031,7 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
                 goto clean_and_exit;
         }
         mdf->dry_mode = dry_mode;
+        mdf->cel_table = NULL;
         mdf->mdf_path = file_mdf;
         mdf->fid = fid_mdf;
         mdf->size = size_mdf - sizeof(*mdf);
@@ -1605,6 +2106,11 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
         size_data[imem++] = memory_padded_size(sizeof(double) * N_SCHEMES *
                 settings.n_materials * settings.n_energies,
             pad_size);
+        /* table_CEL. */
+        size_data[imem++] = memory_padded_size(sizeof(double) *
+                2 * N_CEL_INTERLEAVED * N_SCHEMES * settings.n_materials *
+                settings.n_energies,
+            pad_size);
         /* table_Omega. */
         size_data[imem++] = memory_padded_size(sizeof(double) *
             settings.n_materials * settings.n_energies, pad_size);
@@ -1649,6 +2155,14 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
         size_data[imem++] = memory_padded_size(sizeof(double) *
                 N_DEL_PROCESSES * settings.n_elements * settings.n_energies,
             pad_size);
+        /* table_Af. */
+        size_data[imem++] = memory_padded_size(sizeof(double) *
+                N_DEL_PROCESSES * settings.n_components * settings.n_energies,
+            pad_size);
+        /* table_Ai. */
+        size_data[imem++] = memory_padded_size(sizeof(int) *
+                N_DEL_PROCESSES * settings.n_components * settings.n_energies,
+            pad_size);
         /* table_DCS. */
         size_data[imem++] = memory_padded_size(sizeof(float) *
             (N_DEL_PROCESSES - 1) * settings.n_elements * settings.n_energies *
@@ -1660,6 +2174,14 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
         size_data[imem++] = memory_padded_size(sizeof(float) *
             (N_DEL_PROCESSES - 1) * settings.n_elements * settings.n_energies *
             2, pad_size);
+        /* table_DCS_CDF. */
+        size_data[imem++] = memory_padded_size(sizeof(double) *
+            (N_DEL_PROCESSES - 1) * settings.n_elements * settings.n_energies *
+            (n_table_dcs + 1), pad_size);
+        /* table_polar. */
+        size_data[imem++] = memory_padded_size(sizeof(float) *
+            settings.n_elements * settings.n_energies * n_table_dcs *
+            POLAR_N_QUANTILES, pad_size);
         /* table_Xt */
         size_data[imem++] = memory_padded_size(sizeof(double) *
                 N_DEL_PROCESSES * settings.n_elements * settings.n_energies,
@@ -1699,6 +2221,10 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
         size_data[imem++] = memory_padded_size(
             sizeof(double) * settings.n_materials * settings.n_energies,
             pad_size);
+        /* table_EHSf. */
+        size_data[imem++] = memory_padded_size(
+            sizeof(double) * settings.n_components * settings.n_energies,
+            pad_size);
         /* table_Ms1. */
         size_data[imem++] = memory_padded_size(
             sizeof(double) * (N_SCHEMES + 1) * settings.n_materials *
@@ -1815,6 +2341,7 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
         /* Set the cutoff and elastic ratio */
         physics->cutoff = opts.cutoff;
         physics->elastic_ratio = opts.elastic_ratio;
+        physics->n_threads = opts.n_threads;
 
         /* Allocate a new MDF buffer. */
         if ((mdf = allocate(sizeof(struct mdf_buffer) + size_mdf)) == NULL) {
@@ -1838,6 +2365,15 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
                 goto clean_and_exit;
 
         /* Parse the base materials. */
+        if (!dry_mode) {
+                mdf->cel_table = allocate(2 * N_DEL_PROCESSES *
+                    physics->n_elements * physics->n_energies *
+                    sizeof(double));
+                if (mdf->cel_table == NULL) {
+                        ERROR_REGISTER_MEMORY();
+                        goto clean_and_exit;
+                }
+        }
         if ((mdf_parse_materials(physics, mdf, error_)) != PUMAS_RETURN_SUCCESS)
                 goto clean_and_exit;
 
@@ -1856,23 +2392,17 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
         /* All done if in dry mode. */
         if (dry_mode) goto clean_and_exit;
 
-        /* Precompute the CEL integrals and the TT parameters. */
-        for (imat = 0; imat < physics->n_materials - physics->n_composites;
-             imat++) {
-                /* Set the scalling factor */
-                struct atomic_shell * shells = atomic_shell_create(
-                    physics, imat, NULL, physics->material_aS + imat);
-                if (shells == NULL) {
-                        ERROR_REGISTER_MEMORY();
-                        goto clean_and_exit;
-                }
-                deallocate(shells);
+        /* Index the kinetic energy grid. */
+        compute_kinetic_index(physics);
 
-                compute_cel_integrals(physics, imat);
-                compute_csda_magnetic_transport(physics, imat);
-                if (compute_scattering(physics, imat, error_) !=
-                    PUMAS_RETURN_SUCCESS) goto clean_and_exit;
-        }
+        /* Precompute the multiple scattering per element. */
+        if (compute_msc_soft(physics, &ms1_table, error_) !=
+            PUMAS_RETURN_SUCCESS) goto clean_and_exit;
+
+        /* Precompute the CEL integrals and the TT parameters. */
+        if (compute_parallel(physics, physics->n_materials -
+                physics->n_composites, &compute_base_material, ms1_table,
+                error_) != PUMAS_RETURN_SUCCESS) goto clean_and_exit;
 
         /* Precompute the same properties for composite materials. */
         for (imat = physics->n_materials - physics->n_composites;
@@ -1884,12 +2414,21 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
                         goto clean_and_exit;
         }
 
-        /* Tabulate the DCS for atomic elements. */
-        int iel;
-        for (iel = 0; iel < physics->n_elements; iel++) {
-                if (compute_dcs_table(physics, iel, error_) !=
-                    PUMAS_RETURN_SUCCESS) goto clean_and_exit;
+        /* Tabulate the DCS for atomic elements, over a common energy loss
+         * grid.
+         */
+        int inode;
+        for (inode = 0; inode < physics->n_table_dcs; inode++) {
+                physics->table_DCS_x[inode] =
+                    (float)compute_dcs_node(physics, inode);
         }
+        if (compute_parallel(physics, physics->n_elements, &compute_dcs_table,
+                NULL, error_) != PUMAS_RETURN_SUCCESS) goto clean_and_exit;
+
+        /* Tabulate the polar angle in photonuclear DELs. */
+        if (compute_parallel(physics, physics->n_elements,
+                &compute_polar_table, NULL, error_) != PUMAS_RETURN_SUCCESS)
+                goto clean_and_exit;
 
         /* Compute the cubic interp. coefficients for atomic elements
          * cross-sections
@@ -1898,12 +2437,9 @@ static enum pumas_return _initialise(struct pumas_physics ** physics_ptr,
 
 clean_and_exit:
         if (fid_mdf != NULL) fclose(fid_mdf);
+        if (mdf != NULL) deallocate(mdf->cel_table);
         deallocate(mdf);
-        io_read_line(NULL, NULL, NULL, 0, error_);
-        compute_scattering_parameters(physics, -1, -1, error_);
-        compute_msc_soft(physics, -1, NULL, error_);
-        compute_cel_and_del(physics, -1);
-        compute_dcs_table(physics, -1, error_);
+        deallocate(ms1_table);
         if ((error_->code != PUMAS_RETURN_SUCCESS) && (physics != NULL)) {
                 deallocate(physics);
                 *physics_ptr = NULL;
@@ -1934,9 +2470,11 @@ enum pumas_return pumas_physics_create(struct pumas_physics ** physics,
                     NULL : settings->energy,
                 .overwrite = (settings == NULL) ? 0 : settings->update,
                 .outdir = p->dedx_path,
-                .work = NULL
+                .elements = NULL,
+                .default_energy = NULL
         };
         double * energy = NULL;
+        int * missing = NULL;
 
         /* Prepare the filename buffer */
         char * filename = NULL;
@@ -1976,6 +2514,8 @@ enum pumas_return pumas_physics_create(struct pumas_physics ** physics,
                         mdf_parse_kinetic(
                             &mdf, filename, data.n_energies, energy, error_);
                         if (error_->code == PUMAS_RETURN_PATH_ERROR) {
+                                /* Missing table, generated below. */
+                                error_->code = PUMAS_RETURN_SUCCESS;
                                 continue;
                         } else if (error_->code != PUMAS_RETURN_SUCCESS) {
                                 goto error;
@@ -2006,26 +2546,40 @@ enum pumas_return pumas_physics_create(struct pumas_physics ** physics,
                 }
         }
 
-        /* Force generate (missing) tables */
+        /* Force generate (missing) tables, in parallel over materials. */
+        missing = allocate(nmat * sizeof(*missing));
+        if (missing == NULL) {
+                ERROR_REGISTER_MEMORY();
+                goto error;
+        }
+        int n_missing = 0;
         for (imat = 0; imat < nmat; imat++) {
                 strcpy(filename + offset_dir, p->dedx_filename[imat]);
-                data.material = imat;
 
                 if (data.overwrite) {
-                        if (physics_tabulate(p, &data, error_) !=
-                            PUMAS_RETURN_SUCCESS) goto error;
+                        missing[n_missing++] = imat;
                 } else {
                         FILE * stream = fopen(filename, "r");
                         if (stream == NULL) {
-                                if (physics_tabulate(p, &data, error_) !=
-                                    PUMAS_RETURN_SUCCESS) goto error;
+                                missing[n_missing++] = imat;
                         } else {
                                 fclose(stream);
                         }
                 }
         }
 
+        if (n_missing > 0) {
+                if (physics_tabulation_prepare(p, &data, n_missing, missing,
+                        error_) != PUMAS_RETURN_SUCCESS) goto error;
+
+                struct physics_tabulation_task task = { .data = &data,
+                        .materials = missing };
+                if (compute_parallel(p, n_missing, &physics_tabulate_task,
+                        &task, error_) != PUMAS_RETURN_SUCCESS) goto error;
+        }
+
         physics_tabulation_clear(p, &data);
+        deallocate(missing);
         deallocate(energy);
         deallocate(filename);
         pumas_physics_destroy(physics);
@@ -2040,59 +2594,21 @@ enum pumas_return pumas_physics_create(struct pumas_physics ** physics,
 
 error:
         physics_tabulation_clear(p, &data);
+        deallocate(missing);
         deallocate(energy);
         deallocate(filename);
         pumas_physics_destroy(physics);
         return ERROR_RAISE();
 }
 
-enum pumas_return pumas_physics_load(
-    struct pumas_physics ** physics_ptr, FILE * stream)
+/*
+ * Routine for relinking the shared data once copied or mapped to memory. The
+ * stored pointers are shifted by a single offset, since they all point
+ * within the data block.
+ */
+static enum pumas_return physics_relink(
+    struct pumas_physics * physics, struct error_context * error_)
 {
-        ERROR_INITIALISE(pumas_physics_load);
-
-        /* Check the physics pointer. */
-        if (physics_ptr == NULL) {
-                return ERROR_NULL_PHYSICS();
-        }
-
-        /* Check the input stream */
-        if (stream == NULL)
-                return ERROR_MESSAGE(
-                    PUMAS_RETURN_PATH_ERROR, "invalid input stream (null)");
-#if (GDB_MODE)
-        /* Save the floating points exceptions status and enable them. */
-        if (!fe_initialised) {
-                fe_status = fegetexcept();
-                feclearexcept(FE_ALL_EXCEPT);
-                feenableexcept(
-                    FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW | FE_UNDERFLOW);
-                fe_initialised = 1;
-        }
-#endif
-        /* Check the binary dump tag. */
-        struct pumas_physics * physics = NULL;
-        int tag;
-        if (fread(&tag, sizeof(tag), 1, stream) != 1) goto error;
-        if (tag != PHYSICS_BINARY_DUMP_TAG) {
-                ERROR_REGISTER(PUMAS_RETURN_FORMAT_ERROR,
-                    "incompatible version of binary dump");
-                goto error;
-        }
-
-        /* Allocate the container. */
-        int size;
-        if (fread(&size, sizeof(size), 1, stream) != 1) goto error;
-        physics = allocate(size);
-        *physics_ptr = physics;
-        if (physics == NULL) {
-                ERROR_REGISTER_MEMORY();
-                goto error;
-        }
-
-        /* Load the data and remap the addresses. */
-        if (fread(physics, size, 1, stream) != 1) goto error;
-
         void ** ptr = (void **)(&(physics->mdf_path));
         ptrdiff_t delta = (char *)(physics->data) - (char *)(*ptr);
         int i;
@@ -2128,7 +2644,7 @@ enum pumas_return pumas_physics_load(
                     physics->model_bremsstrahlung,
                     &physics->dcs_bremsstrahlung);
         } else {
-                goto error;
+                return error_->code;
         }
 
         if (dcs_check_model(PUMAS_PROCESS_PAIR_PRODUCTION,
@@ -2137,7 +2653,7 @@ enum pumas_return pumas_physics_load(
                     physics->model_pair_production,
                     &physics->dcs_pair_production);
         } else {
-                goto error;
+                return error_->code;
         }
 
         if (dcs_check_model(PUMAS_PROCESS_PHOTONUCLEAR,
@@ -2146,7 +2662,7 @@ enum pumas_return pumas_physics_load(
                     physics->model_photonuclear,
                     &physics->dcs_photonuclear);
         } else {
-                goto error;
+                return error_->code;
         }
 
         /* Erase the dE/dX filename(s) */
@@ -2155,44 +2671,184 @@ enum pumas_return pumas_physics_load(
         }
 
         return PUMAS_RETURN_SUCCESS;
-
-error:
-        deallocate(physics);
-        *physics_ptr = NULL;
-        return ERROR_RAISE();
-
-#undef N_DATA_POINTERS
 }
 
-enum pumas_return pumas_physics_dump(
-    const struct pumas_physics * physics, FILE * stream)
+enum pumas_return pumas_physics_load(
+    struct pumas_physics ** physics_ptr, FILE * stream)
 {
-        ERROR_INITIALISE(pumas_physics_dump);
+        ERROR_INITIALISE(pumas_physics_load);
 
-        /* Check if the Physics is initialised. */
-        if (physics == NULL) {
-                return ERROR_NOT_INITIALISED();
+        /* Check the physics pointer. */
+        if (physics_ptr == NULL) {
+                return ERROR_NULL_PHYSICS();
         }
 
-        /* Check the output stream */
+        /* Check the input stream */
         if (stream == NULL)
                 return ERROR_MESSAGE(
-                    PUMAS_RETURN_PATH_ERROR, "invalid output stream (null)");
+                    PUMAS_RETURN_PATH_ERROR, "invalid input stream (null)");
+#if (GDB_MODE)
+        /* Save the floating points exceptions status and enable them. */
+        if (!fe_initialised) {
+                fe_status = fegetexcept();
+                feclearexcept(FE_ALL_EXCEPT);
+                feenableexcept(
+                    FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW | FE_UNDERFLOW);
+                fe_initialised = 1;
+        }
+#endif
+        /* Check the binary dump tag. */
+        struct pumas_physics * physics = NULL;
+        int tag;
+        if (fread(&tag, sizeof(tag), 1, stream) != 1) goto error;
+        if (tag != PHYSICS_BINARY_DUMP_TAG) {
+                ERROR_REGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                    "incompatible version of binary dump");
+                goto error;
+        }
 
-        /* Dump the configuration. */
-        int tag = PHYSICS_BINARY_DUMP_TAG;
-        if (fwrite(&tag, sizeof(tag), 1, stream) != 1) goto error;
-        if (fwrite(&physics->size, sizeof(physics->size), 1, stream) != 1)
+        /* Allocate the container. */
+        int size;
+        if (fread(&size, sizeof(size), 1, stream) != 1) goto error;
+        physics = allocate(size);
+        *physics_ptr = physics;
+        if (physics == NULL) {
+                ERROR_REGISTER_MEMORY();
+                goto error;
+        }
+
+        /* Load the data and remap the addresses. */
+        if (fread(physics, size, 1, stream) != 1) goto error;
+        physics->mapped = 0;
+        if (physics_relink(physics, error_) != PUMAS_RETURN_SUCCESS)
                 goto error;
-        if (fwrite(physics, physics->size, 1, stream) != 1) goto error;
 
         return PUMAS_RETURN_SUCCESS;
 
 error:
-        return ERROR_MESSAGE(
-            PUMAS_RETURN_IO_ERROR, "could not write to dump file");
-
-#undef PHYSICS_BINARY_DUMP_TAG
+        deallocate(physics);
+        *physics_ptr = NULL;
+        return ERROR_RAISE();
+
+#undef N_DATA_POINTERS
+}
+
+enum pumas_return pumas_physics_map(
+    struct pumas_physics ** physics_ptr, const char * path)
+{
+        ERROR_INITIALISE(pumas_physics_map);
+
+        /* Check the physics pointer and the path. */
+        if (physics_ptr == NULL) {
+                return ERROR_NULL_PHYSICS();
+        }
+        *physics_ptr = NULL;
+
+        if (path == NULL)
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_PATH_ERROR, "invalid path (null)");
+#if (MMAP_MODE)
+        /* Map the dump file to memory. */
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return ERROR_FORMAT(PUMAS_RETURN_PATH_ERROR,
+                    "could not open file `%s'", path);
+        }
+
+        struct stat st;
+        if ((fstat(fd, &st) != 0) || (st.st_size < 2 * (off_t)sizeof(int))) {
+                close(fd);
+                return ERROR_FORMAT(PUMAS_RETURN_IO_ERROR,
+                    "could not read file `%s'", path);
+        }
+        const size_t length = st.st_size;
+
+        /*
+         * The mapping is private. Thus, the pages that are relinked are
+         * copied on write, and they are private to each process. These are
+         * the physics header, the tables of addresses and the descriptions of
+         * elements and materials. The bulk of the tables remains shared
+         * between processes, through the page cache.
+         */
+        char * base =
+            mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+                return ERROR_FORMAT(PUMAS_RETURN_IO_ERROR,
+                    "could not map file `%s'", path);
+        }
+
+        /* Check the binary dump tag and the size. */
+        int header[2];
+        memcpy(header, base, sizeof(header));
+        if (header[0] != PHYSICS_BINARY_DUMP_TAG) {
+                ERROR_REGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                    "incompatible version of binary dump");
+                goto error;
+        }
+        struct pumas_physics * physics =
+            (struct pumas_physics *)(base + sizeof(header));
+        if ((header[1] < (int)sizeof(*physics)) ||
+            ((size_t)header[1] + sizeof(header) > length) ||
+            (physics->size != header[1])) {
+                ERROR_VREGISTER(PUMAS_RETURN_IO_ERROR,
+                    "could not read file `%s'", path);
+                goto error;
+        }
+
+        /* Relink the shared data. */
+        physics->mapped = 1;
+        if (physics_relink(physics, error_) != PUMAS_RETURN_SUCCESS)
+                goto error;
+        *physics_ptr = physics;
+
+        return PUMAS_RETURN_SUCCESS;
+
+error:
+        munmap(base, length);
+        return ERROR_RAISE();
+#else
+        /* Fallback to a regular load. */
+        FILE * stream = fopen(path, "rb");
+        if (stream == NULL) {
+                return ERROR_FORMAT(PUMAS_RETURN_PATH_ERROR,
+                    "could not open file `%s'", path);
+        }
+        enum pumas_return rc = pumas_physics_load(physics_ptr, stream);
+        fclose(stream);
+        return rc;
+#endif
+}
+
+enum pumas_return pumas_physics_dump(
+    const struct pumas_physics * physics, FILE * stream)
+{
+        ERROR_INITIALISE(pumas_physics_dump);
+
+        /* Check if the Physics is initialised. */
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        }
+
+        /* Check the output stream */
+        if (stream == NULL)
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_PATH_ERROR, "invalid output stream (null)");
+
+        /* Dump the configuration. */
+        int tag = PHYSICS_BINARY_DUMP_TAG;
+        if (fwrite(&tag, sizeof(tag), 1, stream) != 1) goto error;
+        if (fwrite(&physics->size, sizeof(physics->size), 1, stream) != 1)
+                goto error;
+        if (fwrite(physics, physics->size, 1, stream) != 1) goto error;
+
+        return PUMAS_RETURN_SUCCESS;
+
+error:
+        return ERROR_MESSAGE(
+            PUMAS_RETURN_IO_ERROR, "could not write to dump file");
+
+#undef PHYSICS_BINARY_DUMP_TAG
 }
 
 void pumas_physics_destroy(struct pumas_physics ** physics_ptr)
@@ -2201,6 +2857,15 @@ void pumas_physics_destroy(struct pumas_physics ** physics_ptr)
 
         /* Free the shared data. */
         struct pumas_physics * physics = *physics_ptr;
+#if (MMAP_MODE)
+        if (physics->mapped) {
+                /* The data are mapped after the tag and the size. */
+                const size_t offset = 2 * sizeof(int);
+                munmap((char *)physics - offset, physics->size + offset);
+                *physics_ptr = NULL;
+                return;
+        }
+#endif
         int i;
         for (i = 0; i < physics->n_materials - physics->n_composites; i++) {
                 deallocate(physics->dedx_filename[i]);
@@ -2229,14 +2894,26 @@ const char * pumas_error_function(pumas_function_t * caller)
         TOSTRING(pumas_physics_create)
         TOSTRING(pumas_physics_dump)
         TOSTRING(pumas_physics_load)
+        TOSTRING(pumas_physics_map)
         TOSTRING(pumas_context_transport)
+        TOSTRING(pumas_context_transport_batch)
+        TOSTRING(pumas_context_run_parallel)
         TOSTRING(pumas_physics_particle)
         TOSTRING(pumas_context_create)
         TOSTRING(pumas_context_random_dump)
+        TOSTRING(pumas_context_random_event_set)
         TOSTRING(pumas_context_random_load)
         TOSTRING(pumas_context_random_seed_get)
         TOSTRING(pumas_context_random_seed_set)
+        TOSTRING(pumas_context_random_stream_set)
+        TOSTRING(pumas_context_geometry_set)
+        TOSTRING(pumas_geometry_create_layers)
+        TOSTRING(pumas_geometry_create_terrain)
+        TOSTRING(pumas_geometry_create_voxels)
         TOSTRING(pumas_recorder_create)
+        TOSTRING(pumas_recorder_create_stream)
+        TOSTRING(pumas_recorder_create_columnar)
+        TOSTRING(pumas_recorder_flush)
         TOSTRING(pumas_physics_dcs)
         TOSTRING(pumas_physics_element_name)
         TOSTRING(pumas_physics_element_index)
@@ -2258,6 +2935,10 @@ const char * pumas_error_function(pumas_function_t * caller)
         TOSTRING(pumas_physics_property_elastic_cutoff_angle)
         TOSTRING(pumas_physics_property_transport_path)
         TOSTRING(pumas_physics_property_cross_section)
+        TOSTRING(pumas_physics_property_range_v)
+        TOSTRING(pumas_physics_property_kinetic_energy_v)
+        TOSTRING(pumas_physics_property_stopping_power_v)
+        TOSTRING(pumas_physics_property_cross_section_v)
         TOSTRING(pumas_physics_table_value)
         TOSTRING(pumas_physics_table_index)
         TOSTRING(pumas_dcs_get)
@@ -2277,6 +2958,7 @@ const char * pumas_error_function(pumas_function_t * caller)
         TOSTRING(pumas_physics_destroy)
         TOSTRING(pumas_context_destroy)
         TOSTRING(pumas_context_physics_get)
+        TOSTRING(pumas_geometry_destroy)
         TOSTRING(pumas_recorder_clear)
         TOSTRING(pumas_recorder_destroy)
         TOSTRING(pumas_version)
@@ -2306,11 +2988,11 @@ pumas_handler_cb * pumas_error_handler_get(void) { return s_error.handler; }
 void pumas_error_catch(int catch)
 {
         if (catch) {
-                s_error.catch = 1;
-                s_error.catch_error.code = PUMAS_RETURN_SUCCESS;
-                s_error.catch_error.function = NULL;
+                s_error_catch.catch = 1;
+                s_error_catch.catch_error.code = PUMAS_RETURN_SUCCESS;
+                s_error_catch.catch_error.function = NULL;
         } else {
-                s_error.catch = 0;
+                s_error_catch.catch = 0;
         }
 }
 
@@ -2318,11 +3000,11 @@ enum pumas_return pumas_error_raise(void)
 {
         ERROR_INITIALISE(pumas_error_raise);
 
-        if (s_error.catch == 0)
+        if (s_error_catch.catch == 0)
                 ERROR_MESSAGE(
                     PUMAS_RETURN_RAISE_ERROR, "`raise' called without `catch'");
-        s_error.catch = 0;
-        memcpy(error_, &s_error.catch_error, sizeof(*error_));
+        s_error_catch.catch = 0;
+        memcpy(error_, &s_error_catch.catch_error, sizeof(*error_));
         return ERROR_RAISE();
 }
 
@@ -2541,18 +3223,112 @@ static double random_uniform01(struct pumas_context * context)
         return y * (1.0 / 4294967295.0);
 }
 
-/* Public library functions: simulation context management. */
-enum pumas_return pumas_context_create(struct pumas_context ** context_,
-    const struct pumas_physics * physics, int extra_memory)
+/* Update the block of the counter based PRNG, using Philox4x32-10 */
+static void random_counter_update(struct random_counter_data * data)
 {
-        ERROR_INITIALISE(pumas_context_create);
-        *context_ = NULL;
+        const unsigned long long M0 = 0xD2511F53ULL;
+        const unsigned long long M1 = 0xCD9E8D57ULL;
+        const unsigned long W0 = 0x9E3779B9UL;
+        const unsigned long W1 = 0xBB67AE85UL;
 
-        /* Check the Physics initialisation. */
-        if (physics == NULL) {
-                return ERROR_NOT_INITIALISED();
+        unsigned long c[4] = { data->counter[0], data->counter[1],
+                data->counter[2], data->counter[3] };
+        unsigned long k[2] = { data->key[0], data->key[1] };
+        int i;
+        for (i = 0; i < 10; i++) {
+                const unsigned long long p0 = M0 * c[0];
+                const unsigned long long p1 = M1 * c[2];
+                const unsigned long hi0 = (unsigned long)(p0 >> 32);
+                const unsigned long lo0 = (unsigned long)(p0 & 0xffffffffUL);
+                const unsigned long hi1 = (unsigned long)(p1 >> 32);
+                const unsigned long lo1 = (unsigned long)(p1 & 0xffffffffUL);
+                c[0] = hi1 ^ c[1] ^ k[0];
+                c[1] = lo1;
+                c[2] = hi0 ^ c[3] ^ k[1];
+                c[3] = lo0;
+                k[0] = (k[0] + W0) & 0xffffffffUL;
+                k[1] = (k[1] + W1) & 0xffffffffUL;
+        }
+        memcpy(data->buffer, c, sizeof(c));
+        data->index = 0;
+
+        /* Increment the block index */
+        data->counter[0] = (data->counter[0] + 1) & 0xffffffffUL;
+        if (data->counter[0] == 0)
+                data->counter[1] = (data->counter[1] + 1) & 0xffffffffUL;
+}
+
+/* Set the event index of the counter based PRNG */
+static void random_counter_event(
+    struct simulation_context * context, unsigned long event)
+{
+        /* Reset the counter such that the random stream only depends on the
+         * event index.
+         */
+        struct random_counter_data * data = &context->random_counter;
+        data->counter[0] = data->counter[1] = 0;
+        data->counter[2] = event & 0xffffffffUL;
+        data->counter[3] = (unsigned long)(
+            ((unsigned long long)event >> 32) & 0xffffffffUL);
+        data->index = 4;
+}
+
+/* Uniform pseudo random distribution from a counter based generator */
+static double random_uniform01_counter(struct pumas_context * context)
+{
+        struct simulation_context * context_ = (void *)context;
+        struct random_counter_data * data = &context_->random_counter;
+        if (data->index >= 4) random_counter_update(data);
+
+        /* Convert to a floating point and return */
+        return data->buffer[data->index++] * (1.0 / 4294967295.0);
+}
+
+enum pumas_return pumas_context_random_stream_set(
+    struct pumas_context * context, unsigned long seed, unsigned long stream)
+{
+        ERROR_INITIALISE(pumas_context_random_stream_set);
+
+        if (context == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no context (null)");
+        }
+
+        struct simulation_context * context_ = (void *)context;
+        struct random_counter_data * data = &context_->random_counter;
+        data->key[0] = seed & 0xffffffffUL;
+        data->key[1] = stream & 0xffffffffUL;
+        random_counter_event(context_, 0);
+        context->random = &random_uniform01_counter;
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_context_random_event_set(
+    struct pumas_context * context, unsigned long event)
+{
+        ERROR_INITIALISE(pumas_context_random_event_set);
+
+        if (context == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no context (null)");
+        } else if (context->random != &random_uniform01_counter) {
+                return ERROR_MESSAGE(PUMAS_RETURN_MISSING_RANDOM,
+                    "the counter based random engine is not selected");
         }
 
+        struct simulation_context * context_ = (void *)context;
+        random_counter_event(context_, event);
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+/* Public library functions: simulation context management. */
+/* Create a simulation context, for initialised physics */
+static enum pumas_return context_create(struct pumas_context ** context_,
+    const struct pumas_physics * physics, int extra_memory,
+    struct error_context * error_)
+{
         /* Allocate the new context. */
         struct simulation_context * context;
         const int pad_size = sizeof(*(context->data));
@@ -2565,10 +3341,7 @@ enum pumas_return pumas_context_create(struct pumas_context ** context_,
         else
                 extra_memory = memory_padded_size(extra_memory, pad_size);
         context = allocate(sizeof(*context) + work_size + extra_memory);
-        if (context == NULL) {
-                ERROR_REGISTER_MEMORY();
-                return ERROR_RAISE();
-        }
+        if (context == NULL) return ERROR_REGISTER_MEMORY();
 
         /* Set the default configuration. */
         *context_ = (struct pumas_context *)context;
@@ -2584,7 +3357,10 @@ enum pumas_return pumas_context_create(struct pumas_context ** context_,
         context->index_X_last[0] = context->index_X_last[1] = imax;
 
         context->random_data = NULL;
+        memset(&context->random_counter, 0x0, sizeof(context->random_counter));
+        context->random_counter.index = 4;
         (*context_)->random = &random_uniform01;
+        context->geometry = NULL;
 
         (*context_)->medium = NULL;
         (*context_)->recorder = NULL;
@@ -2604,16 +3380,29 @@ enum pumas_return pumas_context_create(struct pumas_context ** context_,
 
         (*context_)->accuracy = DEFAULT_ACCURACY;
 
-        /* Initialise the Gaussian transform of the random stream. */
-        context->randn_done = 0;
-        context->randn_next = 0.;
-
         /* Initialise the work space. */
         context->workspace = (struct coulomb_workspace *)context->data;
 
         return PUMAS_RETURN_SUCCESS;
 }
 
+enum pumas_return pumas_context_create(struct pumas_context ** context_,
+    const struct pumas_physics * physics, int extra_memory)
+{
+        ERROR_INITIALISE(pumas_context_create);
+        *context_ = NULL;
+
+        /* Check the Physics initialisation. */
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        }
+
+        if (context_create(context_, physics, extra_memory, error_) !=
+            PUMAS_RETURN_SUCCESS)
+                return ERROR_RAISE();
+        return PUMAS_RETURN_SUCCESS;
+}
+
 void pumas_context_destroy(struct pumas_context ** context)
 {
         /* Check that the context hasn't already been destroyed */
@@ -2626,6 +3415,38 @@ void pumas_context_destroy(struct pumas_context ** context)
         *context = NULL;
 }
 
+enum pumas_return pumas_context_geometry_set(
+    struct pumas_context * context, struct pumas_geometry * geometry)
+{
+        ERROR_INITIALISE(pumas_context_geometry_set);
+
+        if (context == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no context (null)");
+        }
+
+        struct simulation_context * context_ = (void *)context;
+        if (geometry == NULL) {
+                context_->geometry = NULL;
+                context->medium = NULL;
+                return PUMAS_RETURN_SUCCESS;
+        }
+
+        /* Check the material indices. */
+        const struct pumas_physics * const physics = context_->physics;
+        int i;
+        for (i = 0; i < geometry->n_media; i++) {
+                const int material = geometry->media[i].api.material;
+                if (material >= physics->n_materials)
+                        return ERROR_INVALID_MATERIAL(material);
+        }
+
+        context_->geometry = geometry;
+        context->medium = geometry->medium;
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
 const struct pumas_physics * pumas_context_physics_get(
     const struct pumas_context * context)
 {
@@ -2801,25 +3622,102 @@ enum pumas_return pumas_recorder_create(
         *recorder_ = NULL;
 
         /*  Allocate memory for the new recorder. */
-        struct frame_recorder * recorder = NULL;
-        if (extra_memory < 0) extra_memory = 0;
-        recorder = allocate(sizeof(*recorder) + extra_memory);
+        struct frame_recorder * recorder = recorder_allocate(extra_memory);
         if (recorder == NULL) {
                 ERROR_REGISTER_MEMORY();
                 return ERROR_RAISE();
         }
+        *recorder_ = (struct pumas_recorder *)recorder;
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_recorder_create_stream(
+    struct pumas_recorder ** recorder_, int extra_memory, int capacity,
+    FILE * stream, pumas_stream_cb * consumer)
+{
+        ERROR_INITIALISE(pumas_recorder_create_stream);
+        *recorder_ = NULL;
+
+        /* Check the arguments. */
+        if (capacity <= 0) {
+                return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                    "bad capacity (expected a strictly positive value, got "
+                    "%d)",
+                    capacity);
+        }
+        if ((stream == NULL) && (consumer == NULL)) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no output stream or consumer");
+        }
+
+        /* Create the streaming recorder. */
+        struct frame_recorder * recorder;
+        if (stream_create(&recorder, extra_memory, capacity, stream, consumer,
+                NULL, error_) != PUMAS_RETURN_SUCCESS)
+                return ERROR_RAISE();
+        *recorder_ = (struct pumas_recorder *)recorder;
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_recorder_create_columnar(
+    struct pumas_recorder ** recorder_, int extra_memory, int capacity,
+    int block_size, FILE * stream, int encoding)
+{
+        ERROR_INITIALISE(pumas_recorder_create_columnar);
+        *recorder_ = NULL;
+
+        /* Check the arguments. */
+        if (capacity <= 0) {
+                return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                    "bad capacity (expected a strictly positive value, got "
+                    "%d)",
+                    capacity);
+        }
+        if (block_size <= 0) {
+                return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                    "bad block size (expected a strictly positive value, got "
+                    "%d)",
+                    block_size);
+        }
+        if (stream == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no output stream");
+        }
 
-        /* Configure the context in order to use the new recorder. */
+        /* Create the streaming recorder, with a columns writer. */
+        struct column_writer * columns =
+            columns_allocate(block_size, encoding);
+        if (columns == NULL) {
+                ERROR_REGISTER_MEMORY();
+                return ERROR_RAISE();
+        }
+        struct frame_recorder * recorder;
+        if (stream_create(&recorder, extra_memory, capacity, stream, NULL,
+                columns, error_) != PUMAS_RETURN_SUCCESS)
+                return ERROR_RAISE();
         *recorder_ = (struct pumas_recorder *)recorder;
 
-        /* configure the new recorder and return it. */
-        (*recorder_)->period = 1;
-        (*recorder_)->record = NULL;
-        (*recorder_)->length = 0;
-        (*recorder_)->first = NULL;
-        (*recorder_)->user_data = (extra_memory > 0) ? recorder->data : NULL;
-        recorder->last = NULL;
-        recorder->stack = NULL;
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_recorder_flush(struct pumas_recorder * recorder)
+{
+        ERROR_INITIALISE(pumas_recorder_flush);
+        if (recorder == NULL) return PUMAS_RETURN_SUCCESS;
+
+        struct frame_recorder * const rec =
+            (struct frame_recorder * const)recorder;
+        struct frame_stream * const stream = rec->stream;
+        if (stream == NULL) return PUMAS_RETURN_SUCCESS;
+
+        stream_flush(stream);
+        if (stream->io_error) {
+                stream->io_error = 0;
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_IO_ERROR, "could not write to stream");
+        }
 
         return PUMAS_RETURN_SUCCESS;
 }
@@ -2828,6 +3726,9 @@ void pumas_recorder_destroy(struct pumas_recorder ** recorder)
 {
         if ((recorder == NULL) || (*recorder == NULL)) return;
         pumas_recorder_clear(*recorder);
+        struct frame_recorder * const rec =
+            (struct frame_recorder * const)(*recorder);
+        stream_destroy(rec->stream);
         deallocate(*recorder);
         *recorder = NULL;
 }
@@ -2838,6 +3739,10 @@ void pumas_recorder_clear(struct pumas_recorder * recorder)
 
         struct frame_recorder * const rec =
             (struct frame_recorder * const)recorder;
+        if (rec->stream != NULL) {
+                stream_flush(rec->stream);
+                rec->stream->track = -1;
+        }
         struct frame_stack * current = rec->stack;
         while (current != NULL) {
                 struct frame_stack * next = current->next;
@@ -2850,39 +3755,486 @@ void pumas_recorder_clear(struct pumas_recorder * recorder)
         recorder->length = 0;
 }
 
-/* Public library functions: properties accessors. */
-enum pumas_return pumas_physics_property_range(
-    const struct pumas_physics * physics, enum pumas_mode scheme,
-    int material, double kinetic, double * grammage)
+/* Public library functions: built-in geometries. */
+enum pumas_return pumas_geometry_create_voxels(
+    struct pumas_geometry ** geometry_, const double origin[3],
+    const double spacing[3], const int shape[3], const int * material,
+    const double * density)
 {
-        ERROR_INITIALISE(pumas_physics_property_range);
-        *grammage = 0.;
+        ERROR_INITIALISE(pumas_geometry_create_voxels);
+        *geometry_ = NULL;
 
-        if (physics == NULL) {
-                return ERROR_NOT_INITIALISED();
-        } else if ((scheme <= PUMAS_MODE_DISABLED) ||
-            (scheme >= PUMAS_MODE_STRAGGLED)) {
-                return ERROR_INVALID_SCHEME(scheme);
-        } else if ((material < 0) || (material >= physics->n_materials)) {
-                return ERROR_INVALID_MATERIAL(material);
+        /* Check the arguments. */
+        int i;
+        double size = 1.;
+        for (i = 0; i < 3; i++) {
+                if (shape[i] <= 0) {
+                        return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                            "bad shape (expected a strictly positive value, "
+                            "got %d)",
+                            shape[i]);
+                }
+                if (!(spacing[i] > 0.)) {
+                        return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                            "bad spacing (expected a strictly positive value, "
+                            "got %g)",
+                            spacing[i]);
+                }
+                size *= shape[i];
+        }
+        if (size > INT_MAX) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "too many cells");
+        }
+        if (material == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no material (null)");
+        }
+        const int n = (int)size;
+        for (i = 0; i < n; i++) {
+                if (material[i] < 0) return ERROR_INVALID_MATERIAL(material[i]);
+                if ((density != NULL) && !(density[i] > 0.)) {
+                        return ERROR_FORMAT(PUMAS_RETURN_DENSITY_ERROR,
+                            "bad density for cell [%d] (%g)", i, density[i]);
+                }
         }
 
-        *grammage = cel_grammage(physics, NULL, scheme, material, kinetic);
+        /* Sort the cells by properties. */
+        struct voxel_sort * sorted = allocate(n * sizeof(*sorted));
+        if (sorted == NULL) {
+                ERROR_REGISTER_MEMORY();
+                return ERROR_RAISE();
+        }
+        for (i = 0; i < n; i++) {
+                sorted[i].material = material[i];
+                sorted[i].cell = i;
+                sorted[i].density = (density == NULL) ? 0. : density[i];
+        }
+        qsort(sorted, n, sizeof(*sorted), &voxels_compare);
+        int n_media = 1;
+        for (i = 1; i < n; i++) {
+                if (voxels_compare(sorted + i - 1, sorted + i) != 0)
+                        n_media++;
+        }
+
+        /* Allocate the geometry and map the cells to unique media. */
+        struct voxel_geometry * geometry = allocate(sizeof(*geometry) +
+            n_media * sizeof(*geometry->data) + n * sizeof(*geometry->cells));
+        if (geometry == NULL) {
+                deallocate(sorted);
+                ERROR_REGISTER_MEMORY();
+                return ERROR_RAISE();
+        }
+        geometry->base.medium = &voxels_medium;
+        geometry->base.n_media = n_media;
+        geometry->base.media = geometry->data;
+        geometry->cells = (int *)(geometry->data + n_media);
+        memcpy(geometry->origin, origin, sizeof(geometry->origin));
+        memcpy(geometry->spacing, spacing, sizeof(geometry->spacing));
+        memcpy(geometry->shape, shape, sizeof(geometry->shape));
+
+        int j = -1;
+        for (i = 0; i < n; i++) {
+                if ((i == 0) || (voxels_compare(sorted + i - 1, sorted + i)
+                                    != 0)) {
+                        struct geometry_medium * medium = geometry->data + ++j;
+                        medium->api.material = sorted[i].material;
+                        medium->api.locals =
+                            (density == NULL) ? NULL : &geometry_locals;
+                        memset(&medium->law, 0x0, sizeof(medium->law));
+                        medium->law.model = PUMAS_DENSITY_UNIFORM;
+                        medium->law.coefficients[0] = sorted[i].density;
+                        medium->radial = 0;
+                        medium->scale = 0.;
+                }
+                geometry->cells[sorted[i].cell] = j;
+        }
+        deallocate(sorted);
+        *geometry_ = &geometry->base;
+
         return PUMAS_RETURN_SUCCESS;
 }
 
-enum pumas_return pumas_physics_property_proper_time(
-    const struct pumas_physics * physics, enum pumas_mode scheme,
-    int material, double kinetic, double * time)
+enum pumas_return pumas_geometry_create_layers(
+    struct pumas_geometry ** geometry_, enum pumas_layer_shape shape,
+    double bottom, int n_layers, const struct pumas_layer * layers)
 {
-        ERROR_INITIALISE(pumas_physics_property_proper_time);
-        *time = 0.;
+        ERROR_INITIALISE(pumas_geometry_create_layers);
+        *geometry_ = NULL;
 
-        if (physics == NULL) {
-                return ERROR_NOT_INITIALISED();
-        } else if ((scheme <= PUMAS_MODE_DISABLED) ||
-            (scheme >= PUMAS_MODE_STRAGGLED)) {
-                return ERROR_INVALID_SCHEME(scheme);
+        /* Check the arguments. */
+        if ((shape != PUMAS_LAYER_PLANAR) && (shape != PUMAS_LAYER_SPHERICAL)) {
+                return ERROR_FORMAT(
+                    PUMAS_RETURN_INDEX_ERROR, "invalid shape [%d]", shape);
+        }
+        if (n_layers <= 0) {
+                return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                    "bad number of layers (expected a strictly positive "
+                    "value, got %d)",
+                    n_layers);
+        }
+        if (layers == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no layers (null)");
+        }
+        if ((shape == PUMAS_LAYER_SPHERICAL) && (bottom < 0.)) {
+                return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                    "bad bottom radius (expected a positive value, got %g)",
+                    bottom);
+        }
+        int i;
+        for (i = 0; i < n_layers; i++) {
+                const struct pumas_layer * const layer = layers + i;
+                const double h0 = (i == 0) ? bottom : layers[i - 1].top;
+                if (layer->material < 0)
+                        return ERROR_INVALID_MATERIAL(layer->material);
+                if (!(layer->top > h0)) {
+                        return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                            "bad top for layer [%d] (expected a value "
+                            "larger than %g, got %g)",
+                            i, h0, layer->top);
+                }
+
+                const struct pumas_density_law * const law = &layer->density;
+                if ((law->model < PUMAS_DENSITY_UNIFORM) ||
+                    (law->model > PUMAS_DENSITY_POLYNOMIAL)) {
+                        return ERROR_FORMAT(PUMAS_RETURN_INDEX_ERROR,
+                            "invalid density model [%d]", law->model);
+                }
+                if ((law->model == PUMAS_DENSITY_EXPONENTIAL) &&
+                    !(fabs(law->length) > 0.)) {
+                        return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                            "bad length for layer [%d] (expected a non null "
+                            "value, got %g)",
+                            i, law->length);
+                }
+                if ((law->model != PUMAS_DENSITY_UNIFORM) &&
+                    !density_law_check(law, h0, layer->top)) {
+                        return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                            "bad density law for layer [%d] (expected "
+                            "strictly positive values)",
+                            i);
+                }
+        }
+
+        /* Allocate and configure the geometry. */
+        struct layer_geometry * geometry = allocate(sizeof(*geometry) +
+            n_layers * sizeof(*geometry->data) +
+            (n_layers + 1) * sizeof(*geometry->boundaries));
+        if (geometry == NULL) {
+                ERROR_REGISTER_MEMORY();
+                return ERROR_RAISE();
+        }
+        geometry->base.medium = &layers_medium;
+        geometry->base.n_media = n_layers;
+        geometry->base.media = geometry->data;
+        geometry->spherical = (shape == PUMAS_LAYER_SPHERICAL);
+        geometry->n_layers = n_layers;
+        geometry->boundaries = (double *)(geometry->data + n_layers);
+        geometry->boundaries[0] = bottom;
+        for (i = 0; i < n_layers; i++) {
+                const struct pumas_layer * const layer = layers + i;
+                struct geometry_medium * const medium = geometry->data + i;
+                medium->api.material = layer->material;
+                memcpy(&medium->law, &layer->density, sizeof(medium->law));
+                medium->radial = geometry->spherical;
+                medium->scale = layer->top - geometry->boundaries[i];
+                if ((medium->law.model == PUMAS_DENSITY_EXPONENTIAL) &&
+                    (fabs(medium->law.length) < medium->scale))
+                        medium->scale = fabs(medium->law.length);
+                medium->api.locals =
+                    ((medium->law.model == PUMAS_DENSITY_UNIFORM) &&
+                        (medium->law.coefficients[0] <= 0.)) ?
+                    NULL :
+                    &geometry_locals;
+                geometry->boundaries[i + 1] = layer->top;
+        }
+        *geometry_ = &geometry->base;
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_geometry_create_terrain(
+    struct pumas_geometry ** geometry_, const char * path, double bottom,
+    double top, const int material[2], const double * density)
+{
+        ERROR_INITIALISE(pumas_geometry_create_terrain);
+        *geometry_ = NULL;
+
+        /* Check the arguments. */
+        if (path == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_PATH_ERROR, "invalid path (null)");
+        }
+        if (material == NULL) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no material (null)");
+        }
+        if (material[0] < 0) return ERROR_INVALID_MATERIAL(material[0]);
+        const int n_media = (material[1] < 0) ? 1 : 2;
+        int i;
+        if (density != NULL) {
+                for (i = 0; i < n_media; i++) {
+                        if (!(density[i] > 0.)) {
+                                return ERROR_FORMAT(PUMAS_RETURN_DENSITY_ERROR,
+                                    "bad density for medium [%d] (%g)", i,
+                                    density[i]);
+                        }
+                }
+        }
+
+        /* Parse the header of the raster. */
+        FILE * stream = fopen(path, "r");
+        if (stream == NULL) {
+                return ERROR_FORMAT(PUMAS_RETURN_PATH_ERROR,
+                    "could not open file `%s'", path);
+        }
+        struct terrain_geometry * geometry = NULL;
+        int shape[2] = { 0, 0 }, has_nodata = 0;
+        int centred[2] = { 0, 0 }, has_corner[2] = { 0, 0 };
+        double corner[2] = { 0., 0. };
+        double cellsize = 0., nodata = 0.;
+        char token[64];
+        for (;;) {
+                if (fscanf(stream, "%63s", token) != 1) {
+                        ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                            "unexpected end of file `%s'", path);
+                        goto error;
+                }
+                if (!isalpha((unsigned char)token[0])) break;
+                char * c;
+                for (c = token; *c != 0x0; c++)
+                        *c = tolower((unsigned char)*c);
+                double value;
+                if (fscanf(stream, "%lf", &value) != 1) {
+                        ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                            "bad value for `%s' in file `%s'", token, path);
+                        goto error;
+                }
+                if ((strcmp(token, "ncols") == 0) ||
+                    (strcmp(token, "nrows") == 0)) {
+                        if (!(value >= 2.) || !(value <= INT_MAX) ||
+                            (value != floor(value))) {
+                                ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                                    "bad value for `%s' in file `%s'", token,
+                                    path);
+                                goto error;
+                        }
+                        shape[(strcmp(token, "ncols") == 0) ? 0 : 1] =
+                            (int)value;
+                } else if (strcmp(token, "xllcorner") == 0) {
+                        corner[0] = value;
+                        centred[0] = 0;
+                        has_corner[0] = 1;
+                } else if (strcmp(token, "xllcenter") == 0) {
+                        corner[0] = value;
+                        centred[0] = 1;
+                        has_corner[0] = 1;
+                } else if (strcmp(token, "yllcorner") == 0) {
+                        corner[1] = value;
+                        centred[1] = 0;
+                        has_corner[1] = 1;
+                } else if (strcmp(token, "yllcenter") == 0) {
+                        corner[1] = value;
+                        centred[1] = 1;
+                        has_corner[1] = 1;
+                } else if (strcmp(token, "cellsize") == 0) {
+                        cellsize = value;
+                } else if (strcmp(token, "nodata_value") == 0) {
+                        nodata = value;
+                        has_nodata = 1;
+                } else {
+                        ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                            "unknown key `%s' in file `%s'", token, path);
+                        goto error;
+                }
+        }
+        if ((shape[0] < 2) || (shape[1] < 2) || !has_corner[0] ||
+            !has_corner[1] || ((double)shape[0] * shape[1] > INT_MAX / 4) ||
+            !(cellsize > 0.)) {
+                ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                    "bad header in file `%s'", path);
+                goto error;
+        }
+
+        /* Compute the size of the quadtree. */
+        int n_levels = 0, n_tree = 0, nx = shape[0] - 1, ny = shape[1] - 1;
+        for (;;) {
+                n_tree += nx * ny;
+                n_levels++;
+                if ((nx == 1) && (ny == 1)) break;
+                nx = (nx + 1) / 2;
+                ny = (ny + 1) / 2;
+        }
+
+        /* Allocate the geometry. */
+        const int n_nodes = shape[0] * shape[1];
+        geometry = allocate(sizeof(*geometry) +
+            2 * sizeof(*geometry->data) +
+            (n_nodes + 2 * n_tree) * sizeof(*geometry->heights));
+        if (geometry == NULL) {
+                ERROR_REGISTER_MEMORY();
+                goto error;
+        }
+        geometry->heights = (double *)(geometry->data + 2);
+        geometry->bounds = geometry->heights + n_nodes;
+
+        /* Read the elevation values, from north to south. */
+        for (i = 0; i < n_nodes; i++) {
+                double value;
+                if (i == 0) {
+                        char * end;
+                        value = strtod(token, &end);
+                        if (*end != 0x0) goto format_error;
+                } else if (fscanf(stream, "%lf", &value) != 1) {
+                        goto format_error;
+                }
+                if (has_nodata && (value == nodata)) {
+                        ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
+                            "missing elevation value in file `%s'", path);
+                        goto error;
+                }
+                if (!(value > bottom) || !(value < top)) {
+                        ERROR_VREGISTER(PUMAS_RETURN_VALUE_ERROR,
+                            "bad elevation value (expected a value in "
+                            "]%g, %g[, got %g)",
+                            bottom, top, value);
+                        goto error;
+                }
+                const int row = shape[1] - 1 - i / shape[0];
+                geometry->heights[i % shape[0] + row * shape[0]] = value;
+        }
+        fclose(stream);
+        stream = NULL;
+
+        /* Build the min/max quadtree, from the cells up to the root. */
+        double * bounds = geometry->bounds;
+        nx = shape[0] - 1;
+        ny = shape[1] - 1;
+        int j, level;
+        for (j = 0; j < ny; j++) {
+                for (i = 0; i < nx; i++) {
+                        const double * const h =
+                            geometry->heights + i + j * shape[0];
+                        double hmin = h[0], hmax = h[0];
+                        const double hi[3] = { h[1], h[shape[0]],
+                                h[shape[0] + 1] };
+                        int k;
+                        for (k = 0; k < 3; k++) {
+                                if (hi[k] < hmin) hmin = hi[k];
+                                if (hi[k] > hmax) hmax = hi[k];
+                        }
+                        bounds[2 * (i + j * nx)] = hmin;
+                        bounds[2 * (i + j * nx) + 1] = hmax;
+                }
+        }
+        geometry->offsets[0] = 0;
+        for (level = 1; level < n_levels; level++) {
+                const double * const children =
+                    geometry->bounds + 2 * geometry->offsets[level - 1];
+                geometry->offsets[level] = geometry->offsets[level - 1] +
+                    nx * ny;
+                bounds = geometry->bounds + 2 * geometry->offsets[level];
+                const int mx = (nx + 1) / 2, my = (ny + 1) / 2;
+                for (j = 0; j < my; j++) {
+                        for (i = 0; i < mx; i++) {
+                                double hmin = DBL_MAX, hmax = -DBL_MAX;
+                                int k;
+                                for (k = 0; k < 4; k++) {
+                                        const int ic = 2 * i + k % 2;
+                                        const int jc = 2 * j + k / 2;
+                                        if ((ic >= nx) || (jc >= ny)) continue;
+                                        const double * const b =
+                                            children + 2 * (ic + jc * nx);
+                                        if (b[0] < hmin) hmin = b[0];
+                                        if (b[1] > hmax) hmax = b[1];
+                                }
+                                bounds[2 * (i + j * mx)] = hmin;
+                                bounds[2 * (i + j * mx) + 1] = hmax;
+                        }
+                }
+                nx = mx;
+                ny = my;
+        }
+
+        /* Configure the geometry and its media. */
+        geometry->base.medium = &terrain_medium;
+        geometry->base.n_media = n_media;
+        geometry->base.media = geometry->data;
+        for (i = 0; i < 2; i++) {
+                geometry->origin[i] =
+                    centred[i] ? corner[i] : corner[i] + 0.5 * cellsize;
+        }
+        geometry->spacing = cellsize;
+        memcpy(geometry->shape, shape, sizeof(geometry->shape));
+        geometry->bottom = bottom;
+        geometry->top = top;
+        geometry->n_levels = n_levels;
+        for (i = 0; i < n_media; i++) {
+                struct geometry_medium * const medium = geometry->data + i;
+                medium->api.material = material[i];
+                medium->api.locals =
+                    (density == NULL) ? NULL : &geometry_locals;
+                memset(&medium->law, 0x0, sizeof(medium->law));
+                medium->law.model = PUMAS_DENSITY_UNIFORM;
+                medium->law.coefficients[0] =
+                    (density == NULL) ? 0. : density[i];
+                medium->radial = 0;
+                medium->scale = 0.;
+        }
+        *geometry_ = &geometry->base;
+
+        return PUMAS_RETURN_SUCCESS;
+
+format_error:
+        ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
+            "bad elevation value in file `%s'", path);
+error:
+        if (stream != NULL) fclose(stream);
+        deallocate(geometry);
+        return ERROR_RAISE();
+}
+
+void pumas_geometry_destroy(struct pumas_geometry ** geometry)
+{
+        if ((geometry == NULL) || (*geometry == NULL)) return;
+        deallocate(*geometry);
+        *geometry = NULL;
+}
+
+/* Public library functions: properties accessors. */
+enum pumas_return pumas_physics_property_range(
+    const struct pumas_physics * physics, enum pumas_mode scheme,
+    int material, double kinetic, double * grammage)
+{
+        ERROR_INITIALISE(pumas_physics_property_range);
+        *grammage = 0.;
+
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        } else if ((scheme <= PUMAS_MODE_DISABLED) ||
+            (scheme >= PUMAS_MODE_STRAGGLED)) {
+                return ERROR_INVALID_SCHEME(scheme);
+        } else if ((material < 0) || (material >= physics->n_materials)) {
+                return ERROR_INVALID_MATERIAL(material);
+        }
+
+        *grammage = cel_grammage(physics, NULL, scheme, material, kinetic);
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_physics_property_proper_time(
+    const struct pumas_physics * physics, enum pumas_mode scheme,
+    int material, double kinetic, double * time)
+{
+        ERROR_INITIALISE(pumas_physics_property_proper_time);
+        *time = 0.;
+
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        } else if ((scheme <= PUMAS_MODE_DISABLED) ||
+            (scheme >= PUMAS_MODE_STRAGGLED)) {
+                return ERROR_INVALID_SCHEME(scheme);
         } else if ((material < 0) || (material >= physics->n_materials)) {
                 return ERROR_INVALID_MATERIAL(material);
         }
@@ -3110,6 +4462,154 @@ enum pumas_return pumas_physics_property_cross_section(
         return PUMAS_RETURN_SUCCESS;
 }
 
+enum pumas_return pumas_physics_property_range_v(
+    const struct pumas_physics * physics, enum pumas_mode scheme,
+    int material, int n, const double * kinetic, double * grammage)
+{
+        ERROR_INITIALISE(pumas_physics_property_range_v);
+
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        } else if ((scheme <= PUMAS_MODE_DISABLED) ||
+            (scheme >= PUMAS_MODE_STRAGGLED)) {
+                return ERROR_INVALID_SCHEME(scheme);
+        } else if ((material < 0) || (material >= physics->n_materials)) {
+                return ERROR_INVALID_MATERIAL(material);
+        } else if ((n < 0) ||
+            ((n > 0) && ((kinetic == NULL) || (grammage == NULL)))) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "invalid array(s)");
+        }
+
+        /* Interpolate the tabulated values. */
+        table_interpolate_pchip_v(physics, table_get_K(physics, 0),
+            table_get_X(physics, scheme, material, 0),
+            table_get_X_dK(physics, scheme, material, 0), n, kinetic,
+            grammage);
+
+        /* Process the out of table values. */
+        const double kmin = *table_get_K(physics, 0);
+        const double kmax = *table_get_K(physics, physics->n_energies - 1);
+        int i;
+        for (i = 0; i < n; i++) {
+                if (!((kinetic[i] >= kmin) && (kinetic[i] < kmax)))
+                        grammage[i] = cel_grammage(
+                            physics, NULL, scheme, material, kinetic[i]);
+        }
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_physics_property_kinetic_energy_v(
+    const struct pumas_physics * physics, enum pumas_mode scheme,
+    int material, int n, const double * grammage, double * kinetic)
+{
+        ERROR_INITIALISE(pumas_physics_property_kinetic_energy_v);
+
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        } else if ((scheme <= PUMAS_MODE_DISABLED) ||
+            (scheme >= PUMAS_MODE_STRAGGLED)) {
+                return ERROR_INVALID_SCHEME(scheme);
+        } else if ((material < 0) || (material >= physics->n_materials)) {
+                return ERROR_INVALID_MATERIAL(material);
+        } else if ((n < 0) ||
+            ((n > 0) && ((grammage == NULL) || (kinetic == NULL)))) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "invalid array(s)");
+        }
+
+        /* Interpolate the tabulated values. */
+        const double * const X = table_get_X(physics, scheme, material, 0);
+        table_interpolate_pchip_v(physics, X, table_get_K(physics, 0),
+            table_get_K_dX(physics, scheme, material, 0), n, grammage,
+            kinetic);
+
+        /* Process the out of table values. */
+        const double xmin = X[0];
+        const double xmax = X[physics->n_energies - 1];
+        int i;
+        for (i = 0; i < n; i++) {
+                if (!((grammage[i] >= xmin) && (grammage[i] < xmax)))
+                        kinetic[i] = cel_kinetic_energy(
+                            physics, NULL, scheme, material, grammage[i]);
+        }
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_physics_property_stopping_power_v(
+    const struct pumas_physics * physics, enum pumas_mode scheme,
+    int material, int n, const double * kinetic, double * dedx)
+{
+        ERROR_INITIALISE(pumas_physics_property_stopping_power_v);
+
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        } else if ((scheme <= PUMAS_MODE_DISABLED) ||
+            (scheme >= PUMAS_MODE_STRAGGLED)) {
+                return ERROR_INVALID_SCHEME(scheme);
+        } else if ((material < 0) || (material >= physics->n_materials)) {
+                return ERROR_INVALID_MATERIAL(material);
+        } else if ((n < 0) ||
+            ((n > 0) && ((kinetic == NULL) || (dedx == NULL)))) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "invalid array(s)");
+        }
+
+        /* Interpolate the tabulated values. */
+        table_interpolate_pchip_v(physics, table_get_K(physics, 0),
+            table_get_dE(physics, scheme, material, 0),
+            table_get_dE_dK(physics, scheme, material, 0), n, kinetic,
+            dedx);
+
+        /* Process the out of table values. */
+        const double kmin = *table_get_K(physics, 0);
+        const double kmax = *table_get_K(physics, physics->n_energies - 1);
+        int i;
+        for (i = 0; i < n; i++) {
+                if (!((kinetic[i] >= kmin) && (kinetic[i] < kmax)))
+                        dedx[i] = cel_energy_loss(
+                            physics, NULL, scheme, material, kinetic[i]);
+        }
+        return PUMAS_RETURN_SUCCESS;
+}
+
+enum pumas_return pumas_physics_property_cross_section_v(
+    const struct pumas_physics * physics, int material, int n,
+    const double * kinetic, double * cross_section)
+{
+        ERROR_INITIALISE(pumas_physics_property_cross_section_v);
+
+        if (physics == NULL) {
+                return ERROR_NOT_INITIALISED();
+        } else if ((material < 0) || (material >= physics->n_materials)) {
+                return ERROR_INVALID_MATERIAL(material);
+        } else if ((n < 0) ||
+            ((n > 0) && ((kinetic == NULL) || (cross_section == NULL)))) {
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "invalid array(s)");
+        }
+
+        /* Interpolate the tabulated values. */
+        table_interpolate_pchip_v(physics, table_get_K(physics, 0),
+            table_get_CS(physics, material, 0),
+            table_get_CS_dK(physics, material, 0), n, kinetic,
+            cross_section);
+
+        /* Process the threshold and the out of table values. */
+        const double kt = *table_get_Kt(physics, material);
+        const double kmin = *table_get_K(physics, 0);
+        const double kmax = *table_get_K(physics, physics->n_energies - 1);
+        int i;
+        for (i = 0; i < n; i++) {
+                if (kinetic[i] < kt)
+                        cross_section[i] = 0.;
+                else if (!((kinetic[i] >= kmin) && (kinetic[i] < kmax)))
+                        cross_section[i] = del_cross_section(
+                            physics, NULL, material, kinetic[i]);
+        }
+        return PUMAS_RETURN_SUCCESS;
+}
+
 /* Public library function: the main transport routine. */
 enum pumas_return pumas_context_transport(struct pumas_context * context,
     struct pumas_state * state, enum pumas_event * event,
@@ -3151,102 +4651,541 @@ enum pumas_return pumas_context_transport(struct pumas_context * context,
 
         /* Check the configuration. */
         if (event != NULL) *event = PUMAS_EVENT_NONE;
-        if (context->medium == NULL) {
+        if (transport_check_context(physics, context, error_) !=
+            PUMAS_RETURN_SUCCESS)
+                return ERROR_RAISE();
+
+        /* Transport the state. */
+        transport_state(physics, context, state, event, media, error_);
+        return ERROR_RAISE();
+}
+
+/* Public library function: transport of a batch of states. */
+enum pumas_return pumas_context_transport_batch(
+    struct pumas_context * context, int n, struct pumas_states * states,
+    enum pumas_event * events, struct pumas_medium ** media)
+{
+        ERROR_INITIALISE(pumas_context_transport_batch);
+
+        /* Check the context and states */
+        if (context == NULL)
                 return ERROR_MESSAGE(
-                    PUMAS_RETURN_MEDIUM_ERROR, "no medium specified");
-        } else if ((physics->particle == PUMAS_PARTICLE_TAU) &&
-            (context->mode.direction == PUMAS_MODE_FORWARD) &&
-            (context->mode.decay == PUMAS_MODE_WEIGHTED)) {
-                return ERROR_MESSAGE(PUMAS_RETURN_DECAY_ERROR,
-                    "`PUMAS_MODE_WEIGHTED' mode is not valid for forward taus");
-        }
+                    PUMAS_RETURN_VALUE_ERROR, "no context (null)");
+        if (n < 0)
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "negative number of states");
+        if (n == 0) return PUMAS_RETURN_SUCCESS;
+        if ((states == NULL) || (states->energy == NULL) ||
+            (states->position[0] == NULL) || (states->position[1] == NULL) ||
+            (states->position[2] == NULL) || (states->direction[0] == NULL) ||
+            (states->direction[1] == NULL) || (states->direction[2] == NULL))
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "missing states data (null)");
 
-        if ((context->accuracy <= 0) || (context->accuracy > 1)) {
-                return ERROR_FORMAT(PUMAS_RETURN_ACCURACY_ERROR,
-                    "bad accuracy value (expected a value in ]0,1], got %g)",
-                    context->accuracy);
-        }
+        /* Check the Physics initialisation and the configuration, once for
+         * all states.
+         */
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        const struct pumas_physics * physics = context_->physics;
+        if (physics == NULL) return ERROR_NOT_INITIALISED();
+        if (transport_check_context(physics, context, error_) !=
+            PUMAS_RETURN_SUCCESS)
+                return ERROR_RAISE();
 
-        if ((context->mode.direction == PUMAS_MODE_BACKWARD) &&
-            (context->mode.energy_loss > PUMAS_MODE_CSDA) &&
-            (physics->cutoff < 1E-02)) {
-                return ERROR_FORMAT(PUMAS_RETURN_ACCURACY_ERROR,
-                    "bad cutoff value for backward transport (expected a "
-                    "value greater than or equal to 0.01, got %g)",
-                    physics->cutoff);
-        }
+        /* Loop over states. */
+        int i;
+        for (i = 0; i < n; i++) {
+                enum pumas_event * const event =
+                    (events != NULL) ? events + i : NULL;
+                struct pumas_medium ** const media_i =
+                    (media != NULL) ? media + 2 * i : NULL;
+
+                /* Gather the state data. */
+                struct pumas_state state = {
+                        .charge = (states->charge != NULL) ?
+                            states->charge[i] : -1.,
+                        .energy = states->energy[i],
+                        .distance = (states->distance != NULL) ?
+                            states->distance[i] : 0.,
+                        .grammage = (states->grammage != NULL) ?
+                            states->grammage[i] : 0.,
+                        .time = (states->time != NULL) ?
+                            states->time[i] : 0.,
+                        .weight = (states->weight != NULL) ?
+                            states->weight[i] : 1.,
+                        .position = { states->position[0][i],
+                            states->position[1][i], states->position[2][i] },
+                        .direction = { states->direction[0][i],
+                            states->direction[1][i],
+                            states->direction[2][i] },
+                        .decayed = (states->decayed != NULL) ?
+                            states->decayed[i] : 0
+                };
 
-        /* Get the start medium. */
-        struct pumas_medium * medium;
-        double step_max_medium;
-        enum pumas_step step_max_type = context->medium(
-            context, state, &medium, &step_max_medium);
-        if (media != NULL) {
-                media[0] = medium;
-                media[1] = NULL;
+                /* Check the initial state. */
+                if (state.decayed) {
+                        if (event != NULL) *event = PUMAS_EVENT_VERTEX_DECAY;
+                        continue;
+                }
+                const double * const u = state.direction;
+                const double norm2 = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+                if (fabs(norm2 - 1) > FLT_EPSILON) {
+                        return ERROR_FORMAT(PUMAS_RETURN_DIRECTION_ERROR,
+                            "bad norm for state direction (index = %d, "
+                            "norm^2 - 1 = %g)",
+                            i, norm2 - 1);
+                }
+
+                /* Transport the state. */
+                if (event != NULL) *event = PUMAS_EVENT_NONE;
+                if (transport_state(physics, context, &state, event, media_i,
+                        error_) != PUMAS_RETURN_SUCCESS)
+                        return ERROR_RAISE();
+
+                /* Scatter back the final state. */
+                if (states->charge != NULL) states->charge[i] = state.charge;
+                states->energy[i] = state.energy;
+                if (states->distance != NULL)
+                        states->distance[i] = state.distance;
+                if (states->grammage != NULL)
+                        states->grammage[i] = state.grammage;
+                if (states->time != NULL) states->time[i] = state.time;
+                if (states->weight != NULL) states->weight[i] = state.weight;
+                int j;
+                for (j = 0; j < 3; j++) {
+                        states->position[j][i] = state.position[j];
+                        states->direction[j][i] = state.direction[j];
+                }
+                if (states->decayed != NULL)
+                        states->decayed[i] = state.decayed;
         }
-        if (medium == NULL) {
-                if (event != NULL) *event = PUMAS_EVENT_MEDIUM;
-                /* Register the start of the the track, if recording. */
-                if (context->recorder != NULL)
-                        record_state(context, medium, PUMAS_EVENT_MEDIUM |
-                                PUMAS_EVENT_START | PUMAS_EVENT_STOP,
-                            state);
-                return PUMAS_RETURN_SUCCESS;
-        } else if ((step_max_medium > 0.) &&
-            (step_max_type == PUMAS_STEP_CHECK))
-                step_max_medium += 0.5 * STEP_MIN;
-        struct medium_locals locals = { { 0., { 0., 0., 0. }}, 0, physics };
-        const double step_max_locals =
-            transport_set_locals(context, medium, state, &locals);
-        if ((step_max_locals > 0.) && (step_max_locals < step_max_medium))
-                step_max_medium = step_max_locals;
-        if (locals.api.density <= 0.) {
-                ERROR_REGISTER_NEGATIVE_DENSITY(
-                    physics->material_name[medium->material]);
-                return ERROR_RAISE();
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+/**
+ * Common data of the workers of a thread pool.
+ */
+struct pool_worker {
+        /** The worker's error data. */
+        struct error_context error;
+#if (THREADS_MODE)
+        /** Flag telling if the worker runs in a dedicated thread. */
+        int started;
+        /** The worker's thread. */
+        pthread_t thread;
+#endif
+};
+
+/* Main loop of a thread pool worker. */
+typedef void * pool_main_t(void * worker);
+
+/**
+ * Run the workers of a thread pool.
+ *
+ * @param n_workers   The number of workers.
+ * @param workers     The workers data, each one starting with a `pool_worker`.
+ * @param size        The size of the data of a worker, in bytes.
+ * @param worker_main The main loop of the workers.
+ * @param error_      The error data.
+ * @return The error code of the first failed worker, or
+ * `PUMAS_RETURN_SUCCESS`.
+ *
+ * The first worker runs in the calling thread. The other ones run in dedicated
+ * threads, when built with threads support. If a thread cannot be started, its
+ * work must be taken over by other workers. Once all workers are done, the
+ * error data of the first failed worker, if any, are copied to *error_*.
+ */
+static enum pumas_return pool_run(int n_workers, void * workers, size_t size,
+    pool_main_t * worker_main, struct error_context * error_)
+{
+        int i;
+        for (i = 0; i < n_workers; i++) {
+                struct pool_worker * const worker =
+                    (void *)((char *)workers + i * size);
+                worker->error.code = PUMAS_RETURN_SUCCESS;
+                worker->error.function = error_->function;
+                worker->error.message[0] = 0x0;
         }
 
-        /* Randomise the lifetime, if required. */
-        if (context->mode.decay == PUMAS_MODE_RANDOMISED) {
-                if (context->random == NULL) {
-                        return ERROR_MESSAGE(PUMAS_RETURN_MISSING_RANDOM,
-                            "no random engine specified");
+#if (THREADS_MODE)
+        for (i = 1; i < n_workers; i++) {
+                struct pool_worker * const worker =
+                    (void *)((char *)workers + i * size);
+                worker->started = (pthread_create(&worker->thread, NULL,
+                                       worker_main, worker) == 0);
+        }
+#endif
+        worker_main(workers);
+#if (THREADS_MODE)
+        for (i = 1; i < n_workers; i++) {
+                struct pool_worker * const worker =
+                    (void *)((char *)workers + i * size);
+                if (worker->started) pthread_join(worker->thread, NULL);
+        }
+#endif
+
+        /* Forward any worker error. */
+        for (i = 0; i < n_workers; i++) {
+                const struct pool_worker * const worker =
+                    (void *)((char *)workers + i * size);
+                if (worker->error.code != PUMAS_RETURN_SUCCESS) {
+                        memcpy(error_, &worker->error, sizeof(*error_));
+                        break;
                 }
-                const double u = context->random(context);
-                context_->lifetime = state->time - physics->ctau * log(u);
         }
 
-        /* Call the relevant transport engine. */
-        int do_stepping = 1;
-        enum pumas_event e = PUMAS_EVENT_NONE;
-        if ((step_max_medium <= 0.) && (step_max_locals <= 0.) &&
-            (context->mode.energy_loss <= PUMAS_MODE_CSDA)) {
-                /* This is an infinite and uniform medium. */
-                if ((context->mode.energy_loss == PUMAS_MODE_DISABLED) &&
-                    ((context->event & PUMAS_EVENT_LIMIT) == 0)) {
-                        return ERROR_MESSAGE(PUMAS_RETURN_MISSING_LIMIT,
-                            "infinite medium without external limit(s)");
-                } else if (
-                    (context->mode.scattering == PUMAS_MODE_DISABLED) &&
-                    (context->mode.energy_loss == PUMAS_MODE_CSDA)) {
-                        do_stepping = 0;
+        return error_->code;
+}
+
+/**
+ * Worker data for a parallel run.
+ */
+struct run_worker {
+        /** The thread pool data. */
+        struct pool_worker pool;
+        /** Link to the run data. */
+        struct run_data * run;
+        /** The worker's simulation context. */
+        struct pumas_context * context;
+        /** Start index of the remaining events assigned to the worker. */
+        long begin;
+        /** End index of the remaining events assigned to the worker. */
+        long end;
+        /** Flag telling if the run has been cancelled. */
+        int cancelled;
+#if (THREADS_MODE)
+        /** Lock for accessing the range of events. */
+        pthread_mutex_t mutex;
+#endif
+};
+
+/**
+ * Shared data for a parallel run.
+ */
+struct run_data {
+        /** The Physics tables. */
+        const struct pumas_physics * physics;
+        /** The user supplied generator of events. */
+        pumas_generator_cb * generator;
+        /** The user supplied scorer, or `NULL`. */
+        pumas_scorer_cb * scorer;
+        /** The number of events processed at once by a worker. */
+        long chunk_size;
+        /** The number of workers. */
+        int n_workers;
+        /** Placeholder for the workers data. */
+        struct run_worker workers[];
+};
+
+/* Number of chunks of events initially assigned to a worker. */
+#define RUN_CHUNKS_PER_WORKER 64
+
+#if (THREADS_MODE)
+#define RUN_LOCK(worker) pthread_mutex_lock(&(worker)->mutex)
+#define RUN_UNLOCK(worker) pthread_mutex_unlock(&(worker)->mutex)
+#else
+#define RUN_LOCK(worker)
+#define RUN_UNLOCK(worker)
+#endif
+
+/**
+ * Get the next chunk of events to process for a worker.
+ *
+ * @param worker The worker data.
+ * @param begin  The start index of the chunk.
+ * @param end    The end index of the chunk.
+ * @return `1` if a chunk was found, `0` otherwise.
+ *
+ * Chunks are first popped from the front of the worker's own range of events.
+ * If the latter is empty, half of the remaining range of another worker is
+ * stolen, starting from its back.
+ */
+static int run_worker_next(struct run_worker * worker, long * begin, long * end)
+{
+        struct run_data * const run = worker->run;
+        const long chunk = run->chunk_size;
+
+        /* Pop a chunk from the worker's own range. */
+        RUN_LOCK(worker);
+        if (worker->begin < worker->end) {
+                *begin = worker->begin;
+                worker->begin += chunk;
+                if (worker->begin > worker->end) worker->begin = worker->end;
+                *end = worker->begin;
+                RUN_UNLOCK(worker);
+                return 1;
+        }
+        RUN_UNLOCK(worker);
+
+        /* Steal half of the remaining range of another worker. */
+        const int index = (int)(worker - run->workers);
+        int i;
+        for (i = 1; i < run->n_workers; i++) {
+                struct run_worker * const victim =
+                    run->workers + (index + i) % run->n_workers;
+                RUN_LOCK(victim);
+                const long n = victim->end - victim->begin;
+                if (n <= 0) {
+                        RUN_UNLOCK(victim);
+                        continue;
                 }
+                const long n_steal = (n + 1) / 2;
+                *end = victim->end;
+                *begin = victim->end - n_steal;
+                victim->end = *begin;
+                RUN_UNLOCK(victim);
+
+                /* Keep the stolen events beyond the first chunk as the
+                 * worker's own range. The run might have been cancelled
+                 * since the victim was unlocked, in which case the stolen
+                 * events are dropped.
+                 */
+                RUN_LOCK(worker);
+                const int cancelled = worker->cancelled;
+                if (!cancelled && (*end - *begin > chunk)) {
+                        worker->begin = *begin + chunk;
+                        worker->end = *end;
+                        *end = *begin + chunk;
+                }
+                RUN_UNLOCK(worker);
+                return !cancelled;
         }
 
-        if (do_stepping) {
-                /* Transport with a detailed stepping. */
-                e = transport_with_stepping(physics, context, state, &medium,
-                    &locals, step_max_medium, step_max_type, step_max_locals,
-                    error_);
-        } else {
-                /* This is a purely deterministic case. */
-                e = transport_with_csda(
-                    physics, context, state, medium, &locals, error_);
+        return 0;
+}
+
+/**
+ * Cancel all remaining events of a parallel run.
+ *
+ * @param run The run data.
+ */
+static void run_cancel(struct run_data * run)
+{
+        int i;
+        for (i = 0; i < run->n_workers; i++) {
+                struct run_worker * const worker = run->workers + i;
+                RUN_LOCK(worker);
+                worker->end = worker->begin;
+                worker->cancelled = 1;
+                RUN_UNLOCK(worker);
         }
+}
+
+/**
+ * Main loop of a parallel run worker.
+ *
+ * @param arg The worker data.
+ * @return Always `NULL`.
+ *
+ * Events are generated, transported and scored chunk by chunk until no more
+ * events remain. If an error occurs the remaining events of all workers are
+ * cancelled. The cancellation is checked before each event.
+ */
+static void * run_worker_main(void * arg)
+{
+        struct run_worker * const worker = arg;
+        struct run_data * const run = worker->run;
+        struct pumas_context * const context = worker->context;
+        struct error_context * const error_ = &worker->pool.error;
+
+        long begin, end;
+        while (run_worker_next(worker, &begin, &end)) {
+                long i;
+                for (i = begin; i < end; i++) {
+                        /* Stop as soon as the run is cancelled, e.g. on an
+                         * error from another worker.
+                         */
+                        RUN_LOCK(worker);
+                        const int cancelled = worker->cancelled;
+                        RUN_UNLOCK(worker);
+                        if (cancelled) return NULL;
+
+                        /* Set the random stream of the event, if a counter
+                         * based engine is used.
+                         */
+                        if (context->random == &random_uniform01_counter)
+                                random_counter_event(
+                                    (struct simulation_context *)context, i);
+
+                        /* Generate the initial state. */
+                        struct pumas_state state = { .charge = -1.,
+                                .weight = 1. };
+                        run->generator(context, i, &state);
+
+                        /* Transport the state. */
+                        enum pumas_event event = PUMAS_EVENT_NONE;
+                        struct pumas_medium * media[2] = { NULL, NULL };
+                        if (state.decayed) {
+                                event = PUMAS_EVENT_VERTEX_DECAY;
+                        } else {
+                                const double * const u = state.direction;
+                                const double norm2 =
+                                    u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+                                if (fabs(norm2 - 1) > FLT_EPSILON) {
+                                        ERROR_VREGISTER(
+                                            PUMAS_RETURN_DIRECTION_ERROR,
+                                            "bad norm for state direction "
+                                            "(event = %ld, norm^2 - 1 = %g)",
+                                            i, norm2 - 1);
+                                } else {
+                                        transport_state(run->physics, context,
+                                            &state, &event, media, error_);
+                                }
+                                if (error_->code != PUMAS_RETURN_SUCCESS) {
+                                        run_cancel(run);
+                                        return NULL;
+                                }
+                        }
+
+                        /* Score the final state. */
+                        if (run->scorer != NULL)
+                                run->scorer(context, i, &state, event, media);
+                }
+        }
+
+        return NULL;
+}
+
+/* Public library function: parallel run of Monte Carlo events. */
+enum pumas_return pumas_context_run_parallel(struct pumas_context * context,
+    int n_threads, long n_events, pumas_generator_cb * generator,
+    pumas_scorer_cb * scorer, pumas_reducer_cb * reducer)
+{
+        ERROR_INITIALISE(pumas_context_run_parallel);
+
+        /* Check the arguments. */
+        if (context == NULL)
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no context (null)");
+        if (generator == NULL)
+                return ERROR_MESSAGE(
+                    PUMAS_RETURN_VALUE_ERROR, "no generator (null)");
+        if (n_threads <= 0)
+                return ERROR_FORMAT(PUMAS_RETURN_VALUE_ERROR,
+                    "bad number of threads (expected a strictly positive "
+                    "value, got %d)",
+                    n_threads);
+        if (context->recorder != NULL)
+                return ERROR_MESSAGE(PUMAS_RETURN_VALUE_ERROR,
+                    "recorders are not supported by parallel runs");
+
+        /* Check the Physics initialisation and the configuration. */
+        struct simulation_context * const context_ =
+            (struct simulation_context *)context;
+        const struct pumas_physics * physics = context_->physics;
+        if (physics == NULL) return ERROR_NOT_INITIALISED();
+        if (transport_check_context(physics, context, error_) !=
+            PUMAS_RETURN_SUCCESS)
+                return ERROR_RAISE();
+        if (n_events <= 0) return PUMAS_RETURN_SUCCESS;
+
+        /* Get the base seed of the workers' random streams. */
+        const int default_random = (context->random == &random_uniform01);
+        const int counter_random =
+            (context->random == &random_uniform01_counter);
+        unsigned long seed = 0;
+        if (default_random) {
+                if ((context_->random_data == NULL) &&
+                    (random_initialise(context, NULL, error_) !=
+                        PUMAS_RETURN_SUCCESS))
+                        return ERROR_RAISE();
+                seed = context_->random_data->seed;
+        }
+
+        /* Allocate the workers. */
+#if (!THREADS_MODE)
+        n_threads = 1;
+#endif
+        if (n_threads > n_events) n_threads = (int)n_events;
+        struct run_data * run = allocate(
+            sizeof(*run) + n_threads * sizeof(*run->workers));
+        if (run == NULL) {
+                ERROR_REGISTER_MEMORY();
+                return ERROR_RAISE();
+        }
+        run->physics = physics;
+        run->generator = generator;
+        run->scorer = scorer;
+        run->chunk_size = n_events / (RUN_CHUNKS_PER_WORKER * n_threads);
+        if (run->chunk_size < 1) run->chunk_size = 1;
+        run->n_workers = 0;
+
+        /* Split the events evenly, the first workers getting the remainder.
+         * Note that products of indices could overflow a 32 bits long.
+         */
+        const long n_per_worker = n_events / n_threads;
+        const int n_remainder = (int)(n_events % n_threads);
+        int i;
+        for (i = 0; i < n_threads; i++) {
+                struct run_worker * const worker = run->workers + i;
+                worker->run = run;
+                worker->begin = i * n_per_worker +
+                    ((i < n_remainder) ? i : n_remainder);
+                worker->end = worker->begin + n_per_worker +
+                    ((i < n_remainder) ? 1 : 0);
+                worker->cancelled = 0;
+
+                /* Create a copy of the simulation context. */
+                const int extra_memory = context_->extra_memory;
+                if (context_create(&worker->context, physics, extra_memory,
+                        error_) != PUMAS_RETURN_SUCCESS)
+                        goto clean_and_exit;
+                void * const user_data = worker->context->user_data;
+                memcpy(worker->context, context, sizeof(*context));
+                ((struct simulation_context *)worker->context)->geometry =
+                    context_->geometry;
+                worker->context->user_data = user_data;
+                worker->context->recorder = NULL;
+                if (extra_memory > 0)
+                        memcpy(user_data, context->user_data, extra_memory);
+
+                /* The worker is counted once fully initialised, since the
+                 * clean up destroys its mutex.
+                 */
+#if (THREADS_MODE)
+                pthread_mutex_init(&worker->mutex, NULL);
+#endif
+                run->n_workers++;
+
+                if (counter_random) {
+                        struct simulation_context * const wcontext_ =
+                            (void *)worker->context;
+                        memcpy(&wcontext_->random_counter,
+                            &context_->random_counter,
+                            sizeof(wcontext_->random_counter));
+                } else if (default_random) {
+                        unsigned long wseed = seed + i;
+                        if (random_initialise(worker->context, &wseed,
+                                error_) != PUMAS_RETURN_SUCCESS)
+                                goto clean_and_exit;
+                }
+        }
+
+        /* Run the workers. If a thread cannot be started, its events are
+         * stolen by other workers.
+         */
+        if (pool_run(run->n_workers, run->workers, sizeof(*run->workers),
+                &run_worker_main, error_) != PUMAS_RETURN_SUCCESS)
+                goto clean_and_exit;
+
+        /* Reduce the workers' results. */
+        if (reducer != NULL) {
+                for (i = 0; i < run->n_workers; i++)
+                        reducer(context, run->workers[i].context);
+        }
+
+clean_and_exit:
+        for (i = 0; i < run->n_workers; i++) {
+                struct run_worker * const worker = run->workers + i;
+#if (THREADS_MODE)
+                pthread_mutex_destroy(&worker->mutex);
+#endif
+                pumas_context_destroy(&worker->context);
+        }
+        deallocate(run);
 
-        if (event != NULL) *event = e;
-        if (media != NULL) media[1] = medium;
         return ERROR_RAISE();
 }
 
@@ -3431,15 +5370,10 @@ enum pumas_return pumas_physics_composite_update(struct pumas_physics * physics,
                 component->fraction = (d > 0.) ? d : 0.;
         }
 
-        const enum pumas_return rc =
-            compute_composite_density(physics, material, error_);
-        if ((rc != PUMAS_RETURN_SUCCESS) || (fractions == NULL))
-                goto clean_and_exit;
-        compute_composite(physics, material, error_);
+        if (compute_composite_density(physics, material, error_) ==
+            PUMAS_RETURN_SUCCESS)
+                compute_composite(physics, material, error_);
 
-clean_and_exit:
-        /* Free temporary workspace and return. */
-        compute_scattering_parameters(physics, -1, -1, error_);
         return ERROR_RAISE();
 }
 
@@ -3814,6 +5748,123 @@ double cel_energy_loss(const struct pumas_physics * physics,
             table_get_dE_dK(physics, scheme, material, 0), kinetic);
 }
 
+/**
+ * Snapshot of the CEL properties.
+ *
+ * @param Physics  Handle for physics tables.
+ * @param context  The simulation context.
+ * @param scheme   The energy loss scheme.
+ * @param material The index of the propagation material.
+ * @param kinetic  The kinetic energy.
+ * @param snapshot The computed properties.
+ *
+ * The returned values are identical to `cel_grammage`, `cel_proper_time`,
+ * `cel_energy_loss`, `cel_straggling` and `del_interaction_length`. Yet, the
+ * table index is computed once and the interleaved table rows are interpolated
+ * in a single loop, which can be vectorised by the compiler.
+ *
+ * **Note** : the number of interaction lengths for inelastic DELs is only
+ * computed in mixed mode. Otherwise it is set to `0`.
+ */
+void cel_snapshot(const struct pumas_physics * physics,
+    struct pumas_context * context, enum pumas_mode scheme, int material,
+    double kinetic, struct cel_snapshot * snapshot)
+{
+        const double * const K = table_get_K(physics, 0);
+        const int imax = physics->n_energies - 1;
+        if (!((kinetic >= K[0]) && (kinetic < K[imax]))) {
+                /* Out of table values. */
+                snapshot->grammage =
+                    cel_grammage(physics, context, scheme, material, kinetic);
+                snapshot->time = cel_proper_time(
+                    physics, context, scheme, material, kinetic);
+                snapshot->dedx = cel_energy_loss(
+                    physics, context, scheme, material, kinetic);
+                snapshot->straggling =
+                    cel_straggling(physics, context, material, kinetic);
+                snapshot->ni_in = (scheme == PUMAS_MODE_MIXED) ?
+                    del_interaction_length(
+                        physics, context, material, kinetic) :
+                    0.;
+                return;
+        }
+
+        /* Interpolate all properties at once. */
+        const int i1 = table_index(physics, context, K, kinetic);
+        const double dK = K[i1 + 1] - K[i1];
+        const double t = (kinetic - K[i1]) / dK;
+        const double * const y1 = table_get_CEL(physics, scheme, material, i1);
+        const double * const y2 = y1 + 2 * N_CEL_INTERLEAVED;
+        const double * const m1 = y1 + N_CEL_INTERLEAVED;
+        const double * const m2 = (i1 > 0) ? y2 + N_CEL_INTERLEAVED : m1;
+        double y[N_CEL_INTERLEAVED];
+        int j;
+        for (j = 0; j < N_CEL_INTERLEAVED; j++) {
+                y[j] = math_pchip_interpolate(
+                    t, y1[j], y2[j], m1[j] * dK, m2[j] * dK);
+        }
+        snapshot->grammage = y[0];
+        snapshot->time = y[1];
+        snapshot->dedx = y[2];
+        snapshot->straggling = y[3];
+
+        if (scheme == PUMAS_MODE_MIXED) {
+                const double * const NI =
+                    table_get_NI_in(physics, material, i1);
+                const double * const NI_dK =
+                    table_get_NI_in_dK(physics, material, i1);
+                const double d1 = NI_dK[0] * dK;
+                const double d2 = (i1 > 0) ? NI_dK[1] * dK : d1;
+                snapshot->ni_in =
+                    math_pchip_interpolate(t, NI[0], NI[1], d1, d2);
+        } else {
+                snapshot->ni_in = 0.;
+        }
+}
+
+/**
+ * The CEL properties relevant to energy loss fluctuations.
+ *
+ * @param Physics    Handle for physics tables.
+ * @param context    The simulation context.
+ * @param scheme     The energy loss scheme.
+ * @param material   The index of the propagation material.
+ * @param kinetic    The kinetic energy.
+ * @param dedx       The average energy loss.
+ * @param straggling The energy straggling.
+ *
+ * This is a restriction of `cel_snapshot` to the average energy loss and to
+ * the straggling. Only these two columns of the interleaved table are
+ * interpolated.
+ */
+void cel_fluctuation(const struct pumas_physics * physics,
+    struct pumas_context * context, enum pumas_mode scheme, int material,
+    double kinetic, double * dedx, double * straggling)
+{
+        const double * const K = table_get_K(physics, 0);
+        const int imax = physics->n_energies - 1;
+        if (!((kinetic >= K[0]) && (kinetic < K[imax]))) {
+                /* Out of table values. */
+                *dedx = cel_energy_loss(
+                    physics, context, scheme, material, kinetic);
+                *straggling =
+                    cel_straggling(physics, context, material, kinetic);
+                return;
+        }
+
+        const int i1 = table_index(physics, context, K, kinetic);
+        const double dK = K[i1 + 1] - K[i1];
+        const double t = (kinetic - K[i1]) / dK;
+        const double * const y1 = table_get_CEL(physics, scheme, material, i1);
+        const double * const y2 = y1 + 2 * N_CEL_INTERLEAVED;
+        const double * const m1 = y1 + N_CEL_INTERLEAVED;
+        const double * const m2 = (i1 > 0) ? y2 + N_CEL_INTERLEAVED : m1;
+        *dedx = math_pchip_interpolate(t, y1[2], y2[2], m1[2] * dK,
+            m2[2] * dK);
+        *straggling = math_pchip_interpolate(t, y1[3], y2[3], m1[3] * dK,
+            m2[3] * dK);
+}
+
 /**
  * The energy straggling.
  *
@@ -4156,6 +6207,80 @@ double table_interpolate_pchip(const struct pumas_physics * physics,
         return math_pchip_interpolate(t, table_Y[i1], table_Y[i2], m1, m2);
 }
 
+/* The number of values processed at once by vectorised interpolations. */
+#define TABLE_CHUNK_SIZE 64
+
+/**
+ * Vectorised piecewise Hermite polynomial interpolation.
+ *
+ * @param Physics Handle for physics tables.
+ * @param table_X Table of x values.
+ * @param table_Y Table of y values.
+ * @param table_M Table of dy/dx values.
+ * @param n       The number of points.
+ * @param x       Points at which the interpolant is evaluated.
+ * @param y       The interpolated values.
+ *
+ * The interpolant is identical to `table_interpolate_pchip`. Values are
+ * processed by chunks. First, the x values are bracketed, starting from the
+ * previous index. Thus, monotone x values are bracketed in constant time.
+ * Then, the polynomials are evaluated in a branchless loop, which can be
+ * vectorised by the compiler.
+ *
+ * **Note** : out of table x values are skipped, i.e. the corresponding y values
+ * are not modified.
+ */
+void table_interpolate_pchip_v(const struct pumas_physics * physics,
+    const double * table_X, const double * table_Y, const double * table_M,
+    int n, const double * x, double * y)
+{
+        const int imax = physics->n_energies - 1;
+        const double xmin = table_X[0];
+        const double xmax = table_X[imax];
+        int index[TABLE_CHUNK_SIZE], position[TABLE_CHUNK_SIZE];
+        int i0, i1 = -1;
+        for (i0 = 0; i0 < n; i0 += TABLE_CHUNK_SIZE) {
+                const int n_chunk = (n - i0 < TABLE_CHUNK_SIZE) ?
+                    n - i0 : TABLE_CHUNK_SIZE;
+
+                /* Bracket the values, reusing the previous index. */
+                int j, m = 0;
+                for (j = 0; j < n_chunk; j++) {
+                        const double xj = x[i0 + j];
+                        if (!((xj >= xmin) && (xj < xmax))) continue;
+                        if ((i1 < 0) || (xj < table_X[i1]) ||
+                            (xj >= table_X[i1 + 1])) {
+                                if ((i1 >= 0) && (i1 + 2 <= imax) &&
+                                    (xj >= table_X[i1 + 1]) &&
+                                    (xj < table_X[i1 + 2]))
+                                        i1++;
+                                else if ((i1 > 0) && (xj < table_X[i1]) &&
+                                    (xj >= table_X[i1 - 1]))
+                                        i1--;
+                                else
+                                        i1 = table_index(
+                                            physics, NULL, table_X, xj);
+                        }
+                        index[m] = i1;
+                        position[m] = i0 + j;
+                        m++;
+                }
+
+                /* Evaluate the interpolants. */
+                for (j = 0; j < m; j++) {
+                        const int k = index[j];
+                        const double dX = table_X[k + 1] - table_X[k];
+                        const double t = (x[position[j]] - table_X[k]) / dX;
+                        const double m1 = table_M[k] * dX;
+                        const double m2 = (k > 0) ? table_M[k + 1] * dX : m1;
+                        y[position[j]] = math_pchip_interpolate(
+                            t, table_Y[k], table_Y[k + 1], m1, m2);
+                }
+        }
+}
+
+#undef TABLE_CHUNK_SIZE
+
 /**
  * Find the index closest to `value`, from below.
  *
@@ -4169,7 +6294,9 @@ double table_interpolate_pchip(const struct pumas_physics * physics,
  *
  * Compute the table index for the given entry `value` using a dichotomy
  * algorithm. If a `context` is not `NULL`, `value` is checked against the
- * last used indices in the table, before doing the dichotomy search.
+ * last used indices in the table, before doing the dichotomy search. The
+ * kinetic energy table is indexed with a lookup table instead of the
+ * dichotomy, once the latter has been computed.
  */
 int table_index(const struct pumas_physics * physics,
     struct pumas_context * context, const double * table, double value)
@@ -4195,9 +6322,30 @@ int table_index(const struct pumas_physics * physics,
         if (value < table[0]) return -1;
         if (value >= table[imax]) return imax;
 
-        /* Bracket the value. */
-        int i1 = 0, i2 = imax;
-        table_bracket(table, value, &i1, &i2);
+        int i1;
+        if ((physics->kinetic_index_scale > 0.) &&
+            (table == table_get_K(physics, 0))) {
+                /* Look up the kinetic energy bin and scan forward. */
+                if (value < table[1]) {
+                        i1 = 0;
+                } else {
+                        int ib = (int)((log(value) -
+                                           physics->kinetic_index_min) *
+                            physics->kinetic_index_scale);
+                        if (ib < 0)
+                                ib = 0;
+                        else if (ib >= KINETIC_INDEX_N_BINS)
+                                ib = KINETIC_INDEX_N_BINS - 1;
+                        i1 = physics->kinetic_index[ib];
+                        while ((i1 > 1) && (value < table[i1])) i1--;
+                        while (value >= table[i1 + 1]) i1++;
+                }
+        } else {
+                /* Bracket the value. */
+                int i2 = imax;
+                i1 = 0;
+                table_bracket(table, value, &i1, &i2);
+        }
 
         if (context != NULL) {
                 /* Update the last used indices. */
@@ -4233,7 +6381,8 @@ void table_bracket(const double * table, double value, int * p1, int * p2)
 }
 
 /** Float version of the index bracketing */
-static void table_bracketf(float * table, float value, int * p1, int * p2)
+static void table_bracketf(
+    const float * table, float value, int * p1, int * p2)
 {
         int i3 = (*p1 + *p2) / 2;
         if (value >= table[i3])
@@ -4376,6 +6525,28 @@ double * table_get_dE_dK(
             row;
 }
 
+/**
+ * Encapsulation of the interleaved CEL table.
+ *
+ * @param Physics  Handle for physics tables.
+ * @param scheme   The energy loss scheme.
+ * @param material The material index.
+ * @param row      The kinetic energy row index.
+ * @return A pointer to the table row.
+ *
+ * A row is composed of the grammage, the proper time, the energy loss and the
+ * energy straggling values, followed by their derivatives w.r.t. the kinetic
+ * energy.
+ */
+double * table_get_CEL(
+    const struct pumas_physics * physics, int scheme, int material, int row)
+{
+        scheme = (scheme > PUMAS_MODE_MIXED) ? PUMAS_MODE_MIXED : scheme;
+        return physics->table_CEL + 2 * N_CEL_INTERLEAVED *
+            ((scheme * physics->n_materials + material) * physics->n_energies +
+                row);
+}
+
 /**
  * Encapsulation of the energy straggling table.
  *
@@ -4492,14 +6663,42 @@ double * table_get_CSf_dK(
 }
 
 /**
- * Encapsulation of the cross-sections normalisation table.
+ * Encapsulation of the alias tables for DEL targets.
  *
- * @param Physics Handle for physics tables.
- * @param process The process index.
- * @param element The element index.
- * @param row     The kinetic energy row index.
- * @return A pointer to the table element.
- */
+ * @param Physics      Handle for physics tables.
+ * @param component    The index of the first component of the material.
+ * @param n_components The number of components of the material.
+ * @param row          The kinetic energy row index.
+ * @return A pointer to the first element of the alias table.
+ *
+ * For a given material and kinetic energy, the alias table has an entry per
+ * atomic component and DEL process, with the process index running fastest.
+ */
+double * table_get_Af(const struct pumas_physics * physics, int component,
+    int n_components, int row)
+{
+        return physics->table_Af +
+            N_DEL_PROCESSES *
+            (component * physics->n_energies + row * n_components);
+}
+
+int * table_get_Ai(const struct pumas_physics * physics, int component,
+    int n_components, int row)
+{
+        return physics->table_Ai +
+            N_DEL_PROCESSES *
+            (component * physics->n_energies + row * n_components);
+}
+
+/**
+ * Encapsulation of the cross-sections normalisation table.
+ *
+ * @param Physics Handle for physics tables.
+ * @param process The process index.
+ * @param element The element index.
+ * @param row     The kinetic energy row index.
+ * @return A pointer to the table element.
+ */
 double * table_get_CSn(
     const struct pumas_physics * physics, int process, int element, int row)
 {
@@ -4672,6 +6871,20 @@ double * table_get_Lb_dK(
         return physics->table_Lb_dK + material * physics->n_energies + row;
 }
 
+/**
+ * Encapsulation of the fractional EHS cross sections.
+ *
+ * @param Physics   Handle for physics tables.
+ * @param component The atomic component index.
+ * @param row       The kinetic energy row index.
+ * @return A pointer to the table element.
+ */
+double * table_get_EHSf(
+    const struct pumas_physics * physics, int component, int row)
+{
+        return physics->table_EHSf + component * physics->n_energies + row;
+}
+
 /*!
  * Encapsulation of the Multiple SCattering (MSC) 1st transport path length.
  *
@@ -4751,9 +6964,180 @@ float * table_get_dcs_envelope(const struct pumas_physics * physics,
             kinetic);
 }
 
+/**
+ * Encapsulation of the tabulated DCS cumulative integrals.
+ *
+ * @param Physics Handle for physics tables.
+ * @param element The element index.
+ * @param process The process index.
+ * @param row     The kinetic energy row index.
+ * @return A pointer to the table element.
+ */
+double * table_get_dcs_cdf(const struct pumas_physics * physics,
+    int process, int element, int kinetic)
+{
+        return physics->table_DCS_CDF + (physics->n_table_dcs + 1) * (
+            (process * physics->n_elements + element) * physics->n_energies +
+            kinetic);
+}
+
+/**
+ * Encapsulation of the tabulated quantiles of the photonuclear polar angle.
+ *
+ * @param Physics Handle for physics tables.
+ * @param element The element index.
+ * @param kinetic The kinetic energy index.
+ * @param x       The fractional energy loss node index.
+ * @return A pointer to the table element.
+ */
+float * table_get_polar(const struct pumas_physics * physics,
+    int element, int kinetic, int x)
+{
+        return physics->table_polar + POLAR_N_QUANTILES * (
+            (element * physics->n_energies + kinetic) * physics->n_table_dcs +
+            x);
+}
+
 /*
  * Low level routines: propagation.
  */
+/**
+ * Check the transport configuration of a simulation context.
+ *
+ * @param Physics Handle for physics tables.
+ * @param context The simulation context.
+ * @param error_  The error data.
+ * @return `PUMAS_RETURN_SUCCESS` on success or an error code otherwise.
+ *
+ * The checks performed here only depend on the context settings. Thus, they
+ * can be done once for a batch of states.
+ */
+enum pumas_return transport_check_context(const struct pumas_physics * physics,
+    struct pumas_context * context, struct error_context * error_)
+{
+        if (context->medium == NULL) {
+                return ERROR_REGISTER(
+                    PUMAS_RETURN_MEDIUM_ERROR, "no medium specified");
+        } else if ((physics->particle == PUMAS_PARTICLE_TAU) &&
+            (context->mode.direction == PUMAS_MODE_FORWARD) &&
+            (context->mode.decay == PUMAS_MODE_WEIGHTED)) {
+                return ERROR_REGISTER(PUMAS_RETURN_DECAY_ERROR,
+                    "`PUMAS_MODE_WEIGHTED' mode is not valid for forward taus");
+        }
+
+        if ((context->accuracy <= 0) || (context->accuracy > 1)) {
+                return ERROR_VREGISTER(PUMAS_RETURN_ACCURACY_ERROR,
+                    "bad accuracy value (expected a value in ]0,1], got %g)",
+                    context->accuracy);
+        }
+
+        if ((context->mode.direction == PUMAS_MODE_BACKWARD) &&
+            (context->mode.energy_loss > PUMAS_MODE_CSDA) &&
+            (physics->cutoff < 1E-02)) {
+                return ERROR_VREGISTER(PUMAS_RETURN_ACCURACY_ERROR,
+                    "bad cutoff value for backward transport (expected a "
+                    "value greater than or equal to 0.01, got %g)",
+                    physics->cutoff);
+        }
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+/**
+ * Transport a single Monte Carlo state.
+ *
+ * @param Physics Handle for physics tables.
+ * @param context The simulation context.
+ * @param state   The initial/final state.
+ * @param event   The end event or `NULL`.
+ * @param media   The initial and final media, or `NULL`.
+ * @param error_  The error data.
+ * @return `PUMAS_RETURN_SUCCESS` on success or an error code otherwise.
+ *
+ * Locate the start medium, set the local properties and call the relevant
+ * transport engine. The context configuration and the state direction must
+ * have been checked before calling this routine.
+ */
+enum pumas_return transport_state(const struct pumas_physics * physics,
+    struct pumas_context * context, struct pumas_state * state,
+    enum pumas_event * event, struct pumas_medium * media[2],
+    struct error_context * error_)
+{
+        /* Get the start medium. */
+        struct pumas_medium * medium;
+        double step_max_medium;
+        enum pumas_step step_max_type = context->medium(
+            context, state, &medium, &step_max_medium);
+        if (media != NULL) {
+                media[0] = medium;
+                media[1] = NULL;
+        }
+        if (medium == NULL) {
+                if (event != NULL) *event = PUMAS_EVENT_MEDIUM;
+                /* Register the start of the the track, if recording. */
+                if (context->recorder != NULL)
+                        record_state(context, medium, PUMAS_EVENT_MEDIUM |
+                                PUMAS_EVENT_START | PUMAS_EVENT_STOP,
+                            state);
+                return PUMAS_RETURN_SUCCESS;
+        } else if ((step_max_medium > 0.) &&
+            (step_max_type != PUMAS_STEP_RAW))
+                step_max_medium += 0.5 * STEP_MIN;
+        struct medium_locals locals = { { 0., { 0., 0., 0. }}, 0, physics };
+        const double step_max_locals =
+            transport_set_locals(context, medium, state, &locals);
+        if ((step_max_locals > 0.) && (step_max_locals < step_max_medium))
+                step_max_medium = step_max_locals;
+        if (locals.api.density <= 0.) {
+                return ERROR_REGISTER_NEGATIVE_DENSITY(
+                    physics->material_name[medium->material]);
+        }
+
+        /* Randomise the lifetime, if required. */
+        if (context->mode.decay == PUMAS_MODE_RANDOMISED) {
+                if (context->random == NULL) {
+                        return ERROR_REGISTER(PUMAS_RETURN_MISSING_RANDOM,
+                            "no random engine specified");
+                }
+                struct simulation_context * context_ =
+                    (struct simulation_context *)context;
+                const double u = context->random(context);
+                context_->lifetime = state->time - physics->ctau * log(u);
+        }
+
+        /* Call the relevant transport engine. */
+        int do_stepping = 1;
+        enum pumas_event e = PUMAS_EVENT_NONE;
+        if ((step_max_medium <= 0.) && (step_max_locals <= 0.) &&
+            (context->mode.energy_loss <= PUMAS_MODE_CSDA)) {
+                /* This is an infinite and uniform medium. */
+                if ((context->mode.energy_loss == PUMAS_MODE_DISABLED) &&
+                    ((context->event & PUMAS_EVENT_LIMIT) == 0)) {
+                        return ERROR_REGISTER(PUMAS_RETURN_MISSING_LIMIT,
+                            "infinite medium without external limit(s)");
+                } else if (
+                    (context->mode.scattering == PUMAS_MODE_DISABLED) &&
+                    (context->mode.energy_loss == PUMAS_MODE_CSDA)) {
+                        do_stepping = 0;
+                }
+        }
+
+        if (do_stepping) {
+                /* Transport with a detailed stepping. */
+                e = transport_with_stepping(physics, context, state, &medium,
+                    &locals, step_max_medium, step_max_type, step_max_locals,
+                    error_);
+        } else {
+                /* This is a purely deterministic case. */
+                e = transport_with_csda(
+                    physics, context, state, medium, &locals, error_);
+        }
+
+        if (event != NULL) *event = e;
+        if (media != NULL) media[1] = medium;
+        return error_->code;
+}
+
 /**
  * CSDA propagation routine for a uniform and infinite medium.
  *
@@ -4785,10 +7169,10 @@ enum pumas_event transport_with_csda(const struct pumas_physics * physics,
         const double ki = state->energy;
         const double di = state->distance;
         const double ti = state->time;
-        const double xi =
-            cel_grammage(physics, context, PUMAS_MODE_CSDA, material, ki);
-        const double Ti =
-            cel_proper_time(physics, context, PUMAS_MODE_CSDA, material, ki);
+        struct cel_snapshot cel_i;
+        cel_snapshot(physics, context, PUMAS_MODE_CSDA, material, ki, &cel_i);
+        const double xi = cel_i.grammage;
+        const double Ti = cel_i.time;
 
         /* Register the start of the the track, if recording. */
         enum pumas_event event = PUMAS_EVENT_NONE;
@@ -4920,8 +7304,7 @@ enum pumas_event transport_with_csda(const struct pumas_physics * physics,
         if (context->mode.direction == PUMAS_MODE_BACKWARD)
                 state->weight *= cel_energy_loss(physics, context,
                                      PUMAS_MODE_CSDA, material, kf) /
-                    cel_energy_loss(physics, context, PUMAS_MODE_CSDA,
-                                     material, ki);
+                    cel_i.dedx;
         if (context->mode.decay == PUMAS_MODE_WEIGHTED)
                 state->weight *= exp(-fabs(ti - state->time) / physics->ctau);
 
@@ -5235,15 +7618,16 @@ enum pumas_event transport_with_stepping(const struct pumas_physics * physics,
         double ti = state->time;
         double wi = state->weight;
         double Xi = state->grammage;
-        double dei, Xf;
+        double dei;
+        struct cel_snapshot snapshot;
         if (scheme > PUMAS_MODE_DISABLED) {
                 const double ki = state->energy;
-                Xf = cel_grammage(physics, context, scheme, material, ki);
-                dei = 1. /
-                    cel_energy_loss(physics, context, scheme, material, ki);
+                cel_snapshot(physics, context, scheme, material, ki, &snapshot);
+                dei = 1. / snapshot.dedx;
 
         } else {
-                Xf = dei = 0.;
+                memset(&snapshot, 0x0, sizeof(snapshot));
+                dei = 0.;
         }
 
         /* Check for any initial violation of external limits. */
@@ -5269,7 +7653,7 @@ enum pumas_event transport_with_stepping(const struct pumas_physics * physics,
             0.;
         context_->step_invlb1 = 0;
         transport_limit(
-            physics, context, state, material, Xi, Xf, &grammage_max);
+            physics, context, state, material, Xi, &snapshot, &grammage_max);
         if (context_->step_event) return context_->step_event;
 
         /* Step through the media. */
@@ -5281,7 +7665,7 @@ enum pumas_event transport_with_stepping(const struct pumas_physics * physics,
                         step_max_type = context->medium(
                             context, state, NULL, &step_max_medium);
                         if ((step_max_medium > 0.) &&
-                            (step_max_type == PUMAS_STEP_CHECK))
+                            (step_max_type != PUMAS_STEP_RAW))
                                 step_max_medium += 0.5 * STEP_MIN;
                 }
 
@@ -5478,13 +7862,12 @@ enum pumas_event transport_with_stepping(const struct pumas_physics * physics,
                         Xi = state->grammage;
                         if (context->mode.energy_loss >= PUMAS_MODE_CSDA) {
                                 const double ki = state->energy;
-                                Xf = cel_grammage(
-                                    physics, context, scheme, material, ki);
-                                dei = 1. / cel_energy_loss(physics, context,
-                                               scheme, material, ki);
+                                cel_snapshot(physics, context, scheme,
+                                    material, ki, &snapshot);
+                                dei = 1. / snapshot.dedx;
                         }
                         transport_limit(physics, context, state, material, Xi,
-                            Xf, &grammage_max);
+                            &snapshot, &grammage_max);
                         if (context_->step_event) break;
                 }
         }
@@ -5556,10 +7939,10 @@ double transport_set_locals(const struct pumas_context * context,
  *
  * @param Physics      Handle for physics tables.
  * @param context      The simulation context.
+ * @param state        The initial state.
  * @param material     The index of the propagation material.
- * @param ki           The kinetic energy.
  * @param Xi           The total travelled grammage.
- * @param Xf           The total grammage over which the particle can travel.
+ * @param snapshot     The CEL properties at the initial kinetic energy.
  * @param grammage_max The total grammage at which a limit is reached.
  *
  * Compute the limit, translated into grammage, for Monte-Carlo steps.
@@ -5568,7 +7951,8 @@ double transport_set_locals(const struct pumas_context * context,
  */
 void transport_limit(const struct pumas_physics * physics,
     struct pumas_context * context, const struct pumas_state * state,
-    int material, double Xi, double Xf, double * grammage_max)
+    int material, double Xi, const struct cel_snapshot * snapshot,
+    double * grammage_max)
 {
         /* Initialise the stepping event flags. */
         struct simulation_context * const context_ =
@@ -5610,10 +7994,10 @@ void transport_limit(const struct pumas_physics * physics,
         const enum pumas_mode scheme = context->mode.energy_loss;
         if (scheme == PUMAS_MODE_DISABLED) {
                 if (context->mode.scattering == PUMAS_MODE_MIXED) {
-                        const double X = Xi -
+                        const double X = Xi +
                             coulomb_ehs_length(
                                 physics, context, material, state->energy) *
-                                log(context->random(context));
+                                step_rande(context);
                         if ((*grammage_max == 0.) || (X < *grammage_max)) {
                                 *grammage_max = X;
                                 context_->step_foreseen =
@@ -5633,12 +8017,8 @@ void transport_limit(const struct pumas_physics * physics,
 #define MAX_TRIALS 1000 /* Sanity check against bugs e.g. in the PRNG */
                 int i;
                 for (i = 0; i < MAX_TRIALS; i++) {
-                        const double zeta = context->random(context);
-                        if ((zeta <= 0.) || (zeta >= 1.)) continue;
-
-                        const double nI = del_interaction_length(
-                            physics, context, material, state->energy) +
-                            sgn * log(zeta);
+                        const double nI =
+                            snapshot->ni_in - sgn * step_rande(context);
                         if (nI <= 0.) break;
 
                         const double k = del_kinetic_from_interaction_length(
@@ -5666,8 +8046,8 @@ void transport_limit(const struct pumas_physics * physics,
         if ((scheme < PUMAS_MODE_STRAGGLED) &&
             (context->mode.scattering == PUMAS_MODE_MIXED)) {
                 const double nI = ehs_interaction_length(physics, context,
-                                      scheme, material, state->energy) +
-                    sgn * log(context->random(context));
+                                      scheme, material, state->energy) -
+                    sgn * step_rande(context);
                 if (nI > 0.) {
                         const double k = ehs_kinetic_from_interaction_length(
                             physics, context, scheme, material, nI);
@@ -5687,7 +8067,7 @@ void transport_limit(const struct pumas_physics * physics,
 
         /* Convert the kinetic limit to a grammage one and update. */
         const double X = Xi +
-            sgn * (Xf - cel_grammage(
+            sgn * (snapshot->grammage - cel_grammage(
                             physics, context, scheme, material, kinetic_limit));
         if ((*grammage_max <= 0) || (X < *grammage_max)) {
                 *grammage_max = X;
@@ -5777,58 +8157,76 @@ void transport_do_ehs(const struct pumas_physics * physics,
         double mu0 = 0., invlb1 = 0.;
         table_get_msc(physics, context, material, kinetic, &mu0, &invlb1);
 
-        /* Compute the scattering parameters and the total Coulomb
-         * cross section.
+        /* Randomise the hard scatterer element, using the tabulated
+         * fractional cross sections.
          */
-        int i;
-        struct coulomb_data * data;
-        double cs_tot = 0.;
-        for (i = 0, data = workspace->data; i < physics->elements_in[material];
-             i++, data++) {
-                /* Compute the scattering parameters. */
-                const struct material_component * const component =
-                    &physics->composition[material][i];
-                const struct atomic_element * const element =
-                    physics->element[component->element];
-                double kinetic0;
-                coulomb_frame_parameters(element->Z, element->A, physics->mass,
-                    kinetic, &kinetic0, data->fCM);
-                data->fspin = coulomb_spin_factor(physics->mass, kinetic);
-                coulomb_screening_parameters(element->Z, element->A,
-                    physics->mass, kinetic, kinetic0, &data->n_parameters,
-                    data->amplitude, data->screening);
-                coulomb_pole_reduction(data->n_parameters, data->amplitude,
-                    data->screening, data->a, data->b, data->c);
-                data->normalisation = component->fraction /
-                    coulomb_normalisation(element->Z, element->A, physics->mass,
-                        kinetic, kinetic0);
-
-                /* Compute the restricted Coulomb cross-section in the
-                 * CM frame.
-                 */
-                data->cs_hard = data->normalisation * coulomb_restricted_cs(
-                    mu0, data->fspin, data->n_parameters, data->screening,
-                    data->a, data->b, data->c);
-                cs_tot += data->cs_hard;
-        }
+        const int n_elements = physics->elements_in[material];
+        int i, ihard = n_elements - 1;
+        if (n_elements > 1) {
+                int ic0 = 0;
+                for (i = 0; i < material; i++)
+                        ic0 += physics->elements_in[i];
+
+                const int imax = physics->n_energies - 1;
+                int i1;
+                double h;
+                if (kinetic < *table_get_K(physics, 1)) {
+                        i1 = 1;
+                        h = 0.;
+                } else if (kinetic >= *table_get_K(physics, imax)) {
+                        i1 = imax - 1;
+                        h = 1.;
+                } else {
+                        i1 = table_index(
+                            physics, context, table_get_K(physics, 0), kinetic);
+                        h = (kinetic - *table_get_K(physics, i1)) /
+                            (*table_get_K(physics, i1 + 1) -
+                                *table_get_K(physics, i1));
+                }
 
-        /* Randomise the hard scatterer element. */
-        const double cc0 = context->random(context) * cs_tot;
-        int ihard = physics->elements_in[material] - 1;
-        double cs = 0.;
-        for (i = 0, data = workspace->data; i < physics->elements_in[material];
-             i++, data++) {
-                cs += data->cs_hard;
-                if (cs >= cc0) {
-                        ihard = i;
-                        break;
+                struct coulomb_data * data;
+                double cs_tot = 0.;
+                for (i = 0, data = workspace->data; i < n_elements;
+                     i++, data++) {
+                        const double * const f =
+                            table_get_EHSf(physics, ic0 + i, i1);
+                        data->cs_hard = f[0] + h * (f[1] - f[0]);
+                        cs_tot += data->cs_hard;
                 }
-        }
+                const double cc0 = context->random(context) * cs_tot;
+                double cs = 0.;
+                for (i = 0, data = workspace->data; i < n_elements;
+                     i++, data++) {
+                        cs += data->cs_hard;
+                        if (cs >= cc0) {
+                                ihard = i;
+                                break;
+                        }
+                }
+        } else {
+                /* Consume a random number for consistency with the multi
+                 * elements case.
+                 */
+                context->random(context);
+        }
+
+        /* Compute the scattering parameters of the hard scatterer. */
+        struct coulomb_data * data = workspace->data;
+        const struct material_component * const component =
+            &physics->composition[material][ihard];
+        const struct atomic_element * const element =
+            physics->element[component->element];
+        double kinetic0;
+        coulomb_frame_parameters(element->Z, element->A, physics->mass,
+            kinetic, &kinetic0, data->fCM);
+        data->fspin = coulomb_spin_factor(physics->mass, kinetic);
+        coulomb_screening_parameters(element->Z, element->A, physics->mass,
+            kinetic, kinetic0, &data->n_parameters, data->amplitude,
+            data->screening);
 
         /* Compute the hard angular parameter using a rejection sampling
          * method with a Wentzel cross-section as upper bound.
          */
-        data = workspace->data + ihard;
         const int n = data->n_parameters - 1;
         double A = data->screening[0];
         for (i = 1; i < n; i++) {
@@ -5905,8 +8303,9 @@ static inline double envelope_norm(double a, double xmin, double xmax)
  * @return The polar function for the randomisation of the corresponding TT or
  * `NULL` if none.
  *
- * Below 10 GeV the DEL is randomised from a power law bias PDF. Above,
- * a ziggurat algorithm is used.
+ * Above `DCS_MODEL_MIN_KINETIC` the DEL is randomised from the tabulated
+ * inverse CDF of the DCS. Otherwise, or above the tabulation range, rejection
+ * sampling is used with a power law bias PDF.
  */
 
 polar_function_t * del_randomise_forward(const struct pumas_physics * physics,
@@ -5943,6 +8342,15 @@ polar_function_t * del_randomise_forward(const struct pumas_physics * physics,
                 return NULL;
         }
 
+        /* Randomise from the tabulated inverse CDF, at high energies */
+        double x = 0.;
+        if ((state->energy >= DCS_MODEL_MIN_KINETIC) &&
+            del_randomise_inverse(physics, context, info.process, element,
+                state->energy, &xmin, xmax, &x)) {
+                state->energy *= (1. - x);
+                return polar_get(info.process);
+        }
+
         /* Get the envelopes */
         double a0, a1, b0, b1, p0;
         if (state->energy >= *table_get_K(physics, physics->n_energies - 1)) {
@@ -5978,7 +8386,6 @@ polar_function_t * del_randomise_forward(const struct pumas_physics * physics,
         }
 
         /* Randomise using rejection sampling */
-        double x = 0.;
         int i;
         for (i = 0; i < MAX_TRIALS; i++) {
                 double u = context->random(context);
@@ -6016,6 +8423,141 @@ polar_function_t * del_randomise_forward(const struct pumas_physics * physics,
 #undef MAX_TRIALS
 }
 
+/**
+ * Randomise the fractional energy loss of a DEL from the tabulated inverse CDF.
+ *
+ * @param Physics  Handle for physics tables.
+ * @param context  The simulation context.
+ * @param process  The index of the randomised process.
+ * @param element  The targeted atomic element.
+ * @param kinetic  The initial kinetic energy.
+ * @param xmin     The lower bound of the fractional energy loss.
+ * @param xmax     The upper bound of the fractional energy loss.
+ * @param x        The randomised fractional energy loss.
+ * @return `1` if *x* was randomised, `0` otherwise.
+ *
+ * The DCS is interpolated between the two bracketing kinetic energy rows, as
+ * in `dcs_evaluate`. A row is first selected according to its weighted
+ * integral over `[xmin, xmax]`. Then, the fractional energy loss is obtained
+ * by inverting the tabulated cumulative integral. No rejection is needed.
+ *
+ * If the tabulation cannot be used `0` is returned. If the part above the
+ * sampling grid is selected, *xmin* is set to the upper node and `0` is
+ * returned as well. In both cases, the caller must fall back to rejection
+ * sampling over `[xmin, xmax]`.
+ */
+int del_randomise_inverse(const struct pumas_physics * physics,
+    struct pumas_context * context, int process,
+    const struct atomic_element * element, double kinetic, double * xmin,
+    double xmax, double * x)
+{
+        /* Get the bracketing rows and their weights. */
+        const int imax = physics->n_energies - 1;
+        const double * const K = table_get_K(physics, 0);
+        const double * cdf[2];
+        const float * data[2];
+        double h[2];
+        int nrow, j;
+        if (kinetic >= K[imax]) {
+                nrow = 1;
+                cdf[0] = table_get_dcs_cdf(
+                    physics, process, element->index, imax);
+                data[0] = table_get_dcs(physics, process, element->index, imax);
+                h[0] = 1.;
+        } else {
+                nrow = 2;
+                const int i0 = table_index(physics, context, K, kinetic);
+                for (j = 0; j < 2; j++) {
+                        cdf[j] = table_get_dcs_cdf(
+                            physics, process, element->index, i0 + j);
+                        data[j] = table_get_dcs(
+                            physics, process, element->index, i0 + j);
+                }
+                h[1] = log(kinetic / K[i0]) / log(K[i0 + 1] / K[i0]);
+                h[0] = 1. - h[1];
+        }
+
+        const int n = physics->n_table_dcs;
+        for (j = 0; j < nrow; j++) {
+                if (cdf[j][n] < 0.) return 0;
+        }
+
+        /* Locate the integration bounds on the sampling grid. */
+        const float * const lx = physics->table_DCS_x;
+        int ia = -1, ib = -1;
+        double la = 0., lb = 0.;
+        if (*xmin > physics->cutoff) {
+                la = log(*xmin);
+                if (la >= lx[n - 1]) return 0;
+                ia = 0;
+                int i2 = n - 1;
+                table_bracketf(lx, (float)la, &ia, &i2);
+        }
+        const int tail = (xmax > exp(lx[n - 1]));
+        if (!tail) {
+                lb = log(xmax);
+                ib = 0;
+                int i2 = n - 1;
+                table_bracketf(lx, (float)lb, &ib, &i2);
+        }
+
+        /* Compute the weighted integrals of the rows. */
+        double Fa[2], Fb[2], w[2], wtot = 0.;
+        for (j = 0; j < nrow; j++) {
+                double c, a;
+                if (ia < 0) {
+                        Fa[j] = 0.;
+                } else {
+                        dcs_power_law(lx[ia], lx[ia + 1], data[j][2 * ia],
+                            data[j][2 * ia + 2], &c, &a);
+                        Fa[j] = cdf[j][ia] +
+                            dcs_power_law_integral(c, a, la - lx[ia]);
+                }
+                if (ib < 0) {
+                        Fb[j] = cdf[j][n - 1];
+                } else {
+                        dcs_power_law(lx[ib], lx[ib + 1], data[j][2 * ib],
+                            data[j][2 * ib + 2], &c, &a);
+                        Fb[j] = cdf[j][ib] +
+                            dcs_power_law_integral(c, a, lb - lx[ib]);
+                }
+                w[j] = h[j] * (Fb[j] - Fa[j]);
+                if (w[j] < 0.) w[j] = 0.;
+                wtot += w[j];
+                if (tail) wtot += h[j] * cdf[j][n];
+        }
+        if (wtot <= 0.) return 0;
+
+        /* Select a row, or the part above the sampling grid. */
+        double u = wtot * context->random(context);
+        for (j = 0; j < nrow; j++) {
+                if (u < w[j]) break;
+                u -= w[j];
+        }
+        if (j == nrow) {
+                *xmin = exp(lx[n - 1]);
+                return 0;
+        }
+
+        /* Invert the cumulative integral. */
+        const double r = Fa[j] + u / h[j];
+        int i1 = 0, i2 = n - 1;
+        table_bracket(cdf[j], r, &i1, &i2);
+        double c, a;
+        dcs_power_law(lx[i1], lx[i1 + 1], data[j][2 * i1],
+            data[j][2 * i1 + 2], &c, &a);
+        double d = dcs_power_law_inverse(c, a, r - cdf[j][i1]);
+        const double dmax = lx[i1 + 1] - lx[i1];
+        if (d > dmax) d = dmax;
+        else if (d < 0.) d = 0.;
+        double xi = exp(lx[i1] + d);
+        if (xi < *xmin) xi = *xmin;
+        else if (xi > xmax) xi = xmax;
+        *x = xi;
+
+        return 1;
+}
+
 /**
  * Randomise an inelastic DEL in backward MC.
  *
@@ -6179,34 +8721,60 @@ void del_randomise_target(const struct pumas_physics * physics,
         for (ic = 0; ic < material; ic++) ic0 += physics->elements_in[ic];
         if (context->mode.direction == PUMAS_MODE_FORWARD) {
                 /* Randomise according to the total cross section. */
+                const int n_in = physics->elements_in[material];
                 double zeta = context->random(context);
-                component = physics->composition[material];
-                for (ic = ic0; ic < ic0 + physics->elements_in[material];
-                     ic++, component++)
-                        for (ip = 0; ip < N_DEL_PROCESSES; ip++) {
+                if (n_in == 1) {
+                        /* Scan the DEL processes of the single element. */
+                        component = physics->composition[material];
+                        for (ip = 0; ip < N_DEL_PROCESSES - 1; ip++) {
                                 const double * f =
-                                    table_get_CSf(physics, ip, ic, i1);
+                                    table_get_CSf(physics, ip, ic0, i1);
                                 const double * df =
-                                    table_get_CSf_dK(physics, ip, ic, i1);
+                                    table_get_CSf_dK(physics, ip, ic0, i1);
                                 const double csf = math_pchip_interpolate(
                                     h, f[0], f[1], df[0] * dk, df[1] * dk);
-                                if (!(zeta > csf)) {
-                                        const double * n =
-                                            table_get_CSn(physics, ip,
-                                                component->element, i1);
-                                        const double * dn =
-                                            table_get_CSn_dK(
-                                                physics, ip,
-                                                component->element, i1);
-                                        const double csn =
-                                            math_pchip_interpolate(
-                                                h, n[0], n[1], dn[0] * dk,
-                                                dn[1] * dk);
-                                        info->reverse.weight = 1. / csn;
-                                        goto target_found;
+                                if (!(zeta > csf)) break;
+                        }
+                } else {
+                        /* Use the alias tables. The kinetic row is randomised
+                         * as well, according to the interpolation weight. A
+                         * single random variate is used for both.
+                         */
+                        const int n = n_in * N_DEL_PROCESSES;
+                        int row = i1;
+                        if (i2 != i1) {
+                                const int empty1 =
+                                    (*table_get_Ai(physics, ic0, n_in, i1) < 0);
+                                const int empty2 =
+                                    (*table_get_Ai(physics, ic0, n_in, i2) < 0);
+                                if (empty1 || (!empty2 && (zeta < h))) {
+                                        row = i2;
+                                        if (!empty1) zeta /= h;
+                                } else if (!empty2) {
+                                        zeta = (zeta - h) / (1. - h);
                                 }
                         }
-                assert(0); /* We should never reach this point ... */
+                        const double * const af =
+                            table_get_Af(physics, ic0, n_in, row);
+                        const int * const ai =
+                            table_get_Ai(physics, ic0, n_in, row);
+                        const double x = zeta * n;
+                        int j = (int)x;
+                        if (j >= n) j = n - 1;
+                        if ((ai[j] >= 0) && (x - j >= af[j])) j = ai[j];
+
+                        ic = j / N_DEL_PROCESSES;
+                        ip = j - ic * N_DEL_PROCESSES;
+                        component = physics->composition[material] + ic;
+                }
+
+                const double * n =
+                    table_get_CSn(physics, ip, component->element, i1);
+                const double * dn =
+                    table_get_CSn_dK(physics, ip, component->element, i1);
+                const double csn = math_pchip_interpolate(
+                    h, n[0], n[1], dn[0] * dk, dn[1] * dk);
+                info->reverse.weight = 1. / csn;
         } else {
                 /* Randomise according to the differential cross section. */
                 double stot = 0.;
@@ -6312,11 +8880,25 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
         const double momentum =
             sqrt(state->energy * (state->energy + 2. * physics->mass));
 
+        /* Check for a density law integrated analytically. In this case, the
+         * start position and the propagation direction are also saved.
+         */
+        const struct geometry_medium * const analytic =
+            geometry_analytic(medium);
+        const double sgn =
+            (context->mode.direction == PUMAS_MODE_FORWARD) ? 1. : -1.;
+        const double ri[3] = { position[0], position[1], position[2] };
+        const double ui[3] = { sgn * direction[0], sgn * direction[1],
+                sgn * direction[2] };
+
         /* Total grammage for the initial kinetic energy.  */
         const int tmp_scheme =
             (scheme == PUMAS_MODE_DISABLED) ? PUMAS_MODE_CSDA : scheme;
-        const double Xtot = cel_grammage(
-            physics, context, tmp_scheme, material, state->energy);
+        struct cel_snapshot snapshot;
+        cel_snapshot(
+            physics, context, tmp_scheme, material, state->energy, &snapshot);
+        const double Xtot = snapshot.grammage;
+        const double Ti = snapshot.time;
 
         /* Compute the local step length. */
         double step_loc, rLarmor0 = 0., uT0[3] = {0.};
@@ -6334,7 +8916,9 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                         if (f < 0.1) f = 0.1;
                         r *= f;
                 }
-                step_loc = r * density_i * Xtot;
+                step_loc = (analytic == NULL) ? r * density_i * Xtot :
+                    geometry_distance(
+                        analytic, ri, ui, r * Xtot, step_max_medium);
 
                 if (context->mode.scattering == PUMAS_MODE_MIXED) {
                         /* Compute the soft scattering path length. */
@@ -6345,7 +8929,10 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                                 invlb1 *= density;
                         } else
                                 invlb1 = context_->step_invlb1;
-                        const double stepT = context->accuracy / invlb1;
+                        double stepT = context->accuracy / invlb1;
+                        if (analytic != NULL)
+                                stepT = geometry_distance(analytic, ri, ui,
+                                    stepT * density, step_max_medium);
                         if (stepT < step_loc) step_loc = stepT;
                 }
 
@@ -6384,6 +8971,9 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                 /* This is a straight step. */
                 if (grammage_max <= 0.)
                         step_loc = 1E+09 * density_i;
+                else if (analytic != NULL)
+                        step_loc = geometry_distance(analytic, ri, ui,
+                            grammage_max, step_max_medium);
                 else
                         step_loc = grammage_max * density_i;
         }
@@ -6411,8 +9001,6 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
         }
 
         /* Update the position. */
-        const double sgn =
-            (context->mode.direction == PUMAS_MODE_FORWARD) ? 1. : -1.;
         position[0] += step * sgn * direction[0];
         position[1] += step * sgn * direction[1];
         position[2] += step * sgn * direction[2];
@@ -6422,7 +9010,15 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
         context->medium(context, state, &end_medium, NULL);
         double end_position[3] = { position[0], position[1], position[2] };
         if (end_medium != medium) {
-                if (step_max_type == PUMAS_STEP_CHECK) {
+                /* With an exact geometry step, the boundary lies half a
+                 * spatial resolution before the end position. Thus, no search
+                 * is needed. Note that the locals are then updated at the end
+                 * position. In a magnetic field the trajectory is curved, and
+                 * the boundary is searched for anyway.
+                 */
+                const int exact = (step_max_type == PUMAS_STEP_EXACT) &&
+                    (step >= step_max_medium) && (locals->magnetized == 0);
+                if ((step_max_type != PUMAS_STEP_RAW) && !exact) {
                         /* Check for an exact boundary. */
                         const double step_min =
                             (step < STEP_MIN) ? step : STEP_MIN;
@@ -6491,8 +9087,9 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                 Bi[1] = locals->api.magnet[1];
                 Bi[2] = locals->api.magnet[2];
         }
-        if ((*step_max_locals > 0.) && ((step_max_type != PUMAS_STEP_RAW) ||
-            (event != PUMAS_EVENT_MEDIUM))) {
+        if (((*step_max_locals > 0.) || (analytic != NULL)) &&
+            ((step_max_type != PUMAS_STEP_RAW) ||
+                (event != PUMAS_EVENT_MEDIUM))) {
                 /* Update the locals. */
                 *step_max_locals = transport_set_locals(
                     context, medium, state, locals);
@@ -6512,7 +9109,9 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
 
         /* Set the end step kinetic energy. */
         double k1 = state->energy, dk = 0.;
-        const double dX = 0.5 * step * (density + locals->api.density);
+        const double dX = (analytic == NULL) ?
+            0.5 * step * (density + locals->api.density) :
+            geometry_grammage(analytic, ri, ui, step);
         if ((scheme >= PUMAS_MODE_CSDA) && (scheme <= PUMAS_MODE_MIXED)) {
                 /* Deterministic CEL with check for any kinetic limit. */
                 const double X = Xtot - sgn * dX;
@@ -6563,8 +9162,8 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
         } else if (scheme == PUMAS_MODE_STRAGGLED) {
                 /* Fluctuate the CEL around its average value. */
                 double ratio;
-                step_fluctuate(
-                    physics, context, state, material, Xtot, dX, &k1, &ratio);
+                step_fluctuate(physics, context, state, material, &snapshot,
+                    dX, &k1, &ratio);
                 dk = fabs(state->energy - k1);
 
                 /* Check for a kinetic limit. */
@@ -6605,7 +9204,7 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                     del_cross_section(physics, context, material, k1);
                 if (tmp_del > xs_del) xs_del = tmp_del;
                 if (xs_del <= 0.) goto no_del_event;
-                const double X_del = -log(context->random(context)) / xs_del;
+                const double X_del = step_rande(context) / xs_del;
                 if (X_del >= Xmax) goto no_del_event;
                 const double k_h = cel_kinetic_energy(
                     physics, context, scheme, material, Xtot - sgn * X_del);
@@ -6635,8 +9234,7 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                         double lb_ehs = coulomb_ehs_length(
                             physics, context, material, kmin);
                         if (lb_ehs <= 0.) goto no_ehs_event;
-                        const double X_ehs =
-                            -log(context->random(context)) * lb_ehs;
+                        const double X_ehs = step_rande(context) * lb_ehs;
                         if (X_ehs >= Xmax) goto no_ehs_event;
                         const double k_h = cel_kinetic_energy(
                             physics, context, scheme, material,
@@ -6669,7 +9267,11 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
         double h_int = 0.;
         if ((grammage_max > 0.) && (state->grammage >= grammage_max)) {
                 const double dX_ = grammage_max - Xi;
-                if ((fabs(density - locals->api.density) <= FLT_EPSILON) ||
+                if (analytic != NULL) {
+                        step = geometry_distance(analytic, ri, ui, dX_, sf0);
+                        h_int = (sf0 > 0.) ? step / sf0 : 0.;
+                } else if ((fabs(density - locals->api.density) <=
+                               FLT_EPSILON) ||
                     (sf0 <= FLT_EPSILON)) {
                         step = dX_ * density_i;
                         h_int = dX_ / (state->grammage - Xi);
@@ -6723,11 +9325,55 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
 
         const double sf1 = step;
         if (straight && (scheme != PUMAS_MODE_DISABLED)) {
-                const double Ti = cel_proper_time(
-                    physics, context, scheme, material, state->energy);
-                if (time_max > 0.) {
+                /* The initial proper time, Ti, is computed with Xtot. For a
+                 * density law, the mean density along the step is used.
+                 */
+                const double rho = ((analytic != NULL) && (step > 0.)) ?
+                    (state->grammage - Xi) / step :
+                    density;
+                const double rho_i = (analytic == NULL) ? density_i : 1. / rho;
+                if ((time_max > 0.) && (analytic != NULL)) {
+                        const double Tf = cel_proper_time(
+                            physics, context, scheme, material, k1);
+                        const double dt = time_max - state->time;
+                        if (fabs(Tf - Ti) * rho_i > dt) {
+                                /* A proper time limit is reached. Since the
+                                 * mean density depends on the step length,
+                                 * the latter is located by dichotomy. The
+                                 * column density is integrated from the lower
+                                 * bound of the dichotomy.
+                                 */
+                                event = PUMAS_EVENT_LIMIT_TIME;
+                                state->time = time_max;
+                                state->decayed = decayed;
+                                double s0 = 0., s1 = sf1, X0 = 0.;
+                                while (s1 - s0 > STEP_MIN) {
+                                        const double s2 = 0.5 * (s0 + s1);
+                                        const double dX_ = X0 +
+                                            geometry_grammage_segment(
+                                                analytic, ri, ui, s0, s2);
+                                        const double k = cel_kinetic_energy(
+                                            physics, context, scheme,
+                                            material, Xtot - sgn * dX_);
+                                        const double T = cel_proper_time(
+                                            physics, context, scheme,
+                                            material, k);
+                                        if (fabs(T - Ti) * s2 > dt * dX_) {
+                                                s1 = s2;
+                                        } else {
+                                                s0 = s2;
+                                                X0 = dX_;
+                                        }
+                                }
+                                step = s0;
+                                state->grammage = Xi + X0;
+                                k1 = cel_kinetic_energy(physics, context,
+                                    scheme, material,
+                                    Xtot - sgn * (state->grammage - Xi));
+                        }
+                } else if (time_max > 0.) {
                         const double Tf =
-                            Ti - sgn * (time_max - state->time) * density;
+                            Ti - sgn * (time_max - state->time) * rho;
                         if (Tf > 0.) {
                                 const double dxT = fabs(
                                     Xtot - cel_grammage_as_time(physics,
@@ -6738,7 +9384,6 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                                         state->time = time_max;
                                         state->decayed = decayed;
                                         step = dxT * density_i;
-                                        if (step > sf1) step = sf1;
                                         state->grammage = Xi + dxT;
                                         const double xf = Xtot - sgn * dxT;
                                         k1 = cel_kinetic_energy(physics,
@@ -6750,7 +9395,7 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                 if (event != PUMAS_EVENT_LIMIT_TIME) {
                         const double Tf = cel_proper_time(
                             physics, context, scheme, material, k1);
-                        state->time += fabs(Tf - Ti) * density_i;
+                        state->time += fabs(Tf - Ti) * rho_i;
                 }
         } else {
                 const double p_f =
@@ -6788,7 +9433,10 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
 
                         /* Correct the grammage. */
                         const double Xf = Xi + dX;
-                        if (density == locals->api.density)
+                        if (analytic != NULL)
+                                state->grammage = Xi +
+                                    geometry_grammage(analytic, ri, ui, step);
+                        else if (density == locals->api.density)
                                 state->grammage = Xi + step * density;
                         else
                                 state->grammage = Xi +
@@ -6916,7 +9564,7 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
                 if (ilb1 > 1.) ilb1 = 1.;
                 double mu;
                 do {
-                        mu = -ilb1 * log(context->random(context));
+                        mu = ilb1 * step_rande(context);
                 } while (mu > 1.);
                 step_rotate_direction(context, state, mu);
         }
@@ -6931,7 +9579,7 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
  * @param context  The simulation context.
  * @param state    The particle Monte-Carlo state.
  * @param material The target material.
- * @param Xtot     The initial CSDA total grammage.
+ * @param snapshot The CEL properties at the initial kinetic energy.
  * @param dX       The step grammage length.
  * @param kf       The expected final state kinetic energy.
  * @param ratio    The ratio of the actual energy loss to the CSDA one.
@@ -6942,29 +9590,26 @@ enum pumas_return step_transport(const struct pumas_physics * physics,
  */
 static void step_fluctuate(const struct pumas_physics * physics,
     struct pumas_context * context, struct pumas_state * state, int material,
-    double Xtot, double dX, double * kf, double * ratio)
+    const struct cel_snapshot * snapshot, double dX, double * kf,
+    double * ratio)
 {
         const enum pumas_mode scheme = context->mode.energy_loss;
         const double sgn =
             (context->mode.direction == PUMAS_MODE_FORWARD) ? 1. : -1.;
         double k1, r = 0.;
         k1 = cel_kinetic_energy(
-            physics, context, scheme, material, Xtot - sgn * dX);
+            physics, context, scheme, material, snapshot->grammage - sgn * dX);
         const double dk0 = fabs(state->energy - k1);
         if ((k1 > 0.) && (dk0 > 0.)) {
-                const double Omega0 = cel_straggling(
-                    physics, context, material, state->energy);
-                const double Omega1 = cel_straggling(
-                    physics, context, material, k1);
-                double dk12 = 0.5 * dX * (Omega0 + Omega1);
-                const double tmp = dX / Xtot;
+                double dedx1, straggling1;
+                cel_fluctuation(physics, context, scheme, material, k1,
+                    &dedx1, &straggling1);
+                double dk12 = 0.5 * dX * (snapshot->straggling + straggling1);
+                const double tmp = dX / snapshot->grammage;
 #define X_THRESHOLD 5E-02
                 if (tmp > X_THRESHOLD) {
-                        const double de1 = cel_energy_loss(
-                            physics, context, scheme, material, k1);
-                        const double de0 = cel_energy_loss(
-                            physics, context, scheme, material, state->energy);
-                        dk12 *= 1. + sgn * dX / dk0 * (de1 - de0);
+                        dk12 *= 1. + sgn * dX / dk0 *
+                            (dedx1 - snapshot->dedx);
                 }
 #undef X_THRESHOLD
                 const double dk1 = sqrt(dk12);
@@ -7010,24 +9655,231 @@ static void step_fluctuate(const struct pumas_physics * physics,
  * @param context The simulation context.
  * @return a random number distributed according to a normal distribution.
  *
- * The Box-Muller algorithm is used. The random variates are generated in pairs.
- * The *context* is used as local storage.
+ * The ziggurat algorithm of Marsaglia & Tsang (2000) is used, with 128 layers.
+ * The layer index and the signed abscissa are drawn from two distinct uniform
+ * variates, such that the abscissa has the full resolution of the random
+ * engine (i.e. 2^-32 relative to the layer width, for the default engine) and
+ * it is not correlated to the layer. Most of the time, no transcendental
+ * function is evaluated.
  */
 static double step_randn(struct pumas_context * context)
 {
-        struct simulation_context * const context_ =
-            (struct simulation_context *)context;
-        context_->randn_done = !context_->randn_done;
-        if (!context_->randn_done) return context_->randn_next;
+        /* Abscissas of the layers, for R = 3.442619855899 and
+         * V = 9.91256303526217E-03.
+         */
+        static const double X[129] = {
+            3.713086246742551, 3.442619855899, 3.223084984581142,
+            3.083228858216868, 2.97869625264778, 2.894344007021529,
+            2.82312535054891, 2.761169372387177, 2.70611357312182,
+            2.65640641126136, 2.610972248431847, 2.569033625924938,
+            2.530009672388827, 2.493454522095372, 2.45901817741183,
+            2.42642064553375, 2.395434278011062, 2.365871370117639,
+            2.337575241339237, 2.310413683698763, 2.284274059677472,
+            2.259059573869199, 2.234686395590979, 2.211081408878703,
+            2.188180432076049, 2.165926793748922, 2.144270182360395,
+            2.123165708673977, 2.102573135189238, 2.082456237992017,
+            2.062782274508308, 2.043521536655068, 2.024646973377386,
+            2.006133869963472, 1.98795957412762, 1.970103260854327,
+            1.952545729553557, 1.935269228296623, 1.91825730086451,
+            1.901494653105151, 1.884967035707759, 1.868661140994489,
+            1.852564511728091, 1.836665460258446, 1.820952996596126,
+            1.805416764219228, 1.790046982599859, 1.774834395586069,
+            1.759770224899593, 1.7448461281138, 1.730054160563731,
+            1.715386740713668, 1.700836618569917, 1.686396846779168,
+            1.672060754097601, 1.657821920954024, 1.643674156862869,
+            1.629611479470635, 1.615628095043161, 1.601718380221378,
+            1.587876864890576, 1.574098216023001, 1.560377222366169,
+            1.54670877985991, 1.533087877674043, 1.51950958476594,
+            1.505969036863203, 1.492461423781354, 1.478981976989924,
+            1.465525957342711, 1.452088642889225, 1.438665316684564,
+            1.42525125451406, 1.411841712447058, 1.398431914131005,
+            1.385017037732652, 1.371592202427343, 1.358152454330144,
+            1.344692751753547, 1.331207949665627, 1.317692783209414,
+            1.304141850128617, 1.290549591926196, 1.276910273560156,
+            1.263217961454621, 1.249466499573068, 1.235649483263363,
+            1.221760230539996, 1.20779175041595, 1.193736707833129,
+            1.179587384663988, 1.165335636164752, 1.150972842148867,
+            1.136489852013161, 1.121876922582542, 1.107123647534036,
+            1.092218876907277, 1.077150624892896, 1.061905963694824,
+            1.046470900764045, 1.030830236068196, 1.014967395251331,
+            0.9988642334929836, 0.982500803515429, 0.9658550794011499,
+            0.9489026255113064, 0.9316161966151508, 0.9139652510230323,
+            0.8959153525809377, 0.8774274291129234, 0.8584568431938132,
+            0.8389522142975774, 0.8188539067003573, 0.7980920606440569,
+            0.7765839878947599, 0.7542306644540556, 0.7309119106424888,
+            0.7064796113354365, 0.6807479186691546, 0.6534786387399752,
+            0.6243585973360507, 0.5929629424714483, 0.5586921784081852,
+            0.5206560387620606, 0.4774378372966898, 0.4265479863554235,
+            0.362871431097032, 0.2723208648139647, 0.
+        };
+        const double R = 3.442619855899;
 
-        const double r = sqrt(-2. * log(context->random(context)));
-        const double phi = 2. * M_PI * context->random(context);
-        const double c = cos(phi);
-        const double s = sin(phi);
-        context_->randn_next = r * c;
-        return r * s;
+        for (;;) {
+                const int i = (int)(128. * context->random(context)) & 0x7F;
+                const double x = (2. * context->random(context) - 1.) * X[i];
+                if (fabs(x) < X[i + 1]) return x;
+
+                if (i == 0) {
+                        /* Sample the tail, beyond R. */
+                        for (;;) {
+                                const double u1 = context->random(context);
+                                const double u2 = context->random(context);
+                                if ((u1 <= 0.) || (u2 <= 0.)) continue;
+                                const double xt = -log(u1) / R;
+                                if (-2. * log(u2) >= xt * xt)
+                                        return (x < 0.) ? -R - xt : R + xt;
+                        }
+                }
+
+                /* Sample the wedge. */
+                const double x2 = x * x;
+                const double f0 = exp(-0.5 * (X[i] * X[i] - x2));
+                const double f1 = exp(-0.5 * (X[i + 1] * X[i + 1] - x2));
+                if (f1 + context->random(context) * (f0 - f1) < 1.) return x;
+        }
 }
 
+/**
+ * Exponential random number.
+ *
+ * @param context The simulation context.
+ * @return a random number distributed according to an exponential law, with
+ *         unit mean.
+ *
+ * The ziggurat algorithm of Marsaglia & Tsang (2000) is used, with 256 layers.
+ * As for `step_randn`, the layer index and the abscissa are drawn from two
+ * distinct uniform variates, such that the abscissa has the full resolution of
+ * the random engine. The tail is sampled recursively, since the exponential
+ * law is memoryless.
+ */
+static double step_rande(struct pumas_context * context)
+{
+        /* Abscissas of the layers, for R = 7.69711747013104972 and
+         * V = 3.949659822581572E-03.
+         */
+        static const double X[257] = {
+            8.697117470131085, 7.69711747013105, 6.941033629377211,
+            6.478378493832567, 6.14416466577247, 5.882144315795396,
+            5.66641016745403, 5.482890627526059, 5.323090505754394,
+            5.181487281301496, 5.054288489981301, 4.938777085901247,
+            4.832939741025108, 4.735242996601737, 4.644491885420081,
+            4.559737061707347, 4.480211746528417, 4.405287693473568,
+            4.334443680317268, 4.267242480277361, 4.20331371373518,
+            4.142340865664047, 4.084051310408293, 4.028208544647932,
+            3.974606066673784, 3.923062500135485, 3.873417670399505,
+            3.825529418522332, 3.779270992411663, 3.734528894039793,
+            3.691201090237414, 3.649195515760849, 3.608428813128905,
+            3.568825265648333, 3.530315889129339, 3.492837654774056,
+            3.456332821132756, 3.420748357251116, 3.386035442460297,
+            3.352149030900105, 3.319047470970744, 3.286692171599065,
+            3.255047308570446, 3.22407956528626, 3.193757903212236,
+            3.164053358025969, 3.134938858084436, 3.10638906233982,
+            3.078380215254086, 3.050890016615451, 3.023897504455672,
+            2.997382949516126, 2.971327759921085, 2.945714394895041,
+            2.920526286512736, 2.895747768600137, 2.871364012015532,
+            2.847360965635184, 2.823725302450031, 2.800444370250733,
+            2.777506146439752, 2.75489919656234, 2.732612636194696,
+            2.710636095867924, 2.688959688741799, 2.667573980773262,
+            2.646469963151804, 2.625639026797783, 2.60507293874083,
+            2.584763820214135, 2.5647041263169, 2.544886627111865,
+            2.525304390037822, 2.505950763528588, 2.486819361740204,
+            2.467904050297359, 2.449198932978244, 2.430698339264414,
+            2.412396812688865, 2.394289099921453, 2.376370140536135,
+            2.358635057409332, 2.341079147703029, 2.323697874390191,
+            2.306486858283574, 2.289441870532264, 2.272558825553149,
+            2.255833774367213, 2.239262898312903, 2.222842503111031,
+            2.206569013257658, 2.190438966723214, 2.174449009937769,
+            2.15859589304388, 2.142876465399836, 2.127287671317363,
+            2.111826546019036, 2.096490211801709, 2.081275874393219,
+            2.06618081949057, 2.051202409468579, 2.036338080248764,
+            2.021585338318921, 2.006941757894513, 1.992404978213571,
+            1.977972700957355, 1.963642687789542, 1.949412758007179,
+            1.935280786297045, 1.921244700591522, 1.907302480018381,
+            1.893452152939302, 1.879691795072205, 1.866019527692822,
+            1.852433515911169, 1.838931967018874, 1.825513128903513,
+            1.812175288526384, 1.798916770460284, 1.785735935484119,
+            1.772631179231299, 1.759600930889068, 1.746643651946068,
+            1.733757834985565, 1.720942002521929, 1.708194705878051,
+            1.695514524101531, 1.682900062917547, 1.670349953716446,
+            1.657862852574166, 1.645437439303717, 1.633072416535985,
+            1.620766508828251, 1.608518461798852, 1.596327041286477,
+            1.584191032532682, 1.572109239386223, 1.560080483527882,
+            1.548103603714507, 1.536177455041025, 1.52430090821922,
+            1.51247284887211, 1.50069217684281, 1.488957805516739,
+            1.477268661156127, 1.465623682245739, 1.454021818848787,
+            1.442462031972006, 1.430943292938873, 1.419464582769977,
+            1.408024891569529, 1.396623217917035, 1.385258568263116,
+            1.373929956328484, 1.36263640250508, 1.351376933258329,
+            1.340150580529498, 1.32895638113711, 1.317793376176318,
+            1.306660610415168, 1.295557131686594, 1.284481990275006,
+            1.273434238296234, 1.262412929069609, 1.251417116480846,
+            1.2404458543344, 1.229498195693842, 1.218573192208783,
+            1.207669893426754, 1.196787346088396, 1.185924593404195,
+            1.175080674310904, 1.164254622705672, 1.153445466655767,
+            1.142652227581666, 1.131873919411071, 1.121109547701323,
+            1.110358108727404, 1.09961858853259, 1.08888996193854,
+            1.078171191511365, 1.067461226479961, 1.056759001602544,
+            1.046063435977037, 1.035373431790521, 1.02468787300261,
+            1.014005623957089, 1.003325527915689, 0.9926464055072685,
+            0.9819670530850552, 0.9712862409838959, 0.9606027116686591,
+            0.9499151777640685, 0.9392223199552548, 0.928522784747203,
+            0.9178151820700368, 0.9070980827156827, 0.8963700155898824,
+            0.8856294647617439, 0.8748748662910174, 0.8641046048109967,
+            0.8533170098423655, 0.8425103518103606, 0.8316828377342651,
+            0.8208326065544038, 0.8099577240574102, 0.799056177355479,
+            0.7881258688694843, 0.7771646097591214, 0.7661701127354262,
+            0.7551399841819736, 0.7440717155004994, 0.7329626735843566,
+            0.7218100903087473, 0.710611050909646, 0.699362481103223,
+            0.6880611327737388, 0.6767035680295135, 0.6652861413926686,
+            0.6538049798476555, 0.6422559604245269, 0.6306346849334806,
+            0.6189364513948664, 0.6071562216202903, 0.595288584291493,
+            0.5833277127487596, 0.5712673165325781, 0.5591005855115302,
+            0.5468201251632998, 0.5344178812371547, 0.5218850515921241,
+            0.5092119824436432, 0.4963880455186597, 0.4834014916534501,
+            0.4702392750821571, 0.4568868409314081, 0.4433278660735401,
+            0.4295439402253983, 0.4155141696003436, 0.4012146788962647,
+            0.3866179779411062, 0.3716921453299035, 0.3563997602583797,
+            0.3406964810648346, 0.3245291170168944, 0.3078329546749166,
+            0.2905279554912142, 0.2725131854784478, 0.2536583633858941,
+            0.2337904830596557, 0.2126715106309462, 0.1899586896224097,
+            0.1651276225641628, 0.1373049809399847, 0.1048385075657851,
+            0.06385216381495624, 0.
+        };
+        const double R = 7.69711747013104972;
+
+        double offset = 0.;
+        for (;;) {
+                const int i = (int)(256. * context->random(context)) & 0xFF;
+                const double x = context->random(context) * X[i];
+                if (x < X[i + 1]) return offset + x;
+
+                if (i == 0) {
+                        /* Sample the tail, beyond R. */
+                        offset += R;
+                        continue;
+                }
+
+                /* Sample the wedge. */
+                const double f0 = exp(x - X[i]);
+                const double f1 = exp(x - X[i + 1]);
+                if (f1 + context->random(context) * (f0 - f1) < 1.)
+                        return offset + x;
+        }
+}
+
+#if (TEST_MODE)
+/* Ziggurat samplers, exported for the unit tests only. */
+double pumas_test_randn(struct pumas_context * context)
+{
+        return step_randn(context);
+}
+
+double pumas_test_rande(struct pumas_context * context)
+{
+        return step_rande(context);
+}
+#endif
+
 /**
  * Rotate the direction randomly but constraining the polar angle.
  *
@@ -7602,182 +10454,1468 @@ double coulomb_restricted_cs(double mu, double fspin, int n_parameters,
         coulomb_transport_coefficients(mu, fspin, n_parameters, screening,
             a, b, c, coefficients);
 
-        if (coefficients[0] > cs0)
-                return 0;
-        else
-                return cs0 - coefficients[0];
+        if (coefficients[0] > cs0)
+                return 0;
+        else
+                return cs0 - coefficients[0];
+}
+
+/**
+ * Compute the order 0 and 1 transport coefficients.
+ *
+ * @param mu           The angular cut-off.
+ * @param fspin        The spin factor.
+ * @param n_parameters The number of screening parameters.
+ * @param screening    The screening factors.
+ * @param a            The poles 1st order coefficients.
+ * @param b            The poles 2nd order coefficients.
+ * @param c            The poles nuclear coefficients.
+ * @param coefficient  The computed transport coefficients.
+ */
+void coulomb_transport_coefficients(double mu_, double fspin, int n_parameters,
+    const double * screening, const long double * a, const long double * b,
+    const long double * c, double * coefficient)
+{
+        /* Sum up all factors of the pole reduction.
+         *
+         * Note: we make use of sum(a_i) + c_0 = 0 in order to eliminate some
+         * unstable terms from the summation.
+         */
+        const long double S = fspin;
+        const long double mu = mu_;
+
+        const int n = n_parameters - 1;
+        double cs0 = 0., cs1 = 0.;
+        int i;
+        for (i = 0; i < n; i++) {
+                const long double alp = screening[i];
+                const long double r = mu / (mu + alp);
+                const long double L = logl(1. + mu / alp);
+                const long double I0 = r / alp;
+                const long double J0 = L;
+                const long double I1 = L - r;
+                const long double J1 = -alp * L;
+                const long double I2 = mu + alp * (r - 2. * L);
+                const long double J2 = alp * (alp * L - mu);
+
+                cs0 += a[i] * (J0 - S * J1) + b[i] * (I0 - S * I1);
+                cs1 += a[i] * (J1 - S * J2) + b[i] * (I1 - S * I2);
+        }
+
+        const long double N = screening[n];
+        const long double r = mu / (mu + N);
+        const long double L = logl(1. + mu / N);
+        const long double I0 = r / N;
+        const long double J0 = L;
+        const long double I1 = L - r;
+        const long double J1 = -N * L;
+        const long double I2 = mu + N * (r - 2. * L);
+        const long double J2 = N * (N * L - mu);
+
+        const long double rn = 1. / (1. + mu / N);
+        const long double K0 = (1. - rn) * (1. + rn) / (2 * N * N);
+        const long double L0 = (1. - rn) * ((1. + rn) * (1. + rn) - rn) /
+            (3 * N * N * N);
+        const long double K1 = I0 - N * K0;
+        const long double L1 = K0 - N * L0;
+        const long double K2 = I1 - N * K1;
+        const long double L2 = K1 - N * L1;
+
+        cs0 += c[0] * (J0 - S * J1) +
+               c[1] * (I0 - S * I1) +
+               c[2] * (K0 - S * K1) +
+               c[3] * (L0 - S * L1);
+        cs1 += c[0] * (J1 - S * J2) +
+               c[1] * (I1 - S * I2) +
+               c[2] * (K1 - S * K2) +
+               c[3] * (L1 - S * L2);
+
+        coefficient[0] = cs0;
+        coefficient[1] = 2 * cs1;
+}
+
+/**
+ * The 1st transport cross-section for multiple scattering on electronic
+ * shells.
+ *
+ * @param ZoA      The target Z over A ratio.
+ * @param I        The target mean excitation energy.
+ * @param aS       The target electronic scaling parameter.
+ * @param mass     The projectile rest mass.
+ * @param kinetic  The projectile initiale kinetic energy.
+ * @param nu       The projectile energy loss cutoff.
+ * @return The inverse of the electronic 1st transport path length in kg/m^2.
+ *
+ * The contribution from atomic electronic shells is computed following
+ * Salvat et al., NIMB316 (2013) 144-159, using small angle approximation for
+ * close collisions and keeping only leading term for distant ones.
+ */
+double transverse_transport_electronic(double ZoA, double I, double aS,
+    double mass, double kinetic, double nu)
+{
+        /* Soft close and distant interactions restricted to cutoff. */
+        const double momentum2 = kinetic * (kinetic + 2. * mass);
+        const double E = kinetic + mass;
+        const double Wr = 2. * ELECTRON_MASS * momentum2 /
+            (mass * mass + ELECTRON_MASS * (ELECTRON_MASS + 2. * E));
+        const double Wmax = (nu > Wr) ? Wr : nu;
+
+        const double beta2 = momentum2 / (E * E);
+        const double J = log(aS * Wmax / I) - beta2 * Wmax / Wr +
+            0.25 * Wmax * Wmax / (E * E) + 1 / aS;
+
+        /* Electronic Bremsstrahlung correction. */
+        const double gamma = E / mass;
+        const double lQ = log(1. + 2. * Wr / ELECTRON_MASS);
+        const double Delta =
+            ALPHA_EM / (2 * M_PI) * (log(2. * gamma) - lQ / 3.) * lQ * lQ;
+
+        /* First transport cross-section */
+        return 2 * M_PI * ELECTRON_RADIUS * ELECTRON_RADIUS * ELECTRON_MASS *
+            ELECTRON_MASS * AVOGADRO_NUMBER * ZoA /
+            (beta2 * 1E-03 * momentum2) * (J + Delta);
+}
+
+/* Low level routine: helper function for recording a MC state. */
+/**
+ * Register a Monte-Carlo state.
+ *
+ * @param recorder     The recorder handle.
+ * @param medium       The medium in which the particle is located.
+ * @param event        The current stepping event.
+ * @param state        The Monte-Carlo state to record.
+ *
+ * This routine adds the given state to the recorder's stack. The recorder
+ * filters are applied first, before any copy of the state.
+ */
+void record_state(struct pumas_context * context, struct pumas_medium * medium,
+    enum pumas_event event, struct pumas_state * state)
+{
+        /* Apply the recorder filters */
+        struct pumas_recorder * recorder = context->recorder;
+        struct frame_recorder * const rec =
+            (struct frame_recorder * const)recorder;
+        const int check_energy = (recorder->energy_loss > 0.);
+        const int check_distance = (recorder->distance > 0.);
+        if (event & PUMAS_EVENT_START) {
+                rec->last_energy = state->energy;
+                memcpy(rec->last_position, state->position,
+                    sizeof(rec->last_position));
+                if (rec->stream != NULL) rec->stream->track++;
+        }
+        if ((recorder->event_mask != PUMAS_EVENT_NONE) &&
+            !(event & recorder->event_mask))
+                return;
+        if (!(event & (PUMAS_EVENT_START | PUMAS_EVENT_STOP))) {
+                if (check_energy && (fabs(rec->last_energy - state->energy) <
+                                        recorder->energy_loss))
+                        return;
+                if (check_distance) {
+                        const double dx =
+                            state->position[0] - rec->last_position[0];
+                        const double dy =
+                            state->position[1] - rec->last_position[1];
+                        const double dz =
+                            state->position[2] - rec->last_position[2];
+                        if (dx * dx + dy * dy + dz * dz <=
+                            recorder->distance * recorder->distance)
+                                return;
+                }
+        }
+        if (check_energy) rec->last_energy = state->energy;
+        if (check_distance) {
+                memcpy(rec->last_position, state->position,
+                    sizeof(rec->last_position));
+        }
+
+        /* Check for a user supplied recorder */
+        if (recorder->record != NULL) {
+                recorder->record(context, state, medium, event);
+                return;
+        }
+
+        /* Check for a streaming recorder */
+        if (rec->stream != NULL) {
+                stream_push(rec->stream, medium, event, state);
+                recorder->length++;
+                return;
+        }
+
+        /* Do the default recording ... */
+        struct frame_stack * stack = rec->stack;
+        struct pumas_frame * frame = NULL;
+
+        if ((stack == NULL) || (stack->size < (int)sizeof(*frame))) {
+                /* Allocate a new memory segment. */
+                const int size = 4096;
+                stack = allocate(size);
+                if (stack == NULL) return;
+                stack->size = size - sizeof(*stack);
+                stack->frame = stack->frames;
+                stack->next = rec->stack;
+                rec->stack = stack;
+        }
+
+        /* Allocate the new frame in the stack. */
+        frame = stack->frame++;
+        stack->size -= sizeof(*frame);
+
+        /* Link the new frame. */
+        if (recorder->first == NULL)
+                recorder->first = frame;
+        else
+                rec->last->next = frame;
+        rec->last = frame;
+        frame->next = NULL;
+        frame->medium = medium;
+        frame->event = event;
+        memcpy(&(frame->state), state, sizeof(*state));
+        recorder->length++;
+}
+
+/* Low level routines: streaming of recorded frames. */
+#if (THREADS_MODE)
+#define STREAM_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STREAM_STORE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#else
+#define STREAM_LOAD(ptr) (*(ptr))
+#define STREAM_STORE(ptr, value) (*(ptr) = (value))
+#endif
+
+/**
+ * Allocate and initialise a new recorder.
+ *
+ * @param extra_memory The size of the user extra memory.
+ * @return The new recorder or `NULL` in case of a memory error.
+ */
+struct frame_recorder * recorder_allocate(int extra_memory)
+{
+        if (extra_memory < 0) extra_memory = 0;
+        struct frame_recorder * recorder =
+            allocate(sizeof(*recorder) + extra_memory);
+        if (recorder == NULL) return NULL;
+
+        recorder->api.period = 1;
+        recorder->api.event_mask = PUMAS_EVENT_NONE;
+        recorder->api.energy_loss = 0.;
+        recorder->api.distance = 0.;
+        recorder->api.record = NULL;
+        recorder->api.length = 0;
+        recorder->api.first = NULL;
+        recorder->api.user_data = (extra_memory > 0) ? recorder->data : NULL;
+        recorder->last = NULL;
+        recorder->stack = NULL;
+        recorder->stream = NULL;
+        recorder->last_energy = 0.;
+        memset(recorder->last_position, 0x0, sizeof(recorder->last_position));
+
+        return recorder;
+}
+
+/**
+ * Create a new streaming recorder.
+ *
+ * @param recorder     The new recorder.
+ * @param extra_memory The size of the user extra memory.
+ * @param capacity     The capacity of the ring buffer, in frames.
+ * @param output       The output stream, or `NULL`.
+ * @param consumer     The user supplied consumer, or `NULL`.
+ * @param columns      The columns writer, or `NULL`.
+ * @param error_       The error data.
+ * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned.
+ *
+ * The stream takes ownership of the columns writer, which is released in case
+ * of failure.
+ */
+enum pumas_return stream_create(struct frame_recorder ** recorder_,
+    int extra_memory, int capacity, FILE * output, pumas_stream_cb * consumer,
+    struct column_writer * columns, struct error_context * error_)
+{
+        *recorder_ = NULL;
+
+        /* Allocate memory for the new recorder and for its ring buffer. */
+        unsigned long size = 1;
+        while (size < (unsigned long)capacity) size <<= 1;
+        struct frame_recorder * recorder = recorder_allocate(extra_memory);
+        struct frame_stream * stream = allocate(
+            sizeof(*stream) + size * sizeof(*stream->frames));
+        if ((recorder == NULL) || (stream == NULL)) {
+                deallocate(recorder);
+                deallocate(stream);
+                deallocate(columns);
+                return ERROR_REGISTER_MEMORY();
+        }
+
+        /* Configure the stream. */
+        stream->head = 0;
+        stream->tail = 0;
+        stream->mask = size - 1;
+        stream->track = -1;
+        stream->recorder = &recorder->api;
+        stream->stream = output;
+        stream->consumer = consumer;
+        stream->columns = columns;
+        stream->io_error = 0;
+#if (THREADS_MODE)
+        stream->wake = 0;
+        stream->stop = 0;
+        pthread_mutex_init(&stream->mutex, NULL);
+        pthread_cond_init(&stream->cond, NULL);
+        if (pthread_create(&stream->thread, NULL, &stream_consume, stream) !=
+            0) {
+                pthread_cond_destroy(&stream->cond);
+                pthread_mutex_destroy(&stream->mutex);
+                deallocate(recorder);
+                deallocate(stream);
+                deallocate(columns);
+                return ERROR_REGISTER(PUMAS_RETURN_MEMORY_ERROR,
+                    "could not start the consumer thread");
+        }
+#endif
+        recorder->stream = stream;
+        *recorder_ = recorder;
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
+/**
+ * Write a Monte-Carlo state to a stream of frames.
+ *
+ * @param stream       The stream of frames.
+ * @param medium       The medium in which the particle is located.
+ * @param event        The current stepping event.
+ * @param state        The Monte-Carlo state to record.
+ *
+ * If the ring buffer is full, this routine waits for the consumer thread, or
+ * drains the buffer itself in the absence of threads.
+ */
+void stream_push(struct frame_stream * stream, struct pumas_medium * medium,
+    enum pumas_event event, struct pumas_state * state)
+{
+        const unsigned long head = stream->head;
+        const unsigned long capacity = stream->mask + 1;
+        if (head - STREAM_LOAD(&stream->tail) >= capacity) {
+#if (THREADS_MODE)
+                stream_wake(stream);
+                while (head - STREAM_LOAD(&stream->tail) >= capacity)
+                        sched_yield();
+#else
+                stream_drain(stream);
+#endif
+        }
+
+        /* The frame is zeroed first, such that no uninitialised padding
+         * bytes are written to disk. Note that the padding of the state is
+         * not copied.
+         */
+        struct pumas_stream_frame * frame =
+            stream->frames + (head & stream->mask);
+        memset(frame, 0x0, sizeof(*frame));
+        memcpy(&frame->state, state,
+            offsetof(struct pumas_state, decayed) + sizeof(state->decayed));
+        frame->track = stream->track;
+        frame->material = (medium == NULL) ? -1 : medium->material;
+        frame->event = event;
+        STREAM_STORE(&stream->head, head + 1);
+
+#if (THREADS_MODE)
+        /* Wake up the consumer when the buffer gets half full. */
+        if (head + 1 - STREAM_LOAD(&stream->tail) == capacity / 2)
+                stream_wake(stream);
+#endif
+}
+
+/**
+ * Drain all available frames from the ring buffer.
+ *
+ * @param stream       The stream of frames.
+ *
+ * This routine is called by the consumer side. Frames are forwarded by
+ * contiguous chunks.
+ */
+void stream_drain(struct frame_stream * stream)
+{
+        const unsigned long head = STREAM_LOAD(&stream->head);
+        unsigned long tail = stream->tail;
+        while (tail != head) {
+                const unsigned long i = tail & stream->mask;
+                unsigned long n = head - tail;
+                if (n > stream->mask + 1 - i) n = stream->mask + 1 - i;
+                if (stream->consumer != NULL) {
+                        stream->consumer(
+                            stream->recorder, (int)n, stream->frames + i);
+                } else if (stream->columns != NULL) {
+                        unsigned long j;
+                        for (j = 0; j < n; j++)
+                                columns_push(stream, stream->frames + i + j);
+                } else if (fwrite(stream->frames + i, sizeof(*stream->frames),
+                               n, stream->stream) != n) {
+                        stream->io_error = 1;
+                }
+                tail += n;
+                STREAM_STORE(&stream->tail, tail);
+        }
+}
+
+/**
+ * Wait until all frames have been drained.
+ *
+ * @param stream       The stream of frames.
+ */
+void stream_flush(struct frame_stream * stream)
+{
+#if (THREADS_MODE)
+        if (STREAM_LOAD(&stream->tail) != stream->head) {
+                stream_wake(stream);
+                while (STREAM_LOAD(&stream->tail) != stream->head)
+                        sched_yield();
+        }
+#else
+        stream_drain(stream);
+#endif
+        /* The consumer is idle at this point. Thus, the pending block of
+         * columns can be written from the calling thread.
+         */
+        if ((stream->columns != NULL) && (stream->columns->n_frames > 0))
+                columns_write(stream);
+        if ((stream->consumer == NULL) && (fflush(stream->stream) != 0))
+                stream->io_error = 1;
+}
+
+/**
+ * Release a stream of frames.
+ *
+ * @param stream       The stream of frames.
+ *
+ * The pending frames are drained and the consumer thread is stopped.
+ */
+void stream_destroy(struct frame_stream * stream)
+{
+        if (stream == NULL) return;
+#if (THREADS_MODE)
+        pthread_mutex_lock(&stream->mutex);
+        stream->stop = 1;
+        pthread_cond_signal(&stream->cond);
+        pthread_mutex_unlock(&stream->mutex);
+        pthread_join(stream->thread, NULL);
+        pthread_cond_destroy(&stream->cond);
+        pthread_mutex_destroy(&stream->mutex);
+#endif
+        stream_flush(stream);
+        deallocate(stream->columns);
+        deallocate(stream);
+}
+
+/**
+ * Allocate a new columns writer.
+ *
+ * @param block_size   The maximum number of frames per block.
+ * @param encoding     The encoding flags.
+ * @return The new columns writer or `NULL` in case of a memory error.
+ *
+ * All columns are allocated in a single memory segment, starting with the
+ * 8 bytes aligned ones.
+ */
+struct column_writer * columns_allocate(int block_size, int encoding)
+{
+        const int n_values = PUMAS_COLUMN_EVENT - PUMAS_COLUMN_ENERGY;
+        const size_t n = block_size;
+        struct column_writer * columns = allocate(sizeof(*columns) +
+            n * ((n_values + 1) * sizeof(double) + sizeof(long) +
+                    3 * sizeof(int)));
+        if (columns == NULL) return NULL;
+
+        columns->encoding = encoding &
+            (PUMAS_COLUMN_ENCODING_FLOAT | PUMAS_COLUMN_ENCODING_DELTA);
+        columns->block_size = block_size;
+        columns->n_frames = 0;
+        columns->n_tracks = 0;
+        double * ptr = columns->data;
+        int i;
+        for (i = 0; i < n_values; i++, ptr += n) columns->value[i] = ptr;
+        columns->scratch = ptr;
+        ptr += n;
+        columns->track = (long *)ptr;
+        columns->length = (int *)(columns->track + n);
+        columns->event = columns->length + n;
+        columns->material = columns->event + n;
+
+        return columns;
+}
+
+/**
+ * Append a frame to the current block of columns.
+ *
+ * @param stream       The stream of frames.
+ * @param frame        The frame to append.
+ *
+ * The block is written once it is full.
+ */
+void columns_push(
+    struct frame_stream * stream, const struct pumas_stream_frame * frame)
+{
+        struct column_writer * const columns = stream->columns;
+        const int i = columns->n_frames++;
+        const int k = columns->n_tracks - 1;
+        if ((k < 0) || (columns->track[k] != frame->track)) {
+                columns->track[k + 1] = frame->track;
+                columns->length[k + 1] = 1;
+                columns->n_tracks++;
+        } else {
+                columns->length[k]++;
+        }
+
+        const struct pumas_state * const state = &frame->state;
+        columns->value[0][i] = state->energy;
+        int j;
+        for (j = 0; j < 3; j++) {
+                columns->value[1 + j][i] = state->position[j];
+                columns->value[4 + j][i] = state->direction[j];
+        }
+        columns->value[7][i] = state->grammage;
+        columns->event[i] = frame->event;
+        columns->material[i] = frame->material;
+
+        if (columns->n_frames == columns->block_size) columns_write(stream);
+}
+
+/**
+ * Write the current block of columns.
+ *
+ * @param stream       The stream of frames.
+ *
+ * Floating point columns are encoded in the scratch buffer before being
+ * written. With delta encoding, differences are taken w.r.t. the decoded
+ * value of the previous frame. Thus, rounding errors do not accumulate when
+ * writing `float` values.
+ */
+void columns_write(struct frame_stream * stream)
+{
+        struct column_writer * const columns = stream->columns;
+        const int n = columns->n_frames;
+        const int use_float = columns->encoding & PUMAS_COLUMN_ENCODING_FLOAT;
+        const int use_delta = columns->encoding & PUMAS_COLUMN_ENCODING_DELTA;
+        const int value_size = use_float ? sizeof(float) : sizeof(double);
+
+        /* Write the block header. */
+        struct pumas_column_block header;
+        header.tag = PUMAS_COLUMN_TAG;
+        header.encoding = columns->encoding;
+        header.n_frames = n;
+        header.n_tracks = columns->n_tracks;
+        header.size[PUMAS_COLUMN_TRACK] = columns->n_tracks * sizeof(long);
+        header.size[PUMAS_COLUMN_LENGTH] = columns->n_tracks * sizeof(int);
+        int i;
+        for (i = PUMAS_COLUMN_ENERGY; i < PUMAS_COLUMN_EVENT; i++)
+                header.size[i] = n * value_size;
+        header.size[PUMAS_COLUMN_EVENT] = n * sizeof(int);
+        header.size[PUMAS_COLUMN_MATERIAL] = n * sizeof(int);
+
+        int error = 0;
+        if (fwrite(&header, sizeof(header), 1, stream->stream) != 1) error = 1;
+        if (fwrite(columns->track, sizeof(*columns->track), columns->n_tracks,
+                stream->stream) != (size_t)columns->n_tracks)
+                error = 1;
+        if (fwrite(columns->length, sizeof(*columns->length),
+                columns->n_tracks, stream->stream) != (size_t)columns->n_tracks)
+                error = 1;
+
+        /* Encode and write the floating point columns. */
+        for (i = PUMAS_COLUMN_ENERGY; i < PUMAS_COLUMN_EVENT; i++) {
+                const double * const value =
+                    columns->value[i - PUMAS_COLUMN_ENERGY];
+                const int delta = use_delta &&
+                    ((i <= PUMAS_COLUMN_POSITION_Z) ||
+                        (i == PUMAS_COLUMN_GRAMMAGE));
+                float * const f = columns->scratch;
+                double * const d = columns->scratch;
+                int j, k;
+                for (j = 0, k = 0; k < columns->n_tracks; k++) {
+                        const int last = j + columns->length[k];
+                        double previous = 0.;
+                        for (; j < last; j++) {
+                                const double x =
+                                    delta ? value[j] - previous : value[j];
+                                if (use_float) {
+                                        f[j] = (float)x;
+                                        previous += f[j];
+                                } else {
+                                        d[j] = x;
+                                        previous += x;
+                                }
+                        }
+                }
+                if (fwrite(columns->scratch, value_size, n, stream->stream) !=
+                    (size_t)n)
+                        error = 1;
+        }
+
+        /* Write the integer columns. */
+        if (fwrite(columns->event, sizeof(*columns->event), n,
+                stream->stream) != (size_t)n)
+                error = 1;
+        if (fwrite(columns->material, sizeof(*columns->material), n,
+                stream->stream) != (size_t)n)
+                error = 1;
+
+        if (error) stream->io_error = 1;
+        columns->n_frames = 0;
+        columns->n_tracks = 0;
+}
+
+#if (THREADS_MODE)
+/**
+ * Wake up the consumer thread.
+ *
+ * @param stream       The stream of frames.
+ */
+void stream_wake(struct frame_stream * stream)
+{
+        pthread_mutex_lock(&stream->mutex);
+        stream->wake = 1;
+        pthread_cond_signal(&stream->cond);
+        pthread_mutex_unlock(&stream->mutex);
+}
+
+/**
+ * Main loop of the consumer thread.
+ *
+ * @param args         The stream of frames.
+ * @return `NULL`.
+ *
+ * The consumer drains the ring buffer and then sleeps until it is woken up.
+ */
+void * stream_consume(void * args)
+{
+        struct frame_stream * const stream = args;
+        for (;;) {
+                stream_drain(stream);
+
+                pthread_mutex_lock(&stream->mutex);
+                while (!stream->wake && !stream->stop)
+                        pthread_cond_wait(&stream->cond, &stream->mutex);
+                const int stop = stream->stop;
+                stream->wake = 0;
+                pthread_mutex_unlock(&stream->mutex);
+
+                if (stop) break;
+        }
+        stream_drain(stream);
+
+        return NULL;
+}
+#endif
+
+#undef STREAM_LOAD
+#undef STREAM_STORE
+
+/* Low level routines: built-in geometries. */
+/**
+ * Locals callback for the media of built-in geometries.
+ *
+ * @param medium       The medium.
+ * @param state        The Monte Carlo state.
+ * @param locals       The local properties.
+ * @return Zero, i.e. no step limitation.
+ *
+ * Non uniform density laws do not limit the step length, since their column
+ * density is integrated analytically along the step (see `step_transport`).
+ */
+double geometry_locals(struct pumas_medium * medium,
+    struct pumas_state * state, struct pumas_locals * locals)
+{
+        const struct geometry_medium * const medium_ = (void *)medium;
+        const struct pumas_density_law * const law = &medium_->law;
+        memset(locals->magnet, 0x0, sizeof(locals->magnet));
+        if (law->model == PUMAS_DENSITY_UNIFORM) {
+                locals->density = law->coefficients[0];
+                return 0.;
+        }
+
+        /* Evaluate the density law. */
+        const double * const r = state->position;
+        const double h = medium_->radial ?
+            sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]) :
+            r[2];
+        double derivative;
+        locals->density = density_law_evaluate(law, h, &derivative);
+        return 0.;
+}
+
+/**
+ * Evaluate a density law.
+ *
+ * @param law          The density law.
+ * @param h            The coordinate of the density law.
+ * @param derivative   The derivative of the density w.r.t. *h*.
+ * @return The density, in kg/m^3.
+ */
+double density_law_evaluate(
+    const struct pumas_density_law * law, double h, double * derivative)
+{
+        const double * const c = law->coefficients;
+        const double x = h - law->origin;
+        if (law->model == PUMAS_DENSITY_EXPONENTIAL) {
+                const double rho = c[0] * exp(x / law->length);
+                *derivative = rho / law->length;
+                return rho;
+        } else if (law->model == PUMAS_DENSITY_POLYNOMIAL) {
+                *derivative = c[1] + x * (2. * c[2] + x * 3. * c[3]);
+                return c[0] + x * (c[1] + x * (c[2] + x * c[3]));
+        } else {
+                *derivative = 0.;
+                return c[0];
+        }
+}
+
+/**
+ * Check that a density law is strictly positive over a range.
+ *
+ * @param law          The density law.
+ * @param h0           The lower bound of the range.
+ * @param h1           The upper bound of the range.
+ * @return `1` if the density is strictly positive, `0` otherwise.
+ *
+ * The density is checked at the bounds of the range. For a polynomial law, it
+ * is also checked at the roots of its derivative that lie within the range,
+ * i.e. at its local extrema.
+ */
+int density_law_check(
+    const struct pumas_density_law * law, double h0, double h1)
+{
+        double tmp;
+        if (!(density_law_evaluate(law, h0, &tmp) > 0.) ||
+            !(density_law_evaluate(law, h1, &tmp) > 0.))
+                return 0;
+        if (law->model != PUMAS_DENSITY_POLYNOMIAL) return 1;
+
+        /* Solve c1 + 2 c2 x + 3 c3 x^2 = 0, in a numerically stable way. */
+        const double * const c = law->coefficients;
+        const double a = 3. * c[3], b = 2. * c[2];
+        double roots[2];
+        int i, n = 0;
+        if (a == 0.) {
+                if (b != 0.) roots[n++] = -c[1] / b;
+        } else {
+                const double delta = b * b - 4. * a * c[1];
+                if (delta >= 0.) {
+                        const double q = -0.5 * (b + copysign(sqrt(delta), b));
+                        roots[n++] = q / a;
+                        if (q != 0.) roots[n++] = c[1] / q;
+                }
+        }
+        for (i = 0; i < n; i++) {
+                const double h = roots[i] + law->origin;
+                if ((h > h0) && (h < h1) &&
+                    !(density_law_evaluate(law, h, &tmp) > 0.))
+                        return 0;
+        }
+        return 1;
+}
+
+/**
+ * Get the medium of a built-in geometry with a non uniform density law.
+ *
+ * @param medium       The medium.
+ * @return The built-in medium, or `NULL` if not relevant.
+ */
+const struct geometry_medium * geometry_analytic(
+    const struct pumas_medium * medium)
+{
+        if (medium->locals != &geometry_locals) return NULL;
+        const struct geometry_medium * const medium_ = (const void *)medium;
+        return (medium_->law.model == PUMAS_DENSITY_UNIFORM) ? NULL : medium_;
+}
+
+/**
+ * Compute the column density along a straight step.
+ *
+ * @param medium       The built-in medium.
+ * @param position     The start position of the step.
+ * @param direction    The propagation direction.
+ * @param step         The step length.
+ * @return The column density, in kg/m^2.
+ *
+ * The integral is computed in closed form for an axial law. For a radial law,
+ * a composite 4 points Gauss-Legendre quadrature is used instead, with panels
+ * smaller than the length scale of the density variations.
+ */
+double geometry_grammage(const struct geometry_medium * medium,
+    const double * position, const double * direction, double step)
+{
+        if (step <= 0.) return 0.;
+        const struct pumas_density_law * const law = &medium->law;
+        const double * const c = law->coefficients;
+
+        if (!medium->radial) {
+                const double x = position[2] - law->origin;
+                const double u = direction[2];
+                if (law->model == PUMAS_DENSITY_EXPONENTIAL) {
+                        const double rho = c[0] * exp(x / law->length);
+                        const double a = u * step / law->length;
+                        return (a == 0.) ? rho * step :
+                                           rho * step * expm1(a) / a;
+                } else {
+                        /* Integrate the Taylor expansion along the step. */
+                        const double a0 =
+                            c[0] + x * (c[1] + x * (c[2] + x * c[3]));
+                        const double a1 =
+                            (c[1] + x * (2. * c[2] + x * 3. * c[3])) * u;
+                        const double a2 = (c[2] + x * 3. * c[3]) * u * u;
+                        const double a3 = c[3] * u * u * u;
+                        return step * (a0 + step * (0.5 * a1 +
+                                          step * (a2 / 3. + 0.25 * step * a3)));
+                }
+        }
+
+        /* Split the step at the point of closest approach to the centre. */
+        const double * const r = position;
+        const double * const u = direction;
+        const double r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+        const double b = r[0] * u[0] + r[1] * u[1] + r[2] * u[2];
+        const double p2 = r2 - b * b;
+        const double p = (p2 > 0.) ? sqrt(p2) : 0.;
+        double bounds[3] = { 0., step, step };
+        int n_parts = 1;
+        if ((b < 0.) && (step > -b)) {
+                bounds[1] = -b;
+                n_parts = 2;
+        }
+
+        /* Integrate with a composite Gauss-Legendre quadrature. The panels
+         * are smaller than the density scale and than the impact parameter of
+         * the ray, which bounds the curvature of the radius along the step.
+         */
+        const double xGL[4] = { -0.8611363115940526, -0.3399810435848563,
+                0.3399810435848563, 0.8611363115940526 };
+        const double wGL[4] = { 0.3478548451374538, 0.6521451548625461,
+                0.6521451548625461, 0.3478548451374538 };
+        double grammage = 0.;
+        int k;
+        for (k = 0; k < n_parts; k++) {
+                const double s0 = bounds[k];
+                const double s1 = bounds[k + 1];
+                const double length = s1 - s0;
+                const double ha = sqrt(fabs(r2 + s0 * (2. * b + s0)));
+                const double hb = sqrt(fabs(r2 + s1 * (2. * b + s1)));
+                double m = 2. * fabs(hb - ha) / medium->scale;
+                if ((p > 0.) && (length > m * p)) m = length / p;
+                const int n = (m < 1000.) ? 1 + (int)m : 1000;
+                const double ds = length / n;
+                double sum = 0.;
+                int i;
+                for (i = 0; i < n; i++) {
+                        int j;
+                        for (j = 0; j < 4; j++) {
+                                const double s =
+                                    s0 + (i + 0.5 * (1. + xGL[j])) * ds;
+                                const double h2 = r2 + s * (2. * b + s);
+                                const double h = (h2 > 0.) ? sqrt(h2) : 0.;
+                                double derivative;
+                                sum += wGL[j] *
+                                    density_law_evaluate(law, h, &derivative);
+                        }
+                }
+                grammage += 0.5 * ds * sum;
+        }
+        return grammage;
+}
+
+/**
+ * Compute the column density over a segment of a straight step.
+ *
+ * @param medium       The built-in medium.
+ * @param position     The start position of the step.
+ * @param direction    The propagation direction.
+ * @param s0           The start of the segment, along the step.
+ * @param s1           The end of the segment, along the step.
+ * @return The column density, in kg/m^2.
+ */
+double geometry_grammage_segment(const struct geometry_medium * medium,
+    const double * position, const double * direction, double s0, double s1)
+{
+        const double r[3] = { position[0] + s0 * direction[0],
+                position[1] + s0 * direction[1],
+                position[2] + s0 * direction[2] };
+        return geometry_grammage(medium, r, direction, s1 - s0);
+}
+
+/**
+ * Compute the distance for a given column density along a straight step.
+ *
+ * @param medium       The built-in medium.
+ * @param position     The start position of the step.
+ * @param direction    The propagation direction.
+ * @param grammage     The column density, in kg/m^2.
+ * @param step_max     The maximum step length, or zero if unbounded.
+ * @return The distance, in m.
+ *
+ * The distance is bounded by *step_max*. For an exponential axial law it is
+ * computed in closed form. Otherwise, the column density is inverted with
+ * Newton iterations, safeguarded by bisection, down to a relative accuracy of
+ * `FLT_EPSILON`. The distance is first bracketed by doubling, starting from the
+ * distance at the initial density, such that the column density is integrated
+ * only as far as needed. Then, it is integrated from the closest end of the
+ * bracketing interval, thus over a shrinking range.
+ *
+ * For an unbounded step, the bracketing stops after `DOUBLINGS_MAX` doublings,
+ * or once the column density no longer increases, e.g. if the density
+ * vanishes at infinity. The last distance is then returned.
+ */
+double geometry_distance(const struct geometry_medium * medium,
+    const double * position, const double * direction, double grammage,
+    double step_max)
+{
+#define DOUBLINGS_MAX 40
+#define ITERATIONS_MAX 50
+
+        if (grammage <= 0.) return 0.;
+        const struct pumas_density_law * const law = &medium->law;
+        const double * const r = position;
+        const double * const u = direction;
+        const double h0 = medium->radial ?
+            sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]) :
+            r[2];
+        double derivative;
+        const double rho0 = density_law_evaluate(law, h0, &derivative);
+
+        if (!medium->radial && (u[2] == 0.)) {
+                /* The density is constant along the step. */
+                const double s = grammage / rho0;
+                return ((step_max > 0.) && (s > step_max)) ? step_max : s;
+        } else if (!medium->radial &&
+            (law->model == PUMAS_DENSITY_EXPONENTIAL)) {
+                const double a = grammage * u[2] / (law->length * rho0);
+                if (a > -1.) {
+                        const double s = law->length / u[2] * log1p(a);
+                        return ((step_max > 0.) && (s > step_max)) ?
+                            step_max : s;
+                } else if (step_max > 0.) {
+                        return step_max;
+                }
+        }
+
+        /* Bracket the distance, starting from the distance at the initial
+         * density.
+         */
+        double s0 = 0., g0 = 0.;
+        double s1 = grammage / rho0;
+        if ((step_max > 0.) && (s1 > step_max)) s1 = step_max;
+        double g1 = geometry_grammage(medium, r, u, s1);
+        int i;
+        for (i = 0; g1 <= grammage; i++) {
+                if (step_max > 0.) {
+                        if (s1 >= step_max) return step_max;
+                } else if (i >= DOUBLINGS_MAX) {
+                        return s1;
+                }
+                s0 = s1;
+                g0 = g1;
+                s1 = 2. * s0;
+                if ((step_max > 0.) && (s1 > step_max)) s1 = step_max;
+                const double dg =
+                    geometry_grammage_segment(medium, r, u, s0, s1);
+                g1 = g0 + dg;
+                if ((step_max <= 0.) && (g1 <= grammage) &&
+                    (dg <= FLT_EPSILON * g0))
+                        return s1;
+        }
+
+        /* Invert the column density, starting with a Newton step from the
+         * upper bound.
+         */
+        double s;
+        {
+                const double p[3] = { r[0] + s1 * u[0], r[1] + s1 * u[1],
+                        r[2] + s1 * u[2] };
+                const double h = medium->radial ?
+                    sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]) :
+                    p[2];
+                s = s1 - (g1 - grammage) /
+                        density_law_evaluate(law, h, &derivative);
+        }
+        if (!(s > s0) || !(s < s1)) s = 0.5 * (s0 + s1);
+        for (i = 0; i < ITERATIONS_MAX; i++) {
+                const double g = (s - s0 <= s1 - s) ?
+                    g0 + geometry_grammage_segment(medium, r, u, s0, s) :
+                    g1 - geometry_grammage_segment(medium, r, u, s, s1);
+                const double f = g - grammage;
+                if (f == 0.) {
+                        break;
+                } else if (f < 0.) {
+                        s0 = s;
+                        g0 = g;
+                } else {
+                        s1 = s;
+                        g1 = g;
+                }
+                const double p[3] = { r[0] + s * u[0], r[1] + s * u[1],
+                        r[2] + s * u[2] };
+                const double h = medium->radial ?
+                    sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]) :
+                    p[2];
+                const double rho = density_law_evaluate(law, h, &derivative);
+                double sn = s - f / rho;
+                if (!(sn > s0) || !(sn < s1)) sn = 0.5 * (s0 + s1);
+                const double ds = fabs(sn - s);
+                s = sn;
+                if (ds <= FLT_EPSILON * s) break;
+        }
+        return s;
+
+#undef DOUBLINGS_MAX
+#undef ITERATIONS_MAX
 }
 
 /**
- * Compute the order 0 and 1 transport coefficients.
+ * Compare the properties of two cells of a voxelised geometry.
  *
- * @param mu           The angular cut-off.
- * @param fspin        The spin factor.
- * @param n_parameters The number of screening parameters.
- * @param screening    The screening factors.
- * @param a            The poles 1st order coefficients.
- * @param b            The poles 2nd order coefficients.
- * @param c            The poles nuclear coefficients.
- * @param coefficient  The computed transport coefficients.
+ * @param a            The first cell.
+ * @param b            The second cell.
+ * @return A negative, null or positive value, as for `qsort`.
  */
-void coulomb_transport_coefficients(double mu_, double fspin, int n_parameters,
-    const double * screening, const long double * a, const long double * b,
-    const long double * c, double * coefficient)
+int voxels_compare(const void * a, const void * b)
 {
-        /* Sum up all factors of the pole reduction.
-         *
-         * Note: we make use of sum(a_i) + c_0 = 0 in order to eliminate some
-         * unstable terms from the summation.
-         */
-        const long double S = fspin;
-        const long double mu = mu_;
+        const struct voxel_sort * const va = a;
+        const struct voxel_sort * const vb = b;
+        if (va->material != vb->material)
+                return (va->material < vb->material) ? -1 : 1;
+        if (va->density != vb->density)
+                return (va->density < vb->density) ? -1 : 1;
+        return 0;
+}
 
-        const int n = n_parameters - 1;
-        double cs0 = 0., cs1 = 0.;
-        int i;
-        for (i = 0; i < n; i++) {
-                const long double alp = screening[i];
-                const long double r = mu / (mu + alp);
-                const long double L = logl(1. + mu / alp);
-                const long double I0 = r / alp;
-                const long double J0 = L;
-                const long double I1 = L - r;
-                const long double J1 = -alp * L;
-                const long double I2 = mu + alp * (r - 2. * L);
-                const long double J2 = alp * (alp * L - mu);
+/**
+ * Medium callback for a voxelised geometry.
+ *
+ * @param context      The simulation context.
+ * @param state        The Monte Carlo state.
+ * @param medium       The located medium, or `NULL`.
+ * @param step         The proposed step, or `NULL`.
+ * @return `PUMAS_STEP_EXACT`.
+ *
+ * The grid is traversed with a 3D-DDA, along the propagation direction, until
+ * a cell with a different medium is reached or until the grid is exited.
+ */
+enum pumas_step voxels_medium(struct pumas_context * context,
+    struct pumas_state * state, struct pumas_medium ** medium, double * step)
+{
+        const struct simulation_context * const context_ = (void *)context;
+        const struct voxel_geometry * const geometry =
+            (void *)context_->geometry;
+
+        /* Locate the cell. */
+        int index[3], i;
+        for (i = 0; i < 3; i++) {
+                const double u = (state->position[i] - geometry->origin[i]) /
+                    geometry->spacing[i];
+                if (!(u >= 0.) || !(u < geometry->shape[i])) {
+                        if (medium != NULL) *medium = NULL;
+                        if (step != NULL) *step = 0.;
+                        return PUMAS_STEP_EXACT;
+                }
+                index[i] = (int)u;
+        }
+        const int * const shape = geometry->shape;
+        const int cell = index[0] + shape[0] * (index[1] + shape[1] * index[2]);
+        const int m = geometry->cells[cell];
+        if (medium != NULL) *medium = &geometry->base.media[m].api;
+        if (step == NULL) return PUMAS_STEP_EXACT;
 
-                cs0 += a[i] * (J0 - S * J1) + b[i] * (I0 - S * I1);
-                cs1 += a[i] * (J1 - S * J2) + b[i] * (I1 - S * I2);
+        /* Initialise the DDA. */
+        const double sgn =
+            (context->mode.direction == PUMAS_MODE_FORWARD) ? 1. : -1.;
+        double t_max[3], t_delta[3];
+        int increment[3], offset[3];
+        offset[0] = 1;
+        offset[1] = shape[0];
+        offset[2] = shape[0] * shape[1];
+        for (i = 0; i < 3; i++) {
+                const double d = sgn * state->direction[i];
+                const double h = geometry->spacing[i];
+                if (d > 0.) {
+                        increment[i] = 1;
+                        t_max[i] = (geometry->origin[i] + (index[i] + 1) * h -
+                                       state->position[i]) / d;
+                        t_delta[i] = h / d;
+                } else if (d < 0.) {
+                        increment[i] = -1;
+                        t_max[i] = (geometry->origin[i] + index[i] * h -
+                                       state->position[i]) / d;
+                        t_delta[i] = -h / d;
+                } else {
+                        increment[i] = 0;
+                        t_max[i] = DBL_MAX;
+                        t_delta[i] = 0.;
+                }
         }
 
-        const long double N = screening[n];
-        const long double r = mu / (mu + N);
-        const long double L = logl(1. + mu / N);
-        const long double I0 = r / N;
-        const long double J0 = L;
-        const long double I1 = L - r;
-        const long double J1 = -N * L;
-        const long double I2 = mu + N * (r - 2. * L);
-        const long double J2 = N * (N * L - mu);
+        /* Traverse the cells with the same medium. */
+        double t;
+        int c = cell;
+        for (;;) {
+                i = (t_max[0] < t_max[1]) ? 0 : 1;
+                if (t_max[2] < t_max[i]) i = 2;
+                t = t_max[i];
+                if (increment[i] == 0) break;
+                index[i] += increment[i];
+                if ((index[i] < 0) || (index[i] >= shape[i])) break;
+                c += increment[i] * offset[i];
+                if (geometry->cells[c] != m) break;
+                t_max[i] += t_delta[i];
+        }
 
-        const long double rn = 1. / (1. + mu / N);
-        const long double K0 = (1. - rn) * (1. + rn) / (2 * N * N);
-        const long double L0 = (1. - rn) * ((1. + rn) * (1. + rn) - rn) /
-            (3 * N * N * N);
-        const long double K1 = I0 - N * K0;
-        const long double L1 = K0 - N * L0;
-        const long double K2 = I1 - N * K1;
-        const long double L2 = K1 - N * L1;
+        /* A null step would stand for an infinite medium. */
+        *step = (t > 0.) ? t : 0.5 * STEP_MIN;
 
-        cs0 += c[0] * (J0 - S * J1) +
-               c[1] * (I0 - S * I1) +
-               c[2] * (K0 - S * K1) +
-               c[3] * (L0 - S * L1);
-        cs1 += c[0] * (J1 - S * J2) +
-               c[1] * (I1 - S * I2) +
-               c[2] * (K1 - S * K2) +
-               c[3] * (L1 - S * L2);
+        return PUMAS_STEP_EXACT;
+}
 
-        coefficient[0] = cs0;
-        coefficient[1] = 2 * cs1;
+/**
+ * Medium callback for a stratified geometry.
+ *
+ * @param context      The simulation context.
+ * @param state        The Monte Carlo state.
+ * @param medium       The located medium, or `NULL`.
+ * @param step         The proposed step, or `NULL`.
+ * @return `PUMAS_STEP_EXACT`.
+ *
+ * The proposed step is the distance to the next layer boundary, along the
+ * propagation direction. Horizontal rays in planar layers never exit their
+ * layer. Thus, an infinite step is proposed.
+ */
+enum pumas_step layers_medium(struct pumas_context * context,
+    struct pumas_state * state, struct pumas_medium ** medium, double * step)
+{
+        const struct simulation_context * const context_ = (void *)context;
+        const struct layer_geometry * const geometry =
+            (void *)context_->geometry;
+        const double * const boundaries = geometry->boundaries;
+        const double * const r = state->position;
+
+        /* Locate the layer. */
+        const double r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+        const double h = geometry->spherical ? sqrt(r2) : r[2];
+        if (!(h >= boundaries[0]) || !(h < boundaries[geometry->n_layers])) {
+                if (medium != NULL) *medium = NULL;
+                if (step != NULL) *step = 0.;
+                return PUMAS_STEP_EXACT;
+        }
+        int i0 = 0, i1 = geometry->n_layers;
+        while (i1 - i0 > 1) {
+                const int i2 = (i0 + i1) / 2;
+                if (h >= boundaries[i2])
+                        i0 = i2;
+                else
+                        i1 = i2;
+        }
+        if (medium != NULL) *medium = &geometry->base.media[i0].api;
+        if (step == NULL) return PUMAS_STEP_EXACT;
+
+        /* Intersect the propagation ray with the layer boundaries. */
+        const double sgn =
+            (context->mode.direction == PUMAS_MODE_FORWARD) ? 1. : -1.;
+        const double * const u = state->direction;
+        double s;
+        if (geometry->spherical) {
+                /* Solve |r + s * d|^2 = R^2 in a numerically stable way. */
+                const double b =
+                    sgn * (r[0] * u[0] + r[1] * u[1] + r[2] * u[2]);
+                const double R1 = boundaries[i0 + 1];
+                const double c1 = r2 - R1 * R1;
+                const double q1 = sqrt(b * b - c1);
+                s = (b > 0.) ? -c1 / (b + q1) : q1 - b;
+                const double R0 = boundaries[i0];
+                if ((b < 0.) && (R0 > 0.)) {
+                        const double c0 = r2 - R0 * R0;
+                        const double delta = b * b - c0;
+                        if (delta >= 0.) {
+                                const double s0 = c0 / (sqrt(delta) - b);
+                                if (s0 < s) s = s0;
+                        }
+                }
+        } else {
+                const double d = sgn * u[2];
+                if (d > 0.)
+                        s = (boundaries[i0 + 1] - r[2]) / d;
+                else if (d < 0.)
+                        s = (boundaries[i0] - r[2]) / d;
+                else
+                        s = 0.;
+        }
+
+        /* A null step would stand for an infinite medium. */
+        if ((s <= 0.) && (geometry->spherical || (u[2] != 0.)))
+                s = 0.5 * STEP_MIN;
+        *step = s;
+
+        return PUMAS_STEP_EXACT;
 }
 
 /**
- * The 1st transport cross-section for multiple scattering on electronic
- * shells.
+ * Medium callback for a terrain geometry.
  *
- * @param ZoA      The target Z over A ratio.
- * @param I        The target mean excitation energy.
- * @param aS       The target electronic scaling parameter.
- * @param mass     The projectile rest mass.
- * @param kinetic  The projectile initiale kinetic energy.
- * @param nu       The projectile energy loss cutoff.
- * @return The inverse of the electronic 1st transport path length in kg/m^2.
+ * @param context      The simulation context.
+ * @param state        The Monte Carlo state.
+ * @param medium       The located medium, or `NULL`.
+ * @param step         The proposed step, or `NULL`.
+ * @return `PUMAS_STEP_EXACT`.
  *
- * The contribution from atomic electronic shells is computed following
- * Salvat et al., NIMB316 (2013) 144-159, using small angle approximation for
- * close collisions and keeping only leading term for distant ones.
+ * The proposed step is the distance to the topography surface, or to the
+ * geometry bounds, along the propagation direction.
  */
-double transverse_transport_electronic(double ZoA, double I, double aS,
-    double mass, double kinetic, double nu)
+enum pumas_step terrain_medium(struct pumas_context * context,
+    struct pumas_state * state, struct pumas_medium ** medium, double * step)
 {
-        /* Soft close and distant interactions restricted to cutoff. */
-        const double momentum2 = kinetic * (kinetic + 2. * mass);
-        const double E = kinetic + mass;
-        const double Wr = 2. * ELECTRON_MASS * momentum2 /
-            (mass * mass + ELECTRON_MASS * (ELECTRON_MASS + 2. * E));
-        const double Wmax = (nu > Wr) ? Wr : nu;
+        const struct simulation_context * const context_ = (void *)context;
+        const struct terrain_geometry * const geometry =
+            (void *)context_->geometry;
+        const double * const r = state->position;
 
-        const double beta2 = momentum2 / (E * E);
-        const double J = log(aS * Wmax / I) - beta2 * Wmax / Wr +
-            0.25 * Wmax * Wmax / (E * E) + 1 / aS;
+        /* Locate the medium. */
+        double lower[3], upper[3];
+        int i;
+        for (i = 0; i < 2; i++) {
+                lower[i] = geometry->origin[i];
+                upper[i] = geometry->origin[i] +
+                    (geometry->shape[i] - 1) * geometry->spacing;
+        }
+        lower[2] = geometry->bottom;
+        upper[2] = geometry->top;
+        int inside = (r[2] >= lower[2]) && (r[2] < upper[2]);
+        for (i = 0; (i < 2) && inside; i++)
+                inside = (r[i] >= lower[i]) && (r[i] <= upper[i]);
+        int sky = 0;
+        if (inside) {
+                sky = (r[2] >= terrain_height(geometry, r[0], r[1]));
+                if (sky >= geometry->base.n_media) inside = 0;
+        }
+        if (!inside) {
+                if (medium != NULL) *medium = NULL;
+                if (step != NULL) *step = 0.;
+                return PUMAS_STEP_EXACT;
+        }
+        if (medium != NULL) *medium = &geometry->base.media[sky].api;
+        if (step == NULL) return PUMAS_STEP_EXACT;
+
+        /* Compute the distance to the geometry bounds. */
+        const double sgn =
+            (context->mode.direction == PUMAS_MODE_FORWARD) ? 1. : -1.;
+        const double u[3] = { sgn * state->direction[0],
+                sgn * state->direction[1], sgn * state->direction[2] };
+        double s = DBL_MAX;
+        for (i = 0; i < 3; i++) {
+                double si;
+                if (u[i] > 0.)
+                        si = (upper[i] - r[i]) / u[i];
+                else if (u[i] < 0.)
+                        si = (lower[i] - r[i]) / u[i];
+                else
+                        continue;
+                if (si < s) s = si;
+        }
 
-        /* Electronic Bremsstrahlung correction. */
-        const double gamma = E / mass;
-        const double lQ = log(1. + 2. * Wr / ELECTRON_MASS);
-        const double Delta =
-            ALPHA_EM / (2 * M_PI) * (log(2. * gamma) - lQ / 3.) * lQ * lQ;
+        /* Intersect the propagation ray with the topography surface. */
+        const double t = terrain_intersect(
+            geometry, geometry->n_levels - 1, 0, 0, r, u, 0., s);
+        if (t >= 0.) s = t;
 
-        /* First transport cross-section */
-        return 2 * M_PI * ELECTRON_RADIUS * ELECTRON_RADIUS * ELECTRON_MASS *
-            ELECTRON_MASS * AVOGADRO_NUMBER * ZoA /
-            (beta2 * 1E-03 * momentum2) * (J + Delta);
+        /* A null step would stand for an infinite medium. */
+        *step = (s > 0.) ? s : 0.5 * STEP_MIN;
+
+        return PUMAS_STEP_EXACT;
 }
 
-/* Low level routine: helper function for recording a MC state. */
 /**
- * Register a Monte-Carlo state.
- *
- * @param recorder     The recorder handle.
- * @param medium       The medium in which the particle is located.
- * @param event        The current stepping event.
- * @param state        The Monte-Carlo state to record.
+ * Interpolate the elevation of a terrain geometry.
  *
- * This routine adds the given state to the recorder's stack.
+ * @param geometry     The terrain geometry.
+ * @param x            The x coordinate, inside the geometry.
+ * @param y            The y coordinate, inside the geometry.
+ * @return The elevation, in m.
  */
-void record_state(struct pumas_context * context, struct pumas_medium * medium,
-    enum pumas_event event, struct pumas_state * state)
+double terrain_height(
+    const struct terrain_geometry * geometry, double x, double y)
 {
-        /* Check for a user supplied recorder */
-        struct pumas_recorder * recorder = context->recorder;
-        if (recorder->record != NULL) {
-                recorder->record(context, state, medium, event);
-                return;
+        const int * const shape = geometry->shape;
+        double u = (x - geometry->origin[0]) / geometry->spacing;
+        double v = (y - geometry->origin[1]) / geometry->spacing;
+        int i = (int)u, j = (int)v;
+        if (i > shape[0] - 2) i = shape[0] - 2;
+        if (j > shape[1] - 2) j = shape[1] - 2;
+        u -= i;
+        v -= j;
+        const double * const h = geometry->heights + i + j * shape[0];
+        return (h[0] * (1. - u) + h[1] * u) * (1. - v) +
+            (h[shape[0]] * (1. - u) + h[shape[0] + 1] * u) * v;
+}
+
+/**
+ * Clip a ray segment to a node of the quadtree of a terrain geometry.
+ *
+ * @param geometry     The terrain geometry.
+ * @param level        The level of the node.
+ * @param i            The node index along x.
+ * @param j            The node index along y.
+ * @param position     The origin of the ray.
+ * @param direction    The direction of the ray.
+ * @param t0           The start of the segment, updated at return.
+ * @param t1           The end of the segment, updated at return.
+ * @return `1` if the clipped segment is not empty, `0` otherwise.
+ *
+ * With an odd number of cells along an axis, the last node of a level has a
+ * single child along this axis. The missing child yields `0`.
+ */
+int terrain_clip(const struct terrain_geometry * geometry, int level, int i,
+    int j, const double * position, const double * direction, double * t0,
+    double * t1)
+{
+        const int index[2] = { i, j };
+        int k;
+        for (k = 0; k < 2; k++) {
+                const int n = geometry->shape[k] - 1;
+                const int c0 = index[k] << level;
+                if (c0 >= n) return 0;
+                int c1 = (index[k] + 1) << level;
+                if (c1 > n) c1 = n;
+                const double x0 = geometry->origin[k] +
+                    c0 * geometry->spacing;
+                const double x1 = geometry->origin[k] +
+                    c1 * geometry->spacing;
+                const double r = position[k], u = direction[k];
+                if (u == 0.) {
+                        if ((r < x0) || (r > x1)) return 0;
+                        continue;
+                }
+                double ta = (x0 - r) / u, tb = (x1 - r) / u;
+                if (ta > tb) {
+                        const double tmp = ta;
+                        ta = tb;
+                        tb = tmp;
+                }
+                if (ta > *t0) *t0 = ta;
+                if (tb < *t1) *t1 = tb;
         }
+        return (*t0 <= *t1);
+}
 
-        /* Do the default recording ... */
-        struct frame_recorder * const rec =
-            (struct frame_recorder * const)recorder;
-        struct frame_stack * stack = rec->stack;
-        struct pumas_frame * frame = NULL;
+/**
+ * Intersect a ray segment with the topography surface of a terrain geometry.
+ *
+ * @param geometry     The terrain geometry.
+ * @param level        The level of the quadtree node.
+ * @param i            The node index along x.
+ * @param j            The node index along y.
+ * @param position     The origin of the ray.
+ * @param direction    The direction of the ray.
+ * @param t0           The start of the segment, within the node.
+ * @param t1           The end of the segment, within the node.
+ * @return The first intersection, or a negative value if there is none.
+ *
+ * Nodes whose elevation range does not overlap with the segment are skipped.
+ * Otherwise, the children nodes are traversed in the order of the ray. In a
+ * cell, the elevation is bilinear. Thus, the intersection is the smallest root
+ * of a quadratic polynomial.
+ */
+double terrain_intersect(const struct terrain_geometry * geometry,
+    int level, int i, int j, const double * position,
+    const double * direction, double t0, double t1)
+{
+        /* Check the elevation range of the node. */
+        const int nx = ((geometry->shape[0] - 1) + (1 << level) - 1) >> level;
+        const double * const bounds =
+            geometry->bounds + 2 * (geometry->offsets[level] + i + j * nx);
+        const double z0 = position[2] + t0 * direction[2];
+        const double z1 = position[2] + t1 * direction[2];
+        if (((z0 < bounds[0]) && (z1 < bounds[0])) ||
+            ((z0 > bounds[1]) && (z1 > bounds[1])))
+                return -1.;
+
+        if (level > 0) {
+                /* Sort the children nodes by entry distance. */
+                int children[4][2], n = 0, k;
+                double ta[4], tb[4];
+                for (k = 0; k < 4; k++) {
+                        const int ic = 2 * i + k % 2, jc = 2 * j + k / 2;
+                        double t0c = t0, t1c = t1;
+                        if (!terrain_clip(geometry, level - 1, ic, jc,
+                                position, direction, &t0c, &t1c))
+                                continue;
+                        int m;
+                        for (m = n; (m > 0) && (ta[m - 1] > t0c); m--) {
+                                ta[m] = ta[m - 1];
+                                tb[m] = tb[m - 1];
+                                children[m][0] = children[m - 1][0];
+                                children[m][1] = children[m - 1][1];
+                        }
+                        ta[m] = t0c;
+                        tb[m] = t1c;
+                        children[m][0] = ic;
+                        children[m][1] = jc;
+                        n++;
+                }
 
-        if ((stack == NULL) || (stack->size < (int)sizeof(*frame))) {
-                /* Allocate a new memory segment. */
-                const int size = 4096;
-                stack = allocate(size);
-                if (stack == NULL) return;
-                stack->size = size - sizeof(*stack);
-                stack->frame = stack->frames;
-                stack->next = rec->stack;
-                rec->stack = stack;
+                /* Traverse the children nodes. */
+                for (k = 0; k < n; k++) {
+                        const double t = terrain_intersect(geometry,
+                            level - 1, children[k][0], children[k][1],
+                            position, direction, ta[k], tb[k]);
+                        if (t >= 0.) return t;
+                }
+                return -1.;
+        }
+
+        /* Solve for the bilinear surface in the cell, from t0. */
+        const int * const shape = geometry->shape;
+        const double * const h = geometry->heights + i + j * shape[0];
+        const double a = h[0];
+        const double b = h[1] - h[0];
+        const double c = h[shape[0]] - h[0];
+        const double d = h[0] - h[1] - h[shape[0]] + h[shape[0] + 1];
+        const double hi = 1. / geometry->spacing;
+        const double u0 = (position[0] + t0 * direction[0] -
+                              geometry->origin[0]) * hi - i;
+        const double v0 = (position[1] + t0 * direction[1] -
+                              geometry->origin[1]) * hi - j;
+        const double du = direction[0] * hi, dv = direction[1] * hi;
+        const double A = -d * du * dv;
+        const double B = direction[2] - b * du - c * dv -
+            d * (u0 * dv + v0 * du);
+        const double C = z0 - a - b * u0 - c * v0 - d * u0 * v0;
+        const double tmax = t1 - t0;
+        double tau = -1.;
+        if (A == 0.) {
+                if (B != 0.) tau = -C / B;
+        } else {
+                const double delta = B * B - 4. * A * C;
+                if (delta >= 0.) {
+                        const double q = (B >= 0.) ?
+                            -0.5 * (B + sqrt(delta)) :
+                            -0.5 * (B - sqrt(delta));
+                        double r0 = q / A;
+                        double r1 = (q != 0.) ? C / q : r0;
+                        if (r0 > r1) {
+                                const double tmp = r0;
+                                r0 = r1;
+                                r1 = tmp;
+                        }
+                        tau = (r0 >= 0.) ? r0 : r1;
+                }
         }
+        return ((tau >= 0.) && (tau <= tmax)) ? t0 + tau : -1.;
+}
 
-        /* Allocate the new frame in the stack. */
-        frame = stack->frame++;
-        stack->size -= sizeof(*frame);
-
-        /* Link the new frame. */
-        if (recorder->first == NULL)
-                recorder->first = frame;
-        else
-                rec->last->next = frame;
-        rec->last = frame;
-        frame->next = NULL;
-        frame->medium = medium;
-        frame->event = event;
-        memcpy(&(frame->state), state, sizeof(*state));
-        recorder->length++;
+#if (TEST_MODE)
+/* Quadtree clipping of terrain geometries, exported for the unit tests only. */
+int pumas_test_terrain_clip(const struct pumas_geometry * geometry, int level,
+    int i, int j, const double * position, const double * direction,
+    double * t0, double * t1)
+{
+        return terrain_clip((const void *)geometry, level, i, j, position,
+            direction, t0, t1);
 }
+#endif
 
 /* Low level routine: utility function for memory alignment. */
 /**
@@ -7846,10 +11984,10 @@ static enum pumas_return error_raise(struct error_context * error_)
         if ((s_error.handler == NULL) || (error_->code == PUMAS_RETURN_SUCCESS))
                 return error_->code;
 
-        if (s_error.catch) {
-                if (s_error.catch_error.code == PUMAS_RETURN_SUCCESS) {
-                        memcpy(&s_error.catch_error, error_,
-                            sizeof(s_error.catch_error));
+        if (s_error_catch.catch) {
+                if (s_error_catch.catch_error.code == PUMAS_RETURN_SUCCESS) {
+                        memcpy(&s_error_catch.catch_error, error_,
+                            sizeof(s_error_catch.catch_error));
                 }
                 return error_->code;
         }
@@ -7865,25 +12003,25 @@ static enum pumas_return error_raise(struct error_context * error_)
  * Parse a dE/dX file.
  *
  * @param Physics     Handle for physics tables.
- * @param fid         The file handle.
+ * @param reader      The file reader.
  * @param material    The material index.
- * @param filename    The name of the curent file.
+ * @param cel_table   Work buffer for the per element CEL and DEL terms.
  * @param error_      The error data.
  * @return On succces `PUMAS_RETURN_SUCCESS`, otherwise `PUMAS_ERROR`.
  *
  * Parse a dE/dX data table in PDG text file format.
  */
-enum pumas_return io_parse_dedx_file(struct pumas_physics * physics, FILE * fid,
-    int material, const char * filename, struct error_context * error_)
+enum pumas_return io_parse_dedx_file(struct pumas_physics * physics,
+    struct io_reader * reader, int material, double * cel_table,
+    struct error_context * error_)
 {
-        char * buffer = NULL;
+        const char * buffer;
+        int length;
 
         /* Skip the header. */
-        int line = 0;
         int i;
         for (i = 0; i < physics->n_energy_loss_header; i++) {
-                io_read_line(fid, &buffer, filename, line, error_);
-                line++;
+                io_reader_line(reader, &buffer, &length, error_);
                 if (error_->code != PUMAS_RETURN_SUCCESS) return error_->code;
         }
 
@@ -7907,24 +12045,21 @@ enum pumas_return io_parse_dedx_file(struct pumas_physics * physics, FILE * fid,
 
         /* Scan the new table. */
         while (error_->code == PUMAS_RETURN_SUCCESS) {
-                io_read_line(fid, &buffer, filename, line, error_);
-                line++;
+                io_reader_line(reader, &buffer, &length, error_);
                 if (error_->code != PUMAS_RETURN_SUCCESS) break;
-                io_parse_dedx_row(
-                    physics, buffer, material, &row, filename, line, error_);
+                io_parse_dedx_row(physics, buffer, length, material, &row,
+                    cel_table, reader->filename, reader->line, error_);
         }
 
-        if (error_->code != PUMAS_RETURN_SUCCESS) {
-                if ((error_->code == PUMAS_RETURN_END_OF_FILE) || feof(fid))
-                        error_->code = PUMAS_RETURN_SUCCESS;
-        }
+        if (error_->code == PUMAS_RETURN_END_OF_FILE)
+                error_->code = PUMAS_RETURN_SUCCESS;
         if (error_->code != PUMAS_RETURN_SUCCESS) return error_->code;
 
         if (row != physics->n_energies)
                 return ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
                     "inconsistent number of rows in energy loss tables [%s, %d "
                     "!= %d]",
-                    filename, row, physics->n_energies);
+                    reader->filename, row, physics->n_energies);
 
         compute_regularise_del(physics, material);
 
@@ -7936,32 +12071,46 @@ enum pumas_return io_parse_dedx_file(struct pumas_physics * physics, FILE * fid,
  *
  * @param Physics  Handle for physics tables.
  * @param buffer   The read buffer containing the row data.
+ * @param length   The length of the row data.
  * @param material The index of the material.
  * @param row      The index of the parsed row.
+ * @param cel_table Work buffer for the per element CEL and DEL terms.
  * @param filename The name of the current file.
  * @param line     The line being processed.
  * @param error_   The error data.
  * @return On succees `PUMAS_RETURN_SUCCESS`, or `PUMAS_ERROR` otherwise.
  *
- * Parse a row of a dE/dX data table formated in PDG text file format.
+ * Parse a row of a dE/dX data table formated in PDG text file format. The
+ * row data are parsed in place, i.e. they need not be null terminated. The
+ * per element terms are tabulated to *cel_table* when parsing the first
+ * material, and reused for the next ones.
  */
 enum pumas_return io_parse_dedx_row(struct pumas_physics * physics,
-    char * buffer, int material, int * row, const char * filename, int line,
+    const char * buffer, int length, int material, int * row,
+    double * cel_table, const char * filename, int line,
     struct error_context * error_)
 {
         /*
          * Skip the peculiar values since they differ from material to
          * material.
          */
-        if ((strstr(buffer, "Minimum ionization") != NULL) ||
-            (strstr(buffer, "critical energy") != NULL))
+        if (io_line_find(buffer, length, "Minimum ionization") ||
+            io_line_find(buffer, length, "critical energy"))
                 return PUMAS_RETURN_SUCCESS;
 
         /* parse the new data line */
-        double k, a, be, de, brems, pair, photo;
-        int count = sscanf(buffer, "%lf %*f %lf %lf %lf %lf %lf %lf", &k, &a,
-            &brems, &pair, &photo, &be, &de);
-        if ((count != 7) || (*row >= physics->n_energies))
+        const char * cursor = buffer;
+        const char * end = buffer + length;
+        double k, p, a, be, de, brems, pair, photo;
+        if (!io_scan_double(&cursor, end, &k) ||
+            !io_scan_double(&cursor, end, &p) ||
+            !io_scan_double(&cursor, end, &a) ||
+            !io_scan_double(&cursor, end, &brems) ||
+            !io_scan_double(&cursor, end, &pair) ||
+            !io_scan_double(&cursor, end, &photo) ||
+            !io_scan_double(&cursor, end, &be) ||
+            !io_scan_double(&cursor, end, &de) ||
+            (*row >= physics->n_energies))
                 return ERROR_VREGISTER(PUMAS_RETURN_FORMAT_ERROR,
                     "invalid data line [@%s:%d]", filename, line);
 
@@ -7986,11 +12135,11 @@ enum pumas_return io_parse_dedx_row(struct pumas_physics * physics,
         /* Compute the fractional contributions of the energy loss
          * processes to the CEL and to DELs.
          */
-        static double * cel_table = NULL;
         if (material == 0) {
                 /* Precompute the per element terms. */
-                if ((cel_table = compute_cel_and_del(physics, *row)) == NULL)
-                        return ERROR_REGISTER_MEMORY();
+                if (compute_cel_and_del(physics, *row, cel_table, error_) !=
+                    PUMAS_RETURN_SUCCESS)
+                        return error_->code;
         }
 
         struct material_component * component = physics->composition[material];
@@ -8082,69 +12231,265 @@ enum pumas_return io_parse_dedx_row(struct pumas_physics * physics,
 }
 
 /**
- * Read a line from a file.
+ * Open a text file for reading lines.
  *
- * @param fid      The file handle.
- * @param buf      A pointer to the new line or `NULL` in case of faillure.
- * @param filename The file currently processed.
- * @param line     The current line in the file.
+ * @param reader   The reader to initialise.
+ * @param path     The path to the file.
  * @param error_   The error data.
- * @return On success `PUMAS_RETURN_SUCCESS` otherwise an error code.
+ * @return On success `PUMAS_RETURN_SUCCESS` otherwise `PUMAS_RETURN_PATH_ERROR`.
+ *
+ * Regular files are mapped to memory, if supported. Otherwise, e.g. for
+ * non-seekable streams, lines are read with stdio.
+ */
+enum pumas_return io_reader_open(
+    struct io_reader * reader, const char * path, struct error_context * error_)
+{
+        memset(reader, 0x0, sizeof(*reader));
+        reader->filename = path;
+
+#if (MMAP_MODE)
+        const int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+                struct stat st;
+                void * map = MAP_FAILED;
+                if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) &&
+                    (st.st_size > 0)) {
+                        map = mmap(
+                            NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                }
+                close(fd);
+                if (map != MAP_FAILED) {
+                        reader->map = map;
+                        reader->map_size = st.st_size;
+                        return PUMAS_RETURN_SUCCESS;
+                }
+        }
+#endif
+        /* Fallback to stdio reads. */
+        reader->fid = fopen(path, "r");
+        if (reader->fid == NULL) {
+                return ERROR_VREGISTER(
+                    PUMAS_RETURN_PATH_ERROR, "could not open file `%s'", path);
+        }
+        return PUMAS_RETURN_SUCCESS;
+}
+
+/**
+ * Close a text file reader.
  *
- * This routine manages a dynamic buffer. If *fid* is not `NULL`, this routine
- * reads a new line and fills in a pointer to a string holding the read data.
- * Otherwise, if *fid* is `NULL` any memory previously allocated by the routine
- * is released.
+ * @param reader   The reader to close.
+ *
+ * The file is unmapped, or closed, and any buffer memory is released.
  */
-enum pumas_return io_read_line(FILE * fid, char ** buf, const char * filename,
-    int line, struct error_context * error_)
+void io_reader_close(struct io_reader * reader)
 {
-        static int size = 0;
-        static char * buffer = NULL;
+#if (MMAP_MODE)
+        if (reader->map != NULL) {
+                munmap((void *)reader->map, reader->map_size);
+                reader->map = NULL;
+        }
+#endif
+        if (reader->fid != NULL) {
+                fclose(reader->fid);
+                reader->fid = NULL;
+        }
+        deallocate(reader->buffer);
+        reader->buffer = NULL;
+        reader->size = 0;
+}
 
-        if (buf != NULL) *buf = NULL;
-        if (fid == NULL) {
-                /* Release the buffer memory. */
-                deallocate(buffer);
-                buffer = NULL;
-                size = 0;
+/**
+ * Read a line from a file.
+ *
+ * @param reader   The file reader.
+ * @param line     A pointer to the new line or `NULL` in case of faillure.
+ * @param length   The length of the line.
+ * @param error_   The error data.
+ * @return On success `PUMAS_RETURN_SUCCESS` otherwise an error code.
+ *
+ * The line data are not null terminated when the file is mapped to memory.
+ * Thus, the line *length* must be used when parsing. The returned data are
+ * valid until the next call.
+ */
+enum pumas_return io_reader_line(struct io_reader * reader,
+    const char ** line, int * length, struct error_context * error_)
+{
+        *line = NULL;
+        *length = 0;
+
+        if (reader->map != NULL) {
+                /* Locate the next line in place. */
+                if (reader->offset >= reader->map_size)
+                        return ERROR_REGISTER_EOF(reader->filename);
+                const char * s = reader->map + reader->offset;
+                const size_t left = reader->map_size - reader->offset;
+                const char * e = memchr(s, '\n', left);
+                const size_t n = (e == NULL) ? left : (size_t)(e - s) + 1;
+                reader->offset += n;
+                reader->line++;
+                *line = s;
+                *length = n;
                 return PUMAS_RETURN_SUCCESS;
         }
 
-        if (buffer == NULL) {
+        if (reader->buffer == NULL) {
                 /* Allocate the buffer if not already done. */
-                size = 2048;
-                buffer = allocate(size * sizeof(*buffer));
-                if (buffer == NULL) return ERROR_REGISTER_MEMORY();
+                reader->size = 2048;
+                reader->buffer =
+                    allocate(reader->size * sizeof(*reader->buffer));
+                if (reader->buffer == NULL) return ERROR_REGISTER_MEMORY();
         }
 
         /* Get a full line. */
-        char * s = buffer;
-        int to_read = size;
+        char * s = reader->buffer;
+        int to_read = reader->size;
         for (;;) {
                 const char endline1 = '\n';
                 const char endline2 = '\r';
-                const char * r = fgets(s, to_read, fid);
-                if (r == NULL) return ERROR_REGISTER_EOF(filename);
+                const char * r = fgets(s, to_read, reader->fid);
+                if (r == NULL) return ERROR_REGISTER_EOF(reader->filename);
                 int n_read = strlen(s);
                 if ((n_read >= to_read - 1) && (s[to_read - 2] != endline1) &&
                     (s[to_read - 2] != endline2)) {
-                        size += 2048;
-                        char * new_buffer =
-                            reallocate(buffer, size * sizeof(*buffer));
+                        reader->size += 2048;
+                        char * new_buffer = reallocate(reader->buffer,
+                            reader->size * sizeof(*reader->buffer));
                         if (new_buffer == NULL) {
                                 return ERROR_REGISTER_MEMORY();
                         }
-                        buffer = new_buffer;
-                        s += to_read - 1;
-                        to_read = 2049;
-                        continue;
+                        reader->buffer = new_buffer;
+                        s = new_buffer + reader->size - 2048 - 1;
+                        to_read = 2049;
+                        continue;
+                }
+                break;
+        }
+
+        reader->line++;
+        *line = reader->buffer;
+        *length = strlen(reader->buffer);
+        return PUMAS_RETURN_SUCCESS;
+}
+
+/* Check if a line contains the given pattern. */
+static int io_line_find(const char * line, int length, const char * pattern)
+{
+        const int n = strlen(pattern);
+        int i;
+        for (i = 0; i <= length - n; i++) {
+                const char * s =
+                    memchr(line + i, pattern[0], length - n - i + 1);
+                if (s == NULL) return 0;
+                i = s - line;
+                if (memcmp(s, pattern, n) == 0) return 1;
+        }
+        return 0;
+}
+
+/**
+ * Scan a floating point value from a text buffer.
+ *
+ * @param cursor   The current position in the buffer, updated on success.
+ * @param end      The end of the buffer.
+ * @param value    The scanned value.
+ * @return `1` on success, `0` otherwise.
+ *
+ * Leading white spaces are skipped. Decimal values with at most 15 significant
+ * digits and small exponents are converted exactly, as a single product or
+ * ratio with a power of 10. Other values, e.g. `inf` or hexadecimal ones, are
+ * delegated to `strtod`. Thus, the result is identical to `strtod` in all
+ * cases.
+ */
+static int io_scan_double(const char ** cursor, const char * end,
+    double * value)
+{
+        static const double pow10[] = { 1E+00, 1E+01, 1E+02, 1E+03, 1E+04,
+                1E+05, 1E+06, 1E+07, 1E+08, 1E+09, 1E+10, 1E+11, 1E+12, 1E+13,
+                1E+14, 1E+15, 1E+16, 1E+17, 1E+18, 1E+19, 1E+20, 1E+21,
+                1E+22 };
+
+        const char * s = *cursor;
+        while ((s < end) && isspace((unsigned char)*s)) s++;
+        if (s >= end) return 0;
+        const char * start = s;
+
+        /* Parse the mantissa digits. */
+        int negative = 0;
+        if ((*s == '-') || (*s == '+')) {
+                negative = (*s == '-');
+                s++;
+        }
+        if ((s + 1 < end) && (s[0] == '0') && ((s[1] == 'x') || (s[1] == 'X')))
+                goto fallback;
+        unsigned long long mantissa = 0;
+        int n_digits = 0, n_significant = 0, exponent = 0;
+        for (; (s < end) && isdigit((unsigned char)*s); s++, n_digits++) {
+                if ((mantissa == 0) && (*s == '0')) continue;
+                mantissa = 10 * mantissa + (*s - '0');
+                n_significant++;
+        }
+        if ((s < end) && (*s == '.')) {
+                for (s++; (s < end) && isdigit((unsigned char)*s);
+                     s++, n_digits++) {
+                        exponent--;
+                        if ((mantissa == 0) && (*s == '0')) continue;
+                        mantissa = 10 * mantissa + (*s - '0');
+                        n_significant++;
+                }
+        }
+        if ((n_digits == 0) || (n_significant > 15)) goto fallback;
+
+        /* Parse the exponent, if any. */
+        if ((s < end) && ((*s == 'e') || (*s == 'E'))) {
+                const char * t = s + 1;
+                int sign = 1;
+                if ((t < end) && ((*t == '-') || (*t == '+'))) {
+                        if (*t == '-') sign = -1;
+                        t++;
+                }
+                if ((t < end) && isdigit((unsigned char)*t)) {
+                        int e = 0;
+                        for (; (t < end) && isdigit((unsigned char)*t); t++) {
+                                if (e < 1000) e = 10 * e + (*t - '0');
+                        }
+                        exponent += sign * e;
+                        s = t;
                 }
-                break;
         }
 
-        *buf = buffer;
-        return PUMAS_RETURN_SUCCESS;
+        /* Convert exactly, if possible. */
+        double v = (double)mantissa;
+        if (mantissa == 0) {
+                v = 0.;
+        } else if ((exponent >= 0) && (exponent <= 22)) {
+                v *= pow10[exponent];
+        } else if ((exponent < 0) && (exponent >= -22)) {
+                v /= pow10[-exponent];
+        } else {
+                goto fallback;
+        }
+        *value = negative ? -v : v;
+        *cursor = s;
+        return 1;
+
+fallback:
+        {
+                /* Copy the token and delegate to strtod. */
+                char token[64];
+                const char * t;
+                for (t = start; (t < end) && !isspace((unsigned char)*t) &&
+                     (t - start < (int)sizeof(token) - 1);
+                     t++)
+                        ;
+                const int n = t - start;
+                memcpy(token, start, n);
+                token[n] = 0x0;
+                char * tail;
+                *value = strtod(token, &tail);
+                if (tail == token) return 0;
+                *cursor = start + (tail - token);
+                return 1;
+        }
 }
 
 /* Check for a split in a camel case name */
@@ -8227,6 +12572,7 @@ enum pumas_return mdf_parse_settings(const struct pumas_physics * physics,
         mdf->size_dedx_path = 0;
         mdf->size_elements_names = 0;
         mdf->size_materials_names = 0;
+        struct mdf_settings_tables tables = { NULL, 0, 0, 0, NULL, 0, 0 };
 
         /* Prepare the path to the first dedx file. */
         char * full_path = NULL;
@@ -8238,7 +12584,7 @@ enum pumas_return mdf_parse_settings(const struct pumas_physics * physics,
                 goto clean_and_exit;
 
         /* Prepare the index tables. */
-        if (mdf_settings_index(MDF_INDEX_INITIALISE, 0, error_) !=
+        if (mdf_settings_index(&tables, MDF_INDEX_INITIALISE, 0, error_) !=
             PUMAS_RETURN_SUCCESS)
                 goto clean_and_exit;
 
@@ -8294,9 +12640,10 @@ enum pumas_return mdf_parse_settings(const struct pumas_physics * physics,
                                 /* Update the names table and book a new index
                                  * table.
                                  */
-                                if ((mdf_settings_name(size, 'M', node.at1.name,
-                                         error_) != PUMAS_RETURN_SUCCESS) ||
-                                    (mdf_settings_index(
+                                if ((mdf_settings_name(&tables, size, 'M',
+                                         node.at1.name, error_) !=
+                                        PUMAS_RETURN_SUCCESS) ||
+                                    (mdf_settings_index(&tables,
                                          MDF_INDEX_WRITE_MATERIAL, 0, error_) !=
                                         PUMAS_RETURN_SUCCESS))
                                         goto clean_and_exit;
@@ -8304,7 +12651,7 @@ enum pumas_return mdf_parse_settings(const struct pumas_physics * physics,
                                 if (mdf->elements_in > mdf->max_components)
                                         mdf->max_components = mdf->elements_in;
                                 /* Finalise the index table. */
-                                if (mdf_settings_index(
+                                if (mdf_settings_index(&tables,
                                         MDF_INDEX_FINALISE_MATERIAL,
                                         mdf->elements_in,
                                         error_) != PUMAS_RETURN_SUCCESS)
@@ -8322,14 +12669,14 @@ enum pumas_return mdf_parse_settings(const struct pumas_physics * physics,
                                 mdf->size_materials_names += size;
 
                                 /* Book a new index table. */
-                                if (mdf_settings_index(
+                                if (mdf_settings_index(&tables,
                                         MDF_INDEX_INITIALISE_COMPOSITE,
                                         mdf->n_elements,
                                         error_) != PUMAS_RETURN_SUCCESS)
                                         goto clean_and_exit;
                         } else {
                                 /* Analyse the index table. */
-                                int elements_in = mdf_settings_index(
+                                int elements_in = mdf_settings_index(&tables,
                                     MDF_INDEX_FINALISE_COMPOSITE, 0, error_);
                                 mdf->n_components += elements_in;
                                 if (elements_in > mdf->max_components)
@@ -8351,37 +12698,39 @@ enum pumas_return mdf_parse_settings(const struct pumas_physics * physics,
                         const int size = strlen(node.at1.name) + 1;
                         mdf->size_elements_names +=
                             memory_padded_size(size, pad_size);
-                        if (mdf_settings_name(size, 'E', node.at1.name,
-                                error_) != PUMAS_RETURN_SUCCESS)
+                        if (mdf_settings_name(&tables, size, 'E',
+                                node.at1.name, error_) != PUMAS_RETURN_SUCCESS)
                                 goto clean_and_exit;
                 } else if (node.key == MDF_KEY_ATOMIC_COMPONENT) {
                         mdf->n_components++;
-                        int index =
-                            mdf_settings_name(0, 'E', node.at1.name, error_);
+                        int index = mdf_settings_name(
+                            &tables, 0, 'E', node.at1.name, error_);
                         if (index < 0) {
                                 ERROR_VREGISTER(PUMAS_RETURN_UNKNOWN_ELEMENT,
                                     "unknown atomic element `%s' [@%s:%d]",
                                     node.at1.name, mdf->mdf_path, mdf->line);
                                 goto clean_and_exit;
                         }
-                        if (mdf_settings_index(MDF_INDEX_WRITE_MATERIAL, index,
-                                error_) != PUMAS_RETURN_SUCCESS)
+                        if (mdf_settings_index(&tables,
+                                MDF_INDEX_WRITE_MATERIAL, index, error_) !=
+                            PUMAS_RETURN_SUCCESS)
                                 goto clean_and_exit;
                 } else if (node.key == MDF_KEY_COMPOSITE_COMPONENT) {
                         /* Update the components count. */
                         mdf->materials_in++;
 
                         /* Update the index table. */
-                        int index =
-                            mdf_settings_name(0, 'M', node.at1.name, error_);
+                        int index = mdf_settings_name(
+                            &tables, 0, 'M', node.at1.name, error_);
                         if (index < 0) {
                                 ERROR_VREGISTER(PUMAS_RETURN_UNKNOWN_MATERIAL,
                                     "unknown material `%s' [@%s:%d]",
                                     node.at1.name, mdf->mdf_path, mdf->line);
                                 goto clean_and_exit;
                         }
-                        if (mdf_settings_index(MDF_INDEX_UPDATE_COMPOSITE,
-                                index, error_) != PUMAS_RETURN_SUCCESS)
+                        if (mdf_settings_index(&tables,
+                                MDF_INDEX_UPDATE_COMPOSITE, index, error_) !=
+                            PUMAS_RETURN_SUCCESS)
                                 goto clean_and_exit;
                 }
         }
@@ -8421,8 +12770,8 @@ enum pumas_return mdf_parse_settings(const struct pumas_physics * physics,
 
 clean_and_exit:
         /* Free the temporary memory and return. */
-        mdf_settings_name(-1, 0x0, NULL, error_);
-        mdf_settings_index(MDF_INDEX_FREE, 0, error_);
+        mdf_settings_name(&tables, -1, 0x0, NULL, error_);
+        mdf_settings_index(&tables, MDF_INDEX_FREE, 0, error_);
         deallocate(filename);
         deallocate(full_path);
         return error_->code;
@@ -8436,35 +12785,34 @@ clean_and_exit:
  * @param error_    The error data.
  * @return The return value depends on the operation.
  */
-int mdf_settings_index(int operation, int value, struct error_context * error_)
+int mdf_settings_index(struct mdf_settings_tables * tables, int operation,
+    int value, struct error_context * error_)
 {
         const int chunk_size = 1024;
-        static int * buffer = NULL;
-        static int total_size = 0;
-        static int free_size = 0;
-        static int n_elements = 0;
 
         if (operation == MDF_INDEX_FREE) {
                 /* Free the temporary memory. */
-                deallocate(buffer);
-                buffer = NULL;
-                total_size = 0;
-                free_size = 0;
+                deallocate(tables->index);
+                tables->index = NULL;
+                tables->index_size = 0;
+                tables->index_free = 0;
                 return PUMAS_RETURN_SUCCESS;
         } else if (operation == MDF_INDEX_FINALISE_MATERIAL) {
                 /* Finalise the material index table. */
-                int * header = buffer + (total_size - free_size - value - 1);
+                const int used = tables->index_size - tables->index_free;
+                int * header = tables->index + (used - value - 1);
                 *header = value;
                 return PUMAS_RETURN_SUCCESS;
         } else if (operation == MDF_INDEX_UPDATE_COMPOSITE) {
                 /* Update the composite index table. */
-                int i, *table = buffer;
+                int i, *table = tables->index;
                 for (i = 0; i < value; i++) {
                         table += (*table) + 1;
                 }
                 const int n = *(table++);
+                const int used = tables->index_size - tables->index_free;
                 int * has_element =
-                    buffer + (total_size - free_size - n_elements);
+                    tables->index + (used - tables->n_elements);
                 for (i = 0; i < n; i++) {
                         const int j = table[i];
                         if (has_element[j] == 0) has_element[j]++;
@@ -8473,45 +12821,49 @@ int mdf_settings_index(int operation, int value, struct error_context * error_)
         } else if (operation == MDF_INDEX_FINALISE_COMPOSITE) {
                 /* Finalise the composite index table. */
                 int i, n = 0;
-                int * table = buffer + (total_size - free_size - n_elements);
-                for (i = 0; i < n_elements; i++) n += *(table++);
-                free_size += n_elements;
+                const int used = tables->index_size - tables->index_free;
+                int * table = tables->index + (used - tables->n_elements);
+                for (i = 0; i < tables->n_elements; i++) n += *(table++);
+                tables->index_free += tables->n_elements;
                 return n;
         }
 
         int size = (operation == MDF_INDEX_INITIALISE_COMPOSITE) ? value : 1;
-        if (size > free_size) {
+        if (size > tables->index_free) {
                 /* Reserve memory for the next item. */
                 const int delta_size =
-                    ((size - free_size) / chunk_size + 1) * chunk_size;
-                total_size += delta_size;
-                int * new_buffer =
-                    reallocate(buffer, total_size * sizeof(*buffer));
+                    ((size - tables->index_free) / chunk_size + 1) *
+                    chunk_size;
+                tables->index_size += delta_size;
+                int * new_buffer = reallocate(
+                    tables->index, tables->index_size * sizeof(int));
                 if (new_buffer == NULL) {
-                        deallocate(buffer);
-                        buffer = NULL;
-                        total_size = 0;
-                        free_size = 0;
+                        deallocate(tables->index);
+                        tables->index = NULL;
+                        tables->index_size = 0;
+                        tables->index_free = 0;
                         return ERROR_REGISTER_MEMORY();
                 }
-                buffer = new_buffer;
-                free_size += delta_size;
+                tables->index = new_buffer;
+                tables->index_free += delta_size;
         }
 
         if (operation == MDF_INDEX_INITIALISE) {
                 return PUMAS_RETURN_SUCCESS;
         } else if (operation == MDF_INDEX_WRITE_MATERIAL) {
                 /* Write a value to the material index table. */
-                int * tail = buffer + (total_size - free_size);
+                int * tail =
+                    tables->index + (tables->index_size - tables->index_free);
                 *tail = value;
-                free_size--;
+                tables->index_free--;
                 return PUMAS_RETURN_SUCCESS;
         } else if (operation == MDF_INDEX_INITIALISE_COMPOSITE) {
                 /* Book a new index table for a composite material. */
-                n_elements = value;
-                int * tail = buffer + (total_size - free_size);
-                memset(tail, 0x0, n_elements * sizeof(int));
-                free_size -= n_elements;
+                tables->n_elements = value;
+                int * tail =
+                    tables->index + (tables->index_size - tables->index_free);
+                memset(tail, 0x0, tables->n_elements * sizeof(int));
+                tables->index_free -= tables->n_elements;
                 return PUMAS_RETURN_SUCCESS;
         }
 
@@ -8528,18 +12880,15 @@ int mdf_settings_index(int operation, int value, struct error_context * error_)
  * @param error_ The error data.
  * @return The return value depends on the operation performed.
  */
-int mdf_settings_name(
-    int size, char prefix, const char * name, struct error_context * error_)
+int mdf_settings_name(struct mdf_settings_tables * tables, int size,
+    char prefix, const char * name, struct error_context * error_)
 {
         const int chunk_size = 4096;
-        static char * buffer = NULL;
-        static int total_size = 0;
-        static int free_size = 0;
 
         if (size == 0) {
                 /* Return the name index. */
-                if (buffer == NULL) return -1;
-                const char * ptr = buffer;
+                if (tables->name == NULL) return -1;
+                const char * ptr = tables->name;
                 int index = 0;
                 while (*ptr != 0x0) {
                         if (*ptr == prefix) {
@@ -8551,38 +12900,40 @@ int mdf_settings_name(
                 return -1;
         } else if (size < 0) {
                 /* Free the temporary memory. */
-                deallocate(buffer);
-                buffer = NULL;
-                total_size = 0;
-                free_size = 0;
+                deallocate(tables->name);
+                tables->name = NULL;
+                tables->name_size = 0;
+                tables->name_free = 0;
                 return PUMAS_RETURN_SUCCESS;
         }
 
         size += 1;
-        if (size + 1 > free_size) {
+        if (size + 1 > tables->name_free) {
                 /* Reserve memory for the next item. */
                 const int delta_size =
-                    ((size + 1 - free_size) / chunk_size + 1) * chunk_size;
-                total_size += delta_size;
-                char * new_buffer = reallocate(buffer, total_size);
+                    ((size + 1 - tables->name_free) / chunk_size + 1) *
+                    chunk_size;
+                tables->name_size += delta_size;
+                char * new_buffer =
+                    reallocate(tables->name, tables->name_size);
                 if (new_buffer == NULL) {
-                        deallocate(buffer);
-                        buffer = NULL;
-                        total_size = 0;
-                        free_size = 0;
+                        deallocate(tables->name);
+                        tables->name = NULL;
+                        tables->name_size = 0;
+                        tables->name_free = 0;
                         return ERROR_REGISTER_MEMORY();
                 }
-                buffer = new_buffer;
-                free_size += delta_size;
+                tables->name = new_buffer;
+                tables->name_free += delta_size;
         }
-        if (buffer == NULL) return -1;
+        if (tables->name == NULL) return -1;
 
         /* Dump the new item. */
-        char * tail = buffer + (total_size - free_size);
+        char * tail = tables->name + (tables->name_size - tables->name_free);
         tail[0] = prefix;
         tail++;
         strcpy(tail, name);
-        free_size -= size;
+        tables->name_free -= size;
         *(tail + size - 1) = 0x0; /* Tag the end of the name list. */
         return PUMAS_RETURN_SUCCESS;
 }
@@ -8605,38 +12956,42 @@ enum pumas_return mdf_parse_kinetic(struct mdf_buffer * mdf, const char * path,
         mdf->line = 0;
 
         /* Open the dedx file. */
-        FILE * fid = fopen(path, "r");
-        if (fid == NULL) {
-                return ERROR_VREGISTER(
-                    PUMAS_RETURN_PATH_ERROR, "could not open file `%s'", path);
-        }
+        struct io_reader reader;
+        if (io_reader_open(&reader, path, error_) != PUMAS_RETURN_SUCCESS)
+                return error_->code;
 
         /* Skip the header lines. */
-        char * buffer = NULL;
+        const char * buffer;
+        int length;
         for (mdf->n_energy_loss_header = 0;; mdf->n_energy_loss_header++) {
-                io_read_line(fid, &buffer, path, mdf->line, error_);
+                io_reader_line(&reader, &buffer, &length, error_);
                 mdf->line++;
                 if (error_->code != PUMAS_RETURN_SUCCESS) {
-                        fclose(fid);
+                        io_reader_close(&reader);
                         return error_->code;
                 }
                 const char * c;
                 int i;
-                for (i = 0, c = buffer; (*c == ' ') && (i < 4); i++) c++;
-                if (isdigit(*c)) break;
+                for (i = 0, c = buffer; (i < length) && (*c == ' ') && (i < 4);
+                     i++)
+                        c++;
+                if ((i < length) && isdigit((unsigned char)*c)) break;
         }
 
         /* Scan the table. */
         int nk = 1;
         for (;;) {
                 /* Check for a comment. */
-                if (strstr(buffer, "Minimum ionization") != NULL)
+                if (io_line_find(buffer, length, "Minimum ionization"))
+                        goto next_line;
+                if (io_line_find(buffer, length, "critical energy"))
                         goto next_line;
-                if (strstr(buffer, "critical energy") != NULL) goto next_line;
 
                 /* parse the new data line. */
                 double k;
-                if (sscanf(buffer, "%lf", &k) <= 0) goto next_line;
+                const char * cursor = buffer;
+                if (!io_scan_double(&cursor, buffer + length, &k))
+                        goto next_line;
                 k *= 1E-03;
                 if (energy != NULL) {
                         if (n_energies > 0) {
@@ -8655,23 +13010,20 @@ enum pumas_return mdf_parse_kinetic(struct mdf_buffer * mdf, const char * path,
 
         next_line:
                 /* Check for a new line. */
-                io_read_line(fid, &buffer, path, mdf->line, error_);
+                io_reader_line(&reader, &buffer, &length, error_);
                 mdf->line++;
                 if (error_->code != PUMAS_RETURN_SUCCESS) {
-                        if ((error_->code == PUMAS_RETURN_END_OF_FILE) ||
-                            feof(fid)) {
+                        if (error_->code == PUMAS_RETURN_END_OF_FILE)
                                 error_->code = PUMAS_RETURN_SUCCESS;
-                                break;
-                        }
+                        break;
                 }
         }
-        io_read_line(NULL, NULL, NULL, 0, error_);
+        io_reader_close(&reader);
 
         /*  Update the settings. */
         if (error_->code == PUMAS_RETURN_SUCCESS) mdf->line = 0;
         mdf->n_energies = nk;
 
-        fclose(fid);
         return error_->code;
 }
 
@@ -8812,16 +13164,13 @@ enum pumas_return mdf_parse_materials(struct pumas_physics * physics,
                                 if (mdf->dry_mode) goto update_count;
 
                                 /* Read the energy loss data. */
-                                FILE * fid = fopen(filename, "r");
-                                if (fid == NULL) {
-                                        ERROR_VREGISTER(PUMAS_RETURN_PATH_ERROR,
-                                            "could not open file `%s'",
-                                            filename);
+                                struct io_reader reader;
+                                if (io_reader_open(&reader, filename,
+                                        error_) != PUMAS_RETURN_SUCCESS)
                                         break;
-                                }
-                                io_parse_dedx_file(
-                                    physics, fid, imat, filename, error_);
-                                fclose(fid);
+                                io_parse_dedx_file(physics, &reader, imat,
+                                    mdf->cel_table, error_);
+                                io_reader_close(&reader);
                                 if (error_->code != PUMAS_RETURN_SUCCESS) break;
 
                         /* Update the material count. */
@@ -9562,6 +13911,174 @@ enum pumas_return mdf_format_path(const char * directory, const char * mdf_path,
 /*
  * Low level routines: pre-computation of various properties.
  */
+/**
+ * Worker data for a parallel tabulation.
+ */
+struct compute_worker {
+        /** The thread pool data. */
+        struct pool_worker pool;
+        /** Link to the tabulation data. */
+        struct compute_data * data;
+};
+
+/**
+ * Shared data for a parallel tabulation.
+ */
+struct compute_data {
+        /** The physics tables being tabulated. */
+        struct pumas_physics * physics;
+        /** The tabulation task. */
+        compute_task_t * task;
+        /** Extra arguments for the task. */
+        void * args;
+        /** The total number of tasks. */
+        int n_tasks;
+        /** The index of the next task to process. */
+        int next;
+        /** The number of workers. */
+        int n_workers;
+#if (THREADS_MODE)
+        /** Lock for accessing the next task index. */
+        pthread_mutex_t mutex;
+#endif
+        /** Placeholder for the workers data. */
+        struct compute_worker workers[];
+};
+
+#if (THREADS_MODE)
+#define COMPUTE_LOCK(data) pthread_mutex_lock(&(data)->mutex)
+#define COMPUTE_UNLOCK(data) pthread_mutex_unlock(&(data)->mutex)
+#else
+#define COMPUTE_LOCK(data)
+#define COMPUTE_UNLOCK(data)
+#endif
+
+/**
+ * Main loop of a parallel tabulation worker.
+ *
+ * @param arg The worker data.
+ * @return Always `NULL`.
+ *
+ * Tasks are processed one by one, in increasing index order, until none
+ * remains. If an error occurs the remaining tasks are cancelled.
+ */
+static void * compute_worker_main(void * arg)
+{
+        struct compute_worker * const worker = arg;
+        struct compute_data * const data = worker->data;
+
+        for (;;) {
+                COMPUTE_LOCK(data);
+                const int index = data->next;
+                if (index < data->n_tasks) data->next++;
+                COMPUTE_UNLOCK(data);
+                if (index >= data->n_tasks) break;
+
+                if (data->task(data->physics, index, data->args,
+                        &worker->pool.error) != PUMAS_RETURN_SUCCESS) {
+                        COMPUTE_LOCK(data);
+                        data->next = data->n_tasks;
+                        COMPUTE_UNLOCK(data);
+                        break;
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * Run independent tabulation tasks, possibly in parallel.
+ *
+ * @param physics Handle for physics tables.
+ * @param n_tasks The number of tasks.
+ * @param task    The task to run for indices in `[0, n_tasks[`.
+ * @param args    Extra arguments for the task.
+ * @param error_  The error data.
+ * @return On success `PUMAS_RETURN_SUCCESS` otherwise an error code.
+ *
+ * Tasks are distributed over `physics::n_threads` threads, when built with
+ * threads support. Otherwise, or if a single thread is requested, tasks are
+ * run sequentially in the calling thread. Tasks must write to disjoint
+ * tables, such that results do not depend on the number of threads.
+ */
+enum pumas_return compute_parallel(struct pumas_physics * physics,
+    int n_tasks, compute_task_t * task, void * args,
+    struct error_context * error_)
+{
+        int n_workers = physics->n_threads;
+#if (!THREADS_MODE)
+        n_workers = 1;
+#endif
+        if (n_workers > n_tasks) n_workers = n_tasks;
+        if (n_workers <= 1) {
+                int i;
+                for (i = 0; i < n_tasks; i++) {
+                        if (task(physics, i, args, error_) !=
+                            PUMAS_RETURN_SUCCESS) return error_->code;
+                }
+                return PUMAS_RETURN_SUCCESS;
+        }
+
+        /* Initialise the workers. */
+        struct compute_data * data = allocate(
+            sizeof(*data) + n_workers * sizeof(*data->workers));
+        if (data == NULL) return ERROR_REGISTER_MEMORY();
+        data->physics = physics;
+        data->task = task;
+        data->args = args;
+        data->n_tasks = n_tasks;
+        data->next = 0;
+        data->n_workers = n_workers;
+        int i;
+        for (i = 0; i < n_workers; i++) data->workers[i].data = data;
+
+        /* Run the workers. If a thread cannot be started, its tasks are taken
+         * by other workers.
+         */
+#if (THREADS_MODE)
+        pthread_mutex_init(&data->mutex, NULL);
+#endif
+        pool_run(n_workers, data->workers, sizeof(*data->workers),
+            &compute_worker_main, error_);
+#if (THREADS_MODE)
+        pthread_mutex_destroy(&data->mutex);
+#endif
+        deallocate(data);
+
+        return error_->code;
+}
+
+#undef COMPUTE_LOCK
+#undef COMPUTE_UNLOCK
+
+/**
+ * Precompute the integrals for a deterministic CEL and TT parameters, for
+ * a base material.
+ *
+ * @param Physics  Handle for physics tables.
+ * @param material The base material index.
+ * @param args     The per element multiple scattering table.
+ * @param error_   The error data.
+ * @return On success `PUMAS_RETURN_SUCCESS` otherwise an error code.
+ *
+ * **Note** The per element multiple scattering must have been tabulated
+ * beforehand, with `compute_msc_soft`.
+ */
+enum pumas_return compute_base_material(struct pumas_physics * physics,
+    int material, void * args, struct error_context * error_)
+{
+        /* Set the scalling factor */
+        struct atomic_shell * shells = atomic_shell_create(
+            physics, material, NULL, physics->material_aS + material);
+        if (shells == NULL) return ERROR_REGISTER_MEMORY();
+        deallocate(shells);
+
+        compute_cel_integrals(physics, material);
+        compute_csda_magnetic_transport(physics, material);
+        compute_del_alias(physics, material);
+        return compute_scattering(physics, material, args, error_);
+}
+
 /**
  * Precompute the integrals for a deterministic CEL and TT parameters, for
  * composite materials.
@@ -9577,10 +14094,40 @@ enum pumas_return compute_composite(
 {
         compute_composite_weights(physics, material);
         compute_composite_tables(physics, material);
+        compute_del_alias(physics, material);
         compute_regularise_del(physics, material);
         compute_cel_integrals(physics, material);
         compute_csda_magnetic_transport(physics, material);
-        return compute_scattering(physics, material, error_);
+        return compute_scattering(physics, material, NULL, error_);
+}
+
+/**
+ * Compute the lookup table for the indexing of kinetic energies.
+ *
+ * @param Physics  Handle for physics tables.
+ *
+ * The tabulated kinetic energies, but the first null one, are binned
+ * uniformly in log. For each bin, the index of the closest tabulated value
+ * from below is stored. Then, indexing a kinetic value requires a log, a
+ * multiplication and a short forward scan, whatever the grid.
+ */
+void compute_kinetic_index(struct pumas_physics * physics)
+{
+        const double * const table = table_get_K(physics, 0);
+        const int imax = physics->n_energies - 1;
+        physics->kinetic_index_scale = 0.;
+        if ((imax < 2) || (table[1] <= 0.)) return;
+
+        const double lnk0 = log(table[1]);
+        const double scale = KINETIC_INDEX_N_BINS / (log(table[imax]) - lnk0);
+        int i, j = 1;
+        for (i = 0; i < KINETIC_INDEX_N_BINS; i++) {
+                const double k = exp(lnk0 + i / scale);
+                while ((j < imax - 1) && (k >= table[j + 1])) j++;
+                physics->kinetic_index[i] = j;
+        }
+        physics->kinetic_index_min = lnk0;
+        physics->kinetic_index_scale = scale;
 }
 
 /**
@@ -9599,23 +14146,79 @@ void compute_cel_integrals(struct pumas_physics * physics, int material)
             table_get_NI_in(physics, material, 0),
             table_get_NI_in_dK(physics, material, 0));
         compute_pchip_integral_coeffs(physics, material);
+        compute_cel_interleaved(physics, material);
 }
 
 /**
- * Compute various quantities related to scattering.
+ * Interleave the CEL tables of a material.
  *
  * @param Physics  Handle for physics tables.
- * @param material The index of the material to tabulate.
+ * @param material The index of the material to process.
+ *
+ * The grammage, proper time, energy loss and straggling tables, and their
+ * derivatives, are copied row wise such that the interpolation of all
+ * properties at a given kinetic energy accesses contiguous data.
  */
-enum pumas_return compute_scattering(
-    struct pumas_physics * physics, int material, struct error_context * error_)
+void compute_cel_interleaved(struct pumas_physics * physics, int material)
+{
+        int scheme;
+        for (scheme = PUMAS_MODE_CSDA; scheme <= PUMAS_MODE_MIXED; scheme++) {
+                const double * X = table_get_X(physics, scheme, material, 0);
+                const double * X_dK =
+                    table_get_X_dK(physics, scheme, material, 0);
+                const double * T = table_get_T(physics, scheme, material, 0);
+                const double * T_dK =
+                    table_get_T_dK(physics, scheme, material, 0);
+                const double * dE = table_get_dE(physics, scheme, material, 0);
+                const double * dE_dK =
+                    table_get_dE_dK(physics, scheme, material, 0);
+                const double * Omega = table_get_Omega(physics, material, 0);
+                const double * Omega_dK =
+                    table_get_Omega_dK(physics, material, 0);
+                double * row = table_get_CEL(physics, scheme, material, 0);
+                int i;
+                for (i = 0; i < physics->n_energies;
+                     i++, row += 2 * N_CEL_INTERLEAVED) {
+                        double * const m = row + N_CEL_INTERLEAVED;
+                        row[0] = X[i];
+                        row[1] = T[i];
+                        row[2] = dE[i];
+                        row[3] = Omega[i];
+                        m[0] = X_dK[i];
+                        m[1] = T_dK[i];
+                        m[2] = dE_dK[i];
+                        m[3] = Omega_dK[i];
+                }
+        }
+}
+
+/**
+ * Compute various quantities related to scattering.
+ *
+ * @param Physics   Handle for physics tables.
+ * @param material  The index of the material to tabulate.
+ * @param ms1_table The per element multiple scattering, for base materials.
+ * @param error_    The error data.
+ */
+enum pumas_return compute_scattering(struct pumas_physics * physics,
+    int material, double * ms1_table, struct error_context * error_)
 {
+        /* Allocate a temporary workspace. */
+        const int work_size = sizeof(struct coulomb_workspace) +
+            physics->max_components * sizeof(struct coulomb_data);
+        struct coulomb_workspace * workspace = allocate(work_size);
+        if (workspace == NULL) return ERROR_REGISTER_MEMORY();
+
         int ikin;
         for (ikin = 0; ikin < physics->n_energies; ikin++) {
                 const enum pumas_return rc = compute_scattering_parameters(
-                    physics, material, ikin, error_);
-                if (rc != PUMAS_RETURN_SUCCESS) return rc;
+                    physics, material, ikin, ms1_table, workspace);
+                if (rc != PUMAS_RETURN_SUCCESS) {
+                        deallocate(workspace);
+                        return rc;
+                }
         }
+        deallocate(workspace);
         compute_pchip_scattering_coeffs(physics, material);
         compute_kinetic_integral(physics,
             table_get_NI_el(physics, PUMAS_MODE_CSDA, material, 0),
@@ -9705,6 +14308,74 @@ enum pumas_return compute_composite_density(
         return PUMAS_RETURN_SUCCESS;
 }
 
+/**
+ * Compute the alias tables for the randomisation of DEL targets.
+ *
+ * @param Physics  Handle for physics tables.
+ * @param material The material index.
+ *
+ * For each kinetic energy row, a Walker alias table is built from the
+ * cumulative fractional cross-sections, `physics::table_CSf`, of the
+ * material. Rows with a null cross-section are flagged with a negative
+ * alias index.
+ */
+void compute_del_alias(struct pumas_physics * physics, int material)
+{
+        int ic0 = 0, i;
+        for (i = 0; i < material; i++) ic0 += physics->elements_in[i];
+        const int n_in = physics->elements_in[material];
+        const int n = n_in * N_DEL_PROCESSES;
+
+        int row;
+        for (row = 0; row < physics->n_energies; row++) {
+                double * const af = table_get_Af(physics, ic0, n_in, row);
+                int * const ai = table_get_Ai(physics, ic0, n_in, row);
+
+                /* Unpack the probabilities from the cumulative fractions. */
+                double last = 0.;
+                int ic, ip, j = 0;
+                for (ic = ic0; ic < ic0 + n_in; ic++) {
+                        for (ip = 0; ip < N_DEL_PROCESSES; ip++, j++) {
+                                const double csf =
+                                    *table_get_CSf(physics, ip, ic, row);
+                                const double pj = csf - last;
+                                af[j] = (pj > 0.) ? pj * n : 0.;
+                                ai[j] = -1;
+                                last = csf;
+                        }
+                }
+                if (last <= 0.) {
+                        for (j = 0; j < n; j++) af[j] = 0.;
+                        continue;
+                }
+
+                /* Pair small and large entries. */
+                for (;;) {
+                        int small = -1, large = -1;
+                        for (j = 0; j < n; j++) {
+                                if (ai[j] >= 0) continue;
+                                if (af[j] < 1.) {
+                                        if (small < 0) small = j;
+                                } else if (large < 0) {
+                                        large = j;
+                                }
+                                if ((small >= 0) && (large >= 0)) break;
+                        }
+                        if ((small < 0) || (large < 0)) break;
+                        ai[small] = large;
+                        af[large] -= 1. - af[small];
+                }
+
+                /* Finalise the remaining entries, up to rounding errors. */
+                for (j = 0; j < n; j++) {
+                        if (ai[j] < 0) {
+                                af[j] = 1.;
+                                ai[j] = j;
+                        }
+                }
+        }
+}
+
 /**
  * Computation of tabulated properties for composite materials.
  *
@@ -9869,10 +14540,10 @@ void compute_kinetic_integral(
  */
 void compute_time_integrals(struct pumas_physics * physics, int material)
 {
-        static double I0 = 0.;
-        if (I0 == 0.) {
-                /* Compute the integral of 1/momemtum for the lowest energy bin
-                 * using trapezes. */
+        /* Compute the integral of 1/momemtum for the lowest energy bin
+         * using trapezes. */
+        double I0;
+        {
                 const int n = 101;
                 int i;
                 const double dK = (*table_get_K(physics, 1)) / (n - 1);
@@ -10097,7 +14768,7 @@ void compute_pchip_coeffs(
         }
 
         int i;
-        for (i = 0; i < N_LARMOR_ORDERS + 1; i++) {
+        for (i = 0; i < N_LARMOR_ORDERS; i++) {
                 math_pchip_initialise(0, n, K,
                     table_get_Li(physics, material, i, 0),
                     table_get_Li_dK(physics, material, i, 0));
@@ -10334,32 +15005,28 @@ void compute_csda_magnetic_transport(
  *
  * @param Physics  Handle for physics tables.
  * @param material The target material.
- * @param row      The kinetic energy index to compute for.
- * @param error    The error data.
+ * @param row       The kinetic energy index to compute for.
+ * @param ms1_table The per element multiple scattering, for base materials.
+ * @param workspace A temporary workspace for the Coulomb scattering data.
+ * @return `PUMAS_RETURN_SUCCESS`.
  *
  * At output the *row* of `physics::table_Mu0` and `physics::table_Ms1` are
- * updated. This routine manages a temporary workspace memory buffer. Calling
- * it with a negative *material* index causes the workspace memory to be freed.
+ * updated. The *workspace* must have room for `physics::max_components`
+ * Coulomb data.
  */
 enum pumas_return compute_scattering_parameters(struct pumas_physics * physics,
-    int material, int row, struct error_context * error_)
+    int material, int row, double * ms1_table,
+    struct coulomb_workspace * workspace)
 {
-        /* Handle the memory for the temporary workspace. */
-        static struct coulomb_workspace * workspace = NULL;
-        if (material < 0) {
-                deallocate(workspace);
-                workspace = NULL;
-                return PUMAS_RETURN_SUCCESS;
-        } else if (workspace == NULL) {
-                const int work_size = sizeof(struct coulomb_workspace) +
-                    physics->max_components * sizeof(struct coulomb_data);
-                workspace = allocate(work_size);
-                if (workspace == NULL) return ERROR_REGISTER_MEMORY();
-        }
+        /* Get the index of the first atomic component of the material. */
+        int i, ic0 = 0;
+        for (i = 0; i < material; i++) ic0 += physics->elements_in[i];
 
         /* Check the kinetic energy. */
         const double kinetic = *table_get_K(physics, row);
         if (kinetic <= 0.) {
+                for (i = 0; i < physics->elements_in[material]; i++)
+                        *table_get_EHSf(physics, ic0 + i, row) = 0.;
                 *table_get_Mu0(physics, material, row) = 0.;
                 *table_get_Ms1(physics, PUMAS_MODE_DISABLED, material, row) = 0.;
                 *table_get_Ms1(physics, PUMAS_MODE_CSDA, material, row) = 0.;
@@ -10372,7 +15039,6 @@ enum pumas_return compute_scattering_parameters(struct pumas_physics * physics,
          */
         double cs_m = 0., cs1_m = 0.;
         double A = DBL_MAX, cs_A = 0.;
-        int i;
         struct coulomb_data * data;
         for (i = 0, data = workspace->data; i < physics->elements_in[material];
              i++, data++) {
@@ -10458,6 +15124,24 @@ enum pumas_return compute_scattering_parameters(struct pumas_physics * physics,
         *table_get_Mu0(physics, material, row) = mu0;
         *table_get_Lb(physics, material, row) =
             lb_h * kinetic * (kinetic + 2. * physics->mass);
+
+        /* Tabulate the fractional contributions of atomic components to the
+         * EHS cross section.
+         */
+        double cs_tot = 0.;
+        for (i = 0, data = workspace->data; i < physics->elements_in[material];
+             i++, data++) {
+                data->cs_hard = data->normalisation *
+                    coulomb_restricted_cs(mu0, data->fspin, data->n_parameters,
+                        data->screening, data->a, data->b, data->c);
+                cs_tot += data->cs_hard;
+        }
+        for (i = 0, data = workspace->data; i < physics->elements_in[material];
+             i++, data++) {
+                *table_get_EHSf(physics, ic0 + i, row) = (cs_tot > 0.) ?
+                    data->cs_hard / cs_tot :
+                    1. / physics->elements_in[material];
+        }
         *table_get_NI_el(physics, PUMAS_MODE_CSDA, material, row) = 1. /
             (*table_get_dE(physics, PUMAS_MODE_CSDA, material, row) * lb_h);
         *table_get_NI_el(physics, PUMAS_MODE_MIXED, material, row) = 1. /
@@ -10466,16 +15150,9 @@ enum pumas_return compute_scattering_parameters(struct pumas_physics * physics,
         /* Compute the 1st moment of the soft scattering. */
         const int n0 = physics->n_materials - physics->n_composites;
         if (material < n0) {
-                /* We have a base material. */
-                static double * ms1_table = NULL;
-                if (material == 0) {
-                        /* Precompute the per element soft scattering terms. */
-                        enum pumas_return rc;
-                        if ((rc = compute_msc_soft(physics, row, &ms1_table,
-                                 error_)) != PUMAS_RETURN_SUCCESS)
-                                return rc;
-                }
-
+                /* We have a base material. Get the precomputed per element
+                 * soft scattering terms.
+                 */
                 double invlb1 = 0., invlb1_csda = 0., invlb1_hybrid = 0.;
                 struct material_component * component =
                     physics->composition[material];
@@ -10568,7 +15245,6 @@ enum pumas_return compute_scattering_parameters(struct pumas_physics * physics,
  * Tabulate the multiple scattering per element.
  *
  * @param Physics   Handle for physics tables.
- * @param row       The row index for the kinetic value.
  * @param data      The tabulated data.
  * @param error_    The error data.
  * @return On success `PUMAS_RETRUN_SUCCESS` otherwise an error code.
@@ -10578,58 +15254,75 @@ enum pumas_return compute_scattering_parameters(struct pumas_physics * physics,
  * buffer. These temporary tables are used for computing per material 1st path
  * length.
  *
- * **Note** This routine handles a static dynamically allocated table. If the
- * *row* index is negative the table is freed.
+ * **Note** The table is allocated and computed, in parallel over elements, at
+ * each call. It must be freed by the caller.
  */
-enum pumas_return compute_msc_soft(struct pumas_physics * physics, int row,
+enum pumas_return compute_msc_soft(struct pumas_physics * physics,
     double ** data, struct error_context * error_)
 {
-        static double * ms1_table = NULL;
-        if (data != NULL) *data = NULL;
-
-        if (row < 0) {
-                deallocate(ms1_table);
-                ms1_table = NULL;
-                return PUMAS_RETURN_SUCCESS;
+        *data = NULL;
+        double * table = allocate(N_SCHEMES * physics->n_elements *
+            physics->n_energies * sizeof(double));
+        if (table == NULL) return ERROR_REGISTER_MEMORY();
+        if (compute_parallel(physics, physics->n_elements,
+                &compute_msc_soft_element, table, error_) !=
+            PUMAS_RETURN_SUCCESS) {
+                deallocate(table);
+                return error_->code;
         }
 
-        /* Allocate the temporary table. */
-        if (ms1_table == NULL) {
-                ms1_table = allocate(N_SCHEMES * physics->n_elements *
-                    physics->n_energies * sizeof(double));
-                if (ms1_table == NULL) return ERROR_REGISTER_MEMORY();
-        }
+        *data = table;
+        return PUMAS_RETURN_SUCCESS;
+}
 
-        /* Loop over atomic elements. */
-        const double kinetic = *table_get_K(physics, row);
-        int iel;
-        for (iel = 0; iel < physics->n_elements; iel++) {
-                struct atomic_element * element = physics->element[iel];
+/**
+ * Tabulate the multiple scattering for a single element.
+ *
+ * @param Physics   Handle for physics tables.
+ * @param element   The index of the atomic element.
+ * @param args      The temporary table to fill.
+ * @param error_    The error data.
+ * @return `PUMAS_RETRUN_SUCCESS`.
+ */
+enum pumas_return compute_msc_soft_element(struct pumas_physics * physics,
+    int element, void * args, struct error_context * error_)
+{
+        (void)error_;
+        double * const ms1_table = args;
+        struct atomic_element * e = physics->element[element];
+
+        /* Loop over kinetic energies. */
+        int row;
+        for (row = 0; row < physics->n_energies; row++) {
+                const double kinetic = *table_get_K(physics, row);
                 double invlb1_csda = 0., invlb1_hybrid = 0.;
 
-                /* Radiative contributions to the transverse transport. */
-                invlb1_csda += dcs_bremsstrahlung_transport(
-                    physics, element, kinetic, 1.);
-                invlb1_hybrid += dcs_bremsstrahlung_transport(
-                    physics, element, kinetic, physics->cutoff);
-                invlb1_csda += dcs_pair_production_transport(
-                    physics, element, kinetic, 1.);
-                invlb1_hybrid += dcs_pair_production_transport(
-                    physics, element, kinetic, physics->cutoff);
-                invlb1_csda += dcs_photonuclear_transport(
-                    physics, element, kinetic, 1.);
-                invlb1_hybrid += dcs_photonuclear_transport(
-                    physics, element, kinetic, physics->cutoff);
+                if (kinetic > 0.) {
+                        /* Radiative contributions to the transverse
+                         * transport.
+                         */
+                        invlb1_csda += dcs_bremsstrahlung_transport(
+                            physics, e, kinetic, 1.);
+                        invlb1_hybrid += dcs_bremsstrahlung_transport(
+                            physics, e, kinetic, physics->cutoff);
+                        invlb1_csda += dcs_pair_production_transport(
+                            physics, e, kinetic, 1.);
+                        invlb1_hybrid += dcs_pair_production_transport(
+                            physics, e, kinetic, physics->cutoff);
+                        invlb1_csda += dcs_photonuclear_transport(
+                            physics, e, kinetic, 1.);
+                        invlb1_hybrid += dcs_photonuclear_transport(
+                            physics, e, kinetic, physics->cutoff);
+                }
 
                 *table_get_ms1(
-                    physics, PUMAS_MODE_CSDA, iel, row, ms1_table) =
+                    physics, PUMAS_MODE_CSDA, element, row, ms1_table) =
                         invlb1_csda;
                 *table_get_ms1(
-                    physics, PUMAS_MODE_MIXED, iel, row, ms1_table) =
+                    physics, PUMAS_MODE_MIXED, element, row, ms1_table) =
                         invlb1_hybrid;
         }
 
-        *data = ms1_table;
         return PUMAS_RETURN_SUCCESS;
 }
 
@@ -10687,60 +15380,69 @@ double compute_cutoff_objective(
         return cs_tot - workspace->cs_h;
 }
 
+/* Arguments for the tabulation of CEL and DEL cross-sections per element. */
+struct cel_and_del_task {
+        /** The row index for the kinetic value. */
+        int row;
+        /** The temporary table. */
+        double * table;
+};
+
+/* Parallel task for tabulating the CEL and DEL cross-sections of an element. */
+static enum pumas_return compute_cel_and_del_element(
+    struct pumas_physics * physics, int iel, void * args,
+    struct error_context * error_)
+{
+        (void)error_;
+        const struct cel_and_del_task * task = args;
+        const int row = task->row;
+        double * const cel_table = task->table;
+        const double kinetic = *table_get_K(physics, row);
+        const struct atomic_element * element = physics->element[iel];
+
+        /* Loop over processes. */
+        int ip;
+        for (ip = 0; ip < N_DEL_PROCESSES; ip++) {
+                dcs_function_t * dcs = dcs_get(ip);
+                *table_get_CSn(physics, ip, iel, row) =
+                    compute_dcs_integral(physics, 0, element, kinetic,
+                        dcs, physics->cutoff, 1, 180);
+                *table_get_cel(physics, ip, iel, row, cel_table) =
+                    compute_dcs_integral(physics, 1, element, kinetic,
+                        dcs, physics->cutoff, 1, 180);
+                const double stg = (dcs == dcs_ionisation) ?
+                    compute_dcs_integral(physics, 2, element, kinetic,
+                        dcs, 0, physics->cutoff, 180) : 0.;
+                *table_get_stg(physics, ip, iel, row, cel_table) = stg;
+        }
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
 /**
  * Tabulate the deterministic CEL and DEL cross-sections per element.
  *
  * @param Physics   Handle for physics tables.
  * @param row       The row index for the kinetic value.
- * @return          The tabulated data.
+ * @param cel_table The temporary table to fill.
+ * @param error_    The error data.
+ * @return On success `PUMAS_RETURN_SUCCESS` otherwise an error code.
  *
  * Because this step is time consuming, the CEL integration is precomputed per
- * element at initialisation using a temporary buffer. These temporary tables
- * are used for computing per material CEL corrections and DEL cross-sections.
+ * element at initialisation using a temporary buffer, in parallel over
+ * elements. These temporary tables are used for computing per material CEL
+ * corrections and DEL cross-sections.
  *
- * **Note** This routine handles a static dynamically allocated table. If the
- * *row* index is negative the table is freed.
+ * **Note** The *cel_table* is owned by the caller. It must have room for
+ * `2 * N_DEL_PROCESSES * physics::n_elements * physics::n_energies` values.
  */
-double * compute_cel_and_del(struct pumas_physics * physics, int row)
+enum pumas_return compute_cel_and_del(struct pumas_physics * physics,
+    int row, double * cel_table, struct error_context * error_)
 {
-        static double * cel_table = NULL;
-
-        if (row < 0) {
-                deallocate(cel_table);
-                return (cel_table = NULL);
-        }
-
-        /* Allocate the temporary table. */
-        if (cel_table == NULL) {
-                cel_table = allocate(2 * N_DEL_PROCESSES * physics->n_elements *
-                    physics->n_energies * sizeof(double));
-                if (cel_table == NULL) return NULL;
-        }
-
         /* Loop over atomic elements. */
-        const double kinetic = *table_get_K(physics, row);
-        int iel;
-        for (iel = 0; iel < physics->n_elements; iel++) {
-                const struct atomic_element * element = physics->element[iel];
-
-                /* Loop over processes. */
-                int ip;
-                for (ip = 0; ip < N_DEL_PROCESSES; ip++) {
-                        dcs_function_t * dcs = dcs_get(ip);
-                        *table_get_CSn(physics, ip, iel, row) =
-                            compute_dcs_integral(physics, 0, element, kinetic,
-                                dcs, physics->cutoff, 1, 180);
-                        *table_get_cel(physics, ip, iel, row, cel_table) =
-                            compute_dcs_integral(physics, 1, element, kinetic,
-                                dcs, physics->cutoff, 1, 180);
-                        const double stg = (dcs == dcs_ionisation) ?
-                            compute_dcs_integral(physics, 2, element, kinetic,
-                                dcs, 0, physics->cutoff, 180) : 0.;
-                        *table_get_stg(physics, ip, iel, row, cel_table) = stg;
-                }
-        }
-
-        return cel_table;
+        struct cel_and_del_task task = { row, cel_table };
+        return compute_parallel(physics, physics->n_elements,
+            &compute_cel_and_del_element, &task, error_);
 }
 
 /**
@@ -10874,11 +15576,12 @@ double compute_dcs_integral(struct pumas_physics * physics, int mode,
 
         /* We integrate over the recoil energy using a logarithmic sampling. */
         double dcsint = 0.;
+        struct gauss_quad quad;
         double x0 = log(qlow), x1 = log(qhigh);
-        math_gauss_quad(nint, &x0, &x1); /* Initialisation. */
+        math_gauss_quad(&quad, nint, &x0, &x1); /* Initialisation. */
 
         double xi, wi;
-        while (math_gauss_quad(0, &xi, &wi) == 0) { /* Iterations. */
+        while (math_gauss_quad(&quad, 0, &xi, &wi) == 0) { /* Iterations. */
                 const double qi = exp(xi);
                 double y = dcs(physics, element, kinetic, qi) * qi;
                 if (mode > 0) y *= qi;
@@ -11442,6 +16145,106 @@ static void dcs_tabulate_row(
         }
 }
 
+/**
+ * Power law approximation of a tabulated DCS over a sampling interval.
+ *
+ * @param l0 The log of the lower node.
+ * @param l1 The log of the upper node.
+ * @param y0 The log of the DCS at the lower node.
+ * @param y1 The log of the DCS at the upper node.
+ * @param c  The integral normalisation.
+ * @param a  The integral exponent.
+ *
+ * Between two nodes, the DCS is approximated as `c / x0 * (x / x0)^(a - 1)`,
+ * i.e. it is linearly interpolated in log-log.
+ */
+void dcs_power_law(
+    double l0, double l1, double y0, double y1, double * c, double * a)
+{
+        *a = 1. + (y1 - y0) / (l1 - l0);
+        *c = exp(y0 + l0);
+}
+
+/**
+ * Integral of a power law DCS.
+ *
+ * @param c The integral normalisation.
+ * @param a The integral exponent.
+ * @param d The log of the ratio of the upper bound to the lower node.
+ * @return The integral from the lower node.
+ */
+double dcs_power_law_integral(double c, double a, double d)
+{
+        return (a == 0.) ? c * d : c * expm1(a * d) / a;
+}
+
+/**
+ * Inverse of the integral of a power law DCS.
+ *
+ * @param c The integral normalisation.
+ * @param a The integral exponent.
+ * @param r The integral value.
+ * @return The log of the ratio of the upper bound to the lower node.
+ */
+double dcs_power_law_inverse(double c, double a, double r)
+{
+        if (a == 0.) return r / c;
+        const double z = a * r / c;
+        /* Protect against rounding errors, for decreasing DCSs. */
+        return (z > -1.) ? log1p(z) / a : DBL_MAX;
+}
+
+/**
+ * Tabulate the cumulative integral of a DCS.
+ *
+ * @param Physics Handle for physics tables.
+ * @param process The process index.
+ * @param element The target element index.
+ * @param row     The kinetic energy row index.
+ * @param work    The tabulation work data.
+ *
+ * The tabulated DCS is integrated over the sampling grid using power law
+ * approximations. The last value of the row is the exact DCS integral above
+ * the sampling grid. If the DCS is not tabulated over the full grid, the last
+ * value is set to `-1`, which disables the inverse sampling.
+ */
+static void dcs_tabulate_cdf_row(
+    struct pumas_physics * physics, int process, int element, int row,
+    struct dcs_tabulate_work * work)
+{
+        const int n = physics->n_table_dcs;
+        double * cdf = table_get_dcs_cdf(physics, process, element, row);
+        const double cs = *table_get_CSn(physics, process, element, row);
+        int i;
+        if ((cs <= 0.) || (work->imin > 0) || (work->imax < n - 1)) {
+                for (i = 0; i < n; i++) {
+                        cdf[i] = 0.;
+                }
+                cdf[n] = -1.;
+                return;
+        }
+
+        /* Integrate over the sampling grid. The nodes are converted to single
+         * precision, consistently with the runtime sampling.
+         */
+        const float * data = table_get_dcs(physics, process, element, row);
+        cdf[0] = 0.;
+        for (i = 0; i < n - 1; i++) {
+                const double l0 = (float)work->x[i];
+                const double l1 = (float)work->x[i + 1];
+                double c, a;
+                dcs_power_law(l0, l1, data[2 * i], data[2 * i + 2], &c, &a);
+                cdf[i + 1] = cdf[i] + dcs_power_law_integral(c, a, l1 - l0);
+        }
+
+        /* Integrate the DCS above the sampling grid. */
+        const double K = physics->table_K[row];
+        const double xt = exp((float)work->x[n - 1]);
+        cdf[n] = compute_dcs_integral(physics, 0, physics->element[element],
+                     K, dcs_get(process), xt, 1., 12) *
+            (K + physics->mass) / K;
+}
+
 struct dcs_tabulate_envelope {
         dcs_function_t * dcs;
         const struct atomic_element * element;
@@ -11614,28 +16417,56 @@ static void dcs_tabulate_envelope_row(
 #undef RESOLUTION
 }
 
+/**
+ * Get a node of the energy loss grid for the tabulation of DCSs.
+ *
+ * @param physcis    The physics handle.
+ * @param i          The index of the node.
+ * @return The logarithm of the fractional energy loss at the node.
+ *
+ * The nodes are log-spaced from the cutoff up to `DCS_MODEL_X_REVERSE`, and
+ * then log-spaced in the complement up to `DCS_MODEL_MAX_FRACTION`.
+ */
+double compute_dcs_node(const struct pumas_physics * physics, int i)
+{
+        const int n = physics->n_table_dcs;
+        const int p = DCS_MODEL_N_REVERSE;
+        const int m = n - p;
+
+        const double xrev = (m > 0) ? DCS_MODEL_X_REVERSE : physics->cutoff;
+        if (i < m) {
+                const double x0 = log(physics->cutoff);
+                const double dx = log(xrev / physics->cutoff) / (m - 1);
+                return x0 + i * dx;
+        }
+
+        const double dxmin = DCS_MODEL_DXMIN;
+        const double dx = log((DCS_MODEL_MAX_FRACTION - xrev) / dxmin) /
+            ((m > 0) ? p : p - 1);
+        return log(DCS_MODEL_MAX_FRACTION - dxmin * exp((n - 1 - i) * dx));
+}
+
 /**
  * Tabulate the DCSs for radiative processes.
  *
  * @param physcis    The physics handle.
  * @param element    The index of the target element.
+ * @param args       Unused.
  * @param error_     The error stream
  * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise a memory
  * error.
  *
  * This routines tabulates the DCS values over a fixed grid for later evaluation
- * using monotone cubic splines.
+ * using monotone cubic splines, as well as their cumulative integrals for the
+ * inverse sampling of DELs. The temporary work data are allocated per call,
+ * such that distinct elements can be tabulated concurrently.
  */
-enum pumas_return compute_dcs_table(
-    struct pumas_physics * physics, int element, struct error_context * error_)
+enum pumas_return compute_dcs_table(struct pumas_physics * physics,
+    int element, void * args, struct error_context * error_)
 {
-        static struct dcs_tabulate_work * work = NULL;
-        if (element < 0) {
-                /* Free the temporary work data */
-                deallocate(work);
-                work = NULL;
-                return PUMAS_RETURN_SUCCESS;
-        } else if (work == NULL) {
+        (void)args;
+        struct dcs_tabulate_work * work;
+        {
                 /* Allocate the temporary work data */
                 const int n = physics->n_table_dcs;
                 size_t size = sizeof(*work) + 3 * n * sizeof(*work->x);
@@ -11647,30 +16478,9 @@ enum pumas_return compute_dcs_table(
                 work->m = work->y + n;
 
                 /* Set the sampling range */
-                const int p = DCS_MODEL_N_REVERSE;
-                const int m = n - p;
-
-                double xrev;
-                if (m > 0) {
-                        xrev = DCS_MODEL_X_REVERSE;
-                        const double x0 = log(physics->cutoff);
-                        const double dx = log(xrev / physics->cutoff) / (m - 1);
-                        int i;
-                        for (i = 0; i < m; i++) {
-                                work->x[i] = x0 + i * dx;
-                        }
-                } else {
-                        xrev = physics->cutoff;
-                }
-
-                const double dxmin = DCS_MODEL_DXMIN;
-                const double dx = log((DCS_MODEL_MAX_FRACTION - xrev) / dxmin) /
-                    ((m > 0) ? p : p - 1);
                 int i;
-                for (i = 0; i < p; i++) {
-                        work->x[n - 1 - i] = log(DCS_MODEL_MAX_FRACTION -
-                            dxmin * exp(i * dx));
-                }
+                for (i = 0; i < n; i++)
+                        work->x[i] = compute_dcs_node(physics, i);
         }
 
         /* Tabulate processes for different energies */
@@ -11679,6 +16489,7 @@ enum pumas_return compute_dcs_table(
                 int row;
                 for (row = 0; row < physics->n_energies; row++) {
                         dcs_tabulate_row(physics, ip, element, row, work);
+                        dcs_tabulate_cdf_row(physics, ip, element, row, work);
                 }
 
                 /* Set the envelope for low energy bins to a constant value */
@@ -11706,12 +16517,43 @@ enum pumas_return compute_dcs_table(
                 }
         }
 
-        if (element == 0) {
-                /* Copy the sampling range */
-                const int n = physics->n_table_dcs;
-                int i;
-                for (i = 0; i < n; i++) {
-                        physics->table_DCS_x[i] = (float)work->x[i];
+        deallocate(work);
+        return PUMAS_RETURN_SUCCESS;
+}
+
+/**
+ * Tabulate the polar angle in photonuclear DELs.
+ *
+ * @param physcis    The physics handle.
+ * @param element    The index of the target element.
+ * @param args       Unused.
+ * @param error_     The error stream
+ * @return `PUMAS_RETURN_SUCCESS`.
+ *
+ * The quantiles of the momentum transfer are tabulated for each kinetic energy
+ * row and for each node of the DCS sampling grid. The sampling grid must have
+ * been set previously, i.e. the DCSs must be tabulated first.
+ *
+ * Note that the tabulation is done once, when the physics is created, since
+ * physics tables are read only afterwards. It is restored from dumps.
+ */
+enum pumas_return compute_polar_table(struct pumas_physics * physics,
+    int element, void * args, struct error_context * error_)
+{
+        (void)args;
+        (void)error_;
+
+        const struct atomic_element * e = physics->element[element];
+        int row;
+        for (row = 0; row < physics->n_energies; row++) {
+                const double K = physics->table_K[row];
+                int ix;
+                for (ix = 0; ix < physics->n_table_dcs; ix++) {
+                        const double x = exp(physics->table_DCS_x[ix]);
+                        float * quantiles =
+                            table_get_polar(physics, element, row, ix);
+                        polar_photonuclear_tabulate(
+                            physics, e, K, K * (1. - x), quantiles);
                 }
         }
 
@@ -11862,29 +16704,47 @@ static double photonuclear_polar_objective(
 }
 
 /**
- * Sample the polar angle in a photonuclear event.
+ * Kinematic range of the momentum transfer in a photonuclear event.
  *
  * @param Physics Handle for physics tables.
- * @param context The simulation context.
- * @param element The targeted atomic element.
  * @param ki      The initial kinetic energy.
  * @param kf      The final kinetic energy.
- * @return The polar parameters as 0.5 * (1 - cos_theta).
+ * @param Q2min   The minimum squared momentum transfer.
+ * @param Q2max   The maximum squared momentum transfer.
+ * @return `0` if the range is empty, `1` otherwise.
  */
-double polar_photonuclear(const struct pumas_physics * physics,
-    struct pumas_context * context, const struct atomic_element * element,
-    double ki, double kf)
+static int polar_photonuclear_range(const struct pumas_physics * physics,
+    double ki, double kf, double * Q2min, double * Q2max)
 {
-#define MAX_TRIALS 100
         const double M = 0.5 * (PROTON_MASS + NEUTRON_MASS);
         const double q = ki - kf;
         const double ml = physics->mass;
         const double E = ki + ml;
         const double ml2 = ml * ml;
-        const double Q2min = ml2 * (q * q - 0.5 * ml2) / (E * (E - q));
-        const double Q2max = 2.0 * M * (q - PION_MASS) - PION_MASS * PION_MASS;
-        if ((Q2max < Q2min) | (Q2min < 0)) return 0.;
+        *Q2min = ml2 * (q * q - 0.5 * ml2) / (E * (E - q));
+        *Q2max = 2.0 * M * (q - PION_MASS) - PION_MASS * PION_MASS;
+        return !((*Q2max < *Q2min) | (*Q2min < 0));
+}
 
+/**
+ * Sample the momentum transfer in a photonuclear event by rejection.
+ *
+ * @param Physics Handle for physics tables.
+ * @param context The simulation context.
+ * @param element The targeted atomic element.
+ * @param ki      The initial kinetic energy.
+ * @param q       The energy loss.
+ * @param Q2min   The minimum squared momentum transfer.
+ * @param Q2max   The maximum squared momentum transfer.
+ * @param Q2      The sampled squared momentum transfer.
+ * @return `0` in case of failure, `1` otherwise.
+ */
+static int polar_photonuclear_reject(const struct pumas_physics * physics,
+    struct pumas_context * context, const struct atomic_element * element,
+    double ki, double q, double Q2min, double Q2max, double * Q2)
+{
+#define MAX_TRIALS 100
+        const double M = 0.5 * (PROTON_MASS + NEUTRON_MASS);
         struct photonuclear_polar_parameters args = {
                 .Z = element->Z,
                 .A = element->A,
@@ -11898,7 +16758,7 @@ double polar_photonuclear(const struct pumas_physics * physics,
             physics, lnQ2min, lnQ2max, NULL, NULL, 1E-06, 100, &args, &xopt,
             &fopt);
         fopt = -fopt;
-        if (status == -2) return 0.;
+        if (status == -2) return 0;
 
         const double x = exp(xopt) / (2 * q * M);
         const double lne = 0.1;
@@ -11918,18 +16778,54 @@ double polar_photonuclear(const struct pumas_physics * physics,
         }
 
         ddcs_t * ddcs = dcs_photonuclear_ddcs(physics, NULL);
+        const double ml = physics->mass;
         const double rQ2 = lnQ2max - lnQ2min;
-        double Q2 = 0.;
         int i;
         for (i = 0; i < MAX_TRIALS; i++) {
                 const double u = context->random(context);
-                Q2 = Q2min * exp(rQ2 * u);
+                *Q2 = Q2min * exp(rQ2 * u);
 
                 const double r =
-                    ddcs(element->Z, element->A, ml, ki, q, Q2) * Q2;
-                if (context->random(context) * fopt <= r) break;
+                    ddcs(element->Z, element->A, ml, ki, q, *Q2) * *Q2;
+                if (context->random(context) * fopt <= r) return 1;
+        }
+        return 0;
+
+#undef MAX_TRIALS
+}
+
+/**
+ * Sample the polar angle in a photonuclear event.
+ *
+ * @param Physics Handle for physics tables.
+ * @param context The simulation context.
+ * @param element The targeted atomic element.
+ * @param ki      The initial kinetic energy.
+ * @param kf      The final kinetic energy.
+ * @return The polar parameters as 0.5 * (1 - cos_theta).
+ *
+ * The momentum transfer is sampled from the tabulated quantiles, when
+ * available. Otherwise, a rejection sampling method is used.
+ */
+double polar_photonuclear(const struct pumas_physics * physics,
+    struct pumas_context * context, const struct atomic_element * element,
+    double ki, double kf)
+{
+        const double q = ki - kf;
+        const double ml = physics->mass;
+        const double E = ki + ml;
+        double Q2min, Q2max;
+        if (!polar_photonuclear_range(physics, ki, kf, &Q2min, &Q2max))
+                return 0.;
+
+        double Q2, t;
+        if (polar_photonuclear_tabulated(
+                physics, context, element, ki, kf, &t)) {
+                Q2 = Q2min * exp(t * log(Q2max / Q2min));
+        } else if (!polar_photonuclear_reject(
+                       physics, context, element, ki, q, Q2min, Q2max, &Q2)) {
+                return 0.;
         }
-        if (i == MAX_TRIALS) return 0.;
 
         const double p = sqrt(ki * (ki + 2 * ml));
         const double E1 = E - q;
@@ -11945,9 +16841,179 @@ double polar_photonuclear(const struct pumas_physics * physics,
         else if (mu > 1.) mu = 1.;
 
         return mu;
+}
 
-#undef MAX_TRIALS
+/**
+ * Cumulative probabilities of the tabulated quantiles of the polar angle.
+ *
+ * The levels are refined towards both ends in order to render the tails.
+ */
+static const double polar_levels[POLAR_N_QUANTILES] = { 0., 1E-04, 1E-03,
+        5E-03, 2E-02, 5E-02, 1E-01, 1.5E-01, 2E-01, 3E-01, 4E-01, 5E-01,
+        6E-01, 7E-01, 8E-01, 8.5E-01, 9E-01, 9.5E-01, 9.8E-01, 9.95E-01,
+        9.99E-01, 9.999E-01, 1. };
+
+/**
+ * Sample the momentum transfer of a photonuclear event from the tabulation.
+ *
+ * @param Physics Handle for physics tables.
+ * @param context The simulation context.
+ * @param element The targeted atomic element.
+ * @param ki      The initial kinetic energy.
+ * @param kf      The final kinetic energy.
+ * @param t       The logarithm of the squared momentum transfer, normalised
+ *                to its kinematic range.
+ * @return `1` on success, `0` if the tabulation does not apply.
+ *
+ * The quantiles are bilinearly interpolated w.r.t. the logarithms of the
+ * kinetic energy and of the fractional energy loss. The tabulation does not
+ * apply outside of the tabulated range or if any of the neighbouring nodes
+ * is invalid.
+ */
+int polar_photonuclear_tabulated(const struct pumas_physics * physics,
+    struct pumas_context * context, const struct atomic_element * element,
+    double ki, double kf, double * t)
+{
+        /* Bracket the kinetic energy */
+        const double * const K = physics->table_K;
+        const int imax = physics->n_energies - 1;
+        if ((ki < K[0]) || (ki >= K[imax])) return 0;
+        const int i0 = table_index(physics, context, K, ki);
+        if ((i0 < 0) || (i0 >= imax) || (K[i0] <= 0.)) return 0;
+
+        /* Bracket the fractional energy loss */
+        const int n = physics->n_table_dcs;
+        const float * const lx = physics->table_DCS_x;
+        const double x = (ki - kf) / ki;
+        if (!(x > 0.)) return 0;
+        const float l = (float)log(x);
+        if ((l < lx[0]) || (l >= lx[n - 1])) return 0;
+        int j0 = 0, j1 = n - 1;
+        table_bracketf(lx, l, &j0, &j1);
+
+        /* Locate the quantile */
+        const double u = context->random(context);
+        int k = 0, k1 = POLAR_N_QUANTILES - 1;
+        while (k1 - k > 1) {
+                const int k2 = (k + k1) / 2;
+                if (u >= polar_levels[k2])
+                        k = k2;
+                else
+                        k1 = k2;
+        }
+        const double f = (u - polar_levels[k]) /
+            (polar_levels[k + 1] - polar_levels[k]);
+
+        /* Interpolate the quantiles */
+        const double hk = log(ki / K[i0]) / log(K[i0 + 1] / K[i0]);
+        const double hx = (l - lx[j0]) / (lx[j0 + 1] - lx[j0]);
+        const double w[4] = { (1. - hk) * (1. - hx), (1. - hk) * hx,
+                hk * (1. - hx), hk * hx };
+        double tt = 0.;
+        int ic;
+        for (ic = 0; ic < 4; ic++) {
+                const float * const q = table_get_polar(
+                    physics, element->index, i0 + ic / 2, j0 + ic % 2);
+                if (q[0] < 0.f) return 0;
+                tt += w[ic] * (q[k] + f * (q[k + 1] - q[k]));
+        }
+        *t = tt;
+
+        return 1;
+}
+
+/**
+ * Tabulate the quantiles of the momentum transfer in a photonuclear event.
+ *
+ * @param Physics   Handle for physics tables.
+ * @param element   The targeted atomic element.
+ * @param ki        The initial kinetic energy.
+ * @param kf        The final kinetic energy.
+ * @param quantiles The tabulated quantiles.
+ *
+ * The tabulated variable is the logarithm of the squared momentum transfer,
+ * normalised to its kinematic range. The first quantile is set to `-1` if the
+ * tabulation does not apply.
+ */
+void polar_photonuclear_tabulate(const struct pumas_physics * physics,
+    const struct atomic_element * element, double ki, double kf,
+    float * quantiles)
+{
+        double Q2min, Q2max;
+        if (!polar_photonuclear_range(physics, ki, kf, &Q2min, &Q2max) ||
+            (Q2min <= 0.))
+                goto invalid;
+
+        /* Tabulate the PDF of the normalised variable */
+        ddcs_t * ddcs = dcs_photonuclear_ddcs(physics, NULL);
+        const double rQ2 = log(Q2max / Q2min);
+        const double dt = 1. / (POLAR_N_PDF - 1);
+        double cdf[POLAR_N_PDF];
+        int i;
+        for (i = 0; i < POLAR_N_PDF; i++) {
+                const double Q2 = Q2min * exp(i * dt * rQ2);
+                const double pdf = ddcs(element->Z, element->A, physics->mass,
+                                       ki, ki - kf, Q2) * Q2;
+                cdf[i] = (pdf > 0.) ? pdf : 0.;
+        }
+
+        /* Integrate the PDF with the trapezoidal rule */
+        double p0 = cdf[0];
+        cdf[0] = 0.;
+        for (i = 1; i < POLAR_N_PDF; i++) {
+                const double p1 = cdf[i];
+                cdf[i] = cdf[i - 1] + 0.5 * (p0 + p1);
+                p0 = p1;
+        }
+        const double norm = cdf[POLAR_N_PDF - 1];
+        if (!(norm > 0.) || !isfinite(norm)) goto invalid;
+
+        /* Invert the CDF */
+        int k;
+        for (i = 0, k = 0; k < POLAR_N_QUANTILES; k++) {
+                const double u = polar_levels[k] * norm;
+                while ((i < POLAR_N_PDF - 2) &&
+                    ((cdf[i + 1] < u) || ((k == 0) && (cdf[i + 1] <= 0.))))
+                        i++;
+                const double d = cdf[i + 1] - cdf[i];
+                double f = (d > 0.) ? (u - cdf[i]) / d : 0.;
+                if (f < 0.) f = 0.;
+                else if (f > 1.) f = 1.;
+                quantiles[k] = (float)((i + f) * dt);
+        }
+        return;
+
+invalid:
+        memset(quantiles, 0x0, POLAR_N_QUANTILES * sizeof(*quantiles));
+        quantiles[0] = -1.f;
+}
+
+#if (TEST_MODE)
+/* Tabulated photonuclear polar sampler and its reference PDF, exported for
+ * the unit tests only. The variable is the logarithm of the squared momentum
+ * transfer, normalised to its kinematic range.
+ */
+int pumas_test_polar_photonuclear(const struct pumas_physics * physics,
+    struct pumas_context * context, int element, double ki, double kf,
+    double * t)
+{
+        return polar_photonuclear_tabulated(
+            physics, context, physics->element[element], ki, kf, t);
+}
+
+double pumas_test_polar_photonuclear_pdf(const struct pumas_physics * physics,
+    int element, double ki, double kf, double t)
+{
+        double Q2min, Q2max;
+        if (!polar_photonuclear_range(physics, ki, kf, &Q2min, &Q2max) ||
+            (Q2min <= 0.))
+                return 0.;
+        const struct atomic_element * e = physics->element[element];
+        const double Q2 = Q2min * exp(t * log(Q2max / Q2min));
+        ddcs_t * ddcs = dcs_photonuclear_ddcs(physics, NULL);
+        return ddcs(e->Z, e->A, physics->mass, ki, ki - kf, Q2) * Q2;
 }
+#endif
 
 /**
  * Sample the polar angle in an ionisation event.
@@ -12397,9 +17463,10 @@ int math_find_minimum_bisection(
 /**
  * Iterator function for integration with a Gaussian quadrature.
  *
- * @param n  The minimum number of integration points.
- * @param p1 The integration range lower bound or the sampling point.
- * @param p2 The integration range upper bound or the sampling weight.
+ * @param quad The state of the iterator.
+ * @param n    The minimum number of integration points.
+ * @param p1   The integration range lower bound or the sampling point.
+ * @param p2   The integration range upper bound or the sampling weight.
  * @return The number of points used for the integration or a return code.
  *
  * If *n* is strictly positive the iterator is initialised for a new
@@ -12410,40 +17477,32 @@ int math_find_minimum_bisection(
  * filled with the corresponding weight. If all integration steps have been
  * done `1` is returned, otherwise `0`.
  */
-int math_gauss_quad(int n, double * p1, double * p2)
+int math_gauss_quad(struct gauss_quad * quad, int n, double * p1, double * p2)
 {
 /*
  * Coefficients for the Gaussian quadrature from:
  * https://pomax.github.io/bezierinfo/legendre-gauss.html.
  */
 #define N_GQ 6
-        static const double * xGQ = NULL;
-        static const double * wGQ = NULL;
-
         /* Initialisation step. */
-        static int i, j, n_itv;
-        static double h;
-        static double x0;
         if (n > 0) {
-                if (xGQ == NULL)
-                        math_gauss_quad_coefficients(N_GQ, &xGQ, &wGQ);
-
-                n_itv = (n + N_GQ - 1) / N_GQ;
-                i = j = 0;
-                h = (*p2 - (x0 = *p1)) / n_itv;
-                return N_GQ * n_itv;
+                math_gauss_quad_coefficients(N_GQ, &quad->xGQ, &quad->wGQ);
+                quad->n_itv = (n + N_GQ - 1) / N_GQ;
+                quad->i = quad->j = 0;
+                quad->h = (*p2 - (quad->x0 = *p1)) / quad->n_itv;
+                return N_GQ * quad->n_itv;
         }
 
         /* Iteration step. */
-        if (i == n_itv) return 1;
+        if (quad->i == quad->n_itv) return 1;
 
-        *p1 = x0 + xGQ[j] * h;
-        *p2 = wGQ[j] * h;
+        *p1 = quad->x0 + quad->xGQ[quad->j] * quad->h;
+        *p2 = quad->wGQ[quad->j] * quad->h;
 
-        if (++j == N_GQ) {
-                i++;
-                j = 0;
-                x0 += h;
+        if (++quad->j == N_GQ) {
+                quad->i++;
+                quad->j = 0;
+                quad->x0 += quad->h;
         }
         return 0;
 
@@ -13342,7 +18401,6 @@ struct physics_element * tabulation_element_create(
                 3 * data->n_energies * sizeof(double));
         if (e == NULL) return NULL;
         e->index = element;
-        e->fraction = 0.;
 
         /* Add the element's data on top of the stack. */
         if (data->elements != NULL) data->elements->next = e;
@@ -13354,39 +18412,92 @@ struct physics_element * tabulation_element_create(
 }
 
 /*
- * Get the energy loss table for an element from the temporary data and
- * put it on top of the stack.
+ * Get the energy loss table for an element from the temporary data. The stack
+ * is left unchanged, such that concurrent look-ups are safe.
  */
 struct physics_element * tabulation_element_get(
     struct physics_tabulation_data * data, int element)
 {
         struct physics_element * e;
         for (e = data->elements; e != NULL; e = e->prev) {
-                if (e->index == element) {
-                        struct physics_element * next = e->next;
-                        if (next != NULL) {
-                                /* Put the element on top of the stack. */
-                                struct physics_element * prev = e->prev;
-                                if (prev != NULL) prev->next = next;
-                                next->prev = prev;
-                                data->elements->next = e;
-                                e->prev = data->elements;
-                                e->next = NULL;
-                                data->elements = e;
-                        }
-                        return e;
-                }
+                if (e->index == element) return e;
         }
 
         /* The element wasn't found, return `NULL`. */
         return NULL;
 }
 
+/*
+ * Set the default energy grid for the tabulation of energy losses.
+ */
+static enum pumas_return tabulation_energy_default(
+    const struct pumas_physics * physics,
+    struct physics_tabulation_data * data, struct error_context * error_)
+{
+        double * energy = data->default_energy;
+        if (energy == NULL) {
+                energy = allocate(201 * sizeof(*energy));
+                if (energy == NULL) return ERROR_REGISTER_MEMORY();
+                data->default_energy = energy;
+        }
+        data->energy = energy;
+
+        if (physics->particle == PUMAS_PARTICLE_MUON) {
+                /* For muons an extended PDG like energy grid is used by
+                 * default.
+                 */
+                energy[0] = 1.000E-03;
+                energy[1] = 1.200E-03;
+                energy[2] = 1.400E-03;
+                energy[3] = 1.700E-03;
+                energy[4] = 2.000E-03;
+                energy[5] = 2.500E-03;
+                energy[6] = 3.000E-03;
+                energy[7] = 3.500E-03;
+                energy[8] = 4.000E-03;
+                energy[9] = 4.500E-03;
+                energy[10] = 5.000E-03;
+                energy[11] = 5.500E-03;
+                energy[12] = 6.000E-03;
+                energy[13] = 7.000E-03;
+                energy[14] = 8.000E-03;
+                energy[15] = 9.000E-03;
+
+                const int n_per_decade = 16;
+                const int n_decades = 11;
+                data->n_energies = (n_decades + 1) * n_per_decade + 1;
+
+                int i;
+                for (i = 1; i <= n_decades; i++) {
+                        int j;
+                        for (j = 0; j < n_per_decade; j++) {
+                                energy[i * n_per_decade + j] = 10 *
+                                    energy[(i - 1) * n_per_decade + j];
+                        }
+                }
+                energy[(n_decades + 1) * n_per_decade] = 10 *
+                    energy[n_decades * n_per_decade];
+        } else {
+                /* For taus a logarithmic energy grid is used by default. */
+                data->n_energies = 201;
+                double emin = 1E+02, emax = 1E+12;
+                const double dlnk = log(emax / emin) / (data->n_energies - 1);
+                int i;
+                for (i = 0; i < data->n_energies; i++) {
+                        energy[i] = emin * exp(dlnk * i);
+                }
+        }
+
+        return PUMAS_RETURN_SUCCESS;
+}
+
 /**
  * Tabulate the energy loss for the given material and set of energies.
  *
  * @param physics    Handle for the Physics tables.
  * @param data       The tabulation settings.
+ * @param material   The index of the material to tabulate.
+ * @param error_     The error data.
  * @return On success `PUMAS_RETURN_SUCCESS` is returned otherwise an error
  * code is returned as detailed below.
  *
@@ -13398,7 +18509,8 @@ struct physics_element * tabulation_element_get(
  *
  * __Warnings__
  *
- * This function is **not** thread safe.
+ * This function is **not** thread safe, unless the energy grid and the atomic
+ * elements have been tabulated beforehand with `physics_tabulation_prepare`.
  *
  * __Error codes__
  *
@@ -13412,10 +18524,10 @@ struct physics_element * tabulation_element_get(
  *
  */
 enum pumas_return physics_tabulate(struct pumas_physics * physics,
-    struct physics_tabulation_data * data, struct error_context * error_)
+    struct physics_tabulation_data * data, int material,
+    struct error_context * error_)
 {
         /* Check the material index */
-        const int material = data->material;
         if ((material < 0) ||
             (material >= physics->n_materials - physics->n_composites)) {
                 return ERROR_VREGISTER(PUMAS_RETURN_INDEX_ERROR,
@@ -13424,117 +18536,81 @@ enum pumas_return physics_tabulate(struct pumas_physics * physics,
 
         /* Set the energy grid */
         if ((data->n_energies <= 0) || (data->energy == NULL)) {
-                static double energy_[201];
-                data->energy = energy_;
-
-                if (physics->particle == PUMAS_PARTICLE_MUON) {
-                        /* For muons an extended PDG like energy grid is used
-                         * by default.
-                         */
-                        energy_[0] = 1.000E-03;
-                        energy_[1] = 1.200E-03;
-                        energy_[2] = 1.400E-03;
-                        energy_[3] = 1.700E-03;
-                        energy_[4] = 2.000E-03;
-                        energy_[5] = 2.500E-03;
-                        energy_[6] = 3.000E-03;
-                        energy_[7] = 3.500E-03;
-                        energy_[8] = 4.000E-03;
-                        energy_[9] = 4.500E-03;
-                        energy_[10] = 5.000E-03;
-                        energy_[11] = 5.500E-03;
-                        energy_[12] = 6.000E-03;
-                        energy_[13] = 7.000E-03;
-                        energy_[14] = 8.000E-03;
-                        energy_[15] = 9.000E-03;
-
-                        const int n_per_decade = 16;
-                        const int n_decades = 11;
-                        data->n_energies = (n_decades + 1) * n_per_decade + 1;
-
-                        int i;
-                        for (i = 1; i <= n_decades; i++) {
-                                int j;
-                                for (j = 0; j < n_per_decade; j++) {
-                                        energy_[i * n_per_decade + j] = 10 *
-                                            energy_[(i - 1) * n_per_decade + j];
-                                }
-                        }
-                        energy_[(n_decades + 1) * n_per_decade] = 10 *
-                            energy_[n_decades * n_per_decade];
-                } else {
-                        /* For taus a logarithmic energy grid is used by
-                         * default.
-                         */
-                        data->n_energies = 201;
-                        double emin = 1E+02, emax = 1E+12;
-                        const double dlnk = log(emax / emin) /
-                            (data->n_energies - 1);
-                        int i;
-                        for (i = 0; i < data->n_energies; i++) {
-                                energy_[i] = emin * exp(dlnk * i);
-                        }
-                }
+                if (tabulation_energy_default(physics, data, error_) !=
+                    PUMAS_RETURN_SUCCESS) return error_->code;
         }
 
         /*
-         * Tabulate the radiative energy losses for the constitutive atomic
-         * elements, if not already done. Note that the element are also sorted
-         * on top of the *data* stack.
+         * Get the radiative energy losses for the constitutive atomic
+         * elements. Missing elements are tabulated and added to the *data*
+         * stack.
          */
+        char * path = NULL;
+        double * work = NULL;
+        struct atomic_shell * shells = NULL;
+        FILE * stream = NULL;
+        const int n_components = physics->elements_in[material];
+        struct tabulation_element ** elements =
+            allocate(n_components * sizeof(*elements));
+        if (elements == NULL) {
+                ERROR_REGISTER_MEMORY();
+                goto clean_and_exit;
+        }
+
         struct material_component * component;
-        int iel;
-        for (iel = 0, component = physics->composition[material];
-             iel < physics->elements_in[material]; iel++, component++) {
-                /*
-                 * Get the requested element's data and put them on top of
-                 * the stack for further usage.
-                 */
+        int ic;
+        for (ic = 0, component = physics->composition[material];
+             ic < n_components; ic++, component++) {
                 struct physics_element * e =
                     tabulation_element_get(data, component->element);
 
                 if (e == NULL) {
                         /* Create and tabulate the new element. */
                         e = tabulation_element_create(data, component->element);
-                        if (e == NULL) return PUMAS_RETURN_MEMORY_ERROR;
+                        if (e == NULL) {
+                                ERROR_REGISTER_MEMORY();
+                                goto clean_and_exit;
+                        }
                         tabulate_element(physics,
                             (struct tabulation_element *)e, data->n_energies,
                             data->energy);
                 }
-
-                /* Set the fraction in the current material. */
-                e->fraction = component->fraction;
+                elements[ic] = (struct tabulation_element *)e;
         }
 
         /* Check and open the output file. */
         int offset_dir, size_name;
-        enum pumas_return rc;
-        if ((rc = mdf_format_path(data->outdir, physics->mdf_path,
-            &data->path, &offset_dir, &size_name, error_)) !=
-            PUMAS_RETURN_SUCCESS) {
-                return rc;
+        if (mdf_format_path(data->outdir, physics->mdf_path, &path,
+            &offset_dir, &size_name, error_) != PUMAS_RETURN_SUCCESS) {
+                goto clean_and_exit;
         } else {
                 size_name += strlen(physics->dedx_filename[material]) + 1;
-                char * new_name = reallocate(data->path, size_name);
+                char * new_name = reallocate(path, size_name);
                 if (new_name == NULL) {
-                        return ERROR_REGISTER_MEMORY();
+                        ERROR_REGISTER_MEMORY();
+                        goto clean_and_exit;
                 }
-                data->path = new_name;
-                strcpy(data->path + offset_dir,
-                    physics->dedx_filename[material]);
+                path = new_name;
+                strcpy(path + offset_dir, physics->dedx_filename[material]);
         }
 
-        FILE * stream;
         if (data->overwrite == 0) {
                 /* Check if the file already exists. */
-                stream = fopen(data->path, "r");
+                stream = fopen(path, "r");
                 if (stream != NULL) {
                         fclose(stream);
-                        return PUMAS_RETURN_IO_ERROR;
+                        stream = NULL;
+                        ERROR_VREGISTER(PUMAS_RETURN_IO_ERROR,
+                            "file `%s' already exists", path);
+                        goto clean_and_exit;
                 }
         }
-        stream = fopen(data->path, "w+");
-        if (stream == NULL) return PUMAS_RETURN_PATH_ERROR;
+        stream = fopen(path, "w+");
+        if (stream == NULL) {
+                ERROR_VREGISTER(PUMAS_RETURN_PATH_ERROR,
+                    "could not open file `%s'", path);
+                goto clean_and_exit;
+        }
 
         /* Print the header. */
         const char * type =
@@ -13560,16 +18636,20 @@ enum pumas_return physics_tabulate(struct pumas_physics * physics,
 
         /* Build electronic shells by merging element's one */
         int n_shells = 0;
-        struct atomic_shell * shells = atomic_shell_create(
-            physics, material, &n_shells, NULL);
+        shells = atomic_shell_create(physics, material, &n_shells, NULL);
+        if (shells == NULL) {
+                ERROR_REGISTER_MEMORY();
+                goto clean_and_exit;
+        }
 
         /* Loop on the kinetic energy values and print the table. */
         const int n = data->n_energies + 1;
-        if (data->work == NULL) {
-                data->work = allocate(
-                    n * (N_DEL_PROCESSES + 5) * sizeof(double));
+        work = allocate(n * (N_DEL_PROCESSES + 5) * sizeof(double));
+        if (work == NULL) {
+                ERROR_REGISTER_MEMORY();
+                goto clean_and_exit;
         }
-        double * elec = data->work;
+        double * elec = work;
         double * delta = elec + n;
         double * rads = delta + n;
         double * dedx = rads + (N_DEL_PROCESSES -1) * n;
@@ -13592,14 +18672,13 @@ enum pumas_return physics_tabulate(struct pumas_physics * physics,
                 /* Compute radiative losses */
                 double * brad = rads + i * (N_DEL_PROCESSES - 1);
                 memset(brad, 0x0, sizeof(double) * (N_DEL_PROCESSES - 1));
-                struct tabulation_element * e;
-                int iel;
-                for (iel = 0, e = (struct tabulation_element *)data->elements;
-                     iel < physics->elements_in[material];
-                     iel++, e = (struct tabulation_element *)e->api.prev) {
+                for (ic = n_components - 1; ic >= 0; ic--) {
+                        const double fraction =
+                            physics->composition[material][ic].fraction;
+                        const struct tabulation_element * e = elements[ic];
                         int j;
                         for (j = 0; j < N_DEL_PROCESSES - 1; j++)
-                                brad[j] += e->api.fraction *
+                                brad[j] += fraction *
                                     e->data[(N_DEL_PROCESSES - 1) * i + j];
                 }
 
@@ -13630,12 +18709,98 @@ enum pumas_return physics_tabulate(struct pumas_physics * physics,
                     delta[i], beta);
         }
 
+clean_and_exit:
         /* Free, close and return. */
-        free(shells);
-        fclose(stream);
+        deallocate(elements);
+        deallocate(path);
+        deallocate(work);
+        deallocate(shells);
+        if (stream != NULL) fclose(stream);
+        return error_->code;
+}
+
+/* Parallel task for tabulating the energy loss of atomic elements. */
+static enum pumas_return tabulation_element_task(
+    struct pumas_physics * physics, int index, void * args,
+    struct error_context * error_)
+{
+        (void)error_;
+        struct physics_tabulation_task * task = args;
+        tabulate_element(physics,
+            (struct tabulation_element *)task->elements[index],
+            task->data->n_energies, task->data->energy);
         return PUMAS_RETURN_SUCCESS;
 }
 
+/**
+ * Prepare the tabulation of the energy loss for a set of materials.
+ *
+ * @param physics     Handle for the Physics tables.
+ * @param data        The tabulation settings.
+ * @param n_materials The number of materials to tabulate.
+ * @param materials   The indices of the materials to tabulate.
+ * @param error_      The error data.
+ * @return On success `PUMAS_RETURN_SUCCESS` otherwise an error code.
+ *
+ * The energy grid is set, if not provided, and the radiative energy losses of
+ * all the constitutive atomic elements are tabulated, in parallel over
+ * elements. Then, the *data* are left unchanged by `physics_tabulate` for
+ * these materials. Thus, the latter can be called concurrently.
+ */
+enum pumas_return physics_tabulation_prepare(struct pumas_physics * physics,
+    struct physics_tabulation_data * data, int n_materials,
+    const int * materials, struct error_context * error_)
+{
+        /* Set the energy grid */
+        if ((data->n_energies <= 0) || (data->energy == NULL)) {
+                if (tabulation_energy_default(physics, data, error_) !=
+                    PUMAS_RETURN_SUCCESS) return error_->code;
+        }
+
+        /* Stack the missing atomic elements. */
+        struct physics_element ** elements =
+            allocate(physics->n_elements * sizeof(*elements));
+        if (elements == NULL) return ERROR_REGISTER_MEMORY();
+        int n_elements = 0;
+        int i;
+        for (i = 0; i < n_materials; i++) {
+                const int material = materials[i];
+                struct material_component * component =
+                    physics->composition[material];
+                int ic;
+                for (ic = 0; ic < physics->elements_in[material];
+                     ic++, component++) {
+                        if (tabulation_element_get(data, component->element) !=
+                            NULL) continue;
+                        struct physics_element * e = tabulation_element_create(
+                            data, component->element);
+                        if (e == NULL) {
+                                deallocate(elements);
+                                return ERROR_REGISTER_MEMORY();
+                        }
+                        elements[n_elements++] = e;
+                }
+        }
+
+        /* Tabulate the new elements. */
+        struct physics_tabulation_task task = { .data = data,
+                .elements = elements };
+        compute_parallel(physics, n_elements, &tabulation_element_task, &task,
+            error_);
+        deallocate(elements);
+
+        return error_->code;
+}
+
+/* Parallel task for tabulating the energy loss of materials. */
+enum pumas_return physics_tabulate_task(struct pumas_physics * physics,
+    int index, void * args, struct error_context * error_)
+{
+        struct physics_tabulation_task * task = args;
+        return physics_tabulate(
+            physics, task->data, task->materials[index], error_);
+}
+
 /**
  * Clear the temporary memory used for the tabulation of materials.
  *
@@ -13651,11 +18816,12 @@ enum pumas_return physics_tabulate(struct pumas_physics * physics,
 void physics_tabulation_clear(const struct pumas_physics * physics,
     struct physics_tabulation_data * data)
 {
-        deallocate(data->path);
-        data->path = NULL;
-
-        deallocate(data->work);
-        data->work = NULL;
+        if (data->energy == data->default_energy) {
+                data->n_energies = 0;
+                data->energy = NULL;
+        }
+        deallocate(data->default_energy);
+        data->default_energy = NULL;
 
         struct physics_element * e;
         for (e = data->elements; e != NULL;) {
@@ -14170,11 +19336,12 @@ static double dcs_bremsstrahlung_transport_integrate(double Z, double A,
 
         /* Integrate over the recoil energy using a logarithmic sampling. */
         double dcsint = 0.;
+        struct gauss_quad quad;
         double x0 = log(qmin), x1 = log(qmid);
-        math_gauss_quad(nint, &x0, &x1); /* Initialisation. */
+        math_gauss_quad(&quad, nint, &x0, &x1); /* Initialisation. */
 
         double xi, wi;
-        while (math_gauss_quad(0, &xi, &wi) == 0) { /* Iterations. */
+        while (math_gauss_quad(&quad, 0, &xi, &wi) == 0) { /* Iterations. */
                 const double nu = exp(xi);
                 const double y = dcs_bremsstrahlung_tsai_integrand(
                     Z, A, m, kinetic, nu, dcs);
@@ -14190,9 +19357,10 @@ static double dcs_bremsstrahlung_transport_integrate(double Z, double A,
                  */
                 x0 = log(1E-12 * qmax);
                 x1 = log(qmax - qmid);
-                math_gauss_quad(nint, &x0, &x1); /* Initialisation. */
+                math_gauss_quad(&quad, nint, &x0, &x1); /* Initialisation. */
 
-                while (math_gauss_quad(0, &xi, &wi) == 0) { /* Iterations. */
+                while (math_gauss_quad(&quad, 0, &xi, &wi) == 0) {
+                        /* Iterations. */
                         const double nu = qmax - exp(xi);
                         const double y = dcs_bremsstrahlung_tsai_integrand(
                             Z, A, m, kinetic, nu, dcs);
@@ -15131,11 +20299,12 @@ static double dcs_photonuclear_transport_integrate(double Z, double A,
         /* We integrate over the recoil energy using a logarithmic sampling. */
         const int nint = 180;
         double dcsint = 0.;
+        struct gauss_quad quad;
         double x0 = log(qmin), x1 = log(qmax);
-        math_gauss_quad(nint, &x0, &x1); /* Initialisation. */
+        math_gauss_quad(&quad, nint, &x0, &x1); /* Initialisation. */
 
         double xi, wi;
-        while (math_gauss_quad(0, &xi, &wi) == 0) { /* Iterations. */
+        while (math_gauss_quad(&quad, 0, &xi, &wi) == 0) { /* Iterations. */
                 const double qi = exp(xi);
                 double r = 1.;
                 if (dcs0 != dcs1) {
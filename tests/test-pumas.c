@@ -24,12 +24,18 @@
  */
 
 /* C89 standard library */
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 /* The Check library */
 #include "check.h"
 /* The PUMAS library */
 #include "pumas.h"
+/* POSIX threads, for the multithreaded test cases */
+#if (THREADS_MODE)
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 /* Media densities and geometric parameters */
 #define TEST_ROCK_DENSITY 2.65E+03
@@ -129,6 +135,22 @@ START_TEST(test_api_constant)
 }
 END_TEST
 
+#if (THREADS_MODE)
+/* Catch and raise an error from a secondary thread */
+static void * catch_in_thread(void * arg)
+{
+        enum pumas_return * rc = arg;
+
+        /* This error is not caught, since the catch status is per thread */
+        pumas_physics_material_index(NULL, NULL, NULL);
+
+        pumas_error_catch(1);
+        pumas_physics_material_index(NULL, NULL, NULL);
+        *rc = pumas_error_raise();
+        return NULL;
+}
+#endif
+
 /* Test the error API */
 START_TEST(test_api_error)
 {
@@ -167,6 +189,25 @@ START_TEST(test_api_error)
         pumas_physics_material_index(physics, NULL, NULL);
         ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
 
+#if (THREADS_MODE)
+        /* Check that the catch status is local to each thread */
+        reset_error();
+        pumas_error_catch(1);
+        pthread_t thread;
+        enum pumas_return thread_rc = PUMAS_RETURN_SUCCESS;
+        pthread_create(&thread, NULL, &catch_in_thread, &thread_rc);
+        pthread_join(thread, NULL);
+        ck_assert_int_eq(thread_rc, PUMAS_RETURN_PHYSICS_ERROR);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+
+        reset_error();
+        pumas_physics_material_index(physics, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        rc = pumas_error_raise();
+        ck_assert_int_eq(rc, PUMAS_RETURN_PHYSICS_ERROR);
+        ck_assert_int_eq(error_data.rc, rc);
+#endif
+
 /* Check the stringification of API functions */
 #define CHECK_STRING(function)                                                 \
         ck_assert_str_eq(                                                      \
@@ -178,6 +219,7 @@ START_TEST(test_api_error)
          */
         CHECK_STRING(pumas_constant);
         CHECK_STRING(pumas_context_create);
+        CHECK_STRING(pumas_context_geometry_set);
         CHECK_STRING(pumas_context_random_dump);
         CHECK_STRING(pumas_context_random_load);
         CHECK_STRING(pumas_context_random_seed_get);
@@ -210,6 +252,7 @@ START_TEST(test_api_error)
         CHECK_STRING(pumas_physics_destroy);
         CHECK_STRING(pumas_physics_dump);
         CHECK_STRING(pumas_physics_load);
+        CHECK_STRING(pumas_physics_map);
         CHECK_STRING(pumas_physics_material_index);
         CHECK_STRING(pumas_physics_material_length);
         CHECK_STRING(pumas_physics_material_name);
@@ -225,12 +268,23 @@ START_TEST(test_api_error)
         CHECK_STRING(pumas_physics_property_magnetic_rotation);
         CHECK_STRING(pumas_physics_property_transport_path);
         CHECK_STRING(pumas_physics_property_proper_time);
+        CHECK_STRING(pumas_physics_property_range_v);
+        CHECK_STRING(pumas_physics_property_kinetic_energy_v);
+        CHECK_STRING(pumas_physics_property_stopping_power_v);
+        CHECK_STRING(pumas_physics_property_cross_section_v);
         CHECK_STRING(pumas_physics_table_index);
         CHECK_STRING(pumas_physics_table_length);
         CHECK_STRING(pumas_physics_table_value);
+        CHECK_STRING(pumas_geometry_create_layers);
+        CHECK_STRING(pumas_geometry_create_terrain);
+        CHECK_STRING(pumas_geometry_create_voxels);
+        CHECK_STRING(pumas_geometry_destroy);
         CHECK_STRING(pumas_recorder_clear);
         CHECK_STRING(pumas_recorder_create);
+        CHECK_STRING(pumas_recorder_create_columnar);
+        CHECK_STRING(pumas_recorder_create_stream);
         CHECK_STRING(pumas_recorder_destroy);
+        CHECK_STRING(pumas_recorder_flush);
         CHECK_STRING(pumas_version);
 #undef CHECK_STRING
 
@@ -282,6 +336,25 @@ static void dump_tau(void)
 }
 
 /* Test the library initialisation & finalisation */
+#if (THREADS_MODE)
+/* Data for creating Physics from a secondary thread */
+struct create_data {
+        struct pumas_physics * physics;
+        enum pumas_return rc;
+};
+
+/* Create Physics from a secondary thread */
+static void * create_in_thread(void * arg)
+{
+        struct create_data * data = arg;
+        pumas_error_catch(1);
+        pumas_physics_create(&data->physics, PUMAS_PARTICLE_MUON,
+            "materials/materials.xml", "materials/dedx/muon", NULL);
+        data->rc = pumas_error_raise();
+        return NULL;
+}
+#endif
+
 START_TEST(test_api_init)
 {
         /* Check the particle selection */
@@ -367,6 +440,87 @@ START_TEST(test_api_init)
         reset_error();
         dump_muon();
         ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        /* Check the parallel tabulation */
+        struct pumas_physics * parallel = NULL;
+        reset_error();
+        settings.n_threads = 4;
+        pumas_physics_create(&parallel, PUMAS_PARTICLE_MUON,
+            "materials/materials.xml", "materials/dedx/muon",
+            &settings);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        settings.n_threads = 0;
+
+        int imat;
+        for (imat = 0; imat < pumas_physics_material_length(physics);
+             imat++) {
+                double k;
+                for (k = 1E-03; k < 1E+06; k *= 10.) {
+                        double v0, v1;
+                        pumas_physics_property_cross_section(
+                            physics, imat, k, &v0);
+                        pumas_physics_property_cross_section(
+                            parallel, imat, k, &v1);
+                        ck_assert_double_eq(v0, v1);
+                        pumas_physics_property_transport_path(
+                            physics, PUMAS_MODE_MIXED, imat, k, &v0);
+                        pumas_physics_property_transport_path(
+                            parallel, PUMAS_MODE_MIXED, imat, k, &v1);
+                        ck_assert_double_eq(v0, v1);
+                        pumas_physics_property_elastic_cutoff_angle(
+                            physics, imat, k, &v0);
+                        pumas_physics_property_elastic_cutoff_angle(
+                            parallel, imat, k, &v1);
+                        ck_assert_double_eq(v0, v1);
+                }
+        }
+        pumas_physics_destroy(&parallel);
+
+#if (THREADS_MODE)
+        /* Check concurrent initialisations */
+        reset_error();
+        pthread_t threads[2];
+        struct create_data created[2] = { { NULL, PUMAS_RETURN_SUCCESS },
+                { NULL, PUMAS_RETURN_SUCCESS } };
+        int i;
+        for (i = 0; i < 2; i++)
+                pthread_create(threads + i, NULL, &create_in_thread,
+                    created + i);
+        for (i = 0; i < 2; i++) pthread_join(threads[i], NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        for (i = 0; i < 2; i++) {
+                ck_assert_int_eq(created[i].rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(
+                    pumas_physics_material_length(created[i].physics),
+                    pumas_physics_material_length(physics));
+                for (imat = 0; imat < pumas_physics_material_length(physics);
+                     imat++) {
+                        double k;
+                        for (k = 1E-03; k < 1E+06; k *= 10.) {
+                                double v0, v1;
+                                pumas_physics_property_cross_section(
+                                    physics, imat, k, &v0);
+                                pumas_physics_property_cross_section(
+                                    created[i].physics, imat, k, &v1);
+                                ck_assert_double_eq(v0, v1);
+                                pumas_physics_property_stopping_power(physics,
+                                    PUMAS_MODE_MIXED, imat, k, &v0);
+                                pumas_physics_property_stopping_power(
+                                    created[i].physics, PUMAS_MODE_MIXED,
+                                    imat, k, &v1);
+                                ck_assert_double_eq(v0, v1);
+                                pumas_physics_property_transport_path(
+                                    physics, PUMAS_MODE_MIXED, imat, k, &v0);
+                                pumas_physics_property_transport_path(
+                                    created[i].physics, PUMAS_MODE_MIXED,
+                                    imat, k, &v1);
+                                ck_assert_double_eq(v0, v1);
+                        }
+                }
+                pumas_physics_destroy(&created[i].physics);
+        }
+#endif
         pumas_physics_destroy(&physics);
 
         reset_error();
@@ -422,6 +576,53 @@ START_TEST(test_api_init)
         pumas_physics_dump(physics, NULL);
         ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
 
+        /* Check the map */
+        struct pumas_physics * mapped = NULL;
+        reset_error();
+        pumas_physics_map(&mapped, TEST_MUON_DUMP);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_ptr_nonnull(mapped);
+
+        pumas_physics_particle(mapped, &particle, &lifetime, &mass);
+        ck_assert_int_eq(particle, PUMAS_PARTICLE_MUON);
+        ck_assert_double_eq(mass, 0.10565839);
+
+        load_muon();
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_int_eq(pumas_physics_material_length(mapped),
+            pumas_physics_material_length(physics));
+        const char * name0, * name1;
+        pumas_physics_material_name(mapped, 0, &name0);
+        pumas_physics_material_name(physics, 0, &name1);
+        ck_assert_str_eq(name0, name1);
+        double range0, range1;
+        pumas_physics_property_range(
+            mapped, PUMAS_MODE_CSDA, 0, 1E+01, &range0);
+        pumas_physics_property_range(
+            physics, PUMAS_MODE_CSDA, 0, 1E+01, &range1);
+        ck_assert_double_eq(range0, range1);
+        pumas_physics_destroy(&physics);
+        pumas_physics_destroy(&mapped);
+        ck_assert_ptr_null(mapped);
+
+        /* Check the map errors */
+        reset_error();
+        pumas_physics_map(NULL, TEST_MUON_DUMP);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+
+        reset_error();
+        pumas_physics_map(&mapped, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PATH_ERROR);
+
+        reset_error();
+        pumas_physics_map(&mapped, "materials/void.pumas");
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PATH_ERROR);
+
+        reset_error();
+        pumas_physics_map(&mapped, "materials/materials.xml");
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_FORMAT_ERROR);
+        ck_assert_ptr_null(mapped);
+
         /* Check the transport error */
         reset_error();
         pumas_context_transport(NULL, NULL, NULL, NULL);
@@ -1019,6 +1220,113 @@ START_TEST(test_api_property)
 }
 END_TEST
 
+START_TEST(test_api_property_v)
+{
+        double x[1], y[1];
+
+        /* Check the initialisation error */
+        reset_error();
+        pumas_physics_property_range_v(physics, 0, 0, 1, x, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+
+        reset_error();
+        pumas_physics_property_kinetic_energy_v(physics, 0, 0, 1, x, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+
+        reset_error();
+        pumas_physics_property_stopping_power_v(physics, 0, 0, 1, x, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+
+        reset_error();
+        pumas_physics_property_cross_section_v(physics, 0, 1, x, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+
+        /* Load the muon data */
+        load_muon();
+
+        /* Check the index and value errors */
+        reset_error();
+        pumas_physics_property_range_v(
+            physics, PUMAS_MODE_STRAGGLED, 0, 1, x, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+
+        reset_error();
+        pumas_physics_property_kinetic_energy_v(
+            physics, PUMAS_MODE_CSDA, 4, 1, x, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+
+        reset_error();
+        pumas_physics_property_stopping_power_v(
+            physics, PUMAS_MODE_CSDA, 0, 1, NULL, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_physics_property_cross_section_v(physics, 0, -1, x, y);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_physics_property_cross_section_v(physics, 0, 0, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        /*
+         * Check the values against scalar calls, for sorted and unsorted
+         * energies, including out of table ones.
+         */
+        const int n = 301;
+        double energy[301], grammage[301], values[301];
+        int i;
+        for (i = 0; i < n; i++) {
+                const int j = (i < 200) ? i : (i * 37) % 200;
+                energy[i] = 1E-04 * pow(10., 0.08 * j);
+        }
+
+        enum pumas_mode mode;
+        for (mode = PUMAS_MODE_CSDA; mode <= PUMAS_MODE_MIXED; mode++) {
+                pumas_physics_property_range_v(
+                    physics, mode, 0, n, energy, grammage);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                for (i = 0; i < n; i++) {
+                        double value;
+                        pumas_physics_property_range(
+                            physics, mode, 0, energy[i], &value);
+                        ck_assert_double_eq(grammage[i], value);
+                }
+
+                pumas_physics_property_kinetic_energy_v(
+                    physics, mode, 0, n, grammage, values);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                for (i = 0; i < n; i++) {
+                        double value;
+                        pumas_physics_property_kinetic_energy(
+                            physics, mode, 0, grammage[i], &value);
+                        ck_assert_double_eq(values[i], value);
+                }
+
+                pumas_physics_property_stopping_power_v(
+                    physics, mode, 0, n, energy, values);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                for (i = 0; i < n; i++) {
+                        double value;
+                        pumas_physics_property_stopping_power(
+                            physics, mode, 0, energy[i], &value);
+                        ck_assert_double_eq(values[i], value);
+                }
+        }
+
+        pumas_physics_property_cross_section_v(physics, 0, n, energy, values);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        for (i = 0; i < n; i++) {
+                double value;
+                pumas_physics_property_cross_section(
+                    physics, 0, energy[i], &value);
+                ck_assert_double_eq(values[i], value);
+        }
+
+        /* Unload the data */
+        pumas_physics_destroy(&physics);
+}
+END_TEST
+
 START_TEST(test_api_table)
 {
         int index;
@@ -1334,6 +1642,87 @@ START_TEST(test_api_context)
 }
 END_TEST
 
+/* Internal samplers, exported by the library when built for the tests */
+double pumas_test_randn(struct pumas_context * context);
+double pumas_test_rande(struct pumas_context * context);
+
+/* Cumulative distribution functions of the normal and exponential laws */
+static double cdf_normal(double x, void * data)
+{
+        return 0.5 * (1. + erf(x / sqrt(2.)));
+}
+
+static double cdf_exponential(double x, void * data) { return 1. - exp(-x); }
+
+/* Cumulative distribution function tabulated over a regular grid */
+struct cdf_table {
+        int n;
+        double x0;
+        double dx;
+        const double * cdf;
+};
+
+static double cdf_tabulated(double x, void * data)
+{
+        const struct cdf_table * table = data;
+        const double h = (x - table->x0) / table->dx;
+        int k = (int)h;
+        if (k < 0)
+                k = 0;
+        else if (k > table->n - 2)
+                k = table->n - 2;
+        return (table->cdf[k] + (h - k) * (table->cdf[k + 1] - table->cdf[k])) /
+            table->cdf[table->n - 1];
+}
+
+static int compare_double(const void * a, const void * b)
+{
+        const double da = *(const double *)a, db = *(const double *)b;
+        return (da > db) - (da < db);
+}
+
+/* Kolmogorov-Smirnov test of a sample, at a 0.1% significance level */
+static void check_random_cdf(
+    int n, double * x, double (*cdf)(double, void *), void * data)
+{
+        qsort(x, n, sizeof(*x), &compare_double);
+        double d = 0.;
+        int i;
+        for (i = 0; i < n; i++) {
+                const double f = cdf(x[i], data);
+                const double d0 = fabs(f - (double)i / n);
+                const double d1 = fabs(f - (double)(i + 1) / n);
+                if (d0 > d) d = d0;
+                if (d1 > d) d = d1;
+        }
+        ck_assert_double_le(d * sqrt(n), 1.95);
+}
+
+/* Check a sample against a reference law, at 5 standard deviations */
+static void check_random_law(int n, double * x,
+    double (*cdf)(double, void *), double mean, double variance, double cut)
+{
+        /* Check the first two moments */
+        double s1 = 0., s2 = 0.;
+        int i, n_tail = 0;
+        for (i = 0; i < n; i++) {
+                s1 += x[i];
+                s2 += (x[i] - mean) * (x[i] - mean);
+                if (x[i] > cut) n_tail++;
+        }
+        s1 /= n;
+        s2 /= n;
+        ck_assert_double_le(fabs(s1 - mean), 5. * sqrt(variance / n));
+        ck_assert_double_le(fabs(s2 - variance), 5. * variance * sqrt(2. / n));
+
+        /* Check the tail beyond the cut */
+        const double p = 1. - cdf(cut, NULL);
+        ck_assert_double_le(fabs(n_tail - n * p), 5. * sqrt(n * p * (1. - p)));
+
+        /* Check the distribution */
+        check_random_cdf(n, x, cdf, NULL);
+}
+
 /* Test the random API */
 START_TEST(test_api_random)
 {
@@ -1377,6 +1766,49 @@ START_TEST(test_api_random)
         pumas_context_random_seed_get(context, &seed);
         ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
 
+        /* Test the counter based engine */
+        reset_error();
+        pumas_context_random_event_set(context, 0);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MISSING_RANDOM);
+
+        reset_error();
+        pumas_context_random_stream_set(NULL, 0, 0);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_context_random_stream_set(context, 0, 0);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        const double u3[2] = { context->random(context),
+                context->random(context) };
+        ck_assert_double_eq_tol(u3[0], 0x6627e8d5 / 4294967295., 1E-12);
+        ck_assert_double_eq_tol(u3[1], 0xe169c58d / 4294967295., 1E-12);
+
+        int i;
+        for (i = 0; i < 10; i++) context->random(context);
+        pumas_context_random_event_set(context, 0);
+        ck_assert_double_eq(context->random(context), u3[0]);
+
+        pumas_context_random_event_set(context, 7);
+        const double u4 = context->random(context);
+        ck_assert_double_ne(u4, u3[0]);
+        pumas_context_random_stream_set(context, 0, 1);
+        pumas_context_random_event_set(context, 7);
+        ck_assert_double_ne(context->random(context), u4);
+        pumas_context_random_stream_set(context, 0, 0);
+        pumas_context_random_event_set(context, 7);
+        ck_assert_double_eq(context->random(context), u4);
+
+        /* Test the ziggurat samplers */
+        const int n = 1000000;
+        double * sample = malloc(n * sizeof(*sample));
+        ck_assert_ptr_nonnull(sample);
+        for (i = 0; i < n; i++) sample[i] = pumas_test_randn(context);
+        check_random_law(n, sample, &cdf_normal, 0., 1., 3.5);
+
+        for (i = 0; i < n; i++) sample[i] = pumas_test_rande(context);
+        check_random_law(n, sample, &cdf_exponential, 1., 1., 8.);
+        free(sample);
+
         /* Free the data */
         pumas_context_destroy(&context);
         pumas_physics_destroy(&physics);
@@ -1411,6 +1843,9 @@ START_TEST(test_api_recorder)
         ck_assert_ptr_null(recorder->first);
         ck_assert_int_eq(recorder->length, 0);
         ck_assert_int_eq(recorder->period, 1);
+        ck_assert_int_eq(recorder->event_mask, PUMAS_EVENT_NONE);
+        ck_assert_double_eq(recorder->energy_loss, 0.);
+        ck_assert_double_eq(recorder->distance, 0.);
         ck_assert_ptr_null(recorder->record);
         ck_assert_ptr_null(recorder->user_data);
 
@@ -1434,76 +1869,535 @@ START_TEST(test_api_recorder)
         /* Test the NULL clear */
         pumas_recorder_clear(NULL);
         ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
-}
-END_TEST
 
-/* Test the print API */
-START_TEST(test_api_print)
-{
-        /* Test the initialisation_error */
+        /* Check the streaming recorder errors */
         reset_error();
-        pumas_physics_print(physics, NULL, NULL, NULL);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+        recorder = (void *)0x1;
+        pumas_recorder_create_stream(&recorder, 0, 0, stdout, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        ck_assert_ptr_null(recorder);
 
-        /* Load the tau data */
-        load_tau();
+        reset_error();
+        pumas_recorder_create_stream(&recorder, 0, 16, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        ck_assert_ptr_null(recorder);
 
-        /* Check the NULL stream case */
+        pumas_memory_allocator(&fail_malloc);
         reset_error();
-        pumas_physics_print(physics, NULL, NULL, NULL);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_IO_ERROR);
+        pumas_recorder_create_stream(&recorder, 0, 16, stdout, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MEMORY_ERROR);
+        ck_assert_ptr_null(recorder);
+        pumas_memory_allocator(NULL);
 
-        /* Check printing to a file */
-        FILE * stream = fopen("tau.json", "w+");
-        pumas_physics_print(physics, stream, NULL, NULL);
-        fputs("\n===\n", stream);
-        pumas_physics_print(physics, stream, "    ", "\n");
-        fclose(stream);
+        /* Check the streaming recorder initialisation */
+        reset_error();
+        pumas_recorder_create_stream(&recorder, 0, 16, stdout, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_ptr_null(recorder->first);
+        ck_assert_int_eq(recorder->length, 0);
+        ck_assert_int_eq(recorder->period, 1);
+        ck_assert_ptr_null(recorder->record);
+        ck_assert_ptr_null(recorder->user_data);
 
-        /* Free the data */
-        pumas_physics_destroy(&physics);
+        pumas_recorder_flush(recorder);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_recorder_destroy(&recorder);
+        ck_assert_ptr_null(recorder);
+
+        /* Test the NULL flush */
+        pumas_recorder_flush(NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        /* Check the columnar recorder errors */
+        reset_error();
+        recorder = (void *)0x1;
+        pumas_recorder_create_columnar(&recorder, 0, 0, 16, stdout, 0);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        ck_assert_ptr_null(recorder);
+
+        reset_error();
+        pumas_recorder_create_columnar(&recorder, 0, 16, 0, stdout, 0);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        ck_assert_ptr_null(recorder);
+
+        reset_error();
+        pumas_recorder_create_columnar(&recorder, 0, 16, 16, NULL, 0);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        ck_assert_ptr_null(recorder);
+
+        pumas_memory_allocator(&fail_malloc);
+        reset_error();
+        pumas_recorder_create_columnar(&recorder, 0, 16, 16, stdout, 0);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MEMORY_ERROR);
+        ck_assert_ptr_null(recorder);
+        pumas_memory_allocator(NULL);
+
+        /* Check the columnar recorder initialisation */
+        reset_error();
+        pumas_recorder_create_columnar(&recorder, 0, 16, 16, stdout,
+            PUMAS_COLUMN_ENCODING_FLOAT | PUMAS_COLUMN_ENCODING_DELTA);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_ptr_null(recorder->first);
+        ck_assert_int_eq(recorder->length, 0);
+        ck_assert_ptr_null(recorder->record);
+
+        pumas_recorder_flush(recorder);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_recorder_destroy(&recorder);
+        ck_assert_ptr_null(recorder);
 }
 END_TEST
 
-
-static double dummy_dcs(double Z, double A, double m, double K, double q)
+/* Test the geometry API */
+START_TEST(test_api_geometry)
 {
-        return 0;
-}
+        const double origin[3] = { 0., 0., 0. };
+        const double spacing[3] = { 1., 2., 3. };
+        int shape[3] = { 2, 1, 2 };
+        int material[4] = { 0, 0, 1, 0 };
+        double density[4] = { 1E+03, 1E+03, 2E+03, 2E+03 };
+        struct pumas_geometry * voxels;
+
+        /* Check the voxels errors */
+        reset_error();
+        voxels = (void *)0x1;
+        shape[1] = 0;
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, material, density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        ck_assert_ptr_null(voxels);
+        shape[1] = 1;
 
+        reset_error();
+        const double bad_spacing[3] = { 1., 0., 1. };
+        pumas_geometry_create_voxels(
+            &voxels, origin, bad_spacing, shape, material, density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
 
-/* Test the dcs API */
-START_TEST(test_api_dcs)
-{
-        /* Test the process error */
-        pumas_dcs_t * dcs = NULL;
         reset_error();
-        pumas_dcs_get(-1, "KKP", &dcs);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, NULL, density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
 
         reset_error();
-        pumas_dcs_register(-1, "dummy", &dummy_dcs);
+        material[3] = -1;
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, material, density);
         ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+        material[3] = 0;
 
-        /* Test the model error  */
         reset_error();
-        pumas_dcs_get(PUMAS_PROCESS_BREMSSTRAHLUNG, "toto", &dcs);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MODEL_ERROR);
+        density[3] = 0.;
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, material, density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_DENSITY_ERROR);
+        density[3] = 2E+03;
 
+        pumas_memory_allocator(&fail_malloc);
         reset_error();
-        pumas_dcs_register(PUMAS_PROCESS_BREMSSTRAHLUNG, "KKP", &dummy_dcs);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MODEL_ERROR);
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, material, density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MEMORY_ERROR);
+        ck_assert_ptr_null(voxels);
+        pumas_memory_allocator(NULL);
 
-        /* Test the NULL error */
+        /* Check the NULL destruction */
         reset_error();
-        pumas_dcs_register(PUMAS_PROCESS_BREMSSTRAHLUNG, NULL, &dummy_dcs);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        pumas_geometry_destroy(NULL);
+        voxels = NULL;
+        pumas_geometry_destroy(&voxels);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
 
+        /* Check the context setter */
+        load_muon();
+        pumas_context_create(&context, physics, 0);
         reset_error();
-        pumas_dcs_register(PUMAS_PROCESS_BREMSSTRAHLUNG, "dummy", NULL);
+        pumas_context_geometry_set(NULL, NULL);
         ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
 
-        /* Test the default name getter */
+        reset_error();
+        material[2] = 1000;
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, material, density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_context_geometry_set(context, voxels);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+        ck_assert_ptr_null(context->medium);
+        pumas_geometry_destroy(&voxels);
+        ck_assert_ptr_null(voxels);
+        material[2] = 1;
+
+        reset_error();
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, material, density);
+        pumas_context_geometry_set(context, voxels);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_ptr_nonnull(context->medium);
+
+        /* Check the media of the cells */
+        struct pumas_medium * media[4];
+        int i;
+        memset(state, 0x0, sizeof(*state));
+        state->direction[2] = 1.;
+        for (i = 0; i < 4; i++) {
+                state->position[0] = 0.5 + (i % 2);
+                state->position[1] = 1.;
+                state->position[2] = 1.5 + 3 * (i / 2);
+                double step;
+                ck_assert_int_eq(
+                    context->medium(context, state, media + i, &step),
+                    PUMAS_STEP_EXACT);
+                ck_assert_ptr_nonnull(media[i]);
+                ck_assert_int_eq(media[i]->material, material[i]);
+                ck_assert_double_gt(step, 0.);
+        }
+        ck_assert_ptr_eq(media[0], media[1]);
+        ck_assert_ptr_ne(media[1], media[2]);
+        ck_assert_ptr_ne(media[2], media[3]);
+
+        struct pumas_locals locals;
+        media[3]->locals(media[3], state, &locals);
+        ck_assert_double_eq(locals.density, 2E+03);
+
+        state->position[2] = -1.;
+        context->medium(context, state, media, NULL);
+        ck_assert_ptr_null(media[0]);
+
+        pumas_context_geometry_set(context, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_ptr_null(context->medium);
+        pumas_geometry_destroy(&voxels);
+
+        /* Check the layers errors */
+        struct pumas_layer layers[2];
+        memset(layers, 0x0, sizeof(layers));
+        layers[0].top = 1.;
+        layers[1].top = 2.;
+        layers[1].material = 1;
+        layers[1].density.model = PUMAS_DENSITY_EXPONENTIAL;
+        layers[1].density.coefficients[0] = 1.;
+        layers[1].density.length = -1.;
+
+        reset_error();
+        struct pumas_geometry * stack = (void *)0x1;
+        pumas_geometry_create_layers(&stack, 2, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+        ck_assert_ptr_null(stack);
+
+        reset_error();
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 0, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_geometry_create_layers(&stack, PUMAS_LAYER_PLANAR, 0., 2, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_SPHERICAL, -1., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 1., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        layers[0].material = -1;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+        layers[0].material = 0;
+
+        reset_error();
+        layers[1].density.model = 3;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+        layers[1].density.model = PUMAS_DENSITY_EXPONENTIAL;
+
+        reset_error();
+        layers[1].density.length = 0.;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        layers[1].density.length = -1.;
+
+        reset_error();
+        layers[0].density.model = PUMAS_DENSITY_POLYNOMIAL;
+        layers[0].density.coefficients[1] = -1.;
+        layers[0].density.coefficients[0] = 0.5;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        /* The quadratic law is positive at both ends of the layer but negative
+         * around its minimum, at z = 0.5.
+         */
+        reset_error();
+        layers[0].density.coefficients[0] = 0.2;
+        layers[0].density.coefficients[2] = 1.;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        /* Idem with a cubic law, with a negative local minimum at z = 0.8. */
+        reset_error();
+        layers[0].density.coefficients[0] = 0.2;
+        layers[0].density.coefficients[1] = 2.4;
+        layers[0].density.coefficients[2] = -7.5;
+        layers[0].density.coefficients[3] = 5.;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        layers[0].density.coefficients[1] = -1.;
+        layers[0].density.coefficients[2] = 0.;
+        layers[0].density.coefficients[3] = 0.;
+        layers[0].density.coefficients[0] = 2.;
+
+        pumas_memory_allocator(&fail_malloc);
+        reset_error();
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MEMORY_ERROR);
+        ck_assert_ptr_null(stack);
+        pumas_memory_allocator(NULL);
+
+        /* Check the media of the layers */
+        reset_error();
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 2, layers);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_context_geometry_set(context, stack);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        for (i = 0; i < 2; i++) {
+                state->position[2] = 0.5 + i;
+                double step;
+                ck_assert_int_eq(
+                    context->medium(context, state, media + i, &step),
+                    PUMAS_STEP_EXACT);
+                ck_assert_ptr_nonnull(media[i]);
+                ck_assert_int_eq(media[i]->material, i);
+                ck_assert_double_eq(step, 0.5);
+                media[i]->locals(media[i], state, &locals);
+        }
+        ck_assert_double_eq(locals.density, exp(-1.5));
+        state->position[2] = 2.;
+        context->medium(context, state, media, NULL);
+        ck_assert_ptr_null(media[0]);
+
+        pumas_context_geometry_set(context, NULL);
+        pumas_geometry_destroy(&stack);
+        ck_assert_ptr_null(stack);
+
+        /* Check the terrain errors */
+#define TEST_TERRAIN ".pumas.terrain.asc"
+        FILE * fid = fopen(TEST_TERRAIN, "w");
+        fprintf(fid, "ncols 3\nnrows 3\nxllcorner -15\nyllcorner -15\n"
+                     "cellsize 10\nNODATA_value -9999\n"
+                     "1 2 3\n4 5 6\n7 8 9\n");
+        fclose(fid);
+        struct pumas_geometry * terrain;
+        int terrain_material[2] = { 0, 1 };
+        double terrain_density[2] = { 2E+03, 1. };
+
+        reset_error();
+        terrain = (void *)0x1;
+        pumas_geometry_create_terrain(
+            &terrain, NULL, 0., 20., terrain_material, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PATH_ERROR);
+        ck_assert_ptr_null(terrain);
+
+        reset_error();
+        pumas_geometry_create_terrain(&terrain, ".pumas.missing.asc", 0.,
+            20., terrain_material, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PATH_ERROR);
+
+        reset_error();
+        pumas_geometry_create_terrain(
+            &terrain, TEST_TERRAIN, 0., 20., NULL, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        terrain_material[0] = -1;
+        pumas_geometry_create_terrain(&terrain, TEST_TERRAIN, 0., 20.,
+            terrain_material, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+        terrain_material[0] = 0;
+
+        reset_error();
+        terrain_density[1] = 0.;
+        pumas_geometry_create_terrain(&terrain, TEST_TERRAIN, 0., 20.,
+            terrain_material, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_DENSITY_ERROR);
+        terrain_density[1] = 1.;
+
+        reset_error();
+        pumas_geometry_create_terrain(&terrain, TEST_TERRAIN, 5., 20.,
+            terrain_material, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        ck_assert_ptr_null(terrain);
+
+        pumas_memory_allocator(&fail_malloc);
+        reset_error();
+        pumas_geometry_create_terrain(&terrain, TEST_TERRAIN, 0., 20.,
+            terrain_material, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MEMORY_ERROR);
+        ck_assert_ptr_null(terrain);
+        pumas_memory_allocator(NULL);
+
+        const char * bad_rasters[7] = {
+                "ncols 1\nnrows 3\nxllcorner 0\nyllcorner 0\ncellsize 1\n"
+                "1\n2\n3\n",
+                "ncols 2\nnrows 2\nxllcorner 0\nyllcorner 0\ncellsize 1\n"
+                "NODATA_value -9999\n1 2\n3 -9999\n",
+                "ncols 2\nnrows 2\nxllcorner 0\nyllcorner 0\ncellsize 1\n"
+                "unknown 0\n1 2\n3 4\n",
+                "ncols 2\nnrows 2\nyllcorner 0\ncellsize 1\n1 2\n3 4\n",
+                "ncols 2\nnrows 2\nxllcenter 0\ncellsize 1\n1 2\n3 4\n",
+                "ncols 2.5\nnrows 2\nxllcorner 0\nyllcorner 0\ncellsize 1\n"
+                "1 2\n3 4\n",
+                "ncols 2\nnrows 1E+10\nxllcorner 0\nyllcorner 0\n"
+                "cellsize 1\n1 2\n3 4\n"
+        };
+        for (i = 0; i < 7; i++) {
+                fid = fopen(TEST_TERRAIN, "w");
+                fputs(bad_rasters[i], fid);
+                fclose(fid);
+                reset_error();
+                pumas_geometry_create_terrain(&terrain, TEST_TERRAIN, 0.,
+                    20., terrain_material, terrain_density);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_FORMAT_ERROR);
+                ck_assert_ptr_null(terrain);
+        }
+
+        /* Check the media of the terrain */
+        fid = fopen(TEST_TERRAIN, "w");
+        fprintf(fid, "ncols 3\nnrows 3\nxllcenter -10\nyllcenter -10\n"
+                     "cellsize 10\n1 2 3\n4 5 6\n7 8 9\n");
+        fclose(fid);
+        reset_error();
+        pumas_geometry_create_terrain(&terrain, TEST_TERRAIN, 0., 20.,
+            terrain_material, terrain_density);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_context_geometry_set(context, terrain);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        memset(state->direction, 0x0, sizeof(state->direction));
+        state->direction[2] = 1.;
+        state->position[0] = 5.;
+        state->position[1] = 5.;
+        const double terrain_z[2] = { 3., 4.5 };
+        const double terrain_step[2] = { 1., 15.5 };
+        for (i = 0; i < 2; i++) {
+                state->position[2] = terrain_z[i];
+                double step;
+                ck_assert_int_eq(
+                    context->medium(context, state, media + i, &step),
+                    PUMAS_STEP_EXACT);
+                ck_assert_ptr_nonnull(media[i]);
+                ck_assert_int_eq(media[i]->material, i);
+                ck_assert_double_eq_tol(step, terrain_step[i], FLT_EPSILON);
+                media[i]->locals(media[i], state, &locals);
+                ck_assert_double_eq(locals.density, terrain_density[i]);
+        }
+        state->position[0] = 10.5;
+        context->medium(context, state, media, NULL);
+        ck_assert_ptr_null(media[0]);
+        pumas_context_geometry_set(context, NULL);
+        pumas_geometry_destroy(&terrain);
+
+        /* Check a terrain without sky */
+        terrain_material[1] = -1;
+        pumas_geometry_create_terrain(
+            &terrain, TEST_TERRAIN, 0., 20., terrain_material, NULL);
+        pumas_context_geometry_set(context, terrain);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        state->position[0] = 5.;
+        state->position[2] = 4.5;
+        context->medium(context, state, media, NULL);
+        ck_assert_ptr_null(media[0]);
+        state->position[2] = 3.;
+        context->medium(context, state, media, NULL);
+        ck_assert_ptr_nonnull(media[0]);
+        ck_assert_ptr_null(media[0]->locals);
+        pumas_context_geometry_set(context, NULL);
+        pumas_geometry_destroy(&terrain);
+        remove(TEST_TERRAIN);
+        pumas_context_destroy(&context);
+        pumas_physics_destroy(&physics);
+}
+END_TEST
+
+/* Test the print API */
+START_TEST(test_api_print)
+{
+        /* Test the initialisation_error */
+        reset_error();
+        pumas_physics_print(physics, NULL, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_PHYSICS_ERROR);
+
+        /* Load the tau data */
+        load_tau();
+
+        /* Check the NULL stream case */
+        reset_error();
+        pumas_physics_print(physics, NULL, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_IO_ERROR);
+
+        /* Check printing to a file */
+        FILE * stream = fopen("tau.json", "w+");
+        pumas_physics_print(physics, stream, NULL, NULL);
+        fputs("\n===\n", stream);
+        pumas_physics_print(physics, stream, "    ", "\n");
+        fclose(stream);
+
+        /* Free the data */
+        pumas_physics_destroy(&physics);
+}
+END_TEST
+
+
+static double dummy_dcs(double Z, double A, double m, double K, double q)
+{
+        return 0;
+}
+
+
+/* Test the dcs API */
+START_TEST(test_api_dcs)
+{
+        /* Test the process error */
+        pumas_dcs_t * dcs = NULL;
+        reset_error();
+        pumas_dcs_get(-1, "KKP", &dcs);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+
+        reset_error();
+        pumas_dcs_register(-1, "dummy", &dummy_dcs);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_INDEX_ERROR);
+
+        /* Test the model error  */
+        reset_error();
+        pumas_dcs_get(PUMAS_PROCESS_BREMSSTRAHLUNG, "toto", &dcs);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MODEL_ERROR);
+
+        reset_error();
+        pumas_dcs_register(PUMAS_PROCESS_BREMSSTRAHLUNG, "KKP", &dummy_dcs);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_MODEL_ERROR);
+
+        /* Test the NULL error */
+        reset_error();
+        pumas_dcs_register(PUMAS_PROCESS_BREMSSTRAHLUNG, NULL, &dummy_dcs);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_dcs_register(PUMAS_PROCESS_BREMSSTRAHLUNG, "dummy", NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        /* Test the default name getter */
         const char * model;
         model = pumas_dcs_default(PUMAS_PROCESS_BREMSSTRAHLUNG);
         ck_assert_str_eq("SSR", model);
@@ -1852,8 +2746,10 @@ static struct {
         double last_position[3];
         double position_rt[3];
         double direction_rt[3];
+        enum pumas_step step_type;
+        int n_calls;
 } geometry = { 1, { 0., 0., 0. }, { -1., 1., -1. }, { 0., 0., 0. },
-        { 0., 0., 0. } };
+        { 0., 0., 0. }, PUMAS_STEP_CHECK, 0 };
 
 static double rock_locals(struct pumas_medium * medium,
     struct pumas_state * state, struct pumas_locals * locals)
@@ -1890,6 +2786,7 @@ static enum pumas_step geometry_medium(struct pumas_context * context,
         /* Cache the position for checking the locals API */
         memcpy(geometry.last_position, state->position,
             sizeof geometry.last_position);
+        geometry.n_calls++;
 
         if ((medium_ptr == NULL) && (step_ptr == NULL)) {
                 return PUMAS_STEP_CHECK;
@@ -1943,7 +2840,7 @@ static enum pumas_step geometry_medium(struct pumas_context * context,
                         const double dz2 = 0.5 * TEST_ROCK_DEPTH - z;
                         const double dz = dz1 < dz2 ? dz1 : dz2;
                         if (step_ptr != NULL) *step_ptr = dz > 0. ? dz : 1E-03;
-                        return PUMAS_STEP_CHECK;
+                        return geometry.step_type;
                 } else if (z < TEST_MAX_ALTITUDE) {
                         if (medium_ptr != NULL) *medium_ptr = media + 1;
 
@@ -1962,7 +2859,7 @@ static enum pumas_step geometry_medium(struct pumas_context * context,
                         else
                                 s = (0.5 * TEST_ROCK_DEPTH - z) / uz;
                         if (step_ptr != NULL) *step_ptr = s > 0. ? s : 1E-03;
-                        return PUMAS_STEP_CHECK;
+                        return geometry.step_type;
                 } else {
                         if (step_ptr != NULL) *step_ptr = 0.;
                         return PUMAS_STEP_CHECK;
@@ -3254,154 +4151,1219 @@ START_TEST(test_csda_record)
             frame->event, PUMAS_EVENT_LIMIT_ENERGY | PUMAS_EVENT_STOP);
         ck_assert_ptr_null(frame->next);
 
-        pumas_recorder_destroy(&recorder);
-        context->recorder = NULL;
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+}
+END_TEST
+
+/* Frames collected by a streaming recorder */
+#define TEST_STREAM_SIZE 64
+static struct {
+        int n;
+        struct pumas_stream_frame frames[TEST_STREAM_SIZE];
+} stream_data;
+
+static void stream_consumer(struct pumas_recorder * recorder, int n,
+    const struct pumas_stream_frame * frames)
+{
+        /* The consumer might run in a distinct thread. Thus, no check is
+         * done herein.
+         */
+        if (stream_data.n + n > TEST_STREAM_SIZE)
+                n = TEST_STREAM_SIZE - stream_data.n;
+        memcpy(stream_data.frames + stream_data.n, frames, n * sizeof(*frames));
+        stream_data.n += n;
+}
+
+START_TEST(test_csda_stream)
+{
+        /* Record some tracks with a small ring buffer */
+        const int n_tracks = 5;
+        pumas_recorder_create_stream(
+            &recorder, 0, 3, NULL, &stream_consumer);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        stream_data.n = 0;
+        context->recorder = recorder;
+
+        int i;
+        for (i = 0; i < n_tracks; i++) {
+                initialise_state();
+                state->energy = 1. + i;
+                pumas_context_transport(context, state, NULL, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        }
+        pumas_recorder_flush(recorder);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_int_eq(recorder->length, 2 * n_tracks);
+        ck_assert_int_eq(stream_data.n, 2 * n_tracks);
+
+        for (i = 0; i < 2 * n_tracks; i++) {
+                const struct pumas_stream_frame * frame =
+                    stream_data.frames + i;
+                ck_assert_int_eq(frame->track, i / 2);
+                ck_assert_int_eq(frame->material, 0);
+                if (i % 2) {
+                        ck_assert_int_eq(frame->event,
+                            PUMAS_EVENT_LIMIT_ENERGY | PUMAS_EVENT_STOP);
+                        ck_assert_double_eq(frame->state.energy, 0.);
+                } else {
+                        ck_assert_int_eq(frame->event, PUMAS_EVENT_START);
+                        ck_assert_double_eq(frame->state.energy, 1. + i / 2);
+                        ck_assert_double_eq(frame->state.distance, 0.);
+                }
+        }
+
+        /* Check the reset of the track count */
+        pumas_recorder_clear(recorder);
+        ck_assert_int_eq(recorder->length, 0);
+        stream_data.n = 0;
+        initialise_state();
+        state->energy = 1.;
+        pumas_context_transport(context, state, NULL, NULL);
+        pumas_recorder_flush(recorder);
+        ck_assert_int_eq(stream_data.n, 2);
+        ck_assert_int_eq(stream_data.frames[0].track, 0);
+        pumas_recorder_destroy(&recorder);
+
+        /* Check the binary output. The padding bytes of the state are set,
+         * in order to check that they are not written.
+         */
+        FILE * stream = tmpfile();
+        ck_assert_ptr_nonnull(stream);
+        pumas_recorder_create_stream(&recorder, 0, 3, stream, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        context->recorder = recorder;
+        memset(state, 0xff, sizeof(*state));
+        for (i = 0; i < n_tracks; i++) {
+                initialise_state();
+                state->energy = 1. + i;
+                pumas_context_transport(context, state, NULL, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        }
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+
+        struct pumas_stream_frame frames[TEST_STREAM_SIZE];
+        rewind(stream);
+        const size_t n = fread(frames, sizeof(*frames), TEST_STREAM_SIZE,
+            stream);
+        fclose(stream);
+        ck_assert_int_eq(n, 2 * n_tracks);
+
+        for (i = 0; i < 2 * n_tracks; i++) {
+                const struct pumas_stream_frame * frame =
+                    stream_data.frames + i;
+                ck_assert_int_eq(frames[i].track, frame->track);
+                ck_assert_int_eq(frames[i].material, frame->material);
+                ck_assert_int_eq(frames[i].event, frame->event);
+                ck_assert_double_eq(frames[i].state.energy,
+                    frame->state.energy);
+                ck_assert_double_eq(frames[i].state.distance,
+                    frame->state.distance);
+                const unsigned char * const bytes =
+                    (const void *)&frames[i].state;
+                size_t j;
+                for (j = offsetof(struct pumas_state, decayed) + sizeof(int);
+                     j < sizeof(struct pumas_state); j++)
+                        ck_assert_int_eq(bytes[j], 0);
+        }
+}
+END_TEST
+
+/* Decode a columnar stream of frames */
+static int decode_columns(FILE * stream, struct pumas_stream_frame * frames)
+{
+        int n = 0;
+        struct pumas_column_block header;
+        rewind(stream);
+        while (fread(&header, sizeof(header), 1, stream) == 1) {
+                ck_assert_int_eq(header.tag, PUMAS_COLUMN_TAG);
+                ck_assert(n + header.n_frames <= TEST_STREAM_SIZE);
+
+                long track[TEST_STREAM_SIZE];
+                int length[TEST_STREAM_SIZE];
+                const int nt = header.n_tracks;
+                ck_assert_int_eq(fread(track, sizeof(*track), nt, stream), nt);
+                ck_assert_int_eq(
+                    fread(length, sizeof(*length), nt, stream), nt);
+
+                const int nf = header.n_frames;
+                struct pumas_stream_frame * frame = frames + n;
+                int i, j, k;
+                for (i = 0, k = 0; k < nt; k++) {
+                        for (j = 0; j < length[k]; j++, i++)
+                                frame[i].track = track[k];
+                }
+                ck_assert_int_eq(i, nf);
+
+                int c;
+                for (c = PUMAS_COLUMN_ENERGY; c < PUMAS_COLUMN_EVENT; c++) {
+                        double value[TEST_STREAM_SIZE];
+                        if (header.encoding & PUMAS_COLUMN_ENCODING_FLOAT) {
+                                float f[TEST_STREAM_SIZE];
+                                ck_assert_int_eq(header.size[c],
+                                    nf * sizeof(float));
+                                ck_assert_int_eq(
+                                    fread(f, sizeof(*f), nf, stream), nf);
+                                for (i = 0; i < nf; i++) value[i] = f[i];
+                        } else {
+                                ck_assert_int_eq(header.size[c],
+                                    nf * sizeof(double));
+                                ck_assert_int_eq(fread(value, sizeof(*value),
+                                    nf, stream), nf);
+                        }
+
+                        const int delta = (header.encoding &
+                            PUMAS_COLUMN_ENCODING_DELTA) &&
+                            ((c <= PUMAS_COLUMN_POSITION_Z) ||
+                                (c == PUMAS_COLUMN_GRAMMAGE));
+                        for (i = 0, k = 0; k < nt; k++) {
+                                double previous = 0.;
+                                for (j = 0; j < length[k]; j++, i++) {
+                                        if (delta) {
+                                                value[i] += previous;
+                                                previous = value[i];
+                                        }
+                                        struct pumas_state * s =
+                                            &frame[i].state;
+                                        if (c == PUMAS_COLUMN_ENERGY)
+                                                s->energy = value[i];
+                                        else if (c == PUMAS_COLUMN_GRAMMAGE)
+                                                s->grammage = value[i];
+                                        else if (c <= PUMAS_COLUMN_POSITION_Z)
+                                                s->position[c -
+                                                    PUMAS_COLUMN_POSITION_X] =
+                                                    value[i];
+                                        else
+                                                s->direction[c -
+                                                    PUMAS_COLUMN_DIRECTION_X] =
+                                                    value[i];
+                                }
+                        }
+                }
+
+                int event[TEST_STREAM_SIZE], material[TEST_STREAM_SIZE];
+                ck_assert_int_eq(fread(event, sizeof(*event), nf, stream), nf);
+                ck_assert_int_eq(
+                    fread(material, sizeof(*material), nf, stream), nf);
+                for (i = 0; i < nf; i++) {
+                        frame[i].event = event[i];
+                        frame[i].material = material[i];
+                }
+                n += nf;
+        }
+
+        return n;
+}
+
+START_TEST(test_csda_columnar)
+{
+        /* Record some reference tracks */
+        const int n_tracks = 5;
+        pumas_recorder_create_stream(
+            &recorder, 0, 16, NULL, &stream_consumer);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        stream_data.n = 0;
+        context->recorder = recorder;
+
+        int i;
+        for (i = 0; i < n_tracks; i++) {
+                initialise_state();
+                state->energy = 1. + i;
+                state->position[2] = 1E+03 * i;
+                pumas_context_transport(context, state, NULL, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        }
+        pumas_recorder_destroy(&recorder);
+        ck_assert_int_eq(stream_data.n, 2 * n_tracks);
+
+        /* Check the columnar output, with blocks spanning several tracks */
+        const int encodings[] = { PUMAS_COLUMN_ENCODING_DOUBLE,
+                PUMAS_COLUMN_ENCODING_FLOAT,
+                PUMAS_COLUMN_ENCODING_FLOAT | PUMAS_COLUMN_ENCODING_DELTA };
+        int e;
+        for (e = 0; e < 3; e++) {
+                FILE * stream = tmpfile();
+                ck_assert_ptr_nonnull(stream);
+                pumas_recorder_create_columnar(
+                    &recorder, 0, 4, 3, stream, encodings[e]);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                context->recorder = recorder;
+                for (i = 0; i < n_tracks; i++) {
+                        initialise_state();
+                        state->energy = 1. + i;
+                        state->position[2] = 1E+03 * i;
+                        pumas_context_transport(context, state, NULL, NULL);
+                        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                }
+                pumas_recorder_flush(recorder);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                pumas_recorder_destroy(&recorder);
+                context->recorder = NULL;
+
+                struct pumas_stream_frame frames[TEST_STREAM_SIZE];
+                const int n = decode_columns(stream, frames);
+                fclose(stream);
+                ck_assert_int_eq(n, 2 * n_tracks);
+
+                const double epsilon =
+                    (encodings[e] & PUMAS_COLUMN_ENCODING_FLOAT) ?
+                    FLT_EPSILON : 0.;
+                for (i = 0; i < n; i++) {
+                        const struct pumas_stream_frame * frame =
+                            stream_data.frames + i;
+                        ck_assert_int_eq(frames[i].track, frame->track);
+                        ck_assert_int_eq(frames[i].material, frame->material);
+                        ck_assert_int_eq(frames[i].event, frame->event);
+
+                        const struct pumas_state * s0 = &frame->state;
+                        const struct pumas_state * s1 = &frames[i].state;
+                        ck_assert_double_le(fabs(s1->energy - s0->energy),
+                            epsilon * s0->energy);
+                        ck_assert_double_le(fabs(s1->grammage - s0->grammage),
+                            epsilon * s0->grammage);
+                        int j;
+                        for (j = 0; j < 3; j++) {
+                                ck_assert_double_le(fabs(s1->position[j] -
+                                    s0->position[j]),
+                                    epsilon * fabs(s0->position[j]));
+                                ck_assert_double_le(fabs(s1->direction[j] -
+                                    s0->direction[j]), epsilon);
+                        }
+                }
+        }
+
+        /* Check the track index when the start steps are filtered out */
+        FILE * stream = tmpfile();
+        ck_assert_ptr_nonnull(stream);
+        pumas_recorder_create_columnar(&recorder, 0, 4, 3, stream,
+            PUMAS_COLUMN_ENCODING_DOUBLE | PUMAS_COLUMN_ENCODING_DELTA);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        recorder->event_mask = PUMAS_EVENT_STOP;
+        context->recorder = recorder;
+        for (i = 0; i < n_tracks; i++) {
+                initialise_state();
+                state->energy = 1. + i;
+                state->position[2] = 1E+03 * i;
+                pumas_context_transport(context, state, NULL, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        }
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+
+        struct pumas_stream_frame frames[TEST_STREAM_SIZE];
+        const int n = decode_columns(stream, frames);
+        fclose(stream);
+        ck_assert_int_eq(n, n_tracks);
+        for (i = 0; i < n; i++) {
+                const struct pumas_stream_frame * frame =
+                    stream_data.frames + 2 * i + 1;
+                ck_assert_int_eq(frames[i].track, i);
+                ck_assert_int_eq(frames[i].event, frame->event);
+                ck_assert_double_eq(frames[i].state.position[2],
+                    frame->state.position[2]);
+        }
+}
+END_TEST
+
+START_TEST(test_csda_magnet)
+{
+        geometry.magnet[1] = 0.1;
+
+        reset_error();
+        initialise_state();
+        state->energy = 1.;
+
+        double X, d, phi0, phi1, phi, *u = state->direction;
+        pumas_physics_property_range(
+            physics, PUMAS_MODE_CSDA, 0, state->energy, &X);
+        d = X / TEST_ROCK_DENSITY;
+        pumas_physics_property_magnetic_rotation(
+            physics, 0, state->energy, &phi0);
+        pumas_physics_property_magnetic_rotation(physics, 0, 0., &phi1);
+        phi = -(phi1 - phi0) * geometry.magnet[1] / TEST_ROCK_DENSITY *
+            state->charge;
+
+        pumas_context_transport(context, state, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        const double epsilon = 10 * FLT_EPSILON;
+        ck_assert_double_eq_tol(u[0], sin(phi), epsilon);
+        ck_assert_double_eq_tol(u[1], 0., epsilon);
+        ck_assert_double_eq_tol(u[2], cos(phi), epsilon);
+
+        double norm2 = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+        ck_assert_double_eq_tol(norm2, 1., epsilon);
+
+        geometry.magnet[1] = 0.;
+}
+END_TEST
+
+START_TEST(test_csda_geometry)
+{
+        int i;
+        enum pumas_event event;
+        struct pumas_medium *media[2], *rock, *air;
+        struct pumas_frame * frame;
+        pumas_recorder_create(&recorder, 0);
+        context->recorder = recorder;
+        recorder->period = 0;
+
+        geometry.uniform = 0;
+        initialise_state();
+        double tmp;
+        geometry_medium(context, state, &rock, &tmp);
+        state->position[2] = 0.5 * (0.5 * TEST_ROCK_DEPTH + TEST_MAX_ALTITUDE);
+        geometry_medium(context, state, &air, &tmp);
+
+        /* Test the initially out of world case */
+        state->position[2] = 2 * TEST_MAX_ALTITUDE;
+        reset_error();
+        pumas_context_transport(context, state, &event, media);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+        ck_assert_ptr_eq(media[0], NULL);
+        ck_assert_ptr_eq(media[1], NULL);
+        ck_assert_int_eq(recorder->length, 1);
+        frame = recorder->first;
+        ck_assert_ptr_eq(frame->medium, NULL);
+        ck_assert_int_eq(frame->event,
+            PUMAS_EVENT_START | PUMAS_EVENT_MEDIUM | PUMAS_EVENT_STOP);
+        ck_assert_ptr_null(frame->next);
+
+        for (i = 0; i < 2; i++) {
+                /* Test the unconstrained transport */
+                context->event = PUMAS_EVENT_NONE;
+                initialise_state();
+                state->energy = 1E+03;
+                if (i) {
+                        context->mode.direction = PUMAS_MODE_BACKWARD;
+                        state->direction[2] = -1.;
+                } else {
+                        context->mode.direction = PUMAS_MODE_FORWARD;
+                }
+
+                reset_error();
+                pumas_recorder_clear(recorder);
+                pumas_context_transport(context, state, &event, media);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                ck_assert_ptr_eq(media[0], rock);
+                ck_assert_ptr_eq(media[1], NULL);
+                ck_assert_double_eq_tol(
+                    state->position[2], TEST_MAX_ALTITUDE, FLT_EPSILON);
+                ck_assert_int_eq(recorder->length, 3);
+                frame = recorder->first;
+                ck_assert_ptr_eq(frame->medium, rock);
+                ck_assert_int_eq(frame->event, PUMAS_EVENT_START);
+                frame = frame->next;
+                ck_assert_ptr_eq(frame->medium, air);
+                ck_assert_int_eq(frame->event, PUMAS_EVENT_MEDIUM);
+                frame = frame->next;
+                ck_assert_ptr_null(frame->medium);
+                ck_assert_int_eq(
+                    frame->event, PUMAS_EVENT_STOP | PUMAS_EVENT_MEDIUM);
+
+                /* Test the medium stop condition */
+                context->event = PUMAS_EVENT_MEDIUM;
+                initialise_state();
+                state->energy = 1E+03;
+                if (i) {
+                        state->direction[2] = -1.;
+                }
+
+                reset_error();
+                pumas_recorder_clear(recorder);
+                pumas_context_transport(context, state, &event, media);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                ck_assert_ptr_eq(media[0], rock);
+                ck_assert_ptr_eq(media[1], air);
+                ck_assert_int_eq(recorder->length, 2);
+                frame = recorder->first;
+                ck_assert_ptr_eq(frame->medium, rock);
+                ck_assert_int_eq(frame->event, PUMAS_EVENT_START);
+                frame = frame->next;
+                ck_assert_ptr_eq(frame->medium, air);
+                ck_assert_int_eq(
+                    frame->event, PUMAS_EVENT_STOP | PUMAS_EVENT_MEDIUM);
+
+                pumas_recorder_clear(recorder);
+                pumas_context_transport(context, state, &event, media);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                ck_assert_ptr_eq(media[0], air);
+                ck_assert_ptr_eq(media[1], NULL);
+                ck_assert_int_eq(recorder->length, 2);
+                frame = recorder->first;
+                ck_assert_ptr_eq(frame->medium, air);
+                ck_assert_int_eq(frame->event, PUMAS_EVENT_START);
+                frame = frame->next;
+                ck_assert_ptr_null(frame->medium);
+                ck_assert_int_eq(
+                    frame->event, PUMAS_EVENT_STOP | PUMAS_EVENT_MEDIUM);
+        }
+
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+        geometry.uniform = 1;
+        context->event = PUMAS_EVENT_NONE;
+        context->mode.direction = PUMAS_MODE_FORWARD;
+}
+END_TEST
+
+/* Test the exact distance to boundaries in CSDA mode */
+START_TEST(test_csda_exact)
+{
+        geometry.uniform = 0;
+        int i;
+        for (i = 0; i < 2; i++) {
+                /* Cross the media with a search of boundaries */
+                initialise_state();
+                state->energy = 1E+03;
+                if (i) {
+                        context->mode.direction = PUMAS_MODE_BACKWARD;
+                        state->direction[2] = -1.;
+                } else {
+                        context->mode.direction = PUMAS_MODE_FORWARD;
+                }
+
+                enum pumas_event event;
+                reset_error();
+                geometry.step_type = PUMAS_STEP_CHECK;
+                geometry.n_calls = 0;
+                pumas_context_transport(context, state, &event, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                const int n_check = geometry.n_calls;
+                const double energy = state->energy;
+                const double grammage = state->grammage;
+
+                /* Cross the media with exact distances to boundaries */
+                initialise_state();
+                state->energy = 1E+03;
+                if (i) state->direction[2] = -1.;
+                geometry.step_type = PUMAS_STEP_EXACT;
+                geometry.n_calls = 0;
+                pumas_context_transport(context, state, &event, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                ck_assert_double_eq_tol(
+                    state->position[2], TEST_MAX_ALTITUDE, FLT_EPSILON);
+                ck_assert_double_eq_tol(state->energy, energy, FLT_EPSILON);
+                ck_assert_double_eq_tol(
+                    state->grammage, grammage, 1E-06 * grammage);
+                ck_assert_int_gt(n_check, geometry.n_calls);
+        }
+        context->mode.direction = PUMAS_MODE_FORWARD;
+
+        /* Check that boundaries are searched for in a magnetic field */
+        geometry.magnet[1] = 0.1;
+        double position[3], direction[3];
+        int n_calls = 0;
+        for (i = 0; i < 2; i++) {
+                initialise_state();
+                state->energy = 1E+03;
+                geometry.step_type = i ? PUMAS_STEP_EXACT : PUMAS_STEP_CHECK;
+                geometry.n_calls = 0;
+                enum pumas_event event;
+                reset_error();
+                pumas_context_transport(context, state, &event, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                if (i == 0) {
+                        memcpy(position, state->position, sizeof(position));
+                        memcpy(direction, state->direction, sizeof(direction));
+                        n_calls = geometry.n_calls;
+                        continue;
+                }
+                ck_assert_int_eq(geometry.n_calls, n_calls);
+                int j;
+                for (j = 0; j < 3; j++) {
+                        ck_assert_double_eq(state->position[j], position[j]);
+                        ck_assert_double_eq(
+                            state->direction[j], direction[j]);
+                }
+        }
+        geometry.magnet[1] = 0.;
+
+        geometry.step_type = PUMAS_STEP_CHECK;
+        geometry.uniform = 1;
+}
+END_TEST
+
+START_TEST(test_csda_voxels)
+{
+        /* Create a column of voxels, with two identical cells */
+        const double origin[3] = { -5., -5., 0. };
+        const double spacing[3] = { 10., 10., 10. };
+        const int shape[3] = { 1, 1, 4 };
+        const int material[4] = { 0, 0, 0, 0 };
+        const double density[4] = { 1E+03, 2E+03, 2E+03, 3E+03 };
+        struct pumas_geometry * voxels;
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape, material, density);
+        pumas_context_geometry_set(context, voxels);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_recorder_create(&recorder, 0);
+        recorder->period = 0;
+        context->recorder = recorder;
+
+        int i;
+        for (i = 0; i < 2; i++) {
+                /* Cross the column vertically */
+                enum pumas_event event;
+                initialise_state();
+                state->energy = 1E+03;
+                if (i) {
+                        context->mode.direction = PUMAS_MODE_BACKWARD;
+                        state->direction[2] = -1.;
+                } else {
+                        context->mode.direction = PUMAS_MODE_FORWARD;
+                }
+                state->position[2] = 1.;
+
+                reset_error();
+                pumas_recorder_clear(recorder);
+                pumas_context_transport(context, state, &event, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                ck_assert_double_eq_tol(state->position[2], 40., FLT_EPSILON);
+                ck_assert_double_eq_tol(
+                    state->grammage, 7.9E+04, 1E-06 * 7.9E+04);
+                ck_assert_int_eq(recorder->length, 4);
+        }
+        context->mode.direction = PUMAS_MODE_FORWARD;
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+        pumas_geometry_destroy(&voxels);
+
+        /* Cross a cubic grid diagonally */
+        const int shape3[3] = { 4, 4, 4 };
+        int material3[64];
+        double density3[64];
+        for (i = 0; i < 64; i++) {
+                material3[i] = 0;
+                density3[i] = 1E+03 * (1 + (i * 7) % 5);
+        }
+        pumas_geometry_create_voxels(
+            &voxels, origin, spacing, shape3, material3, density3);
+        pumas_context_geometry_set(context, voxels);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        const double u[3] = { 0.3, 0.5, sqrt(1. - 0.34) };
+        initialise_state();
+        state->energy = 1E+03;
+        state->position[0] = -4.;
+        state->position[1] = -4.;
+        state->position[2] = 0.5;
+        memcpy(state->direction, u, sizeof(u));
+
+        /* Integrate the grammage numerically */
+        const int n = 1000000;
+        double grammage = 0., ds = 1E-04;
+        for (i = 0; i < n; i++) {
+                const double s = (i + 0.5) * ds;
+                int j, k[3];
+                for (j = 0; j < 3; j++) {
+                        const double x = state->position[j] + s * u[j];
+                        k[j] = (int)floor((x - origin[j]) / spacing[j]);
+                }
+                if ((k[0] >= 4) || (k[1] >= 4) || (k[2] >= 4)) break;
+                grammage += density3[k[0] + 4 * (k[1] + 4 * k[2])] * ds;
+        }
+        ck_assert(i < n);
+
+        reset_error();
+        pumas_context_transport(context, state, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_double_eq_tol(state->grammage, grammage, 1E-04 * grammage);
+        ck_assert_double_eq_tol(state->distance, i * ds, 2 * ds);
+
+        pumas_context_geometry_set(context, NULL);
+        context->medium = &geometry_medium;
+        pumas_geometry_destroy(&voxels);
+}
+END_TEST
+
+START_TEST(test_csda_layers)
+{
+        /* Create planar layers with various density laws */
+        struct pumas_layer layers[3];
+        memset(layers, 0x0, sizeof(layers));
+        layers[0].top = 10.;
+        layers[0].density.coefficients[0] = 1E+03;
+        layers[1].top = 30.;
+        layers[1].density.model = PUMAS_DENSITY_POLYNOMIAL;
+        layers[1].density.origin = 10.;
+        layers[1].density.coefficients[0] = 1E+03;
+        layers[1].density.coefficients[1] = 50.;
+        layers[2].top = 130.;
+        layers[2].density.model = PUMAS_DENSITY_EXPONENTIAL;
+        layers[2].density.origin = 30.;
+        layers[2].density.length = -50.;
+        layers[2].density.coefficients[0] = 2E+03;
+
+        struct pumas_geometry * stack;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 3, layers);
+        pumas_context_geometry_set(context, stack);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        const double X0 = 9.5E+03 + 3E+04 + 1E+05 * (1. - exp(-2.));
+        int i;
+        for (i = 0; i < 2; i++) {
+                enum pumas_event event;
+                initialise_state();
+                state->energy = 1E+03;
+                state->position[2] = 0.5;
+                state->direction[0] = 0.6;
+                state->direction[2] = 0.8;
+                if (i) {
+                        context->mode.direction = PUMAS_MODE_BACKWARD;
+                        state->direction[0] = -0.6;
+                        state->direction[2] = -0.8;
+                } else {
+                        context->mode.direction = PUMAS_MODE_FORWARD;
+                }
+
+                reset_error();
+                pumas_context_transport(context, state, &event, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
+                ck_assert_double_eq_tol(state->position[2], 130., FLT_EPSILON);
+                ck_assert_double_eq_tol(
+                    state->grammage, X0 / 0.8, 1E-08 * X0);
+        }
+        context->mode.direction = PUMAS_MODE_FORWARD;
+        pumas_geometry_destroy(&stack);
+
+        /* Create a single exponential layer. Along a straight line, the
+         * grammage is then X(s) = rho0 * L / uz * (1 - exp(-uz * s / L)).
+         */
+        const double rho0 = 2E+03, L = 200., uz = 0.8;
+        memset(layers, 0x0, sizeof(layers));
+        layers[0].top = 1E+03;
+        layers[0].density.model = PUMAS_DENSITY_EXPONENTIAL;
+        layers[0].density.length = -L;
+        layers[0].density.coefficients[0] = rho0;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_PLANAR, 0., 1, layers);
+        pumas_context_geometry_set(context, stack);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        double mu;
+        pumas_physics_particle(physics, NULL, NULL, &mu);
+
+        /* Check the proper time across the layer. The proper time is
+         * bounded by the initial and final momenta.
+         */
+        initialise_state();
+        state->energy = 1E+03;
+        state->direction[0] = 0.6;
+        state->direction[2] = uz;
+        double p0 = sqrt(state->energy * (state->energy + 2. * mu));
+        reset_error();
+        pumas_context_transport(context, state, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        double d = 1E+03 / uz;
+        double p1 = sqrt(state->energy * (state->energy + 2. * mu));
+        ck_assert_double_eq_tol(state->distance, d, FLT_EPSILON * d);
+        double X = rho0 * L / uz * (1. - exp(-uz * d / L));
+        ck_assert_double_eq_tol(state->grammage, X, 1E-08 * X);
+        ck_assert(state->time >= (1. - FLT_EPSILON) * mu * d / p0);
+        ck_assert(state->time <= (1. + FLT_EPSILON) * mu * d / p1);
+
+        /* Check a grammage limit within the layer. The initial grammage is
+         * not null, such that the limit is reached within a step.
+         */
+        const double dX = 1E+05;
+        context->event = PUMAS_EVENT_LIMIT_GRAMMAGE;
+        context->limit.grammage = 1E+04 + dX;
+        enum pumas_event event;
+        initialise_state();
+        state->energy = 1E+03;
+        state->grammage = 1E+04;
+        state->direction[0] = 0.6;
+        state->direction[2] = uz;
+        reset_error();
+        pumas_context_transport(context, state, &event, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_int_eq(event, PUMAS_EVENT_LIMIT_GRAMMAGE);
+        ck_assert_double_eq(state->grammage, context->limit.grammage);
+        d = -L / uz * log(1. - dX * uz / (rho0 * L));
+        ck_assert_double_eq_tol(state->distance, d, 1E-08 * d);
+        ck_assert_double_eq_tol(state->position[0], 0.6 * d, 1E-08 * d);
+        ck_assert_double_eq_tol(state->position[2], uz * d, 1E-08 * d);
+
+        /* Idem, with soft scattering along a vertical line. The steps are
+         * then limited by the multiple scattering path length. The angular
+         * deflection is negligible at this energy.
+         */
+        context->mode.scattering = PUMAS_MODE_MIXED;
+        context->limit.grammage = dX;
+        initialise_state();
+        state->energy = 1E+03;
+        reset_error();
+        pumas_context_transport(context, state, &event, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_int_eq(event, PUMAS_EVENT_LIMIT_GRAMMAGE);
+        ck_assert_double_eq(state->grammage, dX);
+        d = -L * log(1. - dX / (rho0 * L));
+        ck_assert_double_eq_tol(state->position[2], d, 1E-04 * d);
+        ck_assert_double_eq_tol(state->distance, d, 1E-04 * d);
+        context->mode.scattering = PUMAS_MODE_DISABLED;
+        context->limit.grammage = 0.;
+
+        /* Check a proper time limit within the layer */
+        context->event = PUMAS_EVENT_LIMIT_TIME;
+        context->limit.time = 0.03;
+        initialise_state();
+        state->energy = 1E+03;
+        state->direction[0] = 0.6;
+        state->direction[2] = uz;
+        reset_error();
+        pumas_context_transport(context, state, &event, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_int_eq(event, PUMAS_EVENT_LIMIT_TIME);
+        ck_assert_double_eq(state->time, context->limit.time);
+        d = state->distance;
+        p1 = sqrt(state->energy * (state->energy + 2. * mu));
+        ck_assert(d < 1E+03 / uz);
+        ck_assert(state->time >= (1. - FLT_EPSILON) * mu * d / p0);
+        ck_assert(state->time <= (1. + FLT_EPSILON) * mu * d / p1);
+        X = rho0 * L / uz * (1. - exp(-uz * d / L));
+        ck_assert_double_eq_tol(state->grammage, X, 1E-08 * X);
+        ck_assert_double_eq_tol(state->position[2], uz * d, 1E-08 * d);
+        context->event = PUMAS_EVENT_NONE;
+        context->limit.time = 0.;
+        pumas_geometry_destroy(&stack);
+
+        /* Create spherical shells */
+        memset(layers, 0x0, sizeof(layers));
+        layers[0].top = 100.;
+        layers[0].density.coefficients[0] = 2E+03;
+        layers[1].top = 200.;
+        layers[1].density.coefficients[0] = 1E+03;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_SPHERICAL, 0., 2, layers);
+        pumas_context_geometry_set(context, stack);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_recorder_create(&recorder, 0);
+        recorder->period = 0;
+        context->recorder = recorder;
+
+        /* Cross the inner sphere along a chord */
+        initialise_state();
+        state->energy = 1E+03;
+        state->position[0] = -150.;
+        state->position[2] = 50.;
+        state->direction[0] = 1.;
+        state->direction[2] = 0.;
+        reset_error();
+        pumas_context_transport(context, state, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        const double x0 = sqrt(100. * 100. - 50. * 50.);
+        const double x1 = sqrt(200. * 200. - 50. * 50.);
+        ck_assert_double_eq_tol(state->position[0], x1, FLT_EPSILON * x1);
+        const double X1 = 1E+03 * (x1 - x0 + 150. - x0) + 2E+03 * 2. * x0;
+        ck_assert_double_eq_tol(state->grammage, X1, 1E-06 * X1);
+        ck_assert_int_eq(recorder->length, 4);
+        pumas_geometry_destroy(&stack);
+
+        /* Cross a radial density law in a single step */
+        memset(layers, 0x0, sizeof(layers));
+        layers[0].top = 200.;
+        layers[0].density.model = PUMAS_DENSITY_POLYNOMIAL;
+        layers[0].density.coefficients[0] = 1E+03;
+        layers[0].density.coefficients[1] = 5.;
+        pumas_geometry_create_layers(
+            &stack, PUMAS_LAYER_SPHERICAL, 0., 1, layers);
+        pumas_context_geometry_set(context, stack);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        pumas_recorder_clear(recorder);
+
+        initialise_state();
+        state->energy = 1E+03;
+        state->position[0] = -150.;
+        state->position[2] = 50.;
+        state->direction[0] = 1.;
+        state->direction[2] = 0.;
+        reset_error();
+        pumas_context_transport(context, state, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_double_eq_tol(state->position[0], x1, FLT_EPSILON * x1);
+        const double h0 = sqrt(150. * 150. + 50. * 50.);
+        const double X2 = 1E+03 * (x1 + 150.) +
+            2.5 * (x1 * 200. + 150. * h0 +
+                      50. * 50. * (asinh(x1 / 50.) + asinh(3.)));
+        ck_assert_double_eq_tol(state->grammage, X2, 1E-08 * X2);
+        ck_assert_int_eq(recorder->length, 2);
+
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+        pumas_context_geometry_set(context, NULL);
+        context->medium = &geometry_medium;
+        pumas_geometry_destroy(&stack);
+}
+END_TEST
+
+/* Quadtree clipping of terrain geometries, exported by the library in test
+ * mode.
+ */
+int pumas_test_terrain_clip(const struct pumas_geometry * geometry, int level,
+    int i, int j, const double * position, const double * direction,
+    double * t0, double * t1);
+
+START_TEST(test_csda_terrain)
+{
+        /* Create terrains with a varying topography. The second raster has
+         * an odd number of cells along each axis, such that the last nodes of
+         * the quadtree have missing children.
+         */
+        const int material[2] = { 0, 0 };
+        const double density[2] = { 2E+03, 1E+03 };
+        pumas_recorder_create(&recorder, 0);
+        recorder->period = 0;
+        context->recorder = recorder;
+
+        int m;
+        for (m = 0; m < 2; m++) {
+                const int n_nodes = 5 + m;
+                const double extent = 10. * (n_nodes - 1);
+                double heights[6][6];
+                FILE * fid = fopen(TEST_TERRAIN, "w");
+                fprintf(fid, "ncols %d\nnrows %d\nxllcenter 0\nyllcenter 0\n"
+                             "cellsize 10\n",
+                    n_nodes, n_nodes);
+                int i, j;
+                for (j = n_nodes - 1; j >= 0; j--) {
+                        for (i = 0; i < n_nodes; i++) {
+                                heights[j][i] =
+                                    10. + 5. * ((3 * i + 7 * j) % 4);
+                                fprintf(fid, " %g", heights[j][i]);
+                        }
+                        fprintf(fid, "\n");
+                }
+                fclose(fid);
+
+                struct pumas_geometry * terrain;
+                pumas_geometry_create_terrain(
+                    &terrain, TEST_TERRAIN, 0., 40., material, density);
+                remove(TEST_TERRAIN);
+                pumas_context_geometry_set(context, terrain);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                pumas_recorder_clear(recorder);
+
+                /* Check the clipping of the last quadtree nodes along x */
+                const double r0[3] = { 1., 5., 30. }, u0[3] = { 1., 0., 0. };
+                const int n_cells = n_nodes - 1;
+                int level;
+                for (level = 0; level < 2; level++) {
+                        const int last = (n_cells - 1) >> level;
+                        double t0 = 0., t1 = 1E+03;
+                        ck_assert_int_eq(pumas_test_terrain_clip(terrain,
+                                             level, last, 0, r0, u0, &t0, &t1),
+                            1);
+                        ck_assert_double_eq(t1, extent - r0[0]);
+                        t0 = 0., t1 = 1E+03;
+                        ck_assert_int_eq(pumas_test_terrain_clip(terrain,
+                                             level, last + 1, 0, r0, u0, &t0,
+                                             &t1),
+                            0);
+                }
+
+                /* Cross the terrain obliquely */
+                const double u[3] = { 0.6, 0.7, sqrt(1. - 0.85) };
+                initialise_state();
+                state->energy = 1E+03;
+                state->position[0] = 1.;
+                state->position[1] = 2.;
+                state->position[2] = 5.;
+                memcpy(state->direction, u, sizeof(u));
+
+                /* Integrate the grammage numerically */
+                const int n = 1000000;
+                double grammage = 0., ds = 1E-04;
+                int k, n_crossings = 0, ground = 1;
+                for (k = 0; k < n; k++) {
+                        const double s = (k + 0.5) * ds;
+                        double r[3];
+                        for (j = 0; j < 3; j++)
+                                r[j] = state->position[j] + s * u[j];
+                        if ((r[0] >= extent) || (r[1] >= extent) ||
+                            (r[2] >= 40.))
+                                break;
+                        i = (int)(r[0] / 10.);
+                        j = (int)(r[1] / 10.);
+                        const double x = 0.1 * r[0] - i, y = 0.1 * r[1] - j;
+                        const double h = (heights[j][i] * (1. - x) +
+                                             heights[j][i + 1] * x) *
+                                (1. - y) +
+                            (heights[j + 1][i] * (1. - x) +
+                                heights[j + 1][i + 1] * x) *
+                                y;
+                        const int g = (r[2] < h);
+                        if (g != ground) n_crossings++;
+                        ground = g;
+                        grammage += density[1 - g] * ds;
+                }
+                ck_assert(k < n);
+                ck_assert_int_gt(n_crossings, 1);
+
+                reset_error();
+                pumas_context_transport(context, state, NULL, NULL);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_double_eq_tol(
+                    state->grammage, grammage, 1E-04 * grammage);
+                ck_assert_double_eq_tol(state->distance, k * ds, 2 * ds);
+                ck_assert_int_eq(recorder->length, n_crossings + 2);
+
+                pumas_context_geometry_set(context, NULL);
+                pumas_geometry_destroy(&terrain);
+        }
+
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+        context->medium = &geometry_medium;
+}
+END_TEST
+
+/* Test the batch transport in CSDA mode */
+START_TEST(test_csda_batch)
+{
+#define N_BATCH 8
+        int i;
+        double energy[N_BATCH], weight[N_BATCH], distance[N_BATCH];
+        double x[N_BATCH], y[N_BATCH], z[N_BATCH];
+        double ux[N_BATCH], uy[N_BATCH], uz[N_BATCH];
+        int decayed[N_BATCH];
+        enum pumas_event events[N_BATCH];
+        struct pumas_medium * media[2 * N_BATCH];
+        struct pumas_states states = { NULL, energy, distance, NULL, NULL,
+                weight, { x, y, z }, { ux, uy, uz }, decayed };
+
+        /* Check some basic errors */
+        reset_error();
+        pumas_context_transport_batch(NULL, N_BATCH, &states, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_context_transport_batch(context, N_BATCH, NULL, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_context_transport_batch(context, -1, &states, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+
+        reset_error();
+        pumas_context_transport_batch(context, 0, NULL, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        for (i = 0; i < N_BATCH; i++) {
+                energy[i] = 1. + i;
+                weight[i] = distance[i] = 0.;
+                x[i] = y[i] = z[i] = 0.;
+                ux[i] = uy[i] = 0.;
+                uz[i] = 1.;
+                decayed[i] = 0;
+        }
+        ux[N_BATCH / 2] = 1.;
+        reset_error();
+        pumas_context_transport_batch(context, N_BATCH, &states, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_DIRECTION_ERROR);
+
+        /* Check the consistency with the single state transport */
+        for (i = 0; i < N_BATCH; i++) {
+                energy[i] = 1. + i;
+                weight[i] = 1.;
+                distance[i] = 0.;
+                x[i] = y[i] = z[i] = 0.;
+                ux[i] = uy[i] = 0.;
+                uz[i] = 1.;
+                decayed[i] = (i == 1) ? 1 : 0;
+                media[2 * i] = media[2 * i + 1] = NULL;
+        }
+        /* The media of the decayed state must be left unchanged */
+        media[2] = media[3] = (struct pumas_medium *)&states;
+        reset_error();
+        pumas_context_transport_batch(
+            context, N_BATCH, &states, events, media);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+
+        for (i = 0; i < N_BATCH; i++) {
+                enum pumas_event event;
+                struct pumas_medium * m[2];
+                initialise_state();
+                state->energy = 1. + i;
+                state->decayed = (i == 1) ? 1 : 0;
+                pumas_context_transport(context, state, &event, m);
+                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+                ck_assert_int_eq(events[i], event);
+                ck_assert_double_eq(energy[i], state->energy);
+                ck_assert_double_eq(distance[i], state->distance);
+                ck_assert_double_eq(weight[i], state->weight);
+                ck_assert_double_eq(z[i], state->position[2]);
+                ck_assert_double_eq(uz[i], state->direction[2]);
+                ck_assert_int_eq(decayed[i], state->decayed);
+                if (i == 1) {
+                        ck_assert_ptr_eq(media[2 * i], &states);
+                        ck_assert_ptr_eq(media[2 * i + 1], &states);
+                } else {
+                        ck_assert_ptr_eq(media[2 * i], m[0]);
+                        ck_assert_ptr_eq(media[2 * i + 1], m[1]);
+                }
+        }
+#undef N_BATCH
 }
 END_TEST
 
-START_TEST(test_csda_magnet)
-{
-        geometry.magnet[1] = 0.1;
+/* Callbacks for the parallel run tests */
+struct run_score {
+        long n;
+        double distance;
+        double grammage;
+};
 
-        reset_error();
-        initialise_state();
-        state->energy = 1.;
+static long run_bad_event = -1;
 
-        double X, d, phi0, phi1, phi, *u = state->direction;
-        pumas_physics_property_range(
-            physics, PUMAS_MODE_CSDA, 0, state->energy, &X);
-        d = X / TEST_ROCK_DENSITY;
-        pumas_physics_property_magnetic_rotation(
-            physics, 0, state->energy, &phi0);
-        pumas_physics_property_magnetic_rotation(physics, 0, 0., &phi1);
-        phi = -(phi1 - phi0) * geometry.magnet[1] / TEST_ROCK_DENSITY *
-            state->charge;
+static void run_generator(
+    struct pumas_context * context, long event, struct pumas_state * state)
+{
+        state->energy = 1. + (event % 8);
+        state->direction[2] = (event == run_bad_event) ? 2. : 1.;
+}
 
-        pumas_context_transport(context, state, NULL, NULL);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+/* Events generated after the bad one, when cancelling a run */
+static long run_n_cancelled = 0;
+static long run_slow_events = 0;
+#if (THREADS_MODE)
+static pthread_mutex_t run_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
-        const double epsilon = 10 * FLT_EPSILON;
-        ck_assert_double_eq_tol(u[0], sin(phi), epsilon);
-        ck_assert_double_eq_tol(u[1], 0., epsilon);
-        ck_assert_double_eq_tol(u[2], cos(phi), epsilon);
+static void run_slow_generator(
+    struct pumas_context * context, long event, struct pumas_state * state)
+{
+#if (THREADS_MODE)
+        pthread_mutex_lock(&run_mutex);
+#endif
+        if (run_n_cancelled >= 0) run_n_cancelled++;
+        else if (event == run_bad_event) run_n_cancelled = 0;
+#if (THREADS_MODE)
+        pthread_mutex_unlock(&run_mutex);
+
+        /* Slow down the first events, such that they get stolen */
+        if (event < run_slow_events) usleep(100);
+#endif
+        run_generator(context, event, state);
+}
 
-        double norm2 = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
-        ck_assert_double_eq_tol(norm2, 1., epsilon);
+static void run_scorer(struct pumas_context * context, long event,
+    struct pumas_state * state, enum pumas_event end,
+    struct pumas_medium * media[2])
+{
+        struct run_score * score = context->user_data;
+        score->n++;
+        score->distance += state->distance;
+        score->grammage += state->grammage;
+}
 
-        geometry.magnet[1] = 0.;
+static void run_reducer(
+    struct pumas_context * context, struct pumas_context * worker)
+{
+        struct run_score * score = context->user_data;
+        const struct run_score * wscore = worker->user_data;
+        score->n += wscore->n;
+        score->distance += wscore->distance;
+        score->grammage += wscore->grammage;
 }
-END_TEST
 
-START_TEST(test_csda_geometry)
+/* Test the parallel run in CSDA mode */
+START_TEST(test_csda_parallel)
 {
-        int i;
-        enum pumas_event event;
-        struct pumas_medium *media[2], *rock, *air;
-        struct pumas_frame * frame;
-        pumas_recorder_create(&recorder, 0);
-        context->recorder = recorder;
-        recorder->period = 0;
+        const long n_events = 100;
+        struct pumas_context * run_context;
+        pumas_context_create(&run_context, physics, sizeof(struct run_score));
+        run_context->medium = &geometry_medium;
+        run_context->mode.scattering = PUMAS_MODE_DISABLED;
+        run_context->mode.energy_loss = PUMAS_MODE_CSDA;
+        struct run_score * score = run_context->user_data;
 
-        geometry.uniform = 0;
-        initialise_state();
-        double tmp;
-        geometry_medium(context, state, &rock, &tmp);
-        state->position[2] = 0.5 * (0.5 * TEST_ROCK_DEPTH + TEST_MAX_ALTITUDE);
-        geometry_medium(context, state, &air, &tmp);
+        /* Check some basic errors */
+        reset_error();
+        pumas_context_run_parallel(
+            NULL, 1, n_events, &run_generator, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
 
-        /* Test the initially out of world case */
-        state->position[2] = 2 * TEST_MAX_ALTITUDE;
         reset_error();
-        pumas_context_transport(context, state, &event, media);
-        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
-        ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
-        ck_assert_ptr_eq(media[0], NULL);
-        ck_assert_ptr_eq(media[1], NULL);
-        ck_assert_int_eq(recorder->length, 1);
-        frame = recorder->first;
-        ck_assert_ptr_eq(frame->medium, NULL);
-        ck_assert_int_eq(frame->event,
-            PUMAS_EVENT_START | PUMAS_EVENT_MEDIUM | PUMAS_EVENT_STOP);
-        ck_assert_ptr_null(frame->next);
+        pumas_context_run_parallel(run_context, 1, n_events, NULL, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
 
-        for (i = 0; i < 2; i++) {
-                /* Test the unconstrained transport */
-                context->event = PUMAS_EVENT_NONE;
-                initialise_state();
-                state->energy = 1E+03;
-                if (i) {
-                        context->mode.direction = PUMAS_MODE_BACKWARD;
-                        state->direction[2] = -1.;
-                } else {
-                        context->mode.direction = PUMAS_MODE_FORWARD;
-                }
+        reset_error();
+        pumas_context_run_parallel(
+            run_context, 0, n_events, &run_generator, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
 
-                reset_error();
-                pumas_recorder_clear(recorder);
-                pumas_context_transport(context, state, &event, media);
-                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
-                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
-                ck_assert_ptr_eq(media[0], rock);
-                ck_assert_ptr_eq(media[1], NULL);
-                ck_assert_double_eq_tol(
-                    state->position[2], TEST_MAX_ALTITUDE, FLT_EPSILON);
-                ck_assert_int_eq(recorder->length, 3);
-                frame = recorder->first;
-                ck_assert_ptr_eq(frame->medium, rock);
-                ck_assert_int_eq(frame->event, PUMAS_EVENT_START);
-                frame = frame->next;
-                ck_assert_ptr_eq(frame->medium, air);
-                ck_assert_int_eq(frame->event, PUMAS_EVENT_MEDIUM);
-                frame = frame->next;
-                ck_assert_ptr_null(frame->medium);
-                ck_assert_int_eq(
-                    frame->event, PUMAS_EVENT_STOP | PUMAS_EVENT_MEDIUM);
+        reset_error();
+        pumas_recorder_create(&recorder, 0);
+        run_context->recorder = recorder;
+        pumas_context_run_parallel(
+            run_context, 1, n_events, &run_generator, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_VALUE_ERROR);
+        run_context->recorder = NULL;
+        pumas_recorder_destroy(&recorder);
 
-                /* Test the medium stop condition */
-                context->event = PUMAS_EVENT_MEDIUM;
+        reset_error();
+        run_bad_event = n_events / 2;
+        pumas_context_run_parallel(
+            run_context, 4, n_events, &run_generator, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_DIRECTION_ERROR);
+        run_bad_event = -1;
+
+        /* Check that stolen events are cancelled as well. The first worker
+         * is slowed down, such that the bad event at the back of its range
+         * is stolen. Then, only the chunks of 4096 / (64 * 4) = 16 events
+         * being processed, or popped before the cancellation, should be
+         * generated after the bad one.
+         */
+        memset(score, 0x0, sizeof(*score));
+        reset_error();
+        run_slow_events = 1024;
+        run_bad_event = run_slow_events - 1;
+        run_n_cancelled = -1;
+        pumas_context_run_parallel(run_context, 4, 4096, &run_slow_generator,
+            &run_scorer, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_DIRECTION_ERROR);
+        ck_assert_int_ge(run_n_cancelled, 0);
+        ck_assert_int_le(run_n_cancelled, 2 * 4 * 16);
+        run_bad_event = -1;
+        run_slow_events = 0;
+
+        /* Check the consistency with the single state transport */
+        double distance = 0., grammage = 0.;
+        long i;
+        for (i = 0; i < n_events; i++) {
                 initialise_state();
-                state->energy = 1E+03;
-                if (i) {
-                        state->direction[2] = -1.;
-                }
+                state->energy = 1. + (i % 8);
+                pumas_context_transport(context, state, NULL, NULL);
+                distance += state->distance;
+                grammage += state->grammage;
+        }
 
+        int n_threads;
+        for (n_threads = 1; n_threads <= 4; n_threads++) {
+                memset(score, 0x0, sizeof(*score));
                 reset_error();
-                pumas_recorder_clear(recorder);
-                pumas_context_transport(context, state, &event, media);
-                ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
-                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
-                ck_assert_ptr_eq(media[0], rock);
-                ck_assert_ptr_eq(media[1], air);
-                ck_assert_int_eq(recorder->length, 2);
-                frame = recorder->first;
-                ck_assert_ptr_eq(frame->medium, rock);
-                ck_assert_int_eq(frame->event, PUMAS_EVENT_START);
-                frame = frame->next;
-                ck_assert_ptr_eq(frame->medium, air);
-                ck_assert_int_eq(
-                    frame->event, PUMAS_EVENT_STOP | PUMAS_EVENT_MEDIUM);
-
-                pumas_recorder_clear(recorder);
-                pumas_context_transport(context, state, &event, media);
+                pumas_context_run_parallel(run_context, n_threads, n_events,
+                    &run_generator, &run_scorer, &run_reducer);
                 ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
-                ck_assert_int_eq(event, PUMAS_EVENT_MEDIUM);
-                ck_assert_ptr_eq(media[0], air);
-                ck_assert_ptr_eq(media[1], NULL);
-                ck_assert_int_eq(recorder->length, 2);
-                frame = recorder->first;
-                ck_assert_ptr_eq(frame->medium, air);
-                ck_assert_int_eq(frame->event, PUMAS_EVENT_START);
-                frame = frame->next;
-                ck_assert_ptr_null(frame->medium);
-                ck_assert_int_eq(
-                    frame->event, PUMAS_EVENT_STOP | PUMAS_EVENT_MEDIUM);
+                ck_assert_int_eq(score->n, n_events);
+                ck_assert_double_eq_tol(score->distance, distance,
+                    1E-09 * distance);
+                ck_assert_double_eq_tol(
+                    score->grammage, grammage, 1E-09 * grammage);
         }
 
-        pumas_recorder_destroy(&recorder);
-        context->recorder = NULL;
-        geometry.uniform = 1;
-        context->event = PUMAS_EVENT_NONE;
-        context->mode.direction = PUMAS_MODE_FORWARD;
+        pumas_context_destroy(&run_context);
 }
 END_TEST
 
@@ -4305,6 +6267,106 @@ START_TEST(test_hybrid_record)
 }
 END_TEST
 
+/* Transport a muon with a given seed, recording its track */
+static void transport_recorded(unsigned long seed)
+{
+        pumas_context_random_seed_set(context, &seed);
+        pumas_recorder_clear(recorder);
+        initialise_state();
+        state->energy = 1E+03;
+        pumas_context_transport(context, state, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+}
+
+START_TEST(test_hybrid_filter)
+{
+        pumas_recorder_create(&recorder, 0);
+        context->recorder = recorder;
+        reset_error();
+
+        /* Record all steps */
+        const unsigned long seed = 1;
+        transport_recorded(seed);
+        const int n_all = recorder->length;
+        ck_assert_int_gt(n_all, 2);
+        int n_del = 0;
+        struct pumas_frame * frame;
+        for (frame = recorder->first; frame != NULL; frame = frame->next) {
+                if (frame->event & PUMAS_EVENT_VERTEX_DEL) n_del++;
+        }
+        ck_assert_int_gt(n_del, 0);
+
+        /* Filter DEL vertices */
+        recorder->event_mask = PUMAS_EVENT_VERTEX_DEL;
+        transport_recorded(seed);
+        ck_assert_int_eq(recorder->length, n_del);
+        for (frame = recorder->first; frame != NULL; frame = frame->next)
+                ck_assert(frame->event & PUMAS_EVENT_VERTEX_DEL);
+
+        /* Filter DEL vertices and the start and stop steps */
+        recorder->event_mask = PUMAS_EVENT_VERTEX_DEL | PUMAS_EVENT_START |
+            PUMAS_EVENT_STOP;
+        transport_recorded(seed);
+        ck_assert_int_eq(recorder->length, n_del + 2);
+        recorder->event_mask = PUMAS_EVENT_NONE;
+
+        /* Filter on the energy loss */
+        const double energy_loss = 10.;
+        recorder->energy_loss = energy_loss;
+        transport_recorded(seed);
+        ck_assert_int_gt(recorder->length, 2);
+        ck_assert(recorder->length < n_all);
+        double energy = recorder->first->state.energy;
+        for (frame = recorder->first->next; frame->next != NULL;
+             frame = frame->next) {
+                ck_assert_double_ge(
+                    energy - frame->state.energy, energy_loss);
+                energy = frame->state.energy;
+        }
+        ck_assert(frame->event & PUMAS_EVENT_STOP);
+
+        /* Filter on the energy gain, in backward mode */
+        context->mode.direction = PUMAS_MODE_BACKWARD;
+        context->limit.energy = 1E+03;
+        context->event = PUMAS_EVENT_LIMIT_ENERGY;
+        pumas_recorder_clear(recorder);
+        initialise_state();
+        state->energy = 1E+00;
+        pumas_context_transport(context, state, NULL, NULL);
+        ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
+        ck_assert_int_gt(recorder->length, 2);
+        energy = recorder->first->state.energy;
+        for (frame = recorder->first->next; frame->next != NULL;
+             frame = frame->next) {
+                ck_assert_double_ge(
+                    frame->state.energy - energy, energy_loss);
+                energy = frame->state.energy;
+        }
+        ck_assert(frame->event & PUMAS_EVENT_STOP);
+        context->mode.direction = PUMAS_MODE_FORWARD;
+        context->limit.energy = 0.;
+        context->event = PUMAS_EVENT_NONE;
+        recorder->energy_loss = 0.;
+
+        /* Filter on the travelled distance */
+        const double distance = 10.;
+        recorder->distance = distance;
+        transport_recorded(seed);
+        ck_assert_int_gt(recorder->length, 2);
+        ck_assert(recorder->length < n_all);
+        double z = recorder->first->state.position[2];
+        for (frame = recorder->first->next; frame->next != NULL;
+             frame = frame->next) {
+                ck_assert_double_gt(frame->state.position[2] - z, distance);
+                z = frame->state.position[2];
+        }
+        ck_assert(frame->event & PUMAS_EVENT_STOP);
+
+        pumas_recorder_destroy(&recorder);
+        context->recorder = NULL;
+}
+END_TEST
+
 START_TEST(test_hybrid_magnet)
 {
         geometry.magnet[1] = 0.1;
@@ -4396,8 +6458,8 @@ START_TEST(test_detailed_straight)
         double tmp;
         geometry_medium(context, state, &rock, &tmp);
 
-        double ctau;
-        pumas_physics_particle(physics, NULL, &ctau, NULL);
+        double ctau, mass;
+        pumas_physics_particle(physics, NULL, &ctau, &mass);
 
         /* Check the missing random engine case */
         reset_error();
@@ -4637,13 +6699,23 @@ START_TEST(test_detailed_straight)
                 state->energy = 1E+03;
                 pumas_context_transport(context, state, event, media);
                 k1 = state->energy;
-                pumas_physics_property_proper_time(
-                    physics, PUMAS_MODE_MIXED, 0, k1, &t1);
-                t1 /= TEST_ROCK_DENSITY;
                 ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
                 ck_assert_double_le(state->distance, d - d1);
                 ck_assert_double_le(state->grammage, X - X1);
-                ck_assert_double_eq_tol(state->time, t0 - t1, 0.5 * (t0 - t1));
+
+                /* The tabulated proper time follows the CSDA path, i.e. it
+                 * assumes the mean energy loss between the initial and final
+                 * energies. In straggled mode, the final energy fluctuates
+                 * for a given distance, while the proper time is mostly set
+                 * by the distance. Thus, it is bounded instead by the initial
+                 * and final momenta.
+                 */
+                const double p0 = sqrt(1E+03 * (1E+03 + 2. * mass));
+                const double p1 = sqrt(k1 * (k1 + 2. * mass));
+                ck_assert_double_ge(state->time,
+                    state->distance * mass / p0 * (1. - FLT_EPSILON));
+                ck_assert_double_le(state->time,
+                    state->distance * mass / p1 * (1. + FLT_EPSILON));
                 ck_assert_double_eq_tol(
                     state->weight, exp(-state->time / ctau), FLT_EPSILON);
                 ck_assert_double_eq(state->position[0], 0.);
@@ -4681,13 +6753,20 @@ START_TEST(test_detailed_straight)
                 state->energy = 1E+03;
                 pumas_context_transport(context, state, event, media);
                 k1 = state->energy;
-                pumas_physics_property_range(
-                    physics, PUMAS_MODE_MIXED, 0, k1, &X1);
-                d1 = X1 / TEST_ROCK_DENSITY;
                 ck_assert_int_eq(error_data.rc, PUMAS_RETURN_SUCCESS);
-                ck_assert_double_eq_tol(state->distance / (d - d1), 1., 0.5);
-                ck_assert_double_eq_tol(state->grammage / (X - X1), 1., 0.5);
                 ck_assert_double_eq_tol(state->time, t1, FLT_EPSILON);
+
+                /* Conversely, the distance travelled over a given proper
+                 * time is bounded by the initial and final momenta.
+                 */
+                const double p0 = sqrt(1E+03 * (1E+03 + 2. * mass));
+                const double p1 = sqrt(k1 * (k1 + 2. * mass));
+                ck_assert_double_ge(state->distance,
+                    state->time * p1 / mass * (1. - FLT_EPSILON));
+                ck_assert_double_le(state->distance,
+                    state->time * p0 / mass * (1. + FLT_EPSILON));
+                ck_assert_double_eq_tol(state->grammage / state->distance,
+                    TEST_ROCK_DENSITY, FLT_EPSILON * TEST_ROCK_DENSITY);
                 ck_assert_double_eq_tol(
                     state->weight, exp(-state->time / ctau), FLT_EPSILON);
                 ck_assert_double_eq(state->position[0], 0.);
@@ -5256,6 +7335,149 @@ START_TEST(test_detailed_magnet)
 }
 END_TEST
 
+/* Kinetic energies recorded at the last DEL vertex, before and after */
+static double del_kinetic[2];
+
+static void del_record(struct pumas_context * context,
+    struct pumas_state * state, struct pumas_medium * medium,
+    enum pumas_event event)
+{
+        if (event & PUMAS_EVENT_VERTEX_DEL) {
+                del_kinetic[0] = del_kinetic[1];
+                del_kinetic[1] = state->energy;
+        }
+}
+
+START_TEST(test_detailed_del)
+{
+        /* Compare the fractional energy losses sampled at high energy, from
+         * the tabulated inverse CDFs, to the model DCS
+         */
+        context->mode.scattering = PUMAS_MODE_DISABLED;
+        context->mode.energy_loss = PUMAS_MODE_MIXED;
+        context->event = PUMAS_EVENT_VERTEX_DEL;
+        pumas_recorder_create(&recorder, 0);
+        recorder->record = &del_record;
+        context->recorder = recorder;
+
+        double Z, A, mass;
+        pumas_physics_element_properties(physics, 0, &Z, &A, NULL);
+        pumas_physics_particle(physics, NULL, NULL, &mass);
+        const double k0 = 1E+05;
+        const double lx0 = log(pumas_physics_cutoff(physics));
+
+        const enum pumas_process processes[3] = {
+                PUMAS_PROCESS_BREMSSTRAHLUNG, PUMAS_PROCESS_PAIR_PRODUCTION,
+                PUMAS_PROCESS_PHOTONUCLEAR };
+        const enum pumas_event events[3] = {
+                PUMAS_EVENT_VERTEX_BREMSSTRAHLUNG,
+                PUMAS_EVENT_VERTEX_PAIR_CREATION,
+                PUMAS_EVENT_VERTEX_PHOTONUCLEAR };
+#define N_CDF 1001
+#define N_DEL 20000
+        static double cdf[N_CDF], lx[N_DEL];
+        const double dlx = -lx0 / (N_CDF - 1);
+        struct cdf_table table = { N_CDF, lx0, dlx, cdf };
+        int i;
+        for (i = 0; i < 3; i++) {
+                /* Tabulate the CDF of the DCS over log(x) */
+                pumas_dcs_t * dcs;
+                pumas_physics_dcs(physics, processes[i], NULL, &dcs);
+                double f0 = 0.;
+                int j;
+                for (j = 0; j < N_CDF; j++) {
+                        const double q = k0 * exp(lx0 + j * dlx);
+                        const double f =
+                            (j < N_CDF - 1) ? q * dcs(Z, A, mass, k0, q) : 0.;
+                        cdf[j] = (j == 0) ? 0. :
+                                            cdf[j - 1] + 0.5 * (f + f0) * dlx;
+                        f0 = f;
+                }
+
+                /* Sample the first DEL vertex. Vertices occurring after
+                 * more than 1% of CEL are rejected
+                 */
+                int n = 0;
+                while (n < N_DEL) {
+                        initialise_state();
+                        state->energy = k0;
+                        enum pumas_event event;
+                        pumas_context_transport(context, state, &event, NULL);
+                        if (!(event & events[i]) ||
+                            (del_kinetic[0] < 0.99 * k0))
+                                continue;
+                        lx[n++] = log(1. - state->energy / del_kinetic[0]);
+                }
+
+                /* Compare to the tabulated CDF. Since the test statistic is
+                 * invariant by a monotonic transform, log(x) is used
+                 */
+                check_random_cdf(N_DEL, lx, &cdf_tabulated, &table);
+        }
+#undef N_CDF
+#undef N_DEL
+
+        /* Restore the context status */
+        context->recorder = NULL;
+        pumas_recorder_destroy(&recorder);
+        context->event = PUMAS_EVENT_NONE;
+        context->mode.energy_loss = PUMAS_MODE_STRAGGLED;
+        context->mode.scattering = PUMAS_MODE_MIXED;
+}
+END_TEST
+
+/* Tabulated photonuclear polar sampler, exported by the library when built
+ * for the tests
+ */
+int pumas_test_polar_photonuclear(const struct pumas_physics * physics,
+    struct pumas_context * context, int element, double ki, double kf,
+    double * t);
+double pumas_test_polar_photonuclear_pdf(const struct pumas_physics * physics,
+    int element, double ki, double kf, double t);
+
+START_TEST(test_detailed_polar)
+{
+        /* Compare the photonuclear polar angles sampled from the tabulated
+         * quantiles to the model DDCS, between the tabulation nodes
+         */
+        const double kinetic[3] = { 1.3E+01, 1.7E+02, 7.1E+03 };
+        const double xi[3] = { 1.1E-01, 7.3E-02, 4.7E-01 };
+#define N_CDF 10001
+#define N_POLAR 20000
+        static double cdf[N_CDF], t[N_POLAR];
+        const double dt = 1. / (N_CDF - 1);
+        struct cdf_table table = { N_CDF, 0., dt, cdf };
+        int i;
+        for (i = 0; i < 3; i++) {
+                /* Tabulate the CDF of the DDCS over the normalised variable */
+                const double ki = kinetic[i];
+                const double kf = ki * (1. - xi[i]);
+                double f0 = 0.;
+                int j;
+                for (j = 0; j < N_CDF; j++) {
+                        const double f = pumas_test_polar_photonuclear_pdf(
+                            physics, 0, ki, kf, j * dt);
+                        cdf[j] = (j == 0) ? 0. :
+                                            cdf[j - 1] + 0.5 * (f + f0) * dt;
+                        f0 = f;
+                }
+                ck_assert_double_gt(cdf[N_CDF - 1], 0.);
+
+                /* Sample the tabulated quantiles */
+                for (j = 0; j < N_POLAR; j++) {
+                        ck_assert_int_eq(pumas_test_polar_photonuclear(
+                                             physics, context, 0, ki, kf, t + j),
+                            1);
+                }
+
+                /* Compare to the tabulated CDF */
+                check_random_cdf(N_POLAR, t, &cdf_tabulated, &table);
+        }
+#undef N_CDF
+#undef N_POLAR
+}
+END_TEST
+
 /* Fixtures for tau tests */
 static void tau_setup(void)
 {
@@ -5355,10 +7577,12 @@ Suite * create_suite(void)
         tcase_add_test(tc_api, test_api_material);
         tcase_add_test(tc_api, test_api_composite);
         tcase_add_test(tc_api, test_api_property);
+        tcase_add_test(tc_api, test_api_property_v);
         tcase_add_test(tc_api, test_api_table);
         tcase_add_test(tc_api, test_api_context);
         tcase_add_test(tc_api, test_api_random);
         tcase_add_test(tc_api, test_api_recorder);
+        tcase_add_test(tc_api, test_api_geometry);
         tcase_add_test(tc_api, test_api_print);
         tcase_add_test(tc_api, test_api_dcs);
         tcase_add_test(tc_api, test_api_elastic);
@@ -5381,8 +7605,16 @@ Suite * create_suite(void)
         tcase_add_unchecked_fixture(tc_csda, csda_setup, csda_teardown);
         tcase_add_test(tc_csda, test_csda_straight);
         tcase_add_test(tc_csda, test_csda_record);
+        tcase_add_test(tc_csda, test_csda_stream);
+        tcase_add_test(tc_csda, test_csda_columnar);
         tcase_add_test(tc_csda, test_csda_magnet);
         tcase_add_test(tc_csda, test_csda_geometry);
+        tcase_add_test(tc_csda, test_csda_exact);
+        tcase_add_test(tc_csda, test_csda_voxels);
+        tcase_add_test(tc_csda, test_csda_layers);
+        tcase_add_test(tc_csda, test_csda_terrain);
+        tcase_add_test(tc_csda, test_csda_batch);
+        tcase_add_test(tc_csda, test_csda_parallel);
 
         /* The hybrid test case */
         TCase * tc_hybrid = tcase_create("Hybrid");
@@ -5392,6 +7624,7 @@ Suite * create_suite(void)
         tcase_add_test(tc_hybrid, test_hybrid_straight);
         tcase_add_test(tc_hybrid, test_hybrid_scattering);
         tcase_add_test(tc_hybrid, test_hybrid_record);
+        tcase_add_test(tc_hybrid, test_hybrid_filter);
         tcase_add_test(tc_hybrid, test_hybrid_magnet);
 
         /* The detailed test case */
@@ -5403,6 +7636,8 @@ Suite * create_suite(void)
         tcase_add_test(tc_detailed, test_detailed_straight);
         tcase_add_test(tc_detailed, test_detailed_scattering);
         tcase_add_test(tc_detailed, test_detailed_magnet);
+        tcase_add_test(tc_detailed, test_detailed_del);
+        tcase_add_test(tc_detailed, test_detailed_polar);
 
         /* The tau test case */
         TCase * tc_tau = tcase_create("Tau");
@@ -9,11 +9,17 @@ endif ()
 
 include ("tests/libcheck.cmake")
 
+# Export some internal functions of the library, for the unit tests
+target_compile_definitions (pumas PRIVATE "-DTEST_MODE")
+
 add_executable (test-pumas EXCLUDE_FROM_ALL "tests/test-pumas.c")
 target_compile_definitions (test-pumas PRIVATE
         -DPUMAS_VERSION_MAJOR=${PUMAS_VERSION_MAJOR}
         -DPUMAS_VERSION_MINOR=${PUMAS_VERSION_MINOR}
         -DPUMAS_VERSION_PATCH=${PUMAS_VERSION_PATCH})
+if (PUMAS_USE_THREADS)
+        target_compile_definitions (test-pumas PRIVATE "-DTHREADS_MODE")
+endif ()
 add_dependencies (test-pumas LibCheck)
 target_link_libraries (test-pumas check pumas)
 